@@ -0,0 +1,133 @@
+// Benchmark for the ReadoutBufferQueues queue kinds.
+//
+// A producer thread takes buffers from the empty queue, stamps them with the
+// current time and puts them onto the filled queue. A consumer thread takes
+// them from the filled queue, records the hand-off latency and returns them
+// to the empty queue. This is the same pattern as readout -> listfile writer
+// and readout -> analysis.
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include <lyra/lyra.hpp>
+#include <mesytec-mvlc/mesytec-mvlc.h>
+
+using std::cout;
+using std::endl;
+using namespace mesytec::mvlc;
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+
+inline size_t now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        Clock::now().time_since_epoch()).count();
+}
+
+struct BenchResult
+{
+    double buffersPerSecond;
+    size_t latencyMedian_ns;
+    size_t latencyP99_ns;
+    size_t latencyMax_ns;
+};
+
+BenchResult run_bench(ReadoutBufferQueues::QueueKind kind, size_t bufferCount, size_t iterations)
+{
+    ReadoutBufferQueues queues(util::Kilobytes(4), bufferCount, kind);
+    std::vector<size_t> latencies;
+    latencies.reserve(iterations);
+
+    auto tStart = Clock::now();
+
+    std::thread producer([&queues, iterations] ()
+    {
+        auto &empty = queues.emptyBufferQueue();
+        auto &filled = queues.filledBufferQueue();
+
+        for (size_t i=0; i<iterations; ++i)
+        {
+            auto buffer = empty.dequeue_blocking();
+            buffer->setUsed(sizeof(u32));
+            buffer->setBufferNumber(now_ns());
+            filled.enqueue(buffer);
+        }
+    });
+
+    {
+        auto &empty = queues.emptyBufferQueue();
+        auto &filled = queues.filledBufferQueue();
+
+        for (size_t i=0; i<iterations; ++i)
+        {
+            auto buffer = filled.dequeue_blocking();
+            latencies.push_back(now_ns() - buffer->bufferNumber());
+            empty.enqueue(buffer);
+        }
+    }
+
+    producer.join();
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::duration<double>>(
+        Clock::now() - tStart);
+
+    std::sort(latencies.begin(), latencies.end());
+
+    BenchResult result = {};
+    result.buffersPerSecond = iterations / elapsed.count();
+    result.latencyMedian_ns = latencies[latencies.size() / 2];
+    result.latencyP99_ns = latencies[latencies.size() * 99 / 100];
+    result.latencyMax_ns = latencies.back();
+    return result;
+}
+
+void print_result(const char *name, const BenchResult &r)
+{
+    cout << name << ": " << static_cast<size_t>(r.buffersPerSecond) << " buffers/s"
+        << ", latency median=" << r.latencyMedian_ns << " ns"
+        << ", p99=" << r.latencyP99_ns << " ns"
+        << ", max=" << r.latencyMax_ns << " ns"
+        << endl;
+}
+
+} // end anon namespace
+
+int main(int argc, char *argv[])
+{
+    size_t bufferCount = 10;
+    size_t iterations = 1000000;
+    bool showHelp = false;
+
+    auto cli
+        = lyra::help(showHelp)
+        | lyra::opt(bufferCount, "count")["--buffers"]("number of buffers in the queues")
+        | lyra::opt(iterations, "count")["--iterations"]("number of buffer hand-offs")
+        ;
+
+    auto cliParseResult = cli.parse({ argc, argv });
+
+    if (!cliParseResult)
+    {
+        std::cerr << "Error parsing command line arguments: "
+            << cliParseResult.errorMessage() << endl;
+        return 1;
+    }
+
+    if (showHelp)
+    {
+        cout << cli << endl;
+        return 0;
+    }
+
+    cout << "buffers=" << bufferCount << ", iterations=" << iterations << endl;
+    print_result("ThreadSafe", run_bench(ReadoutBufferQueues::QueueKind::ThreadSafe, bufferCount, iterations));
+    print_result("SPSC      ", run_bench(ReadoutBufferQueues::QueueKind::SPSC, bufferCount, iterations));
+
+    return 0;
+}
@@ -0,0 +1,229 @@
+// Microbenchmark for the per packet cost of the ETH receive statistics.
+//
+// Compares eth::process_received_packet() writing into a SeqLocked
+// PipeReceiveStats structure plus atomic PipeHistograms against the previous accounting scheme which
+// locked a TicketMutex multiple times per packet and used unordered_maps for
+// the packet size and header type counts.
+
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <lyra/lyra.hpp>
+#include <mesytec-mvlc/mesytec-mvlc.h>
+#include <mesytec-mvlc/mvlc_impl_eth.h>
+
+using std::cout;
+using std::endl;
+using namespace mesytec::mvlc;
+
+namespace
+{
+
+// Creates 'count' data pipe packets of the given size. Each packet starts
+// with a stack frame header pointed to by nextHeaderPointer.
+std::vector<std::vector<u8>> make_packets(size_t count, size_t packetBytes)
+{
+    std::vector<std::vector<u8>> result;
+    const u32 dataWords = (packetBytes - eth::HeaderBytes) / sizeof(u32);
+
+    for (size_t i=0; i<count; ++i)
+    {
+        std::vector<u32> words(dataWords + eth::HeaderWords);
+
+        words[0] = (static_cast<u32>(eth::PacketChannel::Data) << eth::header0::PacketChannelShift)
+            | ((i & eth::header0::PacketNumberMask) << eth::header0::PacketNumberShift)
+            | (dataWords & eth::header0::NumDataWordsMask);
+        words[1] = 0u; // nextHeaderPointer = 0
+        words[2] = (static_cast<u32>(frame_headers::StackFrame) << frame_headers::TypeShift)
+            | ((dataWords - 1) & frame_headers::LengthMask);
+
+        std::vector<u8> bytes(words.size() * sizeof(u32));
+        std::memcpy(bytes.data(), words.data(), bytes.size());
+        result.emplace_back(std::move(bytes));
+    }
+
+    return result;
+}
+
+// Stats accounting as done before the switch to SeqLocked: a mutex
+// round-trip for each group of counters and unordered_maps for the
+// histograms.
+struct LegacyStats
+{
+    struct Pipe
+    {
+        u64 receivedPackets = 0u;
+        u64 receivedBytes = 0u;
+        u64 lostPackets = 0u;
+        u64 noHeader = 0u;
+        std::unordered_map<u16, u64> packetSizes;
+        std::unordered_map<u8, u64> headerTypes;
+    };
+
+    Pipe pipeStats;
+    Pipe channelStats;
+    s32 lastPacketNumber = -1;
+    mutable TicketMutex mutex;
+
+    void process(eth::PacketReadResult &res)
+    {
+        {
+            std::unique_lock<TicketMutex> guard(mutex);
+            ++pipeStats.receivedPackets;
+            pipeStats.receivedBytes += res.bytesTransferred;
+            ++pipeStats.packetSizes[res.bytesTransferred];
+        }
+
+        {
+            std::unique_lock<TicketMutex> guard(mutex);
+            ++channelStats.receivedPackets;
+            channelStats.receivedBytes += res.bytesTransferred;
+        }
+
+        if (lastPacketNumber >= 0)
+        {
+            auto loss = eth::calc_packet_loss(lastPacketNumber, res.packetNumber());
+            std::unique_lock<TicketMutex> guard(mutex);
+            pipeStats.lostPackets += loss;
+            channelStats.lostPackets += loss;
+        }
+
+        lastPacketNumber = res.packetNumber();
+
+        {
+            std::unique_lock<TicketMutex> guard(mutex);
+            ++channelStats.packetSizes[res.bytesTransferred];
+        }
+
+        if (res.isNextHeaderPointerValid())
+        {
+            u8 type = get_frame_type(res.payloadBegin()[res.nextHeaderPointer()]);
+            std::unique_lock<TicketMutex> guard(mutex);
+            ++pipeStats.headerTypes[type];
+            ++channelStats.headerTypes[type];
+        }
+    }
+
+    u64 read() const
+    {
+        std::unique_lock<TicketMutex> guard(mutex);
+        auto copy = pipeStats;
+        return copy.receivedPackets;
+    }
+};
+
+struct SeqLockedStats
+{
+    SeqLocked<eth::PipeReceiveStats> stats;
+    eth::PipeHistograms histograms;
+
+    void process(eth::PacketReadResult &res)
+    {
+        auto w = stats.write();
+        eth::process_received_packet(w.ref(), histograms, static_cast<unsigned>(Pipe::Data), res);
+    }
+
+    u64 read() const
+    {
+        return stats.copy(
+            [] (const eth::PipeReceiveStats &s) { return s.pipeStats; }).receivedPackets;
+    }
+};
+
+template<typename Stats>
+double run_bench(Stats &stats, std::vector<std::vector<u8>> &packets,
+                 size_t rounds, bool withReader)
+{
+    std::atomic<bool> quit(false);
+    std::thread readerThread;
+
+    // Optional reader thread emulating a monitoring thread polling the stats.
+    if (withReader)
+    {
+        readerThread = std::thread([&stats, &quit] ()
+        {
+            u64 sum = 0u;
+            while (!quit)
+            {
+                sum += stats.read();
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+            (void) sum;
+        });
+    }
+
+    auto tStart = std::chrono::steady_clock::now();
+
+    for (size_t round=0; round<rounds; ++round)
+    {
+        for (auto &packet: packets)
+        {
+            eth::PacketReadResult res = {};
+            res.buffer = packet.data();
+            res.bytesTransferred = packet.size();
+            stats.process(res);
+        }
+    }
+
+    auto elapsed = std::chrono::steady_clock::now() - tStart;
+
+    quit = true;
+    if (readerThread.joinable())
+        readerThread.join();
+
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+    return static_cast<double>(ns) / (rounds * packets.size());
+}
+
+} // end anon namespace
+
+int main(int argc, char *argv[])
+{
+    size_t packetCount = 1000;
+    size_t packetBytes = 8972;
+    size_t rounds = 1000;
+    bool withReader = false;
+    bool showHelp = false;
+
+    auto cli
+        = lyra::help(showHelp)
+        | lyra::opt(packetCount, "count")["--packets"]("number of distinct packets")
+        | lyra::opt(packetBytes, "bytes")["--packet-size"]("packet size in bytes")
+        | lyra::opt(rounds, "rounds")["--rounds"]("number of passes over the packets")
+        | lyra::opt(withReader)["--with-reader"]("poll the stats from a second thread")
+        ;
+
+    auto cliParseResult = cli.parse({ argc, argv });
+
+    if (!cliParseResult)
+    {
+        std::cerr << "Error parsing command line arguments: "
+            << cliParseResult.errorMessage() << endl;
+        return 1;
+    }
+
+    if (showHelp)
+    {
+        cout << cli << endl;
+        return 0;
+    }
+
+    packetBytes = std::max(packetBytes, static_cast<size_t>(eth::HeaderBytes + sizeof(u32)));
+    auto packets = make_packets(packetCount, packetBytes);
+
+    LegacyStats legacy;
+    SeqLockedStats seqLocked;
+
+    double legacyNs = run_bench(legacy, packets, rounds, withReader);
+    double seqLockedNs = run_bench(seqLocked, packets, rounds, withReader);
+
+    cout << "packets=" << packetCount * rounds << ", packetSize=" << packetBytes
+        << ", withReader=" << withReader << endl;
+    cout << "legacy (mutex + unordered_map): " << legacyNs << " ns/packet" << endl;
+    cout << "SeqLocked (atomic histograms):   " << seqLockedNs << " ns/packet" << endl;
+
+    return 0;
+}
@@ -0,0 +1,291 @@
+// Compares the compression ratio and throughput of the listfile entry codecs
+// (deflate, LZ4 and zstd if available) using the data of recorded listfiles.
+//
+// The input data is read into memory, then written to a temporary archive
+// using each codec configuration in chunks of the listfile writer buffer size.
+// Afterwards the entry is read back and compared to the input.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <regex>
+#include <thread>
+#include <vector>
+
+#include <lyra/lyra.hpp>
+#include <mesytec-mvlc/mesytec-mvlc.h>
+
+using std::cout;
+using std::cerr;
+using std::endl;
+using namespace mesytec::mvlc;
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+
+// Reads up to maxBytes of listfile data from either the listfile entry of a
+// zip archive or from a plain file.
+std::vector<u8> read_input(const std::string &filename, size_t maxBytes)
+{
+    std::vector<u8> result;
+    std::vector<u8> buffer(util::Megabytes(1));
+
+    if (filename.size() >= 4 && filename.compare(filename.size() - 4, 4, ".zip") == 0)
+    {
+        listfile::ZipReader reader;
+        reader.openArchive(filename);
+
+        auto entryNames = reader.entryNameList();
+
+        auto it = std::find_if(
+            std::begin(entryNames), std::end(entryNames),
+            [] (const std::string &entryName)
+            {
+                static const std::regex re(R"foo(.+\.mvlclst(\.lz4|\.zst)?)foo");
+                return std::regex_search(entryName, re);
+            });
+
+        if (it == std::end(entryNames))
+            throw std::runtime_error("No listfile found in archive " + filename);
+
+        auto rh = reader.openEntry(*it);
+
+        while (result.size() < maxBytes)
+        {
+            size_t bytesRead = rh->read(buffer.data(), std::min(buffer.size(), maxBytes - result.size()));
+
+            if (bytesRead == 0)
+                break;
+
+            result.insert(result.end(), buffer.begin(), buffer.begin() + bytesRead);
+        }
+    }
+    else
+    {
+        std::ifstream in(filename, std::ios::binary);
+
+        if (!in)
+            throw std::runtime_error("Could not open " + filename);
+
+        while (in && result.size() < maxBytes)
+        {
+            in.read(reinterpret_cast<char *>(buffer.data()), std::min(buffer.size(), maxBytes - result.size()));
+            result.insert(result.end(), buffer.begin(), buffer.begin() + in.gcount());
+        }
+    }
+
+    return result;
+}
+
+struct CodecConfig
+{
+    listfile::ZipEntryInfo::Type type;
+    int level;
+    unsigned threads;
+};
+
+std::string to_string(listfile::ZipEntryInfo::Type type)
+{
+    switch (type)
+    {
+        case listfile::ZipEntryInfo::ZIP:
+            return "deflate";
+        case listfile::ZipEntryInfo::LZ4:
+            return "lz4";
+        case listfile::ZipEntryInfo::ZSTD:
+            return "zstd";
+    }
+
+    return {};
+}
+
+struct BenchResult
+{
+    size_t compressedBytes;
+    double writeMBs;
+    double readMBs;
+    bool dataOk;
+};
+
+BenchResult run_bench(const CodecConfig &cfg, const std::vector<u8> &data,
+                      const std::string &archiveName, size_t writeChunkSize)
+{
+    BenchResult result = {};
+    std::string entryName;
+
+    {
+        listfile::ZipCreator creator;
+        creator.createArchive(archiveName, listfile::ZipCreator::Overwrite);
+
+        auto tStart = Clock::now();
+        listfile::WriteHandle *wh = nullptr;
+
+        switch (cfg.type)
+        {
+            case listfile::ZipEntryInfo::ZIP:
+                wh = creator.createZIPEntry("listfile.mvlclst", cfg.level);
+                break;
+            case listfile::ZipEntryInfo::LZ4:
+                wh = creator.createLZ4Entry("listfile.mvlclst", cfg.level, cfg.threads);
+                break;
+            case listfile::ZipEntryInfo::ZSTD:
+                wh = creator.createZstdEntry("listfile.mvlclst", cfg.level, cfg.threads);
+                break;
+        }
+
+        for (size_t offset=0; offset<data.size(); offset += writeChunkSize)
+            wh->write(data.data() + offset, std::min(writeChunkSize, data.size() - offset));
+
+        creator.closeCurrentEntry();
+
+        std::chrono::duration<double> elapsed = Clock::now() - tStart;
+        const auto &info = creator.entryInfo();
+
+        entryName = info.name;
+        result.compressedBytes = (cfg.type == listfile::ZipEntryInfo::LZ4
+                                  ? info.lz4CompressedBytesWritten
+                                  : cfg.type == listfile::ZipEntryInfo::ZSTD
+                                  ? info.zstdCompressedBytesWritten
+                                  : 0u);
+        result.writeMBs = data.size() / static_cast<double>(util::Megabytes(1)) / elapsed.count();
+    }
+
+    {
+        listfile::ZipReader reader;
+        reader.openArchive(archiveName);
+
+        auto tStart = Clock::now();
+        auto rh = reader.openEntry(entryName);
+
+        // For deflate the compressed size is only known from the archive.
+        if (cfg.type == listfile::ZipEntryInfo::ZIP)
+            result.compressedBytes = reader.entryInfo().compressedSize;
+
+        std::vector<u8> readBuffer(data.size());
+        size_t totalBytesRead = 0u;
+
+        while (totalBytesRead < readBuffer.size())
+        {
+            size_t bytesRead = rh->read(
+                readBuffer.data() + totalBytesRead,
+                std::min(writeChunkSize, readBuffer.size() - totalBytesRead));
+
+            if (bytesRead == 0)
+                break;
+
+            totalBytesRead += bytesRead;
+        }
+
+        std::chrono::duration<double> elapsed = Clock::now() - tStart;
+
+        result.readMBs = totalBytesRead / static_cast<double>(util::Megabytes(1)) / elapsed.count();
+        result.dataOk = (totalBytesRead == data.size() && readBuffer == data);
+    }
+
+    return result;
+}
+
+} // end anon namespace
+
+int main(int argc, char *argv[])
+{
+    std::vector<std::string> inputFiles;
+    size_t maxMegabytes = 256;
+    unsigned threads = std::max(2u, std::thread::hardware_concurrency());
+    std::string archiveName = "listfile_codec_bench.tmp.zip";
+    bool showHelp = false;
+
+    auto cli
+        = lyra::help(showHelp)
+        | lyra::opt(maxMegabytes, "MB")["--max-megabytes"]("maximum amount of listfile data to use per input")
+        | lyra::opt(threads, "count")["--threads"]("number of threads for the multithreaded configurations")
+        | lyra::opt(archiveName, "filename")["--tmp-archive"]("temporary output archive")
+        | lyra::arg(inputFiles, "listfile")("recorded listfile archives (.zip) or raw listfile data")
+        ;
+
+    auto cliParseResult = cli.parse({ argc, argv });
+
+    if (!cliParseResult)
+    {
+        cerr << "Error parsing command line arguments: "
+            << cliParseResult.errorMessage() << endl;
+        return 1;
+    }
+
+    if (showHelp || inputFiles.empty())
+    {
+        cout << cli << endl;
+        return showHelp ? 0 : 1;
+    }
+
+    std::vector<CodecConfig> configs =
+    {
+        { listfile::ZipEntryInfo::ZIP, 1, 1 },
+        { listfile::ZipEntryInfo::ZIP, 6, 1 },
+        { listfile::ZipEntryInfo::LZ4, 0, 1 },
+        { listfile::ZipEntryInfo::LZ4, 0, threads },
+        { listfile::ZipEntryInfo::LZ4, 9, threads },
+    };
+
+    if (listfile::zstd_support_enabled())
+    {
+        for (int level: { 1, 3, 9, 19 })
+        {
+            configs.push_back({ listfile::ZipEntryInfo::ZSTD, level, 1 });
+            configs.push_back({ listfile::ZipEntryInfo::ZSTD, level, threads });
+        }
+    }
+    else
+    {
+        cout << "Note: mesytec-mvlc was built without zstd support." << endl;
+    }
+
+    const size_t writeChunkSize = util::Megabytes(1);
+    int ret = 0;
+
+    for (const auto &inputFile: inputFiles)
+    {
+        try
+        {
+            auto data = read_input(inputFile, util::Megabytes(maxMegabytes));
+
+            cout << inputFile << ": " << data.size() << " bytes" << endl;
+            cout << std::left
+                << std::setw(10) << "codec" << std::setw(8) << "level" << std::setw(10) << "threads"
+                << std::setw(10) << "ratio" << std::setw(14) << "write MB/s" << std::setw(14) << "read MB/s"
+                << endl;
+
+            for (const auto &cfg: configs)
+            {
+                auto result = run_bench(cfg, data, archiveName, writeChunkSize);
+
+                cout << std::left << std::fixed << std::setprecision(2)
+                    << std::setw(10) << to_string(cfg.type)
+                    << std::setw(8) << cfg.level
+                    << std::setw(10) << cfg.threads
+                    << std::setw(10) << (data.size() / static_cast<double>(std::max(result.compressedBytes, size_t(1))))
+                    << std::setw(14) << result.writeMBs
+                    << std::setw(14) << result.readMBs
+                    << (result.dataOk ? "" : "DATA MISMATCH")
+                    << endl;
+
+                if (!result.dataOk)
+                    ret = 1;
+            }
+        }
+        catch (const std::exception &e)
+        {
+            cerr << "Error processing " << inputFile << ": " << e.what() << endl;
+            ret = 1;
+        }
+    }
+
+    std::remove(archiveName.c_str());
+
+    return ret;
+}
@@ -0,0 +1,109 @@
+// Runs the software MVLC ETH emulator until interrupted. Clients connect to it
+// like to a real MVLC, e.g. using 'mini-daq --mvlc-eth 127.0.0.1'.
+
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <iostream>
+#include <thread>
+
+#include <lyra/lyra.hpp>
+#include <mesytec-mvlc/mesytec-mvlc.h>
+#include <mesytec-mvlc/mvlc_eth_emulator.h>
+
+using std::cout;
+using std::cerr;
+using std::endl;
+using namespace mesytec::mvlc;
+
+namespace
+{
+
+std::atomic<bool> signalReceived(false);
+
+void signal_handler(int)
+{
+    signalReceived = true;
+}
+
+} // end anon namespace
+
+int main(int argc, char *argv[])
+{
+    eth::EmulatorOptions opts;
+    unsigned statsInterval_s = 1;
+    bool showHelp = false;
+
+    auto cli
+        = lyra::help(showHelp)
+        | lyra::opt(opts.bindAddress, "address")["--bind"]("address to listen on")
+        | lyra::opt(opts.triggerRate, "Hz")["--trigger-rate"]("trigger rate per active stack (0 = unlimited)")
+        | lyra::opt(opts.maxPacketBytes, "bytes")["--packet-size"]("data packet size (default: depends on jumbo frame setting)")
+        | lyra::opt(opts.packetLossProbability, "p")["--packet-loss"]("probability of dropping a data packet")
+        | lyra::opt(opts.blockReadMaxWords, "words")["--block-read-words"]("number of words produced by block reads")
+        | lyra::opt(statsInterval_s, "seconds")["--stats-interval"]("interval for printing counters (0 = off)")
+        ;
+
+    auto cliParseResult = cli.parse({ argc, argv });
+
+    if (!cliParseResult)
+    {
+        cerr << "Error parsing command line arguments: "
+            << cliParseResult.errorMessage() << endl;
+        return 1;
+    }
+
+    if (showHelp)
+    {
+        cout << cli << endl;
+        return 0;
+    }
+
+    std::signal(SIGINT, signal_handler);
+    std::signal(SIGTERM, signal_handler);
+
+    eth::Emulator emu(opts);
+
+    if (auto ec = emu.start())
+    {
+        cerr << "Error starting the emulator: " << ec.message() << endl;
+        return 1;
+    }
+
+    cout << "Emulating an MVLC on " << opts.bindAddress << ", press Ctrl-C to quit." << endl;
+
+    auto tLastStats = std::chrono::steady_clock::now();
+    auto lastCounters = emu.counters();
+
+    while (!signalReceived)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+        auto now = std::chrono::steady_clock::now();
+        std::chrono::duration<double> elapsed = now - tLastStats;
+
+        if (statsInterval_s == 0 || elapsed.count() < statsInterval_s)
+            continue;
+
+        auto counters = emu.counters();
+        size_t events = 0u;
+
+        for (size_t i=0; i<counters.triggers.size(); ++i)
+            events += counters.triggers[i] - lastCounters.triggers[i];
+
+        cout << "events/s=" << static_cast<size_t>(events / elapsed.count())
+            << ", MB/s=" << (counters.dataBytes - lastCounters.dataBytes) / elapsed.count() / util::Megabytes(1)
+            << ", packets=" << counters.dataPackets
+            << ", dropped=" << counters.droppedPackets
+            << ", delay=" << counters.currentDelay << "us"
+            << ", superCommands=" << counters.superCommands
+            << endl;
+
+        tLastStats = now;
+        lastCounters = counters;
+    }
+
+    emu.stop();
+
+    return 0;
+}
@@ -62,8 +62,12 @@ void dump_counters(
         cout << "buffersRead=" << counters.buffersRead << endl;
         cout << "buffersFlushed=" << counters.buffersFlushed << endl;
         cout << "snoopMissedBuffers=" << counters.snoopMissedBuffers << endl;
+        cout << "listfileSharedBuffers=" << counters.listfileSharedBuffers
+            << " (" << counters.listfileCopyBytesAvoided << " bytes not copied)" << endl;
+        cout << "listfileSharedBufferSkips=" << counters.listfileSharedBufferSkips << endl;
         cout << "usbFramingErrors=" << counters.usbFramingErrors << endl;
         cout << "usbTempMovedBytes=" << counters.usbTempMovedBytes << endl;
+        cout << "outputBufferDetaches=" << counters.outputBufferDetaches << endl;
         cout << "ethShortReads=" << counters.ethShortReads << endl;
         cout << "readTimeouts=" << counters.readTimeouts << endl;
         cout << "totalBytesTransferred=" << counters.bytesRead << endl;
@@ -101,8 +105,10 @@ void dump_counters(
             cout << endl;
             cout << "  -- eth data pipe receive stats --" << endl;
             cout << "  receiveAttempts=" << pipeCounters.receiveAttempts << endl;
+            cout << "  receiveBatches=" << pipeCounters.receiveBatches << endl;
             cout << "  receivedPackets=" << pipeCounters.receivedPackets << endl;
             cout << "  receivedBytes=" << pipeCounters.receivedBytes << endl;
+            cout << "  movedBytes=" << pipeCounters.movedBytes << endl;
             cout << "  shortPackets=" << pipeCounters.shortPackets << endl;
             cout << "  packetsWithResidue=" << pipeCounters.packetsWithResidue << endl;
             cout << "  noHeader=" << pipeCounters.noHeader << endl;
@@ -172,6 +178,8 @@ int main(int argc, char *argv[])
     std::string opt_listfileOut;
     std::string opt_listfileCompressionType = "lz4";
     int opt_listfileCompressionLevel = 0;
+    unsigned opt_listfileCompressionThreads = 1;
+    unsigned opt_parserThreads = 1;
     std::string opt_crateConfig;
     unsigned opt_secondsToRun = 10;
     CommandExecOptions initOptions = {};
@@ -209,11 +217,17 @@ int main(int argc, char *argv[])
             ["--listfile"] ("filename of the output listfile (e.g. run001.zip)")
 
         | lyra::opt(opt_listfileCompressionType, "type")
-            ["--listfile-compression-type"].choices("zip", "lz4") ("'zip' or 'lz4'")
+            ["--listfile-compression-type"].choices("zip", "lz4", "zstd") ("'zip', 'lz4' or 'zstd'")
 
         | lyra::opt(opt_listfileCompressionLevel, "level")
             ["--listfile-compression-level"] ("compression level to use (for zip 0 means no compression)")
 
+        | lyra::opt(opt_listfileCompressionThreads, "threads")
+            ["--listfile-compression-threads"] ("number of lz4 or zstd compression threads")
+
+        | lyra::opt(opt_parserThreads, "threads")
+            ["--parser-threads"] ("number of readout parser threads for the (lossy) snoop data")
+
         // init options
         | lyra::opt(initOptions.noBatching)
             ["--init-no-batching"] ("disables command batching during the MVLC init phase")
@@ -360,7 +374,19 @@ int main(int argc, char *argv[])
                                     : listfile::ZipCreator::DontOverwrite);
 
             if (opt_listfileCompressionType == "lz4")
-                lfh = zipWriter.createLZ4Entry("listfile.mvlclst", opt_listfileCompressionLevel);
+                lfh = zipWriter.createLZ4Entry("listfile.mvlclst", opt_listfileCompressionLevel,
+                                               opt_listfileCompressionThreads);
+            else if (opt_listfileCompressionType == "zstd")
+            {
+                if (!listfile::zstd_support_enabled())
+                {
+                    cerr << "Error: mesytec-mvlc was built without zstd support." << endl;
+                    return 1;
+                }
+
+                lfh = zipWriter.createZstdEntry("listfile.mvlclst", opt_listfileCompressionLevel,
+                                                opt_listfileCompressionThreads);
+            }
             else if (opt_listfileCompressionType == "zip")
                 lfh = zipWriter.createZIPEntry("listfile.mvlclst", opt_listfileCompressionLevel);
             else
@@ -421,15 +447,31 @@ int main(int argc, char *argv[])
 
         auto parserState = readout_parser::make_readout_parser(crateConfig.stacks);
         Protected<readout_parser::ReadoutParserCounters> parserCounters({});
+        std::vector<readout_parser::ReadoutParserState> parserStates;
 
         std::thread parserThread;
 
-        parserThread = std::thread(
-            readout_parser::run_readout_parser,
-            std::ref(parserState),
-            std::ref(parserCounters),
-            std::ref(snoopQueues),
-            std::ref(parserCallbacks));
+        if (opt_parserThreads > 1)
+        {
+            for (unsigned i=0; i<opt_parserThreads; ++i)
+                parserStates.emplace_back(readout_parser::make_readout_parser(crateConfig.stacks));
+
+            parserThread = std::thread(
+                readout_parser::run_readout_parsers,
+                std::ref(parserStates),
+                std::ref(parserCounters),
+                std::ref(snoopQueues),
+                std::ref(parserCallbacks));
+        }
+        else
+        {
+            parserThread = std::thread(
+                readout_parser::run_readout_parser,
+                std::ref(parserState),
+                std::ref(parserCounters),
+                std::ref(snoopQueues),
+                std::ref(parserCallbacks));
+        }
 
         //
         // Create a ReadoutWorker and start the readout.
@@ -74,7 +74,7 @@ int main(int argc, char *argv[])
             std::begin(entryNames), std::end(entryNames),
             [] (const std::string &entryName)
             {
-                static const std::regex re(R"foo(.+\.mvlclst(\.lz4)?)foo");
+                static const std::regex re(R"foo(.+\.mvlclst(\.lz4|\.zst)?)foo");
                 return std::regex_search(entryName, re);
             });
 
@@ -0,0 +1,101 @@
+#ifndef __MESYTEC_MVLC_BENCH_BENCH_H__
+#define __MESYTEC_MVLC_BENCH_BENCH_H__
+
+#include <chrono>
+#include <functional>
+#include <string>
+
+namespace mesytec
+{
+namespace mvlc
+{
+namespace bench
+{
+
+// Minimal benchmark harness for the mesytec-mvlc-bench target.
+//
+// Benchmarks are functions taking a State reference. The code to be measured
+// goes into a 'while (state.keepRunning())' loop. Setup work done before the
+// loop is not measured. Each loop iteration should report the amount of data
+// and the number of events it processed so that throughput numbers can be
+// calculated:
+//
+//   void bench_foo(bench::State &state)
+//   {
+//       auto input = make_input();
+//
+//       while (state.keepRunning())
+//       {
+//           process(input);
+//           state.addBytes(input.size());
+//           state.addEvents(eventCount);
+//       }
+//   }
+//
+//   MVLC_BENCHMARK(bench_foo);
+
+class State
+{
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        explicit State(const std::chrono::duration<double> &minTime)
+            : m_minTime(minTime)
+        {}
+
+        // Returns true as long as the minimum run time has not been reached.
+        // Each call with a true result counts as one iteration.
+        bool keepRunning()
+        {
+            auto now = Clock::now();
+
+            if (m_iterations == 0)
+                m_tStart = now;
+            else if (now - m_tStart - m_pausedTime >= m_minTime)
+            {
+                m_elapsed = now - m_tStart - m_pausedTime;
+                return false;
+            }
+
+            ++m_iterations;
+            return true;
+        }
+
+        // Excludes work done between pauseTiming() and resumeTiming() from the
+        // measurement.
+        void pauseTiming() { m_tPause = Clock::now(); }
+        void resumeTiming() { m_pausedTime += Clock::now() - m_tPause; }
+
+        void addBytes(size_t bytes) { m_bytes += bytes; }
+        void addEvents(size_t events) { m_events += events; }
+
+        size_t iterations() const { return m_iterations; }
+        size_t bytes() const { return m_bytes; }
+        size_t events() const { return m_events; }
+        std::chrono::duration<double> elapsed() const { return m_elapsed; }
+
+    private:
+        std::chrono::duration<double> m_minTime;
+        Clock::time_point m_tStart;
+        Clock::time_point m_tPause;
+        Clock::duration m_pausedTime = {};
+        std::chrono::duration<double> m_elapsed = {};
+        size_t m_iterations = 0u;
+        size_t m_bytes = 0u;
+        size_t m_events = 0u;
+};
+
+using BenchFunction = std::function<void (State &state)>;
+
+// Adds a benchmark to the global registry. Returns true to allow using the
+// function in static initializers.
+bool register_benchmark(const std::string &name, BenchFunction func);
+
+} // end namespace bench
+} // end namespace mvlc
+} // end namespace mesytec
+
+#define MVLC_BENCHMARK(func) \
+    static const bool func##_registered = ::mesytec::mvlc::bench::register_benchmark(#func, func)
+
+#endif /* __MESYTEC_MVLC_BENCH_BENCH_H__ */
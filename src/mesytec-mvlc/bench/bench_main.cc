@@ -0,0 +1,149 @@
+// Runner for the mesytec-mvlc-bench target.
+//
+// Runs all registered benchmarks (or the ones matching --filter) and prints
+// one result per line. The default output format is JSON lines, suitable for
+// collecting and comparing results per commit:
+//
+// {"benchmark":"parse_readout_buffer_eth","version":"1.0-12-gabcdef","iterations":42,
+//  "seconds":1.01,"bytes":...,"events":...,"MB_per_s":812.3,"GB_per_s":0.79,"events_per_s":1.9e+06}
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <regex>
+
+#include <lyra/lyra.hpp>
+#include <mesytec-mvlc/git_version.h>
+
+#include "bench.h"
+
+using std::cerr;
+using std::cout;
+using std::endl;
+
+namespace mesytec
+{
+namespace mvlc
+{
+namespace bench
+{
+
+namespace
+{
+
+std::map<std::string, BenchFunction> &registry()
+{
+    static std::map<std::string, BenchFunction> theRegistry;
+    return theRegistry;
+}
+
+} // end anon namespace
+
+bool register_benchmark(const std::string &name, BenchFunction func)
+{
+    registry()[name] = func;
+    return true;
+}
+
+} // end namespace bench
+} // end namespace mvlc
+} // end namespace mesytec
+
+using namespace mesytec::mvlc;
+
+int main(int argc, char *argv[])
+{
+    std::string filter;
+    std::string format = "json";
+    double minTime = 1.0;
+    bool listOnly = false;
+    bool showHelp = false;
+
+    auto cli
+        = lyra::help(showHelp)
+        | lyra::opt(filter, "regex")["--filter"]("run only benchmarks whose name matches the regex")
+        | lyra::opt(minTime, "seconds")["--min-time"]("minimum run time per benchmark")
+        | lyra::opt(format, "json|csv")["--format"]("output format")
+        | lyra::opt(listOnly)["--list"]("list the available benchmarks")
+        ;
+
+    auto cliParseResult = cli.parse({ argc, argv });
+
+    if (!cliParseResult)
+    {
+        cerr << "Error parsing command line arguments: "
+            << cliParseResult.errorMessage() << endl;
+        return 1;
+    }
+
+    if (showHelp)
+    {
+        cout << cli << endl;
+        return 0;
+    }
+
+    if (format != "json" && format != "csv")
+    {
+        cerr << "Unknown output format '" << format << "'" << endl;
+        return 1;
+    }
+
+    const std::regex filterRe(filter);
+
+    if (format == "csv" && !listOnly)
+        cout << "benchmark,version,iterations,seconds,bytes,events,MB_per_s,GB_per_s,events_per_s" << endl;
+
+    for (const auto &kv: bench::registry())
+    {
+        const auto &name = kv.first;
+
+        if (!filter.empty() && !std::regex_search(name, filterRe))
+            continue;
+
+        if (listOnly)
+        {
+            cout << name << endl;
+            continue;
+        }
+
+        bench::State state(std::chrono::duration<double>{ minTime });
+
+        try
+        {
+            kv.second(state);
+        }
+        catch (const std::exception &e)
+        {
+            cerr << "Benchmark " << name << " failed: " << e.what() << endl;
+            return 1;
+        }
+
+        const double seconds = state.elapsed().count();
+        const double mbPerSecond = seconds > 0.0 ? state.bytes() / seconds / (1024.0 * 1024.0) : 0.0;
+        const double gbPerSecond = mbPerSecond / 1024.0;
+        const double eventsPerSecond = seconds > 0.0 ? state.events() / seconds : 0.0;
+
+        if (format == "json")
+        {
+            cout << "{\"benchmark\":\"" << name << "\""
+                << ",\"version\":\"" << library_version() << "\""
+                << ",\"iterations\":" << state.iterations()
+                << ",\"seconds\":" << seconds
+                << ",\"bytes\":" << state.bytes()
+                << ",\"events\":" << state.events()
+                << ",\"MB_per_s\":" << mbPerSecond
+                << ",\"GB_per_s\":" << gbPerSecond
+                << ",\"events_per_s\":" << eventsPerSecond
+                << "}" << endl;
+        }
+        else
+        {
+            cout << name << "," << library_version() << "," << state.iterations()
+                << "," << seconds << "," << state.bytes() << "," << state.events()
+                << "," << mbPerSecond << "," << gbPerSecond << "," << eventsPerSecond << endl;
+        }
+    }
+
+    return 0;
+}
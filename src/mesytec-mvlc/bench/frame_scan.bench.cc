@@ -0,0 +1,80 @@
+#include <stdexcept>
+
+#include <mesytec-mvlc/mvlc_frame_scan.h>
+
+#include "bench.h"
+#include "synthetic_data.h"
+
+// No using-directive for mesytec::mvlc here: the benchmarks are named after
+// the library functions they measure.
+using mesytec::mvlc::FrameScanImpl;
+using mesytec::mvlc::u32;
+namespace bench = mesytec::mvlc::bench;
+namespace frame_headers = mesytec::mvlc::frame_headers;
+namespace util = mesytec::mvlc::util;
+
+namespace
+{
+
+// Resync worst case: megabytes of data without a single frame header, e.g.
+// after losing the frame structure inside a large block read.
+void bench_find_frame_type(bench::State &state, FrameScanImpl impl)
+{
+    std::vector<u32> data(util::Megabytes(4) / sizeof(u32));
+
+    for (size_t i=0; i<data.size(); ++i)
+        data[i] = i & 0x00ffffffu;
+
+    const auto types = mesytec::mvlc::readout_frame_types();
+    size_t found = 0u;
+
+    while (state.keepRunning())
+    {
+        if (mesytec::mvlc::find_frame_type(data.data(), data.data() + data.size(), types, impl)
+            != data.data() + data.size())
+        {
+            ++found;
+        }
+
+        state.addBytes(data.size() * sizeof(u32));
+    }
+
+    if (found)
+        throw std::runtime_error("bench_find_frame_type: unexpected frame header");
+}
+
+void find_frame_type_scalar(bench::State &state)
+{
+    bench_find_frame_type(state, FrameScanImpl::Scalar);
+}
+
+void find_frame_type_sse2(bench::State &state)
+{
+    bench_find_frame_type(state, FrameScanImpl::SSE2);
+}
+
+void find_frame_type_avx2(bench::State &state)
+{
+    bench_find_frame_type(state, FrameScanImpl::AVX2);
+}
+
+void count_frames_by_type(bench::State &state)
+{
+    auto crateConfig = bench::make_bench_crate_config(2, 4);
+    auto data = bench::make_synthetic_data(crateConfig);
+    const auto &stream = data.usbStream;
+
+    while (state.keepRunning())
+    {
+        auto counts = mesytec::mvlc::count_frames_by_type(stream.data(), stream.data() + stream.size());
+        state.addBytes(stream.size() * sizeof(u32));
+        state.addEvents(counts.frames[frame_headers::StackFrame]);
+    }
+}
+
+} // end anon namespace
+
+MVLC_BENCHMARK(find_frame_type_scalar);
+MVLC_BENCHMARK(find_frame_type_sse2);
+MVLC_BENCHMARK(find_frame_type_avx2);
+MVLC_BENCHMARK(count_frames_by_type);
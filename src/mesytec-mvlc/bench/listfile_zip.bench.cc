@@ -0,0 +1,118 @@
+#include <algorithm>
+#include <cstdio>
+
+#include <mesytec-mvlc/mvlc_listfile_zip.h>
+
+#include "bench.h"
+#include "synthetic_data.h"
+
+using namespace mesytec::mvlc;
+using namespace mesytec::mvlc::listfile;
+
+namespace
+{
+
+static const char *BenchArchiveName = "mesytec-mvlc-bench.zip";
+
+enum class EntryType
+{
+    Deflate,
+    LZ4,
+};
+
+bench::SyntheticData make_listfile_data()
+{
+    auto crateConfig = bench::make_bench_crate_config(2, 4);
+    bench::SyntheticDataOptions opts;
+    opts.eventCount = 50000;
+    return bench::make_synthetic_data(crateConfig, opts);
+}
+
+// Writes the stream in readout buffer sized chunks, like the listfile writer
+// does.
+void write_archive(EntryType entryType, const std::vector<u32> &stream)
+{
+    ZipCreator creator;
+    creator.createArchive(BenchArchiveName, ZipCreator::Overwrite);
+
+    auto writeHandle = (entryType == EntryType::LZ4
+                        ? creator.createLZ4Entry("listfile.mvlclst", 0)
+                        : creator.createZIPEntry("listfile.mvlclst", 1));
+
+    const auto data = reinterpret_cast<const u8 *>(stream.data());
+    const size_t bytes = stream.size() * sizeof(u32);
+    const size_t chunkSize = util::Megabytes(1);
+
+    for (size_t offset=0; offset<bytes; offset += chunkSize)
+        writeHandle->write(data + offset, std::min(chunkSize, bytes - offset));
+
+    creator.closeCurrentEntry();
+}
+
+void bench_zip_write(bench::State &state, EntryType entryType)
+{
+    auto data = make_listfile_data();
+
+    while (state.keepRunning())
+    {
+        write_archive(entryType, data.usbStream);
+        state.addBytes(data.usbStream.size() * sizeof(u32));
+        state.addEvents(data.eventCount);
+    }
+
+    std::remove(BenchArchiveName);
+}
+
+void bench_zip_read(bench::State &state, EntryType entryType)
+{
+    auto data = make_listfile_data();
+    write_archive(entryType, data.usbStream);
+
+    std::vector<u8> dest(util::Megabytes(1));
+    ZipReader reader;
+    reader.openArchive(BenchArchiveName);
+    const auto entryName = reader.entryNameList().at(0);
+
+    while (state.keepRunning())
+    {
+        auto readHandle = reader.openEntry(entryName);
+        size_t bytesRead = 0u;
+
+        while (size_t count = readHandle->read(dest.data(), dest.size()))
+            bytesRead += count;
+
+        reader.closeCurrentEntry();
+        state.addBytes(bytesRead);
+        state.addEvents(data.eventCount);
+    }
+
+    reader.closeArchive();
+    std::remove(BenchArchiveName);
+}
+
+void zip_creator_write_deflate(bench::State &state)
+{
+    bench_zip_write(state, EntryType::Deflate);
+}
+
+void zip_creator_write_lz4(bench::State &state)
+{
+    bench_zip_write(state, EntryType::LZ4);
+}
+
+void zip_reader_read_deflate(bench::State &state)
+{
+    bench_zip_read(state, EntryType::Deflate);
+}
+
+void zip_reader_read_lz4(bench::State &state)
+{
+    bench_zip_read(state, EntryType::LZ4);
+}
+
+} // end anon namespace
+
+MVLC_BENCHMARK(zip_creator_write_deflate);
+MVLC_BENCHMARK(zip_creator_write_lz4);
+MVLC_BENCHMARK(zip_reader_read_deflate);
+MVLC_BENCHMARK(zip_reader_read_lz4);
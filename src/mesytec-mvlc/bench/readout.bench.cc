@@ -0,0 +1,116 @@
+#include <mesytec-mvlc/mvlc_eth_interface.h>
+#include <mesytec-mvlc/mvlc_readout.h>
+#include <mesytec-mvlc/mvlc_replay.h>
+
+#include "bench.h"
+#include "synthetic_data.h"
+
+// No using-directive for mesytec::mvlc here: the benchmarks are named after
+// the library functions they measure.
+using mesytec::mvlc::ConnectionType;
+using mesytec::mvlc::ReadoutBuffer;
+using mesytec::mvlc::ReadoutWorker;
+using mesytec::mvlc::StackHits;
+using mesytec::mvlc::u8;
+using mesytec::mvlc::u32;
+namespace bench = mesytec::mvlc::bench;
+namespace eth = mesytec::mvlc::eth;
+namespace util = mesytec::mvlc::util;
+
+namespace
+{
+
+// Shared setup for the fixup benchmarks: the buffers end in the middle of a
+// frame or packet so that each call has to move trailing data to the temp
+// buffer.
+template<typename Fixup>
+void bench_fixup(bench::State &state, ConnectionType type, Fixup fixup)
+{
+    auto crateConfig = bench::make_bench_crate_config(2, 4);
+    auto data = bench::make_synthetic_data(crateConfig);
+    auto buffers = bench::make_unaligned_buffers(
+        type, type == ConnectionType::ETH ? data.ethStream : data.usbStream,
+        util::Megabytes(1));
+    const size_t bytes = bench::total_bytes(buffers);
+
+    std::vector<size_t> sizes;
+
+    for (const auto &buffer: buffers)
+        sizes.push_back(buffer.used());
+
+    ReadoutBuffer tempBuffer(util::Megabytes(1));
+
+    while (state.keepRunning())
+    {
+        for (size_t i=0; i<buffers.size(); ++i)
+        {
+            buffers[i].setUsed(sizes[i]);
+            tempBuffer.clear();
+            fixup(buffers[i], tempBuffer);
+        }
+
+        state.addBytes(bytes);
+        state.addEvents(data.eventCount);
+    }
+}
+
+void fixup_buffer_eth(bench::State &state)
+{
+    bench_fixup(state, ConnectionType::ETH, [] (ReadoutBuffer &read, ReadoutBuffer &temp)
+    {
+        mesytec::mvlc::fixup_buffer_eth(read, temp);
+    });
+}
+
+void fixup_buffer_usb(bench::State &state)
+{
+    bench_fixup(state, ConnectionType::USB, [] (ReadoutBuffer &read, ReadoutBuffer &temp)
+    {
+        mesytec::mvlc::fixup_buffer_usb(read, temp);
+    });
+}
+
+void fixup_usb_buffer(bench::State &state)
+{
+    ReadoutWorker::Counters counters = {};
+
+    bench_fixup(state, ConnectionType::USB, [&counters] (ReadoutBuffer &read, ReadoutBuffer &temp)
+    {
+        mesytec::mvlc::fixup_usb_buffer(read, temp, counters);
+    });
+}
+
+void count_stack_hits(bench::State &state)
+{
+    auto crateConfig = bench::make_bench_crate_config(2, 4);
+    auto data = bench::make_synthetic_data(crateConfig);
+    std::vector<eth::PacketReadResult> packets;
+
+    for (size_t pos=0; pos<data.ethStream.size();)
+    {
+        eth::PacketReadResult prr = {};
+        prr.buffer = reinterpret_cast<u8 *>(data.ethStream.data() + pos);
+        prr.bytesTransferred = (eth::HeaderWords + prr.dataWordCount()) * sizeof(u32);
+        packets.push_back(prr);
+        pos += eth::HeaderWords + prr.dataWordCount();
+    }
+
+    const size_t bytes = data.ethStream.size() * sizeof(u32);
+    StackHits stackHits = {};
+
+    while (state.keepRunning())
+    {
+        for (const auto &prr: packets)
+            mesytec::mvlc::count_stack_hits(prr, stackHits);
+
+        state.addBytes(bytes);
+        state.addEvents(data.eventCount);
+    }
+}
+
+} // end anon namespace
+
+MVLC_BENCHMARK(fixup_buffer_eth);
+MVLC_BENCHMARK(fixup_buffer_usb);
+MVLC_BENCHMARK(fixup_usb_buffer);
+MVLC_BENCHMARK(count_stack_hits);
@@ -0,0 +1,168 @@
+#include <mesytec-mvlc/mvlc_readout_parser.h>
+
+#include "bench.h"
+#include "synthetic_data.h"
+
+using namespace mesytec::mvlc;
+
+namespace
+{
+
+void bench_parse_readout_buffers(bench::State &state, ConnectionType type, bool batched = false,
+                                 bool useFixedModuleParsers = true)
+{
+    auto crateConfig = bench::make_bench_crate_config(2, 4);
+    auto data = bench::make_synthetic_data(crateConfig);
+    auto buffers = bench::make_readout_buffers(
+        type, type == ConnectionType::ETH ? data.ethStream : data.usbStream);
+    const size_t bytes = bench::total_bytes(buffers);
+
+    auto parserState = readout_parser::make_readout_parser(crateConfig.stacks, useFixedModuleParsers);
+    readout_parser::ReadoutParserCounters counters = {};
+    readout_parser::ReadoutParserCallbacks callbacks;
+    size_t events = 0u;
+    u32 bufferNumber = 0u;
+
+    callbacks.eventData = [&events] (int, const readout_parser::ModuleData *, unsigned)
+    {
+        ++events;
+    };
+
+    if (batched)
+    {
+        callbacks.eventBatch = [&events] (const readout_parser::EventBatch &batch)
+        {
+            events += batch.events.size();
+        };
+    }
+
+    auto parse = (type == ConnectionType::ETH
+                  ? readout_parser::parse_readout_buffer_eth
+                  : readout_parser::parse_readout_buffer_usb);
+
+    while (state.keepRunning())
+    {
+        size_t eventsBefore = events;
+
+        for (const auto &buffer: buffers)
+        {
+            auto view = buffer.viewU32();
+            parse(parserState, callbacks, counters, ++bufferNumber, view.data(), view.size());
+        }
+
+        state.addBytes(bytes);
+        state.addEvents(events - eventsBefore);
+    }
+}
+
+void parse_readout_buffer_eth(bench::State &state)
+{
+    bench_parse_readout_buffers(state, ConnectionType::ETH);
+}
+
+void parse_readout_buffer_usb(bench::State &state)
+{
+    bench_parse_readout_buffers(state, ConnectionType::USB);
+}
+
+void parse_readout_buffer_eth_batched(bench::State &state)
+{
+    bench_parse_readout_buffers(state, ConnectionType::ETH, true);
+}
+
+void parse_readout_buffer_usb_batched(bench::State &state)
+{
+    bench_parse_readout_buffers(state, ConnectionType::USB, true);
+}
+
+// The generic parser without the module parsers specialized for the readout
+// structure.
+void parse_readout_buffer_eth_generic(bench::State &state)
+{
+    bench_parse_readout_buffers(state, ConnectionType::ETH, false, false);
+}
+
+void parse_readout_buffer_usb_generic(bench::State &state)
+{
+    bench_parse_readout_buffers(state, ConnectionType::USB, false, false);
+}
+
+// Large crate with 20 modules in a single event. The consumer only needs
+// selectedModules of them.
+void bench_module_selection(bench::State &state, ConnectionType type, unsigned selectedModules)
+{
+    static const unsigned ModuleCount = 20;
+
+    auto crateConfig = bench::make_bench_crate_config(1, ModuleCount);
+    auto data = bench::make_synthetic_data(crateConfig);
+    auto buffers = bench::make_readout_buffers(
+        type, type == ConnectionType::ETH ? data.ethStream : data.usbStream);
+    const size_t bytes = bench::total_bytes(buffers);
+
+    readout_parser::ModuleSelection selection = { std::vector<bool>(ModuleCount, false) };
+
+    for (unsigned mi=0; mi<selectedModules; ++mi)
+        selection[0][mi * ModuleCount / selectedModules] = true;
+
+    auto parserState = readout_parser::make_readout_parser(crateConfig.stacks, selection);
+    readout_parser::ReadoutParserCounters counters = {};
+    readout_parser::ReadoutParserCallbacks callbacks;
+    size_t events = 0u;
+    u32 bufferNumber = 0u;
+
+    callbacks.eventData = [&events] (int, const readout_parser::ModuleData *, unsigned)
+    {
+        ++events;
+    };
+
+    auto parse = (type == ConnectionType::ETH
+                  ? readout_parser::parse_readout_buffer_eth
+                  : readout_parser::parse_readout_buffer_usb);
+
+    while (state.keepRunning())
+    {
+        size_t eventsBefore = events;
+
+        for (const auto &buffer: buffers)
+        {
+            auto view = buffer.viewU32();
+            parse(parserState, callbacks, counters, ++bufferNumber, view.data(), view.size());
+        }
+
+        state.addBytes(bytes);
+        state.addEvents(events - eventsBefore);
+    }
+}
+
+void parse_readout_buffer_eth_20_modules(bench::State &state)
+{
+    bench_module_selection(state, ConnectionType::ETH, 20);
+}
+
+void parse_readout_buffer_eth_20_modules_select_2(bench::State &state)
+{
+    bench_module_selection(state, ConnectionType::ETH, 2);
+}
+
+void parse_readout_buffer_usb_20_modules(bench::State &state)
+{
+    bench_module_selection(state, ConnectionType::USB, 20);
+}
+
+void parse_readout_buffer_usb_20_modules_select_2(bench::State &state)
+{
+    bench_module_selection(state, ConnectionType::USB, 2);
+}
+
+} // end anon namespace
+
+MVLC_BENCHMARK(parse_readout_buffer_eth);
+MVLC_BENCHMARK(parse_readout_buffer_usb);
+MVLC_BENCHMARK(parse_readout_buffer_eth_batched);
+MVLC_BENCHMARK(parse_readout_buffer_usb_batched);
+MVLC_BENCHMARK(parse_readout_buffer_eth_generic);
+MVLC_BENCHMARK(parse_readout_buffer_usb_generic);
+MVLC_BENCHMARK(parse_readout_buffer_eth_20_modules);
+MVLC_BENCHMARK(parse_readout_buffer_eth_20_modules_select_2);
+MVLC_BENCHMARK(parse_readout_buffer_usb_20_modules);
+MVLC_BENCHMARK(parse_readout_buffer_usb_20_modules_select_2);
@@ -0,0 +1,258 @@
+#include "synthetic_data.h"
+
+#include <algorithm>
+#include <cstring>
+#include <random>
+
+#include <mesytec-mvlc/mvlc_constants.h>
+#include <mesytec-mvlc/mvlc_eth_interface.h>
+#include <mesytec-mvlc/mvlc_util.h>
+#include <mesytec-mvlc/vme_constants.h>
+
+namespace mesytec
+{
+namespace mvlc
+{
+namespace bench
+{
+
+namespace
+{
+
+inline u32 make_frame_header(u8 type, u8 flags, u8 stackId, u16 len)
+{
+    using namespace frame_headers;
+
+    return (static_cast<u32>(type) << TypeShift)
+        | (static_cast<u32>(flags & FrameFlagsMask) << FrameFlagsShift)
+        | (static_cast<u32>(stackId & StackNumMask) << StackNumShift)
+        | (len & LengthMask);
+}
+
+// Wraps the payload in frames of the given type with the Continue flag set on
+// all but the last one.
+void append_framed(std::vector<u32> &dest, const std::vector<u32> &payload,
+                   u8 type, u8 contType, u8 stackId)
+{
+    size_t offset = 0u;
+
+    do
+    {
+        const size_t len = std::min(payload.size() - offset, static_cast<size_t>(frame_headers::LengthMask));
+        const bool isLast = (offset + len == payload.size());
+
+        dest.push_back(make_frame_header(offset == 0 ? type : contType,
+                                         isLast ? 0u : frame_flags::Continue, stackId, len));
+        dest.insert(dest.end(), payload.begin() + offset, payload.begin() + offset + len);
+        offset += len;
+    } while (offset < payload.size());
+}
+
+// Returns the number of words of the frame or packet starting at pos. Returns
+// 0 if the header is not contained in the stream.
+size_t element_size(ConnectionType type, const std::vector<u32> &stream, size_t pos)
+{
+    if (type == ConnectionType::USB)
+        return pos < stream.size() ? 1u + extract_frame_info(stream[pos]).len : 0u;
+
+    if (pos + 1 < stream.size())
+        return eth::HeaderWords + eth::PayloadHeaderInfo{ stream[pos], stream[pos + 1] }.dataWordCount();
+
+    return 0u;
+}
+
+ReadoutBuffer make_buffer(ConnectionType type, const u32 *begin, const u32 *end, size_t bufferNumber)
+{
+    const size_t bytes = (end - begin) * sizeof(u32);
+    ReadoutBuffer result(bytes);
+    result.setType(type);
+    result.setBufferNumber(bufferNumber);
+    std::memcpy(result.data(), begin, bytes);
+    result.use(bytes);
+    return result;
+}
+
+} // end anon namespace
+
+SyntheticData make_synthetic_data(const CrateConfig &crateConfig, const SyntheticDataOptions &options)
+{
+    SyntheticData result;
+
+    if (crateConfig.stacks.empty())
+        return result;
+
+    std::mt19937 rng(1234);
+    std::vector<u32> payload;
+    std::vector<u32> blockPayload;
+    u32 eventCounter = 0u;
+
+    for (size_t event=0; event<options.eventCount; ++event)
+    {
+        const size_t stackIndex = event % crateConfig.stacks.size();
+        const u8 stackId = stackIndex + stacks::FirstReadoutStackID;
+        payload.clear();
+
+        for (const auto &cmd: crateConfig.stacks[stackIndex].getCommands())
+        {
+            using CT = StackCommand::CommandType;
+
+            switch (cmd.type)
+            {
+                case CT::VMERead:
+                case CT::VMEMBLTSwapped:
+                case CT::SignallingVMERead:
+                    if (vme_amods::is_block_mode(cmd.amod))
+                    {
+                        const u16 words = std::max(options.blockReadWords, static_cast<u16>(2u));
+                        blockPayload.clear();
+                        blockPayload.push_back(0x40000000u | ((cmd.address >> 24) << 16) | (words - 1u));
+
+                        for (u16 i=0; i<words-2u; ++i)
+                            blockPayload.push_back(0x04000000u | ((i & 0x1fu) << 16) | (rng() & 0x1fffu));
+
+                        blockPayload.push_back(0xc0000000u | (eventCounter & 0x3fffffffu));
+                        append_framed(payload, blockPayload, frame_headers::BlockRead, frame_headers::BlockRead, stackId);
+                    }
+                    else
+                        payload.push_back(rng() & 0xffffu);
+                    break;
+
+                case CT::WriteMarker:
+                    payload.push_back(cmd.value);
+                    break;
+
+                case CT::WriteSpecial:
+                    payload.push_back(eventCounter);
+                    break;
+
+                default:
+                    break;
+            }
+        }
+
+        append_framed(result.usbStream, payload, frame_headers::StackFrame,
+                      frame_headers::StackContinuation, stackId);
+        ++eventCounter;
+    }
+
+    result.eventCount = options.eventCount;
+
+    // Split the frames into ETH packets.
+    const size_t maxDataWords = std::min(
+        options.ethPacketBytes / sizeof(u32) - eth::HeaderWords,
+        static_cast<size_t>(eth::header1::HeaderPointerMask));
+
+    size_t nextFrameHeader = 0u;
+    u16 packetNumber = 0u;
+
+    for (size_t pos=0; pos<result.usbStream.size(); pos += maxDataWords)
+    {
+        const size_t dataWords = std::min(maxDataWords, result.usbStream.size() - pos);
+        u32 nextHeaderPointer = eth::header1::NoHeaderPointerPresent;
+
+        while (nextFrameHeader < pos)
+            nextFrameHeader += 1u + extract_frame_info(result.usbStream[nextFrameHeader]).len;
+
+        if (nextFrameHeader < pos + dataWords)
+            nextHeaderPointer = nextFrameHeader - pos;
+
+        result.ethStream.push_back((static_cast<u32>(eth::PacketChannel::Data) << eth::header0::PacketChannelShift)
+                                   | ((packetNumber++ & eth::header0::PacketNumberMask) << eth::header0::PacketNumberShift)
+                                   | (dataWords & eth::header0::NumDataWordsMask));
+        result.ethStream.push_back(nextHeaderPointer);
+        result.ethStream.insert(result.ethStream.end(),
+                                result.usbStream.begin() + pos,
+                                result.usbStream.begin() + pos + dataWords);
+    }
+
+    return result;
+}
+
+CrateConfig make_bench_crate_config(unsigned stackCount, unsigned modulesPerStack)
+{
+    CrateConfig result;
+    result.connectionType = ConnectionType::ETH;
+    result.ethHost = "127.0.0.1";
+
+    for (unsigned stackIndex=0; stackIndex<stackCount; ++stackIndex)
+    {
+        StackCommandBuilder stack("event" + std::to_string(stackIndex));
+
+        for (unsigned moduleIndex=0; moduleIndex<modulesPerStack; ++moduleIndex)
+        {
+            const u32 address = (stackIndex * modulesPerStack + moduleIndex) << 24;
+            stack.beginGroup("module" + std::to_string(moduleIndex));
+            stack.addVMEBlockRead(address, vme_amods::MBLT64, 0xffff);
+            stack.addWriteMarker(0x87654321u);
+        }
+
+        result.stacks.push_back(stack);
+        result.triggers.push_back(trigger_value(stacks::IRQNoIACK, stackIndex + 1));
+    }
+
+    return result;
+}
+
+std::vector<ReadoutBuffer> make_readout_buffers(
+    ConnectionType type, const std::vector<u32> &stream, size_t bufferSize)
+{
+    std::vector<ReadoutBuffer> result;
+    const size_t maxWords = bufferSize / sizeof(u32);
+    size_t start = 0u;
+    size_t pos = 0u;
+
+    while (pos < stream.size())
+    {
+        size_t size = element_size(type, stream, pos);
+
+        if (pos + size - start > maxWords && pos > start)
+        {
+            result.emplace_back(make_buffer(type, stream.data() + start, stream.data() + pos, result.size() + 1));
+            start = pos;
+        }
+
+        pos += size;
+    }
+
+    if (start < stream.size())
+        result.emplace_back(make_buffer(type, stream.data() + start, stream.data() + stream.size(), result.size() + 1));
+
+    return result;
+}
+
+std::vector<ReadoutBuffer> make_unaligned_buffers(
+    ConnectionType type, const std::vector<u32> &stream, size_t bufferSize)
+{
+    std::vector<ReadoutBuffer> result;
+    const size_t maxWords = bufferSize / sizeof(u32);
+    size_t start = 0u;
+
+    while (start < stream.size())
+    {
+        const size_t end = std::min(start + maxWords, stream.size());
+        result.emplace_back(make_buffer(type, stream.data() + start, stream.data() + end, result.size() + 1));
+
+        // The next buffer starts with the partial frame or packet at the end
+        // of this one, just like after moving the trailing data to the
+        // temporary buffer.
+        size_t next = start;
+
+        while (next < end)
+        {
+            size_t size = element_size(type, stream, next);
+
+            if (next + size > end)
+                break;
+
+            next += size;
+        }
+
+        start = (next > start ? next : end);
+    }
+
+    return result;
+}
+
+} // end namespace bench
+} // end namespace mvlc
+} // end namespace mesytec
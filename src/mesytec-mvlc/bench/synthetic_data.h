@@ -0,0 +1,80 @@
+#ifndef __MESYTEC_MVLC_BENCH_SYNTHETIC_DATA_H__
+#define __MESYTEC_MVLC_BENCH_SYNTHETIC_DATA_H__
+
+#include <vector>
+
+#include <mesytec-mvlc/mvlc_readout_config.h>
+#include <mesytec-mvlc/readout_buffer.h>
+#include <mesytec-mvlc/util/int_types.h>
+#include <mesytec-mvlc/util/storage_sizes.h>
+
+namespace mesytec
+{
+namespace mvlc
+{
+namespace bench
+{
+
+// Generation of MVLC readout data for benchmarking without hardware. The data
+// is derived from the readout stacks of a CrateConfig: each single VME read
+// yields one data word, each block read a mesytec style module event
+// (header, data words, end of event) wrapped in a BlockRead frame and markers
+// yield their marker value. Events are generated round-robin for the readout
+// stacks.
+
+struct SyntheticDataOptions
+{
+    // Total number of events to generate.
+    size_t eventCount = 10000;
+
+    // Number of words produced by each block read.
+    u16 blockReadWords = 32;
+
+    // ETH packet size in bytes including the two ETH header words. The
+    // default is the size of packets sent with jumbo frames enabled.
+    size_t ethPacketBytes = 8972;
+};
+
+struct SyntheticData
+{
+    // Stack frames as sent by the MVLC via USB.
+    std::vector<u32> usbStream;
+
+    // The same frames split into ETH data packets.
+    std::vector<u32> ethStream;
+
+    size_t eventCount = 0u;
+};
+
+SyntheticData make_synthetic_data(const CrateConfig &crateConfig, const SyntheticDataOptions &options = {});
+
+// Crate config containing stackCount readout stacks. Each stack reads
+// modulesPerStack modules, each using an MBLT block read followed by a marker
+// word. The stacks are triggered by IRQs 1 to stackCount.
+CrateConfig make_bench_crate_config(unsigned stackCount = 1, unsigned modulesPerStack = 4);
+
+// Splits the stream into buffers of at most bufferSize bytes which contain
+// only complete frames (USB) or packets (ETH). This is the form in which the
+// ReadoutWorker hands out buffers.
+std::vector<ReadoutBuffer> make_readout_buffers(
+    ConnectionType type, const std::vector<u32> &stream, size_t bufferSize = util::Megabytes(1));
+
+// Splits the stream into buffers of bufferSize bytes. Each buffer starts with
+// a frame or packet header but ends at an arbitrary position, like buffers
+// read from a listfile or directly from USB before being fixed up.
+std::vector<ReadoutBuffer> make_unaligned_buffers(
+    ConnectionType type, const std::vector<u32> &stream, size_t bufferSize = util::Megabytes(1));
+
+inline size_t total_bytes(const std::vector<ReadoutBuffer> &buffers)
+{
+    size_t result = 0u;
+    for (const auto &buffer: buffers)
+        result += buffer.used();
+    return result;
+}
+
+} // end namespace bench
+} // end namespace mvlc
+} // end namespace mesytec
+
+#endif /* __MESYTEC_MVLC_BENCH_SYNTHETIC_DATA_H__ */
@@ -0,0 +1,58 @@
+#include <thread>
+
+#include <mesytec-mvlc/readout_buffer.h>
+#include <mesytec-mvlc/util/storage_sizes.h>
+#include <mesytec-mvlc/util/threadsafequeue.h>
+
+#include "bench.h"
+
+using namespace mesytec::mvlc;
+
+namespace
+{
+
+// Buffer hand-off between a producer and a consumer thread using a pair of
+// empty/filled queues, the way ReadoutBufferQueues are used by the readout
+// and the analysis side.
+void threadsafequeue_handoff(bench::State &state)
+{
+    static const size_t BufferCount = 10;
+    static const size_t BuffersPerIteration = 10000;
+
+    std::vector<ReadoutBuffer> buffers(BufferCount, ReadoutBuffer(util::Kilobytes(64)));
+    ThreadSafeQueue<ReadoutBuffer *> emptyQueue;
+    ThreadSafeQueue<ReadoutBuffer *> filledQueue;
+
+    for (auto &buffer: buffers)
+    {
+        buffer.use(buffer.capacity());
+        emptyQueue.enqueue(&buffer);
+    }
+
+    auto consumer = [&] ()
+    {
+        while (auto buffer = filledQueue.dequeue_blocking())
+            emptyQueue.enqueue(buffer);
+    };
+
+    std::thread consumerThread(consumer);
+
+    while (state.keepRunning())
+    {
+        for (size_t i=0; i<BuffersPerIteration; ++i)
+        {
+            auto buffer = emptyQueue.dequeue_blocking();
+            filledQueue.enqueue(buffer);
+            state.addBytes(buffer->used());
+        }
+
+        state.addEvents(BuffersPerIteration);
+    }
+
+    filledQueue.enqueue(nullptr);
+    consumerThread.join();
+}
+
+} // end anon namespace
+
+MVLC_BENCHMARK(threadsafequeue_handoff);
@@ -34,15 +34,19 @@
 #include "mvlc_command_builders.h"
 #include "mvlc_dialog.h"
 #include "mvlc_dialog_util.h"
+#include "mvlc_event_ring.h"
 #include "mvlc_factory.h"
+#include "mvlc_frame_scan.h"
 #include "mvlc.h"
 #include "mvlc_listfile.h"
 #include "mvlc_listfile_zip.h"
+#include "mvlc_parallel_replay.h"
 #include "mvlc_readout.h"
 #include "mvlc_readout_parser.h"
 #include "mvlc_readout_parser_util.h"
 #include "mvlc_replay.h"
 #include "mvlc_stack_executor.h"
+#include "mvlc_thread_policy.h"
 #include "mvlc_threading.h"
 #include "mvlc_util.h"
 #include "util/filesystem.h"
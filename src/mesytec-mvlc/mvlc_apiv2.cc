@@ -250,6 +250,8 @@ void cmd_pipe_reader(ReaderContext &context)
     prctl(PR_SET_NAME,"cmd_pipe_reader",0,0,0);
 #endif
 
+    context.counters.access()->threadPolicy = apply_thread_policy("cmd_pipe_reader");
+
     spdlog::info("cmd_pipe_reader starting");
 
     auto mvlcUsb = dynamic_cast<usb::MVLC_USB_Interface *>(context.mvlc);
@@ -11,6 +11,7 @@
 #include "mvlc_basic_interface.h"
 #include "mvlc_command_builders.h"
 #include "mvlc_stack_errors.h"
+#include "mvlc_thread_policy.h"
 #include "mvlc_threading.h"
 #include "util/protected.h"
 
@@ -39,6 +40,9 @@ struct CmdPipeCounters
     size_t superFormatErrors;
     size_t superRefMismatches;
     size_t stackRefMismatches;
+
+    // Effective thread policy of the reader thread.
+    ThreadPolicyResult threadPolicy;
 };
 
 class MESYTEC_MVLC_EXPORT MVLC
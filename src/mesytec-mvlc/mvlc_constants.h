@@ -368,6 +368,10 @@ namespace usb
     // streaming read size is set to this value. This means all read requests
     // have to be of this exact size.
     static const size_t USBStreamPipeReadSize = USBSingleTransferMaxBytes;
+    // Read timeout of the data pipe set when connecting. It is not changed
+    // during a readout as FT_SetPipeTimeout is not thread-safe under
+    // Windows.
+    static const unsigned DataPipeReadTimeout_ms = 100;
 } // end namespace usb
 
 namespace eth
@@ -16,11 +16,19 @@ namespace eth
 using PacketSizeMap = std::unordered_map<u16, u64>; // size -> count
 using HeaderTypeMap = std::unordered_map<u8, u64>;  // header type byte -> count
 
-struct MESYTEC_MVLC_EXPORT PipeStats
+// The scalar part of PipeStats. Trivially copyable so that it can be
+// snapshotted without locking.
+struct MESYTEC_MVLC_EXPORT PipeCounters
 {
-    // Number of calls to read_packet() for the specified pipe.
+    // Number of packet receive attempts for the specified pipe: one per call
+    // to read_packet(). read_packets() counts one attempt per received packet
+    // or one if no packet was received.
     u64 receiveAttempts = 0u;
 
+    // Number of batched receive calls made by read_packets(). Each batch may
+    // return multiple packets.
+    u64 receiveBatches = 0u;
+
     // Total number of received UDP packets.
     u64 receivedPackets = 0u;
 
@@ -28,6 +36,11 @@ struct MESYTEC_MVLC_EXPORT PipeStats
     // the sum of the payload sizes of the received UDP packets.
     u64 receivedBytes = 0u;
 
+    // Bytes moved by read_packets() to store the packets back-to-back. Only
+    // packets following a packet shorter than the receive slot size or
+    // packets larger than the slot size are moved.
+    u64 movedBytes = 0u;
+
     // Packets shorther than the header size (2 * 32 bit).
     u64 shortPackets = 0u;
 
@@ -39,23 +52,85 @@ struct MESYTEC_MVLC_EXPORT PipeStats
     u64 headerOutOfRange = 0u;  // Header points outside the packet data
     u64 packetChannelOutOfRange = 0u;
     u64 lostPackets = 0u;
+};
 
+struct MESYTEC_MVLC_EXPORT PipeStats: public PipeCounters
+{
+    // Packet sizes are counted in multiples of 32-bit words. The
+    // JumboFrameMaxSize entry also counts all larger packets.
     PacketSizeMap packetSizes;
     HeaderTypeMap headerTypes;
 };
 
-struct MESYTEC_MVLC_EXPORT PacketChannelStats
+// The scalar part of PacketChannelStats.
+struct MESYTEC_MVLC_EXPORT PacketChannelCounters
 {
     u64 receivedPackets = 0u;
     u64 receivedBytes = 0u;
     u64 lostPackets = 0u;
     u64 noHeader = 0u;          // Packets where nextHeaderPointer = 0xffff
     u64 headerOutOfRange = 0u;  // Header points outside the packet data
+};
 
+struct MESYTEC_MVLC_EXPORT PacketChannelStats: public PacketChannelCounters
+{
+    // Packet sizes are counted in multiples of 32-bit words. The
+    // JumboFrameMaxSize entry also counts all larger packets.
     PacketSizeMap packetSizes;
     HeaderTypeMap headerTypes;
 };
 
+// Helpers for summing up stats.
+template<typename Map>
+Map &add_counts(Map &a, const Map &b)
+{
+    for (const auto &kv: b)
+        a[kv.first] += kv.second;
+    return a;
+}
+
+inline PipeCounters &operator+=(PipeCounters &a, const PipeCounters &b)
+{
+    a.receiveAttempts += b.receiveAttempts;
+    a.receiveBatches += b.receiveBatches;
+    a.receivedPackets += b.receivedPackets;
+    a.receivedBytes += b.receivedBytes;
+    a.movedBytes += b.movedBytes;
+    a.shortPackets += b.shortPackets;
+    a.packetsWithResidue += b.packetsWithResidue;
+    a.noHeader += b.noHeader;
+    a.headerOutOfRange += b.headerOutOfRange;
+    a.packetChannelOutOfRange += b.packetChannelOutOfRange;
+    a.lostPackets += b.lostPackets;
+    return a;
+}
+
+inline PipeStats &operator+=(PipeStats &a, const PipeStats &b)
+{
+    static_cast<PipeCounters &>(a) += b;
+    add_counts(a.packetSizes, b.packetSizes);
+    add_counts(a.headerTypes, b.headerTypes);
+    return a;
+}
+
+inline PacketChannelCounters &operator+=(PacketChannelCounters &a, const PacketChannelCounters &b)
+{
+    a.receivedPackets += b.receivedPackets;
+    a.receivedBytes += b.receivedBytes;
+    a.lostPackets += b.lostPackets;
+    a.noHeader += b.noHeader;
+    a.headerOutOfRange += b.headerOutOfRange;
+    return a;
+}
+
+inline PacketChannelStats &operator+=(PacketChannelStats &a, const PacketChannelStats &b)
+{
+    static_cast<PacketChannelCounters &>(a) += b;
+    add_counts(a.packetSizes, b.packetSizes);
+    add_counts(a.headerTypes, b.headerTypes);
+    return a;
+}
+
 }
 }
 }
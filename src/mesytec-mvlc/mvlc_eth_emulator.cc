@@ -0,0 +1,870 @@
+#include "mvlc_eth_emulator.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
+
+#include <spdlog/spdlog.h>
+
+#include "mvlc_error.h"
+#include "util/protected.h"
+#include "vme_constants.h"
+
+namespace mesytec
+{
+namespace mvlc
+{
+namespace eth
+{
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+
+// Socket receive timeout. Determines how fast the threads react to stop().
+static const unsigned ReceiveTimeout_ms = 100;
+
+// Triggers which could not be handled for longer than this, e.g. because the
+// data pipe was throttled, are dropped instead of being generated in a burst
+// afterwards. The MVLC blocks triggers while its buffers are full.
+static const auto MaxTriggerBacklog = std::chrono::milliseconds(100);
+
+// Maximum number of pending data words the generator accumulates, counted in
+// packets. Limits the amount of data produced in one go when running
+// without a trigger rate limit.
+static const size_t MaxPendingPackets = 4;
+
+std::error_code make_udp_socket(const std::string &address, u16 port, int &sock)
+{
+    sock = -1;
+
+    struct addrinfo hints = {};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_protocol = IPPROTO_UDP;
+
+    struct addrinfo *result = nullptr;
+
+    if (getaddrinfo(address.c_str(), std::to_string(port).c_str(), &hints, &result) != 0 || !result)
+        return make_error_code(MVLCErrorCode::HostLookupError);
+
+    sockaddr_in addr = {};
+    std::memcpy(&addr, result->ai_addr, std::min(sizeof(addr), static_cast<size_t>(result->ai_addrlen)));
+    freeaddrinfo(result);
+
+    int s = ::socket(AF_INET, SOCK_DGRAM, 0);
+
+    if (s < 0)
+        return std::error_code(errno, std::system_category());
+
+    int reuse = 1;
+    setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    struct timeval tv = {};
+    tv.tv_sec = ReceiveTimeout_ms / 1000;
+    tv.tv_usec = (ReceiveTimeout_ms % 1000) * 1000;
+
+    if (setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) != 0
+        || ::bind(s, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) != 0)
+    {
+        auto ec = std::error_code(errno, std::system_category());
+        ::close(s);
+        return ec;
+    }
+
+    sock = s;
+    return {};
+}
+
+inline u32 make_frame_header(u8 type, u8 flags, u8 stackId, u16 len)
+{
+    using namespace frame_headers;
+
+    return (static_cast<u32>(type) << TypeShift)
+        | (static_cast<u32>(flags & FrameFlagsMask) << FrameFlagsShift)
+        | (static_cast<u32>(stackId & StackNumMask) << StackNumShift)
+        | (len & LengthMask);
+}
+
+// Appends the payload to dest wrapped in a frame of the given type. If the
+// payload does not fit into a single frame continuation frames of type
+// contType are used. All but the last frame have the Continue flag set.
+void append_framed(std::vector<u32> &dest, const std::vector<u32> &payload,
+                   u8 type, u8 contType, u8 stackId, u8 flags)
+{
+    size_t offset = 0u;
+
+    do
+    {
+        const size_t len = std::min(payload.size() - offset, static_cast<size_t>(frame_headers::LengthMask));
+        const bool isLast = (offset + len == payload.size());
+        const u8 frameFlags = (isLast ? flags : (flags | frame_flags::Continue));
+
+        dest.push_back(make_frame_header(offset == 0 ? type : contType, frameFlags, stackId, len));
+        dest.insert(dest.end(), payload.begin() + offset, payload.begin() + offset + len);
+        offset += len;
+    } while (offset < payload.size());
+}
+
+// Collects outgoing frames for one packet channel and cuts them into packets.
+// Keeps track of frame header positions to fill in the next header pointer.
+struct PacketWriter
+{
+    std::vector<u32> words;
+    std::vector<size_t> headers;
+    u16 packetNumber = 0u;
+
+    // 'frames' must consist of complete outer frames.
+    void addFrames(const std::vector<u32> &frames)
+    {
+        size_t pos = 0u;
+
+        while (pos < frames.size())
+        {
+            headers.push_back(words.size() + pos);
+            pos += (frames[pos] & frame_headers::LengthMask) + 1;
+        }
+
+        words.insert(words.end(), frames.begin(), frames.end());
+    }
+
+    size_t size() const { return words.size(); }
+    bool empty() const { return words.empty(); }
+
+    void clear()
+    {
+        words.clear();
+        headers.clear();
+    }
+
+    // Moves up to maxDataWords into the packet buffer and prepends the two
+    // ETH header words.
+    void makePacket(std::vector<u32> &packet, PacketChannel channel, u32 timestamp, size_t maxDataWords)
+    {
+        const size_t dataWords = std::min(words.size(), maxDataWords);
+        u32 nextHeaderPointer = header1::NoHeaderPointerPresent;
+
+        if (!headers.empty() && headers.front() < dataWords)
+            nextHeaderPointer = headers.front();
+
+        packet.clear();
+        packet.push_back((static_cast<u32>(channel) << header0::PacketChannelShift)
+                         | ((packetNumber & header0::PacketNumberMask) << header0::PacketNumberShift)
+                         | (dataWords & header0::NumDataWordsMask));
+        packet.push_back(((timestamp & header1::TimestampMask) << header1::TimestampShift)
+                         | (nextHeaderPointer & header1::HeaderPointerMask));
+        packet.insert(packet.end(), words.begin(), words.begin() + dataWords);
+
+        words.erase(words.begin(), words.begin() + dataWords);
+
+        auto it = std::find_if(headers.begin(), headers.end(),
+                               [dataWords] (size_t h) { return h >= dataWords; });
+        headers.erase(headers.begin(), it);
+
+        for (auto &h: headers)
+            h -= dataWords;
+
+        ++packetNumber;
+    }
+};
+
+} // end anon namespace
+
+struct Emulator::Private
+{
+    explicit Private(const EmulatorOptions &opts_)
+        : opts(opts_)
+        , quit(false)
+        , running(false)
+        , counters({})
+        , delay(NoDelay)
+        , rng(std::random_device()())
+    {
+        stackMemory.fill(0u);
+        eventCounters.fill(0u);
+    }
+
+    EmulatorOptions opts;
+    int cmdSock = -1;
+    int dataSock = -1;
+    int delaySock = -1;
+    std::atomic<bool> quit;
+    std::atomic<bool> running;
+    std::thread cmdThread;
+    std::thread dataThread;
+    std::thread delayThread;
+    Clock::time_point tStart;
+    mutable Protected<EmulatorCounters> counters;
+    std::atomic<u16> delay;
+
+    // Emulated controller state. Shared by the command and data threads.
+    std::mutex stateMutex;
+    std::unordered_map<u16, u32> registerValues;
+    std::array<u32, stacks::StackMemoryWords> stackMemory;
+    std::unordered_map<u32, u32> vmeMemory;
+    std::array<u32, stacks::StackCount> eventCounters;
+    std::vector<u32> pendingDataFrames; // output of immediate stacks routed to the data pipe
+    std::minstd_rand rng;
+
+    // Command and Stack channel packets. Only used by the command thread.
+    PacketWriter superWriter;
+    PacketWriter stackWriter;
+
+    void closeSockets()
+    {
+        for (int *sock: { &cmdSock, &dataSock, &delaySock })
+        {
+            if (*sock >= 0)
+                ::close(*sock);
+            *sock = -1;
+        }
+    }
+
+    u32 timestamp() const
+    {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - tStart).count();
+    }
+
+    // The following methods require the stateMutex to be locked.
+    u32 readRegister(u16 address);
+    void writeRegister(u16 address, u32 value);
+    u32 vmeRead(u32 address, VMEDataWidth dataWidth);
+    void vmeWrite(u32 address, u32 value, VMEDataWidth dataWidth);
+    void blockRead(u8 stackId, u32 address, u8 amod, u16 transfers, std::vector<u32> &dest);
+    bool executeStack(u8 stackId, std::vector<u32> &dest, u8 &outputPipe);
+
+    size_t maxDataWords();
+
+    void sendPacket(int sock, const sockaddr_in &dest, const std::vector<u32> &packet);
+    void handleCommandPacket(const u32 *begin, const u32 *end, const sockaddr_in &src);
+
+    void cmdLoop();
+    void dataLoop();
+    void delayLoop();
+};
+
+u32 Emulator::Private::readRegister(u16 address)
+{
+    if (address == registers::hardware_id)
+        return opts.hardwareId;
+
+    if (address == registers::firmware_revision)
+        return opts.firmwareRevision;
+
+    if (address == registers::eth_delay_read)
+        return delay;
+
+    if (address >= stacks::StackMemoryBegin && address < stacks::StackMemoryEnd)
+        return stackMemory[(address - stacks::StackMemoryBegin) / AddressIncrement];
+
+    auto it = registerValues.find(address);
+    return it != registerValues.end() ? it->second : 0u;
+}
+
+void Emulator::Private::writeRegister(u16 address, u32 value)
+{
+    if (address >= stacks::StackMemoryBegin && address < stacks::StackMemoryEnd)
+        stackMemory[(address - stacks::StackMemoryBegin) / AddressIncrement] = value;
+    else
+        registerValues[address] = value;
+}
+
+u32 Emulator::Private::vmeRead(u32 address, VMEDataWidth dataWidth)
+{
+    u32 value = 0u;
+
+    if ((address & 0xffff0000u) == SelfVMEAddress)
+        value = readRegister(address & 0xffffu);
+    else
+    {
+        auto it = vmeMemory.find(address);
+        value = it != vmeMemory.end() ? it->second : (address & 0xffffu);
+    }
+
+    return dataWidth == VMEDataWidth::D16 ? (value & 0xffffu) : value;
+}
+
+void Emulator::Private::vmeWrite(u32 address, u32 value, VMEDataWidth dataWidth)
+{
+    if (dataWidth == VMEDataWidth::D16)
+        value &= 0xffffu;
+
+    if ((address & 0xffff0000u) == SelfVMEAddress)
+        writeRegister(address & 0xffffu, value);
+    else
+        vmeMemory[address] = value;
+}
+
+// Produces a mesytec style module event: header word, data words and an end
+// of event word containing the event counter.
+void Emulator::Private::blockRead(u8 stackId, u32 address, u8 amod, u16 transfers, std::vector<u32> &dest)
+{
+    const size_t wordsPerTransfer = vme_amods::is_blt_mode(amod) ? 1u : 2u;
+    const size_t wordCount = std::min(static_cast<size_t>(opts.blockReadMaxWords),
+                                      transfers * wordsPerTransfer);
+
+    std::vector<u32> payload;
+    payload.reserve(wordCount);
+
+    const u32 moduleId = (address >> 24) & 0xffu;
+
+    for (size_t i=0; i<wordCount; ++i)
+    {
+        if (i == 0 && wordCount > 2)
+            payload.push_back(0x40000000u | (moduleId << 16) | ((wordCount - 1) & 0x3ffu));
+        else if (i == wordCount - 1 && wordCount > 2)
+            payload.push_back(0xc0000000u | (eventCounters[stackId] & 0x3fffffffu));
+        else
+            payload.push_back(0x04000000u | ((i & 0x1fu) << 16) | (rng() & 0xffffu));
+    }
+
+    append_framed(dest, payload, frame_headers::BlockRead, frame_headers::BlockRead, stackId, 0u);
+}
+
+// Executes the stack referenced by the stacks offset register. The output is
+// appended to dest in the form of a StackFrame followed by StackContinuation
+// frames if needed.
+bool Emulator::Private::executeStack(u8 stackId, std::vector<u32> &dest, u8 &outputPipe)
+{
+    using namespace stack_commands;
+
+    size_t index = (readRegister(stacks::get_offset_register(stackId))
+                    & stacks::StackOffsetBitMaskBytes) / AddressIncrement;
+
+    if (index >= stackMemory.size()
+        || ((stackMemory[index] >> CmdShift) & CmdMask) != static_cast<u32>(StackCommandType::StackStart))
+    {
+        return false;
+    }
+
+    outputPipe = (stackMemory[index] >> CmdArg0Shift) & CmdArg0Mask;
+
+    // Returns the next stack word. Reading past the end of the stack memory
+    // yields 0 which is not a valid command.
+    auto next_word = [this, &index] () -> u32
+    {
+        return ++index < stackMemory.size() ? stackMemory[index] : 0u;
+    };
+
+    std::vector<u32> payload;
+    u8 flags = 0u;
+    bool done = false;
+
+    while (!done)
+    {
+        const u32 cmdWord = next_word();
+        const u8 arg0 = (cmdWord >> CmdArg0Shift) & CmdArg0Mask;
+        const u16 arg1 = (cmdWord >> CmdArg1Shift) & CmdArg1Mask;
+
+        switch (static_cast<StackCommandType>((cmdWord >> CmdShift) & CmdMask))
+        {
+            case StackCommandType::StackEnd:
+                done = true;
+                break;
+
+            case StackCommandType::VMERead:
+            case StackCommandType::VMEMBLTSwapped:
+            case StackCommandType::SignallingVMERead:
+                {
+                    const u32 address = next_word();
+                    const u8 amod = arg0 & 0x3fu; // strip the 2eSST rate bits
+
+                    if (vme_amods::is_block_mode(amod))
+                        blockRead(stackId, address, amod, arg1, payload);
+                    else
+                        payload.push_back(vmeRead(address, static_cast<VMEDataWidth>(arg1)));
+                }
+                break;
+
+            case StackCommandType::VMEWrite:
+                {
+                    const u32 address = next_word();
+                    const u32 value = next_word();
+                    vmeWrite(address, value, static_cast<VMEDataWidth>(arg1));
+                }
+                break;
+
+            case StackCommandType::WriteMarker:
+                payload.push_back(next_word());
+                break;
+
+            case StackCommandType::WriteSignalWord:
+                next_word();
+                break;
+
+            case StackCommandType::WriteSpecial:
+                if ((cmdWord & 0xffu) == static_cast<u32>(SpecialWord::Timestamp))
+                    payload.push_back(timestamp());
+                else
+                    payload.push_back(1u << stackId);
+                break;
+
+            default:
+                flags |= frame_flags::SyntaxError;
+                done = true;
+                break;
+        }
+    }
+
+    ++eventCounters[stackId];
+    append_framed(dest, payload, frame_headers::StackFrame, frame_headers::StackContinuation, stackId, flags);
+
+    return true;
+}
+
+size_t Emulator::Private::maxDataWords()
+{
+    size_t packetBytes = opts.maxPacketBytes;
+
+    if (packetBytes == 0)
+        packetBytes = readRegister(registers::jumbo_frame_enable) ? EmulatorJumboPacketBytes : EmulatorPacketBytes;
+
+    const size_t packetWords = packetBytes / sizeof(u32);
+    const size_t dataWords = packetWords > HeaderWords ? packetWords - HeaderWords : 1u;
+
+    // The next header pointer can address at most HeaderPointerMask - 1 words.
+    return std::min(dataWords, static_cast<size_t>(header1::HeaderPointerMask));
+}
+
+void Emulator::Private::sendPacket(int sock, const sockaddr_in &dest, const std::vector<u32> &packet)
+{
+    // Errors are ignored. A client which went away simply does not receive
+    // anything anymore.
+    ::sendto(sock, reinterpret_cast<const char *>(packet.data()), packet.size() * sizeof(u32), 0,
+             reinterpret_cast<const struct sockaddr *>(&dest), sizeof(dest));
+}
+
+void Emulator::Private::handleCommandPacket(const u32 *begin, const u32 *end, const sockaddr_in &src)
+{
+    using namespace super_commands;
+
+    std::vector<u32> response = { 0u }; // space for the SuperFrame header
+    std::vector<u8> immediateStacks;
+    size_t superCommands = 0u;
+    size_t maxWords = 0u;
+
+    {
+        std::unique_lock<std::mutex> guard(stateMutex);
+        maxWords = maxDataWords();
+
+        for (auto it = begin; it < end; ++it)
+        {
+            const u32 cmdWord = *it;
+            const u16 address = (cmdWord >> SuperCmdArgShift) & SuperCmdArgMask;
+            bool bufferEnd = false;
+
+            switch (static_cast<SuperCommandType>((cmdWord >> SuperCmdShift) & SuperCmdMask))
+            {
+                case SuperCommandType::CmdBufferStart:
+                    break;
+
+                case SuperCommandType::CmdBufferEnd:
+                    bufferEnd = true;
+                    break;
+
+                case SuperCommandType::ReferenceWord:
+                case SuperCommandType::WriteReset:
+                    response.push_back(cmdWord);
+                    break;
+
+                case SuperCommandType::ReadLocal:
+                    response.push_back(cmdWord);
+                    response.push_back(readRegister(address));
+                    break;
+
+                case SuperCommandType::ReadLocalBlock:
+                    response.push_back(cmdWord);
+                    if (it + 1 < end)
+                        response.push_back(*++it);
+                    break;
+
+                case SuperCommandType::WriteLocal:
+                    if (it + 1 < end)
+                    {
+                        u32 value = *++it;
+                        response.push_back(cmdWord);
+                        response.push_back(value);
+
+                        // Trigger register writes with the Immediate bit set
+                        // run the stack once. The bit is not stored.
+                        if (address >= stacks::Stack0TriggerRegister
+                            && address < stacks::get_trigger_register(stacks::StackCount)
+                            && (address - stacks::Stack0TriggerRegister) % AddressIncrement == 0
+                            && ((value >> stacks::ImmediateShift) & stacks::ImmediateMask))
+                        {
+                            immediateStacks.push_back((address - stacks::Stack0TriggerRegister) / AddressIncrement);
+                            value &= ~(stacks::ImmediateMask << stacks::ImmediateShift);
+                        }
+
+                        writeRegister(address, value);
+                    }
+                    break;
+
+                default:
+                    // Unknown command word: stop interpreting the buffer.
+                    bufferEnd = true;
+                    break;
+            }
+
+            if (bufferEnd)
+                break;
+
+            ++superCommands;
+        }
+    }
+
+    response[0] = make_frame_header(frame_headers::SuperFrame, 0u, 0u, response.size() - 1);
+
+    // The super response is sent first, then the output of immediately
+    // executed stacks.
+    std::vector<u32> packet;
+
+    superWriter.addFrames(response);
+
+    while (!superWriter.empty())
+    {
+        superWriter.makePacket(packet, PacketChannel::Command, timestamp(), maxWords);
+        sendPacket(cmdSock, src, packet);
+    }
+
+    size_t stackExecutions = 0u;
+
+    for (u8 stackId: immediateStacks)
+    {
+        std::vector<u32> frames;
+        u8 outputPipe = CommandPipe;
+        std::unique_lock<std::mutex> guard(stateMutex);
+
+        if (!executeStack(stackId, frames, outputPipe))
+            continue;
+
+        ++stackExecutions;
+
+        if (outputPipe == DataPipe)
+        {
+            pendingDataFrames.insert(pendingDataFrames.end(), frames.begin(), frames.end());
+        }
+        else if (outputPipe == CommandPipe)
+        {
+            guard.unlock();
+            stackWriter.addFrames(frames);
+
+            while (!stackWriter.empty())
+            {
+                stackWriter.makePacket(packet, PacketChannel::Stack, timestamp(), maxWords);
+                sendPacket(cmdSock, src, packet);
+            }
+        }
+    }
+
+    auto c = counters.access();
+    ++c->commandPackets;
+    c->superCommands += superCommands;
+    c->stackExecutions += stackExecutions;
+}
+
+void Emulator::Private::cmdLoop()
+{
+#ifdef __linux__
+    prctl(PR_SET_NAME, "emu_cmd", 0, 0, 0);
+#endif
+
+    std::array<u32, JumboFrameMaxSize / sizeof(u32)> buffer;
+
+    while (!quit)
+    {
+        sockaddr_in src = {};
+        socklen_t srcLen = sizeof(src);
+
+        ssize_t res = ::recvfrom(cmdSock, reinterpret_cast<char *>(buffer.data()),
+                                 buffer.size() * sizeof(u32), 0,
+                                 reinterpret_cast<struct sockaddr *>(&src), &srcLen);
+
+        if (res >= static_cast<ssize_t>(sizeof(u32)))
+            handleCommandPacket(buffer.data(), buffer.data() + res / sizeof(u32), src);
+    }
+}
+
+void Emulator::Private::dataLoop()
+{
+#ifdef __linux__
+    prctl(PR_SET_NAME, "emu_data", 0, 0, 0);
+#endif
+
+    PacketWriter writer;
+    std::vector<u32> frames;
+    std::vector<u32> packet;
+    std::array<u8, 64> requestBuffer;
+    std::array<Clock::time_point, stacks::StackCount> nextTrigger;
+    std::array<bool, stacks::StackCount> stackActive = {};
+    std::minstd_rand lossRng(std::random_device{}());
+    std::uniform_real_distribution<double> lossDist(0.0, 1.0);
+    sockaddr_in dest = {};
+    bool haveDest = false;
+
+    const auto triggerPeriod = (opts.triggerRate > 0.0
+                                ? std::chrono::duration_cast<Clock::duration>(
+                                    std::chrono::duration<double>(1.0 / opts.triggerRate))
+                                : Clock::duration::zero());
+
+    auto send_data_packet = [&] (size_t maxWords)
+    {
+        // Apply the delay requested via the delay port. StopSending halts
+        // the data pipe completely.
+        u16 curDelay = delay;
+
+        while (curDelay == StopSending && !quit)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            curDelay = delay;
+        }
+
+        if (curDelay > 0)
+            std::this_thread::sleep_for(std::chrono::microseconds(curDelay));
+
+        writer.makePacket(packet, PacketChannel::Data, timestamp(), maxWords);
+
+        const bool drop = opts.packetLossProbability > 0.0
+            && lossDist(lossRng) < opts.packetLossProbability;
+
+        if (!drop)
+            sendPacket(dataSock, dest, packet);
+
+        auto c = counters.access();
+
+        if (drop)
+            ++c->droppedPackets;
+        else
+        {
+            ++c->dataPackets;
+            c->dataBytes += packet.size() * sizeof(u32);
+        }
+    };
+
+    while (!quit)
+    {
+        // Any datagram on the data port sets the destination for readout data.
+        {
+            sockaddr_in src = {};
+            socklen_t srcLen = sizeof(src);
+
+            while (::recvfrom(dataSock, reinterpret_cast<char *>(requestBuffer.data()),
+                              requestBuffer.size(), MSG_DONTWAIT,
+                              reinterpret_cast<struct sockaddr *>(&src), &srcLen) >= 0)
+            {
+                dest = src;
+                haveDest = true;
+                srcLen = sizeof(src);
+            }
+        }
+
+        size_t maxWords = 0u;
+        size_t generated = 0u;
+        std::array<size_t, stacks::StackCount> triggers = {};
+        auto now = Clock::now();
+        auto nextWakeup = now + std::chrono::milliseconds(1);
+
+        {
+            std::unique_lock<std::mutex> guard(stateMutex);
+
+            maxWords = maxDataWords();
+            frames.clear();
+            std::swap(frames, pendingDataFrames);
+
+            const bool daqMode = readRegister(DAQModeEnableRegister) & 1u;
+
+            for (u8 stackId=0; stackId<stacks::StackCount; ++stackId)
+            {
+                const u32 triggerVal = readRegister(stacks::get_trigger_register(stackId));
+                const bool active = haveDest && daqMode
+                    && ((triggerVal >> stacks::TriggerTypeShift) & stacks::TriggerTypeMask) != stacks::NoTrigger;
+
+                if (!active)
+                {
+                    stackActive[stackId] = false;
+                    continue;
+                }
+
+                if (!stackActive[stackId])
+                {
+                    stackActive[stackId] = true;
+                    nextTrigger[stackId] = now;
+                }
+
+                if (now - nextTrigger[stackId] > MaxTriggerBacklog)
+                    nextTrigger[stackId] = now;
+
+                while (nextTrigger[stackId] <= now
+                       && writer.size() + frames.size() < maxWords * MaxPendingPackets)
+                {
+                    u8 outputPipe = DataPipe;
+                    std::vector<u32> stackFrames;
+
+                    if (!executeStack(stackId, stackFrames, outputPipe))
+                        break;
+
+                    if (outputPipe == DataPipe)
+                        frames.insert(frames.end(), stackFrames.begin(), stackFrames.end());
+
+                    ++triggers[stackId];
+                    ++generated;
+                    nextTrigger[stackId] += triggerPeriod;
+                }
+
+                nextWakeup = std::min(nextWakeup, nextTrigger[stackId]);
+            }
+        }
+
+        if (generated)
+        {
+            auto c = counters.access();
+            for (size_t i=0; i<triggers.size(); ++i)
+                c->triggers[i] += triggers[i];
+            c->stackExecutions += generated;
+        }
+
+        if (!haveDest)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            continue;
+        }
+
+        writer.addFrames(frames);
+
+        while (!quit && writer.size() >= maxWords)
+            send_data_packet(maxWords);
+
+        // Flush partially filled packets once the generator is idle.
+        if (generated == 0)
+        {
+            if (!writer.empty())
+                send_data_packet(maxWords);
+
+            std::this_thread::sleep_until(nextWakeup);
+        }
+    }
+}
+
+void Emulator::Private::delayLoop()
+{
+#ifdef __linux__
+    prctl(PR_SET_NAME, "emu_delay", 0, 0, 0);
+#endif
+
+    std::array<u32, 64> buffer;
+
+    while (!quit)
+    {
+        ssize_t res = ::recv(delaySock, reinterpret_cast<char *>(buffer.data()),
+                             buffer.size() * sizeof(u32), 0);
+
+        for (ssize_t i=0; i<res / static_cast<ssize_t>(sizeof(u32)); ++i)
+        {
+            using namespace super_commands;
+
+            if (((buffer[i] >> SuperCmdShift) & SuperCmdMask) == static_cast<u32>(SuperCommandType::EthDelay))
+            {
+                delay = buffer[i] & SuperCmdArgMask;
+                auto c = counters.access();
+                ++c->delayCommands;
+                c->currentDelay = delay;
+            }
+        }
+    }
+}
+
+Emulator::Emulator(const EmulatorOptions &options)
+    : d(std::make_unique<Private>(options))
+{
+}
+
+Emulator::~Emulator()
+{
+    stop();
+}
+
+std::error_code Emulator::start()
+{
+    if (d->running)
+        return {};
+
+    const u16 ports[] = { d->opts.commandPort,
+                          static_cast<u16>(d->opts.commandPort + 1),
+                          static_cast<u16>(d->opts.commandPort + 2) };
+    int *socks[] = { &d->cmdSock, &d->dataSock, &d->delaySock };
+
+    for (size_t i=0; i<3; ++i)
+    {
+        if (auto ec = make_udp_socket(d->opts.bindAddress, ports[i], *socks[i]))
+        {
+            spdlog::warn("emulator: could not bind {}:{}: {}", d->opts.bindAddress, ports[i], ec.message());
+            d->closeSockets();
+            return ec;
+        }
+    }
+
+    d->tStart = Clock::now();
+    d->quit = false;
+    d->running = true;
+    d->cmdThread = std::thread(&Private::cmdLoop, d.get());
+    d->dataThread = std::thread(&Private::dataLoop, d.get());
+    d->delayThread = std::thread(&Private::delayLoop, d.get());
+
+    spdlog::info("emulator listening on {}:{}", d->opts.bindAddress, d->opts.commandPort);
+
+    return {};
+}
+
+void Emulator::stop()
+{
+    if (!d->running)
+        return;
+
+    d->quit = true;
+
+    for (auto t: { &d->cmdThread, &d->dataThread, &d->delayThread })
+    {
+        if (t->joinable())
+            t->join();
+    }
+
+    d->closeSockets();
+    d->running = false;
+}
+
+bool Emulator::isRunning() const
+{
+    return d->running;
+}
+
+const EmulatorOptions &Emulator::options() const
+{
+    return d->opts;
+}
+
+EmulatorCounters Emulator::counters() const
+{
+    return d->counters.copy();
+}
+
+} // end namespace eth
+} // end namespace mvlc
+} // end namespace mesytec
@@ -0,0 +1,122 @@
+#ifndef __MESYTEC_MVLC_MVLC_ETH_EMULATOR_H__
+#define __MESYTEC_MVLC_MVLC_ETH_EMULATOR_H__
+
+#include <array>
+#include <memory>
+#include <string>
+#include <system_error>
+
+#include "mesytec-mvlc/mesytec-mvlc_export.h"
+#include "mesytec-mvlc/mvlc_constants.h"
+
+namespace mesytec
+{
+namespace mvlc
+{
+namespace eth
+{
+
+// Software emulation of the ETH side of an MVLC. Intended for load testing the
+// eth::Impl, MVLC and ReadoutWorker code paths without hardware, e.g. by
+// running an emulator on 127.0.0.1 and connecting to it using
+// make_mvlc_eth("127.0.0.1").
+//
+// Command port: super command buffers are executed and mirrored back. The
+// emulator keeps the internal registers and the stack memory. Writing the
+// Immediate bit to a trigger register executes the stack and sends the output
+// to the pipe specified in the stacks StackStart word.
+//
+// Data port: the first datagram received on the data port sets the
+// destination for readout data. While DAQ mode is enabled each stack with a
+// non-zero trigger register is executed at the configured trigger rate. The
+// output is packed into data packets the same way the MVLC does it, i.e.
+// frames may span multiple packets and the next header pointer is set for
+// each packet.
+//
+// Delay port: EthDelay commands set the delay between outgoing data packets.
+// StopSending halts the data pipe and with it the generation of new events.
+//
+// VME emulation: VME writes are stored in a sparse memory, single reads
+// return the stored value or the lower 16 bits of the address if nothing was
+// written. Block reads yield mesytec style module events (header, data words,
+// end of event with an event counter). Accesses to SelfVMEAddress are mapped
+// to the internal registers.
+
+struct MESYTEC_MVLC_EXPORT EmulatorOptions
+{
+    // Address to bind the command, data and delay sockets to. Using different
+    // loopback addresses (127.0.0.2, ...) allows running multiple emulators.
+    std::string bindAddress = "127.0.0.1";
+
+    // Data and delay ports follow the command port. Note that eth::Impl
+    // always connects to the default ports.
+    u16 commandPort = CommandPort;
+
+    // Trigger rate in Hz for each stack with an active trigger. 0 means
+    // generate events as fast as possible.
+    double triggerRate = 1000.0;
+
+    // Maximum size of data pipe packets in bytes including the two ETH header
+    // words but excluding IP and UDP headers. If 0 the size is determined by
+    // the jumbo_frame_enable register just like on the MVLC.
+    size_t maxPacketBytes = 0;
+
+    // Probability in the range [0, 1] that a data packet is dropped instead of
+    // being sent. Packet numbers are incremented for dropped packets so that
+    // the loss is visible on the receiving side.
+    double packetLossProbability = 0.0;
+
+    // Upper limit for the number of words produced by a single block read.
+    u16 blockReadMaxWords = 32;
+
+    // Values of the hardware_id and firmware_revision registers.
+    u32 hardwareId = 0x5008;
+    u32 firmwareRevision = 0x0036;
+};
+
+struct MESYTEC_MVLC_EXPORT EmulatorCounters
+{
+    size_t commandPackets;
+    size_t superCommands;
+    size_t stackExecutions;
+    std::array<size_t, stacks::StackCount> triggers;
+    size_t dataPackets;
+    size_t dataBytes;
+    size_t droppedPackets;
+    size_t delayCommands;
+    u16 currentDelay;
+};
+
+class MESYTEC_MVLC_EXPORT Emulator
+{
+    public:
+        explicit Emulator(const EmulatorOptions &options = {});
+        ~Emulator();
+
+        Emulator(const Emulator &) = delete;
+        Emulator &operator=(const Emulator &) = delete;
+
+        // Binds the sockets and starts the command, data and delay threads.
+        std::error_code start();
+        void stop();
+        bool isRunning() const;
+
+        const EmulatorOptions &options() const;
+        EmulatorCounters counters() const;
+
+    private:
+        struct Private;
+        std::unique_ptr<Private> d;
+};
+
+// Sizes of the data packets the MVLC sends with and without jumbo frames
+// enabled. These are the UDP payload sizes for the standard 1500 and 9000 byte
+// MTUs.
+static const size_t EmulatorPacketBytes = 1500 - 28;
+static const size_t EmulatorJumboPacketBytes = JumboFrameMaxSize - 28;
+
+} // end namespace eth
+} // end namespace mvlc
+} // end namespace mesytec
+
+#endif /* __MESYTEC_MVLC_MVLC_ETH_EMULATOR_H__ */
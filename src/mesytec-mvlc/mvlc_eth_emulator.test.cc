@@ -0,0 +1,1262 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <set>
+#include <thread>
+
+#ifdef __linux__
+#include <dirent.h>
+#include <sched.h>
+#endif
+
+#include "gtest/gtest.h"
+#include "mesytec-mvlc/mesytec-mvlc.h"
+#include "mesytec-mvlc/mvlc_eth_emulator.h"
+#include "mesytec-mvlc/mvlc_listfile_util.h"
+
+using namespace mesytec::mvlc;
+
+namespace
+{
+
+CrateConfig make_test_crate_config()
+{
+    CrateConfig crateConfig;
+    crateConfig.connectionType = ConnectionType::ETH;
+    crateConfig.ethHost = "127.0.0.1";
+
+    StackCommandBuilder stack("event0");
+    stack.beginGroup("module0");
+    stack.addVMEBlockRead(0x01000000, vme_amods::MBLT64, 0xffff);
+    crateConfig.stacks.push_back(stack);
+    crateConfig.triggers.push_back(trigger_value(stacks::IRQNoIACK, 1));
+
+    return crateConfig;
+}
+
+ReadoutWorker::Counters run_readout(MVLC &mvlc, const CrateConfig &crateConfig,
+                                    const std::chrono::milliseconds &duration,
+                                    listfile::WriteHandle *lfh = nullptr,
+                                    const ReadoutWorker::FlushPolicy &flushPolicy = {})
+{
+    ReadoutBufferQueues snoopQueues;
+    ReadoutWorker worker(mvlc, crateConfig.triggers, snoopQueues, lfh);
+    worker.setFlushPolicy(flushPolicy);
+
+    auto f = worker.start();
+    std::this_thread::sleep_for(duration);
+    worker.stop();
+
+    while (worker.state() != ReadoutWorker::State::Idle)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    f.get();
+
+    return worker.counters();
+}
+
+// Starts the readout of the emulator without a ReadoutWorker: enables the
+// stack triggers, tells the emulator where to send the data and enables DAQ
+// mode.
+std::error_code start_daq(MVLC &mvlc, const CrateConfig &crateConfig)
+{
+    std::array<u32, stacks::ReadoutStackCount> triggers = {};
+    std::copy_n(crateConfig.triggers.begin(), std::min(crateConfig.triggers.size(), triggers.size()),
+                triggers.begin());
+
+    if (auto ec = setup_readout_triggers(mvlc, triggers))
+        return ec;
+
+    static const std::array<u32, 2> EmptyRequest = { 0xF1000000, 0xF2000000 };
+    size_t bytesTransferred = 0;
+
+    if (auto ec = mvlc.getImpl()->write(
+            Pipe::Data, reinterpret_cast<const u8 *>(EmptyRequest.data()),
+            EmptyRequest.size() * sizeof(u32), bytesTransferred))
+    {
+        return ec;
+    }
+
+    return enable_daq_mode(mvlc);
+}
+
+// Lets the emulator queue up data packets, then receives them using a single
+// call to read_packets(). Checks that the packets are stored back-to-back
+// and intact.
+void read_queued_packets(eth::MVLC_ETH_Interface *ethImpl, size_t minPackets)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    const auto statsBefore = ethImpl->getPipeStats()[DataPipe];
+
+    ReadoutBuffer dest(util::Megabytes(1));
+    std::vector<eth::PacketReadResult> results;
+
+    ASSERT_FALSE(ethImpl->read_packets(Pipe::Data, dest, results));
+
+    const auto statsAfter = ethImpl->getPipeStats()[DataPipe];
+
+    ASSERT_GE(results.size(), minPackets);
+    ASSERT_EQ(statsAfter.receiveBatches, statsBefore.receiveBatches + 1);
+    ASSERT_EQ(statsAfter.receiveAttempts, statsBefore.receiveAttempts + results.size());
+    ASSERT_EQ(statsAfter.receivedPackets, statsBefore.receivedPackets + results.size());
+
+    const u8 *expectedBegin = dest.data();
+
+    for (const auto &prr: results)
+    {
+        ASSERT_FALSE(prr.ec) << prr.ec.message();
+        ASSERT_EQ(prr.buffer, expectedBegin);
+        ASSERT_EQ(prr.bytesTransferred, eth::HeaderBytes + prr.dataWordCount() * sizeof(u32));
+
+        // The next header pointer leads to valid stack frames.
+        StackHits stackHits = {};
+        ASSERT_TRUE(count_stack_hits(prr, stackHits));
+
+        expectedBegin += prr.bytesTransferred;
+    }
+
+    ASSERT_EQ(expectedBegin, dest.data() + dest.used());
+}
+
+} // end anon namespace
+
+#define START_EMULATOR_OR_SKIP(emu) \
+    if (auto ec = emu.start()) \
+    { \
+        std::cerr << "Could not start the emulator: " << ec.message() << std::endl; \
+        GTEST_SKIP(); \
+    }
+
+TEST(mvlc_eth_emulator, RegisterAndVMEAccess)
+{
+    eth::EmulatorOptions opts;
+    eth::Emulator emu(opts);
+    START_EMULATOR_OR_SKIP(emu);
+
+    auto mvlc = make_mvlc_eth("127.0.0.1");
+
+    ASSERT_FALSE(mvlc.connect());
+    ASSERT_EQ(mvlc.hardwareId(), opts.hardwareId);
+    ASSERT_EQ(mvlc.firmwareRevision(), opts.firmwareRevision);
+
+    u32 value = 0;
+    ASSERT_FALSE(mvlc.writeRegister(0x1304, 0x1234));
+    ASSERT_FALSE(mvlc.readRegister(0x1304, value));
+    ASSERT_EQ(value, 0x1234);
+
+    ASSERT_FALSE(mvlc.vmeWrite(0x00006070, 0xabcd, vme_amods::A32, VMEDataWidth::D16));
+    ASSERT_FALSE(mvlc.vmeRead(0x00006070, value, vme_amods::A32, VMEDataWidth::D16));
+    ASSERT_EQ(value, 0xabcd);
+
+    std::vector<u32> blockData;
+    ASSERT_FALSE(mvlc.vmeBlockRead(0x01000000, vme_amods::BLT32, 0xffff, blockData));
+    // StackFrame header, marker, BlockRead header and the module data
+    ASSERT_EQ(blockData.size(), 3u + opts.blockReadMaxWords);
+    ASSERT_EQ(get_frame_type(blockData[2]), frame_headers::BlockRead);
+
+    ASSERT_FALSE(mvlc.disconnect());
+
+    auto counters = emu.counters();
+    ASSERT_GT(counters.superCommands, 0u);
+    ASSERT_GE(counters.stackExecutions, 3u);
+}
+
+TEST(mvlc_eth_emulator, Readout)
+{
+    eth::EmulatorOptions opts;
+    opts.triggerRate = 1000.0;
+    eth::Emulator emu(opts);
+    START_EMULATOR_OR_SKIP(emu);
+
+    auto crateConfig = make_test_crate_config();
+    auto mvlc = make_mvlc(crateConfig);
+
+    ASSERT_FALSE(mvlc.connect());
+    ASSERT_FALSE(init_readout(mvlc, crateConfig).ec);
+
+    auto counters = run_readout(mvlc, crateConfig, std::chrono::milliseconds(500));
+    auto emuCounters = emu.counters();
+
+    ASSERT_FALSE(counters.ec);
+    ASSERT_GT(emuCounters.triggers[1], 0u);
+    ASSERT_EQ(counters.stackHits[1], emuCounters.triggers[1]);
+    ASSERT_EQ(counters.ethStats[DataPipe].lostPackets, 0u);
+    ASSERT_EQ(counters.bytesRead, emuCounters.dataBytes);
+}
+
+// counters() can be polled while the readout is running. The counters are
+// complete once the worker reports the Idle state.
+TEST(mvlc_eth_emulator, CountersWhileRunning)
+{
+    eth::EmulatorOptions opts;
+    opts.triggerRate = 1000.0;
+    eth::Emulator emu(opts);
+    START_EMULATOR_OR_SKIP(emu);
+
+    auto crateConfig = make_test_crate_config();
+    auto mvlc = make_mvlc(crateConfig);
+
+    ASSERT_FALSE(mvlc.connect());
+    ASSERT_FALSE(init_readout(mvlc, crateConfig).ec);
+
+    ReadoutBufferQueues snoopQueues;
+    ReadoutWorker worker(mvlc, crateConfig.triggers, snoopQueues, nullptr);
+    worker.setCountersPublishInterval(std::chrono::milliseconds(0));
+
+    std::atomic<bool> quit(false);
+    size_t polls = 0u;
+    bool monotonic = true;
+    bool histogramsConsistent = true;
+
+    std::thread reader([&] ()
+    {
+        size_t lastBytesRead = 0u;
+
+        while (!quit)
+        {
+            auto counters = worker.counters();
+            monotonic = monotonic && counters.bytesRead >= lastBytesRead;
+            lastBytesRead = counters.bytesRead;
+
+            // The eth stats are copied while the readout thread receives.
+            const auto &pipeStats = counters.ethStats[DataPipe];
+            u64 histoPackets = 0u;
+            for (const auto &kv: pipeStats.packetSizes)
+                histoPackets += kv.second;
+            histogramsConsistent = histogramsConsistent && histoPackets == pipeStats.receivedPackets;
+
+            ++polls;
+        }
+    });
+
+    auto f = worker.start();
+    ASSERT_FALSE(f.get());
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+
+    auto running = worker.counters();
+    ASSERT_EQ(running.state, ReadoutWorker::State::Running);
+    ASSERT_NE(running.tStart, decltype(running.tStart){});
+    ASSERT_EQ(running.threadPolicies.size(), 2u);
+
+    worker.stop();
+    worker.waitableState().wait(
+        [] (const ReadoutWorker::State &state) { return state == ReadoutWorker::State::Idle; });
+
+    auto counters = worker.counters();
+    quit = true;
+    reader.join();
+
+    ASSERT_TRUE(monotonic);
+    ASSERT_TRUE(histogramsConsistent);
+    ASSERT_GT(polls, 0u);
+    ASSERT_EQ(counters.state, ReadoutWorker::State::Idle);
+    ASSERT_FALSE(counters.ec);
+    ASSERT_FALSE(counters.eptr);
+    ASSERT_GE(counters.tEnd, counters.tTerminateEnd);
+    ASSERT_GE(counters.tTerminateStart, counters.tStart);
+    ASSERT_EQ(counters.threadPolicies.size(), 2u);
+    ASSERT_EQ(counters.threadPolicies[0].threadName, "readout_worker");
+    ASSERT_EQ(counters.threadPolicies[1].threadName, "readout_proc");
+    ASSERT_EQ(counters.bytesRead, emu.counters().dataBytes);
+    ASSERT_EQ(counters.stackHits[1], emu.counters().triggers[1]);
+}
+
+// read_packets() receives multiple queued packets at once. First small
+// packets at a low trigger rate, then full sized packets which are larger
+// than any packet seen before, then small packets again.
+TEST(mvlc_eth_emulator, ReadPackets)
+{
+    auto crateConfig = make_test_crate_config();
+    auto mvlc = make_mvlc(crateConfig);
+    auto ethImpl = dynamic_cast<eth::MVLC_ETH_Interface *>(mvlc.getImpl());
+    ASSERT_TRUE(ethImpl);
+
+    for (double triggerRate: { 200.0, 0.0, 200.0 })
+    {
+        eth::EmulatorOptions opts;
+        opts.triggerRate = triggerRate;
+        eth::Emulator emu(opts);
+        START_EMULATOR_OR_SKIP(emu);
+
+        ASSERT_FALSE(mvlc.connect());
+        ASSERT_FALSE(init_readout(mvlc, crateConfig).ec);
+        ASSERT_FALSE(start_daq(mvlc, crateConfig));
+
+        read_queued_packets(ethImpl, 5);
+
+        // connect() resets the stats, so the histograms count exactly the
+        // packets received above.
+        const auto pipeStats = ethImpl->getPipeStats()[DataPipe];
+        const auto channelStats = ethImpl->getPacketChannelStats()[
+            static_cast<unsigned>(eth::PacketChannel::Data)];
+        u64 histoPackets = 0u;
+
+        for (const auto &kv: pipeStats.packetSizes)
+        {
+            ASSERT_EQ(kv.first % sizeof(u32), 0u);
+            ASSERT_EQ(channelStats.packetSizes.at(kv.first), kv.second);
+            histoPackets += kv.second;
+        }
+
+        ASSERT_EQ(histoPackets, pipeStats.receivedPackets);
+        ASSERT_EQ(pipeStats.headerTypes, channelStats.headerTypes);
+        ASSERT_FALSE(pipeStats.headerTypes.empty());
+
+        ASSERT_FALSE(disable_all_triggers_and_daq_mode(mvlc));
+        ASSERT_FALSE(mvlc.disconnect());
+    }
+}
+
+// read_packets() adapts the receive slot size to the packet size: after the
+// first batch full sized packets are received in place without being moved.
+// Jumbo packets grow the slots, normal sized packets shrink them again.
+TEST(mvlc_eth_emulator, ReadPacketsInPlace)
+{
+    auto crateConfig = make_test_crate_config();
+    auto mvlc = make_mvlc(crateConfig);
+    auto ethImpl = dynamic_cast<eth::MVLC_ETH_Interface *>(mvlc.getImpl());
+    ASSERT_TRUE(ethImpl);
+
+    for (size_t packetBytes: { eth::EmulatorJumboPacketBytes, eth::EmulatorPacketBytes })
+    {
+        eth::EmulatorOptions opts;
+        opts.triggerRate = 0.0;
+        opts.maxPacketBytes = packetBytes;
+        eth::Emulator emu(opts);
+        START_EMULATOR_OR_SKIP(emu);
+
+        ASSERT_FALSE(mvlc.connect());
+        ASSERT_FALSE(init_readout(mvlc, crateConfig).ec);
+        ASSERT_FALSE(start_daq(mvlc, crateConfig));
+
+        read_queued_packets(ethImpl, 5);
+
+        const auto statsBefore = ethImpl->getPipeStats()[DataPipe];
+        read_queued_packets(ethImpl, 5);
+        const auto statsAfter = ethImpl->getPipeStats()[DataPipe];
+
+        ASSERT_EQ(statsAfter.receivedBytes - statsBefore.receivedBytes,
+                  (statsAfter.receivedPackets - statsBefore.receivedPackets) * packetBytes);
+        ASSERT_EQ(statsAfter.movedBytes, statsBefore.movedBytes);
+
+        ASSERT_FALSE(disable_all_triggers_and_daq_mode(mvlc));
+        ASSERT_FALSE(mvlc.disconnect());
+    }
+}
+
+TEST(mvlc_eth_emulator, PacketLoss)
+{
+    eth::EmulatorOptions opts;
+    opts.triggerRate = 0.0; // no limit
+    opts.packetLossProbability = 0.25;
+    eth::Emulator emu(opts);
+    START_EMULATOR_OR_SKIP(emu);
+
+    auto crateConfig = make_test_crate_config();
+    auto mvlc = make_mvlc(crateConfig);
+
+    ASSERT_FALSE(mvlc.connect());
+    ASSERT_FALSE(init_readout(mvlc, crateConfig).ec);
+
+    auto counters = run_readout(mvlc, crateConfig, std::chrono::milliseconds(200));
+    auto emuCounters = emu.counters();
+
+    ASSERT_GT(emuCounters.droppedPackets, 0u);
+    ASSERT_GT(counters.ethStats[DataPipe].lostPackets, 0u);
+}
+
+// The listfile contains the readout data and the system events written by the
+// processing side of the ReadoutWorker in order.
+TEST(mvlc_eth_emulator, ListfileContents)
+{
+    eth::EmulatorOptions opts;
+    opts.triggerRate = 1000.0;
+    eth::Emulator emu(opts);
+    START_EMULATOR_OR_SKIP(emu);
+
+    auto crateConfig = make_test_crate_config();
+    auto mvlc = make_mvlc(crateConfig);
+
+    ASSERT_FALSE(mvlc.connect());
+    ASSERT_FALSE(init_readout(mvlc, crateConfig).ec);
+
+    ReadoutBuffer listfileBuffer;
+    listfile::BufferWriteHandle lfh(listfileBuffer);
+
+    auto counters = run_readout(mvlc, crateConfig, std::chrono::milliseconds(1500), &lfh);
+    auto emuCounters = emu.counters();
+
+    ASSERT_FALSE(counters.ec);
+    ASSERT_FALSE(counters.eptr);
+    ASSERT_GT(emuCounters.triggers[1], 0u);
+
+    auto parserState = readout_parser::make_readout_parser(crateConfig.stacks);
+    readout_parser::ReadoutParserCallbacks callbacks;
+    readout_parser::ReadoutParserCounters parserCounters = {};
+    std::vector<u8> systemEvents;
+
+    callbacks.systemEvent = [&systemEvents] (const u32 *header, u32)
+    {
+        systemEvents.push_back(system_event::extract_subtype(*header));
+    };
+
+    auto view = listfileBuffer.viewU32();
+    readout_parser::parse_readout_buffer_eth(
+        parserState, callbacks, parserCounters, 1, view.data(), view.size());
+
+    ASSERT_EQ(parserCounters.eventHits[0], emuCounters.triggers[1]);
+    ASSERT_GE(systemEvents.size(), 4u);
+    ASSERT_EQ(systemEvents.front(), system_event::subtype::BeginRun);
+    ASSERT_EQ(systemEvents[systemEvents.size() - 2], system_event::subtype::EndRun);
+    ASSERT_EQ(systemEvents.back(), system_event::subtype::EndOfFile);
+    ASSERT_NE(std::find(systemEvents.begin(), systemEvents.end(), system_event::subtype::UnixTimetick),
+              systemEvents.end());
+}
+
+// Listfile write handle recording the memory and a checksum of each buffer
+// handed to it by the listfile writer. Writes block until released is set.
+class RecordingWriteHandle: public listfile::WriteHandle
+{
+    public:
+        struct Write
+        {
+            const u8 *data;
+            size_t checksum;
+        };
+
+        size_t write(const u8 *data, size_t size) override
+        {
+            while (!released)
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+            writes.push_back({ data, checksum(data, size) });
+            // A slow disk. Makes the snoop consumer return shared buffers
+            // before the writer does.
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+            return size;
+        }
+
+        static size_t checksum(const u8 *data, size_t size)
+        {
+            return std::hash<std::string>()(std::string(reinterpret_cast<const char *>(data), size));
+        }
+
+        std::vector<Write> writes;
+        std::atomic<bool> released{true};
+};
+
+// Buffers taken from the snoop queues are handed to the listfile writer
+// without copying them. Both sides see the same memory and the buffer is not
+// reused while either side still holds it. The writer is held at the start
+// of the run until the readout had to skip a snoop buffer still queued to
+// the writer.
+TEST(mvlc_eth_emulator, SharedSnoopBuffers)
+{
+    eth::EmulatorOptions opts;
+    opts.triggerRate = 0.0; // no limit
+    eth::Emulator emu(opts);
+    START_EMULATOR_OR_SKIP(emu);
+
+    auto crateConfig = make_test_crate_config();
+    auto mvlc = make_mvlc(crateConfig);
+
+    ASSERT_FALSE(mvlc.connect());
+    ASSERT_FALSE(init_readout(mvlc, crateConfig).ec);
+
+    ReadoutWorker::FlushPolicy flushPolicy;
+    flushPolicy.minFill = util::Kilobytes(64);
+    flushPolicy.maxFill = util::Kilobytes(64);
+
+    RecordingWriteHandle lfh;
+    ReadoutBufferQueues snoopQueues(util::Megabytes(1), 4);
+    ReadoutWorker worker(mvlc, crateConfig.triggers, snoopQueues, &lfh);
+    worker.setFlushPolicy(flushPolicy);
+
+    // Snoop consumer: checks that the contents of each buffer do not change
+    // while it holds the buffer.
+    std::vector<RecordingWriteHandle::Write> snooped;
+    std::atomic<bool> quit(false);
+    std::atomic<size_t> modifiedWhileHeld(0u);
+
+    std::thread snoopConsumer([&] ()
+    {
+        auto &filled = snoopQueues.filledBufferQueue();
+        auto &empty = snoopQueues.emptyBufferQueue();
+
+        while (!quit || !filled.empty())
+        {
+            auto buffer = filled.dequeue(std::chrono::milliseconds(10));
+
+            if (!buffer)
+                continue;
+
+            auto view = buffer->viewU8();
+            const auto checksum = RecordingWriteHandle::checksum(view.data(), view.size());
+            snooped.push_back({ view.data(), checksum });
+
+            if (snooped.size() % 2)
+                std::this_thread::sleep_for(std::chrono::milliseconds(3));
+
+            if (RecordingWriteHandle::checksum(view.data(), view.size()) != checksum)
+                ++modifiedWhileHeld;
+
+            empty.enqueue(buffer);
+        }
+    });
+
+    lfh.released = false;
+    auto f = worker.start();
+
+    // Once the snoop consumer has returned the buffers the readout takes them
+    // from the snoop empty queue while the writer still holds them.
+    const auto skipDeadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+
+    while (worker.counters().listfileSharedBufferSkips == 0
+           && std::chrono::steady_clock::now() < skipDeadline)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    lfh.released = true;
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    worker.stop();
+
+    while (worker.state() != ReadoutWorker::State::Idle)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    quit = true;
+    snoopConsumer.join();
+
+    ASSERT_FALSE(f.get());
+
+    auto counters = worker.counters();
+
+    ASSERT_FALSE(counters.eptr);
+    ASSERT_GT(counters.listfileSharedBuffers, 0u);
+    ASSERT_GT(counters.listfileSharedBufferSkips, 0u);
+    ASSERT_EQ(snooped.size(), counters.listfileSharedBuffers);
+    ASSERT_EQ(lfh.writes.size(), counters.buffersFlushed);
+    ASSERT_EQ(modifiedWhileHeld, 0u);
+
+    // Each snooped buffer was written from the same memory with the same
+    // contents.
+    size_t wi = 0;
+
+    for (const auto &s: snooped)
+    {
+        while (wi < lfh.writes.size()
+               && (lfh.writes[wi].data != s.data || lfh.writes[wi].checksum != s.checksum))
+        {
+            ++wi;
+        }
+
+        ASSERT_LT(wi, lfh.writes.size());
+        ++wi;
+    }
+}
+
+// Readout data is received directly into the buffers handed to the listfile
+// writer and the snoop queue. ETH data is never copied and each received
+// buffer is flushed as is.
+TEST(mvlc_eth_emulator, ZeroCopyReceive)
+{
+    eth::EmulatorOptions opts;
+    opts.triggerRate = 0.0; // no limit
+    eth::Emulator emu(opts);
+    START_EMULATOR_OR_SKIP(emu);
+
+    auto crateConfig = make_test_crate_config();
+    auto mvlc = make_mvlc(crateConfig);
+
+    ASSERT_FALSE(mvlc.connect());
+    ASSERT_FALSE(init_readout(mvlc, crateConfig).ec);
+
+    ReadoutWorker::FlushPolicy flushPolicy;
+    flushPolicy.maxFill = util::Kilobytes(256);
+
+    RecordingWriteHandle lfh;
+    ReadoutBufferQueues snoopQueues(util::Megabytes(1), 4);
+    std::set<const u8 *> snoopMemory;
+
+    {
+        std::vector<ReadoutBuffer *> buffers;
+        while (auto buffer = snoopQueues.emptyBufferQueue().dequeue())
+            buffers.push_back(buffer);
+        for (auto buffer: buffers)
+        {
+            snoopMemory.insert(buffer->data());
+            snoopQueues.emptyBufferQueue().enqueue(buffer);
+        }
+    }
+
+    ReadoutWorker worker(mvlc, crateConfig.triggers, snoopQueues, &lfh);
+    worker.setFlushPolicy(flushPolicy);
+
+    std::vector<const u8 *> snooped;
+    std::atomic<bool> quit(false);
+
+    std::thread snoopConsumer([&] ()
+    {
+        auto &filled = snoopQueues.filledBufferQueue();
+
+        while (!quit || !filled.empty())
+        {
+            if (auto buffer = filled.dequeue(std::chrono::milliseconds(10)))
+            {
+                snooped.push_back(buffer->data());
+                snoopQueues.emptyBufferQueue().enqueue(buffer);
+            }
+        }
+    });
+
+    auto f = worker.start();
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    worker.stop();
+
+    while (worker.state() != ReadoutWorker::State::Idle)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    quit = true;
+    snoopConsumer.join();
+
+    ASSERT_FALSE(f.get());
+
+    auto counters = worker.counters();
+
+    ASSERT_FALSE(counters.eptr);
+    ASSERT_GT(counters.buffersRead, 0u);
+    ASSERT_EQ(counters.bytesRead, emu.counters().dataBytes);
+    ASSERT_EQ(counters.bytesCopied, 0u);
+    ASSERT_EQ(counters.flushesBufferFull + counters.flushesLatency, counters.buffersRead);
+    ASSERT_EQ(counters.buffersFlushed, counters.buffersRead + counters.flushesSystemEvent);
+    ASSERT_EQ(lfh.writes.size(), counters.buffersFlushed);
+
+    // The snoop consumer got the memory of its own queue back, the same
+    // memory the listfile writer wrote from.
+    ASSERT_FALSE(snooped.empty());
+
+    for (auto data: snooped)
+    {
+        ASSERT_TRUE(snoopMemory.count(data));
+        ASSERT_TRUE(std::any_of(lfh.writes.begin(), lfh.writes.end(),
+                                [data] (const RecordingWriteHandle::Write &w) { return w.data == data; }));
+    }
+}
+
+// A short latency target makes the worker flush small buffers at low data
+// rates instead of waiting for a full buffer.
+TEST(mvlc_eth_emulator, FlushPolicyLatency)
+{
+    eth::EmulatorOptions opts;
+    opts.triggerRate = 500.0;
+    eth::Emulator emu(opts);
+    START_EMULATOR_OR_SKIP(emu);
+
+    auto crateConfig = make_test_crate_config();
+    auto mvlc = make_mvlc(crateConfig);
+
+    ASSERT_FALSE(mvlc.connect());
+    ASSERT_FALSE(init_readout(mvlc, crateConfig).ec);
+
+    auto defaultCounters = run_readout(mvlc, crateConfig, std::chrono::milliseconds(1000));
+
+    ReadoutWorker::FlushPolicy policy;
+    policy.latencyTarget = std::chrono::milliseconds(5);
+    policy.minFill = util::Kilobytes(64);
+    policy.adaptiveSizing = true;
+
+    auto counters = run_readout(mvlc, crateConfig, std::chrono::milliseconds(1000), nullptr, policy);
+
+    ASSERT_FALSE(counters.ec);
+    ASSERT_GT(counters.stackHits[1], 0u);
+    ASSERT_GT(counters.flushesLatency, 50u);
+    ASSERT_EQ(counters.flushSize, policy.minFill);
+    ASSERT_GT(counters.buffersFlushed, 4 * defaultCounters.buffersFlushed);
+    ASSERT_GT(defaultCounters.flushesSystemEvent, 0u);
+}
+
+// At low trigger rates the data of each event is flushed within the latency
+// target instead of waiting for the socket read timeout or further packets.
+TEST(mvlc_eth_emulator, FlushLatencyLowRate)
+{
+    using Clock = std::chrono::steady_clock;
+
+    eth::EmulatorOptions opts;
+    opts.triggerRate = 2.0;
+    eth::Emulator emu(opts);
+    START_EMULATOR_OR_SKIP(emu);
+
+    auto crateConfig = make_test_crate_config();
+    auto mvlc = make_mvlc(crateConfig);
+
+    ASSERT_FALSE(mvlc.connect());
+    ASSERT_FALSE(init_readout(mvlc, crateConfig).ec);
+
+    ReadoutWorker::FlushPolicy policy;
+    policy.latencyTarget = std::chrono::milliseconds(100);
+
+    ReadoutBufferQueues snoopQueues;
+    ReadoutWorker worker(mvlc, crateConfig.triggers, snoopQueues, nullptr);
+    worker.setFlushPolicy(policy);
+
+    // Times the emulator sent data packets and the times buffers of readout
+    // data arrived on the snoop queue.
+    std::vector<Clock::time_point> sendTimes;
+    std::vector<Clock::time_point> flushTimes;
+    std::atomic<bool> quit(false);
+
+    std::thread packetWatcher([&] ()
+    {
+        size_t packets = emu.counters().dataPackets;
+
+        while (!quit)
+        {
+            auto now = emu.counters().dataPackets;
+            if (now != packets)
+                sendTimes.push_back(Clock::now());
+            packets = now;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    });
+
+    std::thread snoopConsumer([&] ()
+    {
+        auto &filled = snoopQueues.filledBufferQueue();
+
+        while (!quit || !filled.empty())
+        {
+            if (auto buffer = filled.dequeue(std::chrono::milliseconds(1)))
+            {
+                auto view = buffer->viewU32();
+
+                if (!view.empty() && get_frame_type(view[0]) != frame_headers::SystemEvent)
+                    flushTimes.push_back(Clock::now());
+
+                snoopQueues.emptyBufferQueue().enqueue(buffer);
+            }
+        }
+    });
+
+    auto f = worker.start();
+    std::this_thread::sleep_for(std::chrono::milliseconds(2500));
+    // Skip the data produced by the DAQ stop sequence.
+    const auto tQuit = Clock::now();
+    quit = true;
+    packetWatcher.join();
+    snoopConsumer.join();
+    worker.stop();
+
+    while (worker.state() != ReadoutWorker::State::Idle)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    ASSERT_FALSE(f.get());
+    ASSERT_GE(sendTimes.size(), 3u);
+
+    for (auto tSend: sendTimes)
+    {
+        // Data sent right before stopping the consumer may not have arrived.
+        if (tQuit - tSend < policy.latencyTarget)
+            continue;
+
+        auto it = std::lower_bound(flushTimes.begin(), flushTimes.end(), tSend);
+
+        ASSERT_NE(it, flushTimes.end());
+        ASSERT_LT(*it - tSend, policy.latencyTarget);
+    }
+}
+
+// With adaptive sizing the flush size follows the data rate.
+TEST(mvlc_eth_emulator, FlushPolicyAdaptiveSize)
+{
+    eth::EmulatorOptions opts;
+    opts.triggerRate = 0.0; // no limit
+    eth::Emulator emu(opts);
+    START_EMULATOR_OR_SKIP(emu);
+
+    auto crateConfig = make_test_crate_config();
+    auto mvlc = make_mvlc(crateConfig);
+
+    ASSERT_FALSE(mvlc.connect());
+    ASSERT_FALSE(init_readout(mvlc, crateConfig).ec);
+
+    ReadoutWorker::FlushPolicy policy;
+    policy.latencyTarget = std::chrono::milliseconds(10);
+    policy.minFill = util::Kilobytes(4);
+    policy.adaptiveSizing = true;
+
+    // The rate drops during the DAQ stop sequence, so look at the counters
+    // while the readout is running.
+    ReadoutBufferQueues snoopQueues;
+    ReadoutWorker worker(mvlc, crateConfig.triggers, snoopQueues, nullptr);
+    worker.setFlushPolicy(policy);
+
+    auto f = worker.start();
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    auto counters = worker.counters();
+    worker.stop();
+
+    while (worker.state() != ReadoutWorker::State::Idle)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    ASSERT_FALSE(f.get());
+    ASSERT_EQ(counters.state, ReadoutWorker::State::Running);
+    ASSERT_GT(counters.dataRate, 0.0);
+    ASSERT_GT(counters.flushSize, policy.minFill);
+    ASSERT_LE(counters.flushSize, policy.maxFill);
+    ASSERT_GT(counters.flushesBufferFull, 0u);
+}
+
+// Readout with the listfile buffers carved from a contiguous region.
+TEST(mvlc_eth_emulator, ListfileBufferAllocation)
+{
+    eth::EmulatorOptions opts;
+    opts.triggerRate = 1000.0;
+    eth::Emulator emu(opts);
+    START_EMULATOR_OR_SKIP(emu);
+
+    auto crateConfig = make_test_crate_config();
+    auto mvlc = make_mvlc(crateConfig);
+
+    ASSERT_FALSE(mvlc.connect());
+    ASSERT_FALSE(init_readout(mvlc, crateConfig).ec);
+
+    ReadoutBuffer listfileBuffer;
+    listfile::BufferWriteHandle lfh(listfileBuffer);
+    ReadoutBufferQueues snoopQueues;
+    ReadoutWorker worker(mvlc, crateConfig.triggers, snoopQueues, &lfh);
+
+    BufferAllocation allocation;
+    allocation.mode = BufferAllocation::Mode::Contiguous;
+    allocation.hugePages = BufferAllocation::HugePages::Transparent;
+
+    ASSERT_FALSE(worker.setListfileBufferAllocation(allocation));
+    ASSERT_EQ(worker.listfileBufferAllocation().mode, BufferAllocation::Mode::Contiguous);
+    ASSERT_GT(worker.listfileBufferAllocation().regionSize, 0u);
+
+    auto f = worker.start();
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    ASSERT_EQ(worker.setListfileBufferAllocation({}),
+              make_error_code(ReadoutWorkerError::ReadoutNotIdle));
+    worker.stop();
+
+    while (worker.state() != ReadoutWorker::State::Idle)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    ASSERT_FALSE(f.get());
+
+    auto emuCounters = emu.counters();
+    auto parserState = readout_parser::make_readout_parser(crateConfig.stacks);
+    readout_parser::ReadoutParserCallbacks callbacks;
+    readout_parser::ReadoutParserCounters parserCounters = {};
+
+    auto view = listfileBuffer.viewU32();
+    readout_parser::parse_readout_buffer_eth(
+        parserState, callbacks, parserCounters, 1, view.data(), view.size());
+
+    ASSERT_GT(emuCounters.triggers[1], 0u);
+    ASSERT_EQ(parserCounters.eventHits[0], emuCounters.triggers[1]);
+}
+
+// Listfile write handle which blocks until released, simulating a stalled
+// disk.
+// Readout data is received in place into the listfile buffers. None of the
+// buffers outgrows the contiguous region and gets moved to the heap.
+TEST(mvlc_eth_emulator, ListfileBuffersStayInRegion)
+{
+    eth::EmulatorOptions opts;
+    opts.triggerRate = 0.0; // no limit
+    eth::Emulator emu(opts);
+    START_EMULATOR_OR_SKIP(emu);
+
+    auto crateConfig = make_test_crate_config();
+    auto mvlc = make_mvlc(crateConfig);
+
+    ASSERT_FALSE(mvlc.connect());
+    ASSERT_FALSE(init_readout(mvlc, crateConfig).ec);
+
+    // Hold on to the snoop buffers so that all data goes through the
+    // listfile buffers.
+    RecordingWriteHandle lfh;
+    ReadoutBufferQueues snoopQueues(util::Megabytes(1), 4);
+    std::vector<ReadoutBuffer *> snoopBuffers;
+
+    while (auto buffer = snoopQueues.emptyBufferQueue().dequeue())
+        snoopBuffers.push_back(buffer);
+
+    ReadoutWorker worker(mvlc, crateConfig.triggers, snoopQueues, &lfh);
+
+    BufferAllocation allocation;
+    allocation.mode = BufferAllocation::Mode::Contiguous;
+    ASSERT_FALSE(worker.setListfileBufferAllocation(allocation));
+    const auto info = worker.listfileBufferAllocation();
+
+    auto f = worker.start();
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    worker.stop();
+
+    while (worker.state() != ReadoutWorker::State::Idle)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    ASSERT_FALSE(f.get());
+
+    auto counters = worker.counters();
+
+    ASSERT_GT(counters.buffersRead, 0u);
+    ASSERT_EQ(counters.outputBufferDetaches, 0u);
+    ASSERT_EQ(lfh.writes.size(), counters.buffersFlushed);
+
+    auto minmax = std::minmax_element(
+        lfh.writes.begin(), lfh.writes.end(),
+        [] (const RecordingWriteHandle::Write &a, const RecordingWriteHandle::Write &b)
+        { return a.data < b.data; });
+
+    ASSERT_LT(static_cast<size_t>(minmax.second->data - minmax.first->data), info.regionSize);
+
+    for (auto buffer: snoopBuffers)
+        snoopQueues.emptyBufferQueue().enqueue(buffer);
+}
+
+// Sums up the bytes of the ETH packets in a sequence of readout buffers,
+// skipping system event frames, e.g. timeticks appended to the packets.
+size_t eth_packet_bytes(const u8 *data, size_t size)
+{
+    auto words = reinterpret_cast<const u32 *>(data);
+    const size_t wordCount = size / sizeof(u32);
+    size_t result = 0u;
+
+    for (size_t i=0; i<wordCount;)
+    {
+        size_t len = 0u;
+
+        if (get_frame_type(words[i]) == frame_headers::SystemEvent)
+            len = 1 + extract_frame_info(words[i]).len;
+        else
+        {
+            len = eth::HeaderWords
+                + ((words[i] >> eth::header0::NumDataWordsShift) & eth::header0::NumDataWordsMask);
+            result += std::min(len, wordCount - i) * sizeof(u32);
+        }
+
+        i += len;
+    }
+
+    return result;
+}
+
+class StallingWriteHandle: public listfile::WriteHandle
+{
+    public:
+        size_t write(const u8 *data, size_t size) override
+        {
+            while (!released)
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+            bytesWritten += size;
+            packetBytesWritten += eth_packet_bytes(data, size);
+            return size;
+        }
+
+        std::atomic<bool> released{false};
+        std::atomic<size_t> bytesWritten{0u};
+        std::atomic<size_t> packetBytesWritten{0u};
+};
+
+// Runs a readout with small output buffers and a listfile writer stalling for
+// the first half of the run. If stalledAllocation is set it receives the
+// listfile buffer allocation info at the end of the stall.
+ReadoutWorker::Counters run_stalled_readout(const ReadoutWorker::ListfileBufferPolicy &bufferPolicy,
+                                            StallingWriteHandle &lfh,
+                                            const BufferAllocation &allocation = {},
+                                            BufferAllocationInfo *stalledAllocation = nullptr)
+{
+    eth::EmulatorOptions opts;
+    opts.triggerRate = 0.0; // no limit
+    eth::Emulator emu(opts);
+
+    if (emu.start())
+        return {};
+
+    auto crateConfig = make_test_crate_config();
+    auto mvlc = make_mvlc(crateConfig);
+
+    if (mvlc.connect() || init_readout(mvlc, crateConfig).ec)
+        return {};
+
+    ReadoutWorker::FlushPolicy flushPolicy;
+    flushPolicy.minFill = util::Kilobytes(64);
+    flushPolicy.maxFill = util::Kilobytes(64);
+    flushPolicy.latencyTarget = std::chrono::milliseconds(10);
+
+    ReadoutBufferQueues snoopQueues;
+    ReadoutWorker worker(mvlc, crateConfig.triggers, snoopQueues, &lfh);
+    worker.setFlushPolicy(flushPolicy);
+
+    if (worker.setListfileBufferPolicy(bufferPolicy) || worker.setListfileBufferAllocation(allocation))
+        return {};
+
+    auto f = worker.start();
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    if (stalledAllocation)
+        *stalledAllocation = worker.listfileBufferAllocation();
+    lfh.released = true;
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    worker.stop();
+
+    while (worker.state() != ReadoutWorker::State::Idle)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    f.get();
+
+    return worker.counters();
+}
+
+// The listfile buffer pool grows while the writer stalls, then drops data
+// once the memory limit is reached.
+TEST(mvlc_eth_emulator, ListfileBufferPolicyDrop)
+{
+    ReadoutWorker::ListfileBufferPolicy policy;
+    policy.memoryLimit = util::Megabytes(16);
+    policy.overflow = ReadoutWorker::ListfileBufferPolicy::Overflow::Drop;
+
+    StallingWriteHandle lfh;
+    auto counters = run_stalled_readout(policy, lfh);
+
+    if (!counters.buffersRead)
+        GTEST_SKIP();
+
+    ASSERT_FALSE(counters.ec);
+    ASSERT_FALSE(counters.eptr);
+    ASSERT_EQ(counters.listfileBuffersHighWater, 16u);
+    ASSERT_EQ(counters.listfileMemoryHighWater, util::Megabytes(16));
+    ASSERT_GE(counters.listfileQueuedHighWater, 15u);
+    ASSERT_EQ(counters.listfileBuffersAllocated, 10u);
+    ASSERT_GT(counters.listfileDroppedBuffers, 0u);
+    ASSERT_GT(counters.listfileDroppedBytes, 0u);
+    ASSERT_EQ(counters.listfileSpilledBuffers, 0u);
+    ASSERT_EQ(counters.listfileBufferWaits, 0u);
+    ASSERT_GT(lfh.bytesWritten, 0u);
+
+    // Each byte read ends up either in the listfile or in a dropped buffer.
+    // The dropped bytes also include the timeticks appended to the dropped
+    // buffers, at most one per second.
+    const size_t droppedPacketBytes = counters.bytesRead - lfh.packetBytesWritten;
+    ASSERT_GE(counters.listfileDroppedBytes, droppedPacketBytes);
+    ASSERT_LE(counters.listfileDroppedBytes - droppedPacketBytes, 256u);
+}
+
+// Growing the pool honors the buffer allocation. The extra buffers count
+// towards the memory limit and show up in the allocation info.
+TEST(mvlc_eth_emulator, ListfileBufferPolicyGrowContiguous)
+{
+    ReadoutWorker::ListfileBufferPolicy policy;
+    policy.memoryLimit = util::Megabytes(16);
+    policy.overflow = ReadoutWorker::ListfileBufferPolicy::Overflow::Drop;
+
+    BufferAllocation allocation;
+    allocation.mode = BufferAllocation::Mode::Contiguous;
+
+    StallingWriteHandle lfh;
+    BufferAllocationInfo stalledAllocation;
+    auto counters = run_stalled_readout(policy, lfh, allocation, &stalledAllocation);
+
+    if (!counters.buffersRead)
+        GTEST_SKIP();
+
+    ASSERT_FALSE(counters.ec);
+    ASSERT_EQ(stalledAllocation.mode, BufferAllocation::Mode::Contiguous);
+    ASSERT_EQ(counters.listfileBuffersHighWater, 16u);
+    ASSERT_EQ(counters.listfileMemoryHighWater, util::Megabytes(16));
+    ASSERT_EQ(stalledAllocation.regionSize, counters.listfileMemoryHighWater);
+    ASSERT_GT(counters.listfileDroppedBuffers, 0u);
+}
+
+TEST(mvlc_eth_emulator, ListfileBufferPolicySpill)
+{
+    ReadoutWorker::ListfileBufferPolicy policy;
+    policy.overflow = ReadoutWorker::ListfileBufferPolicy::Overflow::Spill;
+    policy.spillDirectory = ".";
+
+    StallingWriteHandle lfh;
+    auto counters = run_stalled_readout(policy, lfh);
+
+    if (!counters.buffersRead)
+        GTEST_SKIP();
+
+    ASSERT_FALSE(counters.ec);
+    ASSERT_EQ(counters.listfileBuffersHighWater, 10u);
+    ASSERT_GT(counters.listfileSpilledBuffers, 0u);
+    ASSERT_EQ(counters.listfileDroppedBuffers, 0u);
+    ASSERT_EQ(counters.listfileBufferWaits, 0u);
+    ASSERT_FALSE(counters.listfileSpillFilename.empty());
+
+    // The spill file is a listfile containing the spilled buffers.
+    std::ifstream spill(counters.listfileSpillFilename, std::ios::binary | std::ios::ate);
+    ASSERT_TRUE(spill.is_open());
+    ASSERT_EQ(static_cast<size_t>(spill.tellg()),
+              listfile::get_filemagic_len() + counters.listfileSpilledBytes);
+    spill.seekg(0);
+    std::string magic(listfile::get_filemagic_len(), '\0');
+    spill.read(&magic[0], magic.size());
+    ASSERT_EQ(magic, "MVLC_ETH");
+
+    // Each byte read ends up either in the listfile or in the spill file.
+    std::vector<u8> spilled(counters.listfileSpilledBytes);
+    spill.read(reinterpret_cast<char *>(spilled.data()), spilled.size());
+    ASSERT_EQ(static_cast<size_t>(spill.gcount()), spilled.size());
+    spill.close();
+
+    ASSERT_EQ(lfh.packetBytesWritten + eth_packet_bytes(spilled.data(), spilled.size()),
+              counters.bytesRead);
+
+    std::remove(counters.listfileSpillFilename.c_str());
+}
+
+// The default policy waits for the writer.
+TEST(mvlc_eth_emulator, ListfileBufferPolicyBlock)
+{
+    StallingWriteHandle lfh;
+    auto counters = run_stalled_readout({}, lfh);
+
+    if (!counters.buffersRead)
+        GTEST_SKIP();
+
+    ASSERT_FALSE(counters.ec);
+    ASSERT_EQ(counters.listfileBuffersHighWater, 10u);
+    ASSERT_GT(counters.listfileBufferWaits, 0u);
+    ASSERT_EQ(counters.listfileDroppedBuffers, 0u);
+    ASSERT_EQ(counters.listfileSpilledBuffers, 0u);
+}
+
+#ifdef __linux__
+namespace
+{
+
+// Returns the CPU affinity of the threads of this process by thread name as
+// reported by the kernel.
+std::map<std::string, std::vector<unsigned>> thread_affinities()
+{
+    std::map<std::string, std::vector<unsigned>> result;
+
+    auto dir = opendir("/proc/self/task");
+
+    if (!dir)
+        return result;
+
+    while (auto entry = readdir(dir))
+    {
+        if (entry->d_name[0] == '.')
+            continue;
+
+        std::ifstream commFile(std::string("/proc/self/task/") + entry->d_name + "/comm");
+        std::string name;
+        cpu_set_t cpuSet;
+        CPU_ZERO(&cpuSet);
+
+        if (!std::getline(commFile, name)
+            || sched_getaffinity(std::stoi(entry->d_name), sizeof(cpuSet), &cpuSet) != 0)
+            continue;
+
+        auto &cpus = result[name];
+        cpus.clear();
+
+        for (unsigned cpu=0; cpu<CPU_SETSIZE; ++cpu)
+        {
+            if (CPU_ISSET(cpu, &cpuSet))
+                cpus.push_back(cpu);
+        }
+    }
+
+    closedir(dir);
+
+    return result;
+}
+
+} // end anon namespace
+
+// The thread policies are applied to the library threads. Their effective
+// settings end up in the counters.
+TEST(mvlc_eth_emulator, ThreadPolicies)
+{
+    eth::EmulatorOptions opts;
+    opts.triggerRate = 1000.0;
+    eth::Emulator emu(opts);
+    START_EMULATOR_OR_SKIP(emu);
+
+    const std::vector<std::string> threadNames =
+    {
+        "readout_worker", "readout_proc", "listfile_writer", "eth_throttler", "cmd_pipe_reader"
+    };
+
+    // Pin all threads to the last CPU the process may run on.
+    cpu_set_t cpuSet;
+    CPU_ZERO(&cpuSet);
+    ASSERT_EQ(sched_getaffinity(0, sizeof(cpuSet), &cpuSet), 0);
+
+    ThreadPolicy policy;
+    for (unsigned cpu=CPU_SETSIZE; cpu>0 && policy.cpus.empty(); --cpu)
+    {
+        if (CPU_ISSET(cpu - 1, &cpuSet))
+            policy.cpus.push_back(cpu - 1);
+    }
+
+    for (const auto &name: threadNames)
+        set_thread_policy(name, policy);
+
+    auto crateConfig = make_test_crate_config();
+    auto mvlc = make_mvlc(crateConfig);
+
+    ASSERT_FALSE(mvlc.connect());
+    ASSERT_FALSE(init_readout(mvlc, crateConfig).ec);
+
+    ReadoutBuffer listfileBuffer;
+    listfile::BufferWriteHandle lfh(listfileBuffer);
+
+    ReadoutBufferQueues snoopQueues;
+    ReadoutWorker worker(mvlc, crateConfig.triggers, snoopQueues, &lfh);
+
+    auto f = worker.start();
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    auto affinities = thread_affinities();
+    worker.stop();
+
+    while (worker.state() != ReadoutWorker::State::Idle)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    ASSERT_FALSE(f.get());
+
+    auto counters = worker.counters();
+    auto throttleCounters = dynamic_cast<eth::MVLC_ETH_Interface *>(mvlc.getImpl())->getThrottleCounters();
+    auto cmdPipeCounters = mvlc.getCmdPipeCounters();
+
+    ASSERT_FALSE(mvlc.disconnect());
+    clear_thread_policies();
+
+    ASSERT_FALSE(counters.ec);
+    ASSERT_EQ(counters.threadPolicies.size(), 2u);
+
+    std::vector<ThreadPolicyResult> results = counters.threadPolicies;
+    results.push_back(counters.listfileWriterCounters.threadPolicy);
+    results.push_back(throttleCounters.threadPolicy);
+    results.push_back(cmdPipeCounters.threadPolicy);
+
+    for (const auto &name: threadNames)
+    {
+        auto it = std::find_if(results.begin(), results.end(),
+                               [&name] (const ThreadPolicyResult &r) { return r.threadName == name; });
+        ASSERT_NE(it, results.end()) << name;
+        ASSERT_TRUE(it->policyApplied) << name;
+        ASSERT_FALSE(it->ec) << name;
+        ASSERT_EQ(it->cpus, policy.cpus) << name;
+
+        // Check with the kernel that the affinity was applied to the thread
+        // running under the name.
+        auto affinity = affinities.find(name.substr(0, 15));
+        ASSERT_NE(affinity, affinities.end()) << name;
+        ASSERT_EQ(affinity->second, policy.cpus) << name;
+    }
+}
+#endif // __linux__
@@ -28,11 +28,15 @@
 #ifndef __MESYTEC_MVLC_MVLC_ETH_INTERFACE_H__
 #define __MESYTEC_MVLC_MVLC_ETH_INTERFACE_H__
 
+#include <chrono>
 #include <system_error>
+#include <vector>
 
 #include "mesytec-mvlc/mesytec-mvlc_export.h"
+#include "mesytec-mvlc/readout_buffer.h"
 #include "mvlc_constants.h"
 #include "mvlc_counters.h"
+#include "mvlc_thread_policy.h"
 
 namespace mesytec
 {
@@ -162,6 +166,8 @@ struct EthThrottleCounters
     u16 currentDelay = 0u;
     u16 maxDelay = 0u;
     float avgDelay = 0u;
+    // Effective thread policy of the throttler thread.
+    ThreadPolicyResult threadPolicy;
 };
 
 class MVLC_ETH_Interface
@@ -170,6 +176,54 @@ class MVLC_ETH_Interface
         virtual ~MVLC_ETH_Interface() {}
 
         virtual PacketReadResult read_packet(Pipe pipe, u8 *buffer, size_t size) = 0;
+
+        // Batched version of read_packet(): receives as many packets as fit
+        // into the free space of the destination buffer, using as few system
+        // calls as possible. Blocks until at least one packet is available or
+        // the read timeout expires. If maxWait is shorter than the read
+        // timeout the call returns with a SocketReadTimeout error after
+        // maxWait. A maxWait of zero only picks up already queued packets.
+        //
+        // The packets are appended back-to-back to dest and dest.used() is
+        // updated accordingly. Residual bytes at the end of packets are
+        // dropped. A PacketReadResult is added to 'results' for each received
+        // packet, its buffer pointer pointing into dest. The returned error
+        // code is set if receiving failed, per packet errors are stored in
+        // the individual results.
+        //
+        // The default implementation reads a single packet via read_packet()
+        // and ignores maxWait.
+        virtual std::error_code read_packets(
+            Pipe pipe, ReadoutBuffer &dest, std::vector<PacketReadResult> &results,
+            std::chrono::milliseconds maxWait)
+        {
+            (void) maxWait;
+
+            results.clear();
+
+            if (dest.free() < JumboFrameMaxSize)
+                return {};
+
+            auto res = read_packet(pipe, dest.data() + dest.used(), dest.free());
+
+            if (res.bytesTransferred == 0)
+                return res.ec;
+
+            res.bytesTransferred -= res.leftoverBytes();
+            dest.use(res.bytesTransferred);
+            results.emplace_back(res);
+            return {};
+        }
+
+        // Waits up to the read timeout for the first packet.
+        std::error_code read_packets(
+            Pipe pipe, ReadoutBuffer &dest, std::vector<PacketReadResult> &results)
+        {
+            return read_packets(pipe, dest, results, std::chrono::milliseconds::max());
+        }
+
+        // Thread-safe. The histograms of each pipe or packet channel are
+        // consistent with its counters.
         virtual std::array<eth::PipeStats, PipeCount> getPipeStats() const = 0;
         virtual std::array<PacketChannelStats, NumPacketChannels> getPacketChannelStats() const = 0;
         virtual void resetPipeAndChannelStats() = 0;
@@ -0,0 +1,548 @@
+#include "mvlc_event_ring.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <thread>
+
+namespace mesytec
+{
+namespace mvlc
+{
+namespace readout_parser
+{
+
+namespace
+{
+
+// Layout of a ring slot:
+//   header      (SlotHeaderWords)
+//   part sizes  (3 words per module: prefix, dynamic, suffix)
+//   data        (maxEventWords)
+// The data of the module parts is stored consecutively in module order.
+enum SlotHeader
+{
+    Kind,
+    EventIndex,
+    ModuleCount,
+    DataWords,
+    SlotHeaderWords,
+};
+
+enum SlotKind: u32
+{
+    EventSlot,
+    SystemEventSlot,
+};
+
+// Slot stamps: (seq + 1) << 1 once the event with sequence number seq has been
+// written, the lowest bit is set while the slot is being written. 0 means the
+// slot has never been written.
+inline u64 stamp_written(u64 seq) { return (seq + 1) << 1; }
+inline u64 stamp_writing(u64 seq) { return stamp_written(seq) | 1u; }
+
+// Number of times the producer yields waiting for a blocking consumer before
+// going to sleep until the consumer advances.
+static const unsigned ProducerSpinCount = 64;
+
+struct Consumer
+{
+    // policy is stored before active is set, both are read by the producer
+    // while consumers are added and removed.
+    std::atomic<bool> active;
+    std::atomic<EventRing::Policy> policy;
+
+    // Sequence number of the next event to read.
+    std::atomic<u64> readSeq;
+
+    std::atomic<u64> eventsConsumed;
+    std::atomic<u64> eventsDropped;
+    std::atomic<u64> maxLag;
+
+    // Drop policy consumers copy slots here before invoking the callbacks.
+    std::vector<u32> slotCopy;
+    std::vector<ModuleData> moduleData;
+
+    Consumer()
+        : active(false)
+        , policy(EventRing::Policy::Block)
+        , readSeq(0u)
+        , eventsConsumed(0u)
+        , eventsDropped(0u)
+        , maxLag(0u)
+    {}
+};
+
+} // end anon namespace
+
+struct EventRing::Private
+{
+    size_t slotCount;
+    size_t slotMask;
+    size_t maxEventWords;
+    unsigned maxModules;
+    size_t slotStride;
+
+    std::vector<u32> arena;
+    std::unique_ptr<std::atomic<u64>[]> stamps;
+
+    // Sequence number of the next event to be written.
+    std::atomic<u64> writeSeq;
+    std::atomic<bool> closed;
+
+    std::atomic<u64> eventsWritten;
+    std::atomic<u64> oversizedEvents;
+    std::atomic<u64> blockedWrites;
+
+    std::array<Consumer, MaxConsumers> consumers;
+    std::mutex consumersMutex; // serializes addConsumer()
+
+    std::atomic<unsigned> consumersWaiting;
+    std::mutex waitMutex;
+    std::condition_variable waitCond;
+
+    // Set while the producer sleeps waiting for a blocking consumer.
+    std::atomic<bool> producerWaiting;
+    std::mutex producerMutex;
+    std::condition_variable producerCond;
+
+    Private()
+        : writeSeq(0u)
+        , closed(false)
+        , eventsWritten(0u)
+        , oversizedEvents(0u)
+        , blockedWrites(0u)
+        , consumersWaiting(0u)
+        , producerWaiting(false)
+    {}
+
+    u32 *slot(u64 seq) { return arena.data() + (seq & slotMask) * slotStride; }
+
+    // Waits until no blocking consumer needs the event currently stored in
+    // the slot for seq. Spins briefly, then sleeps until the consumer
+    // advances, is removed or the ring is closed.
+    void waitForSlot(u64 seq)
+    {
+        if (seq < slotCount)
+            return;
+
+        const u64 oldSeq = seq - slotCount;
+        bool blocked = false;
+
+        for (auto &consumer: consumers)
+        {
+            if (!consumer.active.load(std::memory_order_acquire)
+                || consumer.policy.load(std::memory_order_relaxed) != Policy::Block)
+            {
+                continue;
+            }
+
+            auto mustWait = [&] ()
+            {
+                return (consumer.readSeq.load(std::memory_order_acquire) <= oldSeq
+                        && consumer.active.load(std::memory_order_acquire)
+                        && !closed.load(std::memory_order_acquire));
+            };
+
+            for (unsigned i=0; i<ProducerSpinCount && mustWait(); ++i)
+            {
+                blocked = true;
+                std::this_thread::yield();
+            }
+
+            if (!mustWait())
+                continue;
+
+            blocked = true;
+
+            // Pairs with the fence in notifyProducer().
+            producerWaiting.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+
+            {
+                std::unique_lock<std::mutex> lock(producerMutex);
+                producerCond.wait(lock, [&] () { return !mustWait(); });
+            }
+
+            producerWaiting.store(false, std::memory_order_relaxed);
+        }
+
+        if (blocked)
+            blockedWrites.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Called after a blocking consumer advanced its readSeq, was removed or
+    // the ring was closed. Wakes up the producer if it is waiting in
+    // waitForSlot().
+    void notifyProducer()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        if (producerWaiting.load(std::memory_order_relaxed))
+        {
+            {
+                std::unique_lock<std::mutex> lock(producerMutex);
+            }
+            producerCond.notify_one();
+        }
+    }
+
+    // Calls fill(slotPointer) to write the slot contents, then publishes the
+    // slot.
+    template<typename Fill>
+    void write(Fill fill)
+    {
+        const u64 seq = writeSeq.load(std::memory_order_relaxed);
+
+        waitForSlot(seq);
+
+        auto &stamp = stamps[seq & slotMask];
+        stamp.store(stamp_writing(seq), std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        fill(slot(seq));
+
+        stamp.store(stamp_written(seq), std::memory_order_release);
+        writeSeq.store(seq + 1, std::memory_order_release);
+        eventsWritten.fetch_add(1, std::memory_order_relaxed);
+
+        // Pairs with the increment of consumersWaiting in waitForData().
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        if (consumersWaiting.load(std::memory_order_relaxed))
+        {
+            {
+                std::unique_lock<std::mutex> lock(waitMutex);
+            }
+            waitCond.notify_all();
+        }
+    }
+
+    void waitForData(u64 readSeq, const std::chrono::milliseconds &timeout)
+    {
+        consumersWaiting.fetch_add(1, std::memory_order_seq_cst);
+
+        {
+            std::unique_lock<std::mutex> lock(waitMutex);
+            waitCond.wait_for(lock, timeout, [this, readSeq] ()
+            {
+                return (writeSeq.load(std::memory_order_acquire) != readSeq
+                        || closed.load(std::memory_order_acquire));
+            });
+        }
+
+        consumersWaiting.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    // Copies the slot for seq into the consumers buffer. Returns false if
+    // the slot was overwritten.
+    bool copySlot(Consumer &consumer, u64 seq)
+    {
+        const auto &stamp = stamps[seq & slotMask];
+        const u64 stamp0 = stamp.load(std::memory_order_acquire);
+
+        if (stamp0 != stamp_written(seq))
+            return false;
+
+        const u32 *src = slot(seq);
+        // The value may be torn if the slot is being overwritten. Limit it so
+        // the copy stays within the slot.
+        const size_t dataWords = std::min(static_cast<size_t>(src[DataWords]), maxEventWords);
+        const size_t words = SlotHeaderWords + 3 * maxModules + dataWords;
+
+        std::memcpy(consumer.slotCopy.data(), src, words * sizeof(u32));
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        return stamp.load(std::memory_order_relaxed) == stamp0;
+    }
+
+    void dispatch(Consumer &consumer, const u32 *slot, ReadoutParserCallbacks &callbacks)
+    {
+        const u32 *sizes = slot + SlotHeaderWords;
+        const u32 *data = sizes + 3 * maxModules;
+
+        if (slot[Kind] == SystemEventSlot)
+        {
+            callbacks.systemEvent(data, slot[DataWords]);
+            return;
+        }
+
+        const unsigned moduleCount = slot[ModuleCount];
+
+        for (unsigned mi=0; mi<moduleCount; ++mi)
+        {
+            auto &md = consumer.moduleData[mi];
+            md.prefix = { data, sizes[0] };
+            data += sizes[0];
+            md.dynamic = { data, sizes[1] };
+            data += sizes[1];
+            md.suffix = { data, sizes[2] };
+            data += sizes[2];
+            sizes += 3;
+        }
+
+        callbacks.eventData(slot[EventIndex], consumer.moduleData.data(), moduleCount);
+    }
+};
+
+EventRing::EventRing(size_t slotCount, size_t maxEventWords, unsigned maxModules)
+    : d(std::make_unique<Private>())
+{
+    size_t count = 1u;
+    while (count < slotCount)
+        count <<= 1;
+
+    d->slotCount = count;
+    d->slotMask = count - 1;
+    d->maxEventWords = maxEventWords;
+    d->maxModules = maxModules;
+    d->slotStride = SlotHeaderWords + 3 * maxModules + maxEventWords;
+    d->arena.resize(d->slotCount * d->slotStride);
+    d->stamps = std::make_unique<std::atomic<u64>[]>(d->slotCount);
+
+    for (size_t i=0; i<d->slotCount; ++i)
+        d->stamps[i].store(0u, std::memory_order_relaxed);
+}
+
+EventRing::~EventRing()
+{
+}
+
+size_t EventRing::slotCount() const
+{
+    return d->slotCount;
+}
+
+size_t EventRing::maxEventWords() const
+{
+    return d->maxEventWords;
+}
+
+void EventRing::writeEvent(int eventIndex, const ModuleData *moduleDataList, unsigned moduleCount)
+{
+    size_t totalWords = 0u;
+
+    for (unsigned mi=0; mi<moduleCount; ++mi)
+    {
+        const auto &md = moduleDataList[mi];
+        totalWords += md.prefix.size + md.dynamic.size + md.suffix.size;
+    }
+
+    if (moduleCount > d->maxModules || totalWords > d->maxEventWords)
+    {
+        d->oversizedEvents.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    const unsigned maxModules = d->maxModules;
+
+    d->write([=] (u32 *slot)
+    {
+        slot[Kind] = EventSlot;
+        slot[EventIndex] = eventIndex;
+        slot[ModuleCount] = moduleCount;
+        slot[DataWords] = totalWords;
+
+        u32 *sizes = slot + SlotHeaderWords;
+        u32 *data = sizes + 3 * maxModules;
+
+        for (unsigned mi=0; mi<moduleCount; ++mi)
+        {
+            for (const auto &block: { moduleDataList[mi].prefix,
+                                      moduleDataList[mi].dynamic,
+                                      moduleDataList[mi].suffix })
+            {
+                *sizes++ = block.size;
+                if (block.size)
+                    std::memcpy(data, block.data, block.size * sizeof(u32));
+                data += block.size;
+            }
+        }
+    });
+}
+
+void EventRing::writeSystemEvent(const u32 *header, u32 size)
+{
+    if (size > d->maxEventWords)
+    {
+        d->oversizedEvents.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    const unsigned maxModules = d->maxModules;
+
+    d->write([=] (u32 *slot)
+    {
+        slot[Kind] = SystemEventSlot;
+        slot[EventIndex] = 0;
+        slot[ModuleCount] = 0;
+        slot[DataWords] = size;
+        std::memcpy(slot + SlotHeaderWords + 3 * maxModules, header, size * sizeof(u32));
+    });
+}
+
+ReadoutParserCallbacks EventRing::parserCallbacks()
+{
+    ReadoutParserCallbacks result;
+
+    result.eventData = [this] (int eventIndex, const ModuleData *moduleDataList, unsigned moduleCount)
+    {
+        writeEvent(eventIndex, moduleDataList, moduleCount);
+    };
+
+    result.systemEvent = [this] (const u32 *header, u32 size)
+    {
+        writeSystemEvent(header, size);
+    };
+
+    return result;
+}
+
+void EventRing::close()
+{
+    d->closed.store(true, std::memory_order_release);
+
+    {
+        std::unique_lock<std::mutex> lock(d->waitMutex);
+    }
+    d->waitCond.notify_all();
+    d->notifyProducer();
+}
+
+bool EventRing::isClosed() const
+{
+    return d->closed.load(std::memory_order_acquire);
+}
+
+EventRing::ConsumerId EventRing::addConsumer(Policy policy)
+{
+    std::unique_lock<std::mutex> lock(d->consumersMutex);
+
+    for (ConsumerId id=0; id<MaxConsumers; ++id)
+    {
+        auto &consumer = d->consumers[id];
+
+        if (consumer.active.load(std::memory_order_acquire))
+            continue;
+
+        consumer.policy.store(policy, std::memory_order_relaxed);
+        consumer.eventsConsumed = 0u;
+        consumer.eventsDropped = 0u;
+        consumer.maxLag = 0u;
+        consumer.moduleData.resize(d->maxModules);
+
+        if (policy == Policy::Drop)
+            consumer.slotCopy.resize(d->slotStride);
+
+        consumer.readSeq.store(d->writeSeq.load(std::memory_order_acquire),
+                               std::memory_order_relaxed);
+        consumer.active.store(true, std::memory_order_release);
+        return id;
+    }
+
+    return MaxConsumers;
+}
+
+void EventRing::removeConsumer(ConsumerId id)
+{
+    if (id < MaxConsumers)
+    {
+        d->consumers[id].active.store(false, std::memory_order_release);
+        d->notifyProducer();
+    }
+}
+
+bool EventRing::consume(
+    ConsumerId id, ReadoutParserCallbacks &callbacks,
+    const std::chrono::milliseconds &timeout, size_t maxEvents)
+{
+    auto &consumer = d->consumers.at(id);
+    u64 seq = consumer.readSeq.load(std::memory_order_relaxed);
+    u64 endSeq = d->writeSeq.load(std::memory_order_acquire);
+
+    if (seq == endSeq)
+    {
+        d->waitForData(seq, timeout);
+        endSeq = d->writeSeq.load(std::memory_order_acquire);
+
+        if (seq == endSeq)
+            return !d->closed.load(std::memory_order_acquire)
+                || seq != d->writeSeq.load(std::memory_order_acquire);
+    }
+
+    const u64 lag = endSeq - seq;
+
+    if (lag > consumer.maxLag.load(std::memory_order_relaxed))
+        consumer.maxLag.store(lag, std::memory_order_relaxed);
+
+    const bool blocking = consumer.policy.load(std::memory_order_relaxed) == Policy::Block;
+
+    for (size_t eventCount = 0; eventCount < maxEvents && seq < endSeq; ++eventCount)
+    {
+        if (blocking)
+        {
+            d->dispatch(consumer, d->slot(seq), callbacks);
+        }
+        else
+        {
+            if (!d->copySlot(consumer, seq))
+            {
+                // The producer overwrote the slot. Continue with the oldest
+                // event that is still available.
+                endSeq = d->writeSeq.load(std::memory_order_acquire);
+                u64 nextSeq = seq + 1;
+
+                if (endSeq >= d->slotCount)
+                    nextSeq = std::max(nextSeq, endSeq - d->slotCount + 1);
+
+                consumer.eventsDropped.fetch_add(nextSeq - seq, std::memory_order_relaxed);
+                seq = nextSeq;
+                consumer.readSeq.store(seq, std::memory_order_release);
+                continue;
+            }
+
+            d->dispatch(consumer, consumer.slotCopy.data(), callbacks);
+        }
+
+        consumer.readSeq.store(++seq, std::memory_order_release);
+        consumer.eventsConsumed.fetch_add(1, std::memory_order_relaxed);
+
+        if (blocking)
+            d->notifyProducer();
+    }
+
+    return true;
+}
+
+EventRing::ConsumerCounters EventRing::consumerCounters(ConsumerId id) const
+{
+    const auto &consumer = d->consumers.at(id);
+
+    ConsumerCounters result;
+    result.eventsConsumed = consumer.eventsConsumed.load(std::memory_order_relaxed);
+    result.eventsDropped = consumer.eventsDropped.load(std::memory_order_relaxed);
+    result.maxLag = consumer.maxLag.load(std::memory_order_relaxed);
+
+    const u64 readSeq = consumer.readSeq.load(std::memory_order_acquire);
+    const u64 writeSeq = d->writeSeq.load(std::memory_order_acquire);
+    result.lag = writeSeq > readSeq ? writeSeq - readSeq : 0u;
+
+    return result;
+}
+
+EventRing::Counters EventRing::counters() const
+{
+    Counters result;
+    result.eventsWritten = d->eventsWritten.load(std::memory_order_relaxed);
+    result.oversizedEvents = d->oversizedEvents.load(std::memory_order_relaxed);
+    result.blockedWrites = d->blockedWrites.load(std::memory_order_relaxed);
+    return result;
+}
+
+} // end namespace readout_parser
+} // end namespace mvlc
+} // end namespace mesytec
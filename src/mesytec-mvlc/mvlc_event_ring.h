@@ -0,0 +1,134 @@
+#ifndef __MESYTEC_MVLC_MVLC_EVENT_RING_H__
+#define __MESYTEC_MVLC_MVLC_EVENT_RING_H__
+
+#include <chrono>
+#include <memory>
+
+#include "mesytec-mvlc/mesytec-mvlc_export.h"
+#include "mesytec-mvlc/mvlc_readout_parser.h"
+
+namespace mesytec
+{
+namespace mvlc
+{
+namespace readout_parser
+{
+
+// Decouples the readout parser from the consumers of the parsed data.
+//
+// The parser writes events and system events into a ring of preallocated,
+// fixed size slots using the callbacks returned by parserCallbacks(). Any
+// number of consumer threads (up to MaxConsumers) read from the ring, each
+// with its own read cursor and overflow policy:
+//
+// - Block: the producer waits for the consumer when the ring is full. The
+//   consumer callbacks receive pointers directly into the ring.
+// - Drop: the producer never waits for the consumer. Events overwritten
+//   before the consumer got to them are counted as dropped. The event data is
+//   copied out of the ring before invoking the consumer callbacks.
+//
+// Events larger than the slot size are not written to the ring and are
+// counted in Counters::oversizedEvents.
+//
+// Example:
+//   EventRing ring(4096, util::Megabytes(1) / sizeof(u32));
+//   auto histoConsumer = ring.addConsumer(EventRing::Policy::Block);
+//   auto monitorConsumer = ring.addConsumer(EventRing::Policy::Drop);
+//
+//   auto parserCallbacks = ring.parserCallbacks();
+//   std::thread parserThread(run_readout_parser, std::ref(parserState),
+//      std::ref(parserCounters), std::ref(snoopQueues), std::ref(parserCallbacks));
+//
+//   // In the consumer threads:
+//   while (ring.consume(histoConsumer, histoCallbacks)) {}
+//
+//   // Once the parser is done:
+//   ring.close();
+
+class MESYTEC_MVLC_EXPORT EventRing
+{
+    public:
+        static const unsigned MaxConsumers = 16;
+        static const unsigned DefaultMaxModules = 32;
+
+        enum class Policy
+        {
+            Block,
+            Drop,
+        };
+
+        using ConsumerId = unsigned;
+
+        struct ConsumerCounters
+        {
+            // Events and system events passed to the consumer callbacks.
+            u64 eventsConsumed = 0u;
+            // Events overwritten before the consumer could read them. Always
+            // 0 for Policy::Block.
+            u64 eventsDropped = 0u;
+            // Number of events written to the ring but not yet consumed.
+            u64 lag = 0u;
+            // Maximum lag observed by the consumer.
+            u64 maxLag = 0u;
+        };
+
+        struct Counters
+        {
+            u64 eventsWritten = 0u;
+            u64 oversizedEvents = 0u;
+            // Number of writes that had to wait for a blocking consumer.
+            u64 blockedWrites = 0u;
+        };
+
+        // slotCount is rounded up to the next power of two. maxEventWords is
+        // the number of data words a slot can hold, maxModules the maximum
+        // number of modules per event.
+        EventRing(size_t slotCount, size_t maxEventWords,
+                  unsigned maxModules = DefaultMaxModules);
+        ~EventRing();
+
+        EventRing(const EventRing &) = delete;
+        EventRing &operator=(const EventRing &) = delete;
+
+        size_t slotCount() const;
+        size_t maxEventWords() const;
+
+        // Producer side. Only one thread may write to the ring.
+        void writeEvent(int eventIndex, const ModuleData *moduleDataList, unsigned moduleCount);
+        void writeSystemEvent(const u32 *header, u32 size);
+
+        // Callbacks for the readout parser writing into the ring.
+        ReadoutParserCallbacks parserCallbacks();
+
+        // Wakes up all consumers. consume() returns false once the ring is
+        // closed and the consumer has read all events.
+        void close();
+        bool isClosed() const;
+
+        // Consumer side. Consumers start reading at the current write
+        // position and may be added and removed while the producer is
+        // running. Returns MaxConsumers if all consumer slots are in use.
+        ConsumerId addConsumer(Policy policy);
+        void removeConsumer(ConsumerId id);
+
+        // Invokes the callbacks for up to maxEvents available events. Waits
+        // up to timeout for new data if no events are available. Must only be
+        // called from one thread per consumer. Returns false if the ring is
+        // closed and all events have been consumed.
+        bool consume(ConsumerId id, ReadoutParserCallbacks &callbacks,
+                     const std::chrono::milliseconds &timeout = std::chrono::milliseconds(100),
+                     size_t maxEvents = std::numeric_limits<size_t>::max());
+
+        ConsumerCounters consumerCounters(ConsumerId id) const;
+        Counters counters() const;
+
+    private:
+        struct Private;
+        std::unique_ptr<Private> d;
+};
+
+} // end namespace readout_parser
+} // end namespace mvlc
+} // end namespace mesytec
+
+#endif /* __MESYTEC_MVLC_MVLC_EVENT_RING_H__ */
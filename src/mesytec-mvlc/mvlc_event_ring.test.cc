@@ -0,0 +1,241 @@
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "mvlc_event_ring.h"
+
+using namespace mesytec::mvlc;
+using namespace mesytec::mvlc::readout_parser;
+
+namespace
+{
+
+// Writes an event with two modules. The data words encode the event number
+// so that consumers can check for consistency.
+void write_test_event(EventRing &ring, u32 eventNumber)
+{
+    std::vector<u32> data(3 + eventNumber % 7, eventNumber);
+    ModuleData modules[2] =
+    {
+        { { data.data(), 1 }, { data.data() + 1, static_cast<u32>(data.size() - 2) }, { data.data() + data.size() - 1, 1 } },
+        { { data.data(), 1 }, { nullptr, 0 }, { nullptr, 0 } },
+    };
+
+    ring.writeEvent(eventNumber % 3, modules, 2);
+}
+
+// Checks that consecutive events are received and returns the event number
+// of the last event.
+struct EventChecker
+{
+    std::vector<u32> eventNumbers;
+    bool consistent = true;
+
+    ReadoutParserCallbacks callbacks()
+    {
+        ReadoutParserCallbacks result;
+
+        result.eventData = [this] (int eventIndex, const ModuleData *modules, unsigned moduleCount)
+        {
+            const u32 eventNumber = modules[0].prefix.data[0];
+
+            consistent = consistent
+                && moduleCount == 2
+                && eventIndex == static_cast<int>(eventNumber % 3)
+                && modules[0].dynamic.size == 1 + eventNumber % 7
+                && modules[0].dynamic.data[modules[0].dynamic.size - 1] == eventNumber
+                && modules[0].suffix.data[0] == eventNumber
+                && modules[1].prefix.data[0] == eventNumber
+                && modules[1].dynamic.size == 0;
+
+            eventNumbers.push_back(eventNumber);
+        };
+
+        return result;
+    }
+};
+
+} // end anon namespace
+
+TEST(mvlc_event_ring, BlockingConsumersReceiveAllEvents)
+{
+    static const u32 EventCount = 100000;
+
+    EventRing ring(8, 16, 2);
+    std::vector<EventRing::ConsumerId> ids = {
+        ring.addConsumer(EventRing::Policy::Block),
+        ring.addConsumer(EventRing::Policy::Block),
+    };
+
+    std::vector<EventChecker> checkers(ids.size());
+    std::vector<std::thread> threads;
+
+    for (size_t i=0; i<ids.size(); ++i)
+    {
+        threads.emplace_back([&ring, &checkers, &ids, i] ()
+        {
+            auto callbacks = checkers[i].callbacks();
+            while (ring.consume(ids[i], callbacks)) {}
+        });
+    }
+
+    for (u32 i=0; i<EventCount; ++i)
+        write_test_event(ring, i);
+
+    ring.close();
+
+    for (auto &t: threads)
+        t.join();
+
+    for (size_t i=0; i<ids.size(); ++i)
+    {
+        ASSERT_TRUE(checkers[i].consistent);
+        ASSERT_EQ(checkers[i].eventNumbers.size(), EventCount);
+
+        for (u32 en=0; en<EventCount; ++en)
+            ASSERT_EQ(checkers[i].eventNumbers[en], en);
+
+        auto counters = ring.consumerCounters(ids[i]);
+        ASSERT_EQ(counters.eventsConsumed, EventCount);
+        ASSERT_EQ(counters.eventsDropped, 0u);
+        ASSERT_EQ(counters.lag, 0u);
+        ASSERT_LE(counters.maxLag, ring.slotCount());
+    }
+
+    ASSERT_EQ(ring.counters().eventsWritten, EventCount);
+}
+
+TEST(mvlc_event_ring, RemovingBlockingConsumerWakesProducer)
+{
+    EventRing ring(8, 16, 2);
+    auto id = ring.addConsumer(EventRing::Policy::Block);
+
+    // The consumer is not reading. The producer sleeps once the ring is full
+    // until the consumer is removed.
+    std::thread producer([&ring] ()
+    {
+        for (u32 i=0; i<100; ++i)
+            write_test_event(ring, i);
+    });
+
+    while (ring.counters().eventsWritten < ring.slotCount())
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    ASSERT_EQ(ring.counters().eventsWritten, ring.slotCount());
+
+    ring.removeConsumer(id);
+    producer.join();
+
+    ASSERT_EQ(ring.counters().eventsWritten, 100u);
+    ASSERT_EQ(ring.counters().blockedWrites, 1u);
+}
+
+TEST(mvlc_event_ring, DropConsumerDoesNotBlockProducer)
+{
+    EventRing ring(8, 16, 2);
+    auto id = ring.addConsumer(EventRing::Policy::Drop);
+
+    // The consumer is not reading. The producer must not block.
+    for (u32 i=0; i<100; ++i)
+        write_test_event(ring, i);
+
+    ASSERT_EQ(ring.consumerCounters(id).lag, 100u);
+
+    ring.close();
+
+    EventChecker checker;
+    auto callbacks = checker.callbacks();
+    while (ring.consume(id, callbacks, std::chrono::milliseconds(1))) {}
+
+    ASSERT_TRUE(checker.consistent);
+    ASSERT_FALSE(checker.eventNumbers.empty());
+    ASSERT_LE(checker.eventNumbers.size(), ring.slotCount());
+    ASSERT_EQ(checker.eventNumbers.back(), 99u);
+
+    auto counters = ring.consumerCounters(id);
+    ASSERT_EQ(counters.eventsConsumed + counters.eventsDropped, 100u);
+    ASSERT_EQ(counters.maxLag, 100u);
+    ASSERT_EQ(counters.lag, 0u);
+}
+
+TEST(mvlc_event_ring, DropConsumerConcurrentWithProducer)
+{
+    static const u32 EventCount = 100000;
+
+    EventRing ring(4, 16, 2);
+    auto blockId = ring.addConsumer(EventRing::Policy::Block);
+    auto dropId = ring.addConsumer(EventRing::Policy::Drop);
+    EventChecker blockChecker;
+    EventChecker dropChecker;
+
+    std::thread blockThread([&] ()
+    {
+        auto callbacks = blockChecker.callbacks();
+        while (ring.consume(blockId, callbacks)) {}
+    });
+
+    std::thread dropThread([&] ()
+    {
+        auto callbacks = dropChecker.callbacks();
+        while (ring.consume(dropId, callbacks, std::chrono::milliseconds(100), 1))
+            std::this_thread::yield(); // slow consumer
+    });
+
+    for (u32 i=0; i<EventCount; ++i)
+        write_test_event(ring, i);
+
+    ring.close();
+    blockThread.join();
+    dropThread.join();
+
+    ASSERT_TRUE(blockChecker.consistent);
+    ASSERT_EQ(blockChecker.eventNumbers.size(), EventCount);
+
+    // The drop consumer sees a consistent, increasing subset of the events.
+    ASSERT_TRUE(dropChecker.consistent);
+    ASSERT_TRUE(std::is_sorted(dropChecker.eventNumbers.begin(), dropChecker.eventNumbers.end()));
+
+    auto counters = ring.consumerCounters(dropId);
+    ASSERT_EQ(counters.eventsConsumed, dropChecker.eventNumbers.size());
+    ASSERT_EQ(counters.eventsConsumed + counters.eventsDropped, EventCount);
+}
+
+TEST(mvlc_event_ring, ParserCallbacks)
+{
+    EventRing ring(16, 4, 1);
+    auto id = ring.addConsumer(EventRing::Policy::Block);
+    auto parserCallbacks = ring.parserCallbacks();
+
+    const u32 systemEvent[] = { 0xFA000001, 0x1234 };
+    const u32 data[] = { 1, 2, 3, 4, 5 };
+    ModuleData md = { { data, 1 }, { data + 1, 2 }, { data + 3, 1 } };
+    ModuleData oversized = { { data, 1 }, { data + 1, 4 }, { nullptr, 0 } };
+
+    parserCallbacks.systemEvent(systemEvent, 2);
+    parserCallbacks.eventData(0, &md, 1);
+    parserCallbacks.eventData(0, &oversized, 1);
+    parserCallbacks.eventData(0, &md, 2); // too many modules
+
+    std::vector<u32> received;
+    ReadoutParserCallbacks callbacks;
+
+    callbacks.systemEvent = [&] (const u32 *header, u32 size)
+    {
+        received.insert(received.end(), header, header + size);
+    };
+
+    callbacks.eventData = [&] (int, const ModuleData *modules, unsigned)
+    {
+        for (auto &block: { modules[0].prefix, modules[0].dynamic, modules[0].suffix })
+            received.insert(received.end(), block.data, block.data + block.size);
+    };
+
+    ring.close();
+    while (ring.consume(id, callbacks)) {}
+
+    ASSERT_EQ(received, std::vector<u32>({ 0xFA000001, 0x1234, 1, 2, 3, 4 }));
+    ASSERT_EQ(ring.counters().eventsWritten, 2u);
+    ASSERT_EQ(ring.counters().oversizedEvents, 2u);
+}
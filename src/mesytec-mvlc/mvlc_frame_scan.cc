@@ -0,0 +1,226 @@
+#include "mvlc_frame_scan.h"
+
+#include "mvlc_util.h"
+
+#if !defined(MESYTEC_MVLC_DISABLE_SIMD) && defined(__SSE2__)
+#define MVLC_FRAME_SCAN_HAVE_SSE2
+#include <emmintrin.h>
+#endif
+
+// AVX2 code is compiled using a function target attribute and selected at
+// runtime so that the library still runs on CPUs without AVX2.
+#if !defined(MESYTEC_MVLC_DISABLE_SIMD) && (defined(__x86_64__) || defined(__i386__)) \
+    && defined(__GNUC__)
+#define MVLC_FRAME_SCAN_HAVE_AVX2
+#include <immintrin.h>
+#endif
+
+namespace mesytec
+{
+namespace mvlc
+{
+
+namespace
+{
+
+inline const u32 *find_frame_type_scalar(
+    const u32 *begin, const u32 *end, const FrameTypeSet &types)
+{
+    for (; begin < end; ++begin)
+    {
+        if (types.contains(get_frame_type(*begin)))
+            return begin;
+    }
+
+    return end;
+}
+
+#ifdef MVLC_FRAME_SCAN_HAVE_SSE2
+const u32 *find_frame_type_sse2(
+    const u32 *begin, const u32 *end, const FrameTypeSet &types)
+{
+    static const size_t WordsPerVector = sizeof(__m128i) / sizeof(u32);
+
+    __m128i wanted[FrameTypeSet::MaxTypes];
+
+    for (size_t ti=0; ti<types.size; ++ti)
+        wanted[ti] = _mm_set1_epi32(types.types[ti]);
+
+    while (end - begin >= static_cast<ptrdiff_t>(WordsPerVector))
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(begin));
+        v = _mm_srli_epi32(v, frame_headers::TypeShift);
+        __m128i match = _mm_setzero_si128();
+
+        for (size_t ti=0; ti<types.size; ++ti)
+            match = _mm_or_si128(match, _mm_cmpeq_epi32(v, wanted[ti]));
+
+        if (int mask = _mm_movemask_ps(_mm_castsi128_ps(match)))
+            return begin + __builtin_ctz(mask);
+
+        begin += WordsPerVector;
+    }
+
+    return find_frame_type_scalar(begin, end, types);
+}
+#endif
+
+#ifdef MVLC_FRAME_SCAN_HAVE_AVX2
+__attribute__((target("avx2")))
+const u32 *find_frame_type_avx2(
+    const u32 *begin, const u32 *end, const FrameTypeSet &types)
+{
+    static const size_t WordsPerVector = sizeof(__m256i) / sizeof(u32);
+
+    __m256i wanted[FrameTypeSet::MaxTypes];
+
+    for (size_t ti=0; ti<types.size; ++ti)
+        wanted[ti] = _mm256_set1_epi32(types.types[ti]);
+
+    while (end - begin >= static_cast<ptrdiff_t>(WordsPerVector))
+    {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(begin));
+        v = _mm256_srli_epi32(v, frame_headers::TypeShift);
+        __m256i match = _mm256_setzero_si256();
+
+        for (size_t ti=0; ti<types.size; ++ti)
+            match = _mm256_or_si256(match, _mm256_cmpeq_epi32(v, wanted[ti]));
+
+        if (int mask = _mm256_movemask_ps(_mm256_castsi256_ps(match)))
+            return begin + __builtin_ctz(mask);
+
+        begin += WordsPerVector;
+    }
+
+    return find_frame_type_scalar(begin, end, types);
+}
+#endif
+
+FrameScanImpl detect_best_frame_scan_impl()
+{
+    if (is_supported(FrameScanImpl::AVX2))
+        return FrameScanImpl::AVX2;
+
+    if (is_supported(FrameScanImpl::SSE2))
+        return FrameScanImpl::SSE2;
+
+    return FrameScanImpl::Scalar;
+}
+
+} // end anon namespace
+
+FrameTypeSet readout_frame_types()
+{
+    return
+    {
+        frame_headers::StackFrame,
+        frame_headers::StackContinuation,
+        frame_headers::SystemEvent,
+    };
+}
+
+const char *to_string(FrameScanImpl impl)
+{
+    switch (impl)
+    {
+        case FrameScanImpl::Scalar:
+            return "Scalar";
+        case FrameScanImpl::SSE2:
+            return "SSE2";
+        case FrameScanImpl::AVX2:
+            return "AVX2";
+    }
+
+    return "unknown FrameScanImpl";
+}
+
+bool is_supported(FrameScanImpl impl)
+{
+    switch (impl)
+    {
+        case FrameScanImpl::Scalar:
+            return true;
+
+        case FrameScanImpl::SSE2:
+#ifdef MVLC_FRAME_SCAN_HAVE_SSE2
+            return true;
+#else
+            return false;
+#endif
+
+        case FrameScanImpl::AVX2:
+#ifdef MVLC_FRAME_SCAN_HAVE_AVX2
+            return __builtin_cpu_supports("avx2");
+#else
+            return false;
+#endif
+    }
+
+    return false;
+}
+
+FrameScanImpl best_frame_scan_impl()
+{
+    static const FrameScanImpl result = detect_best_frame_scan_impl();
+    return result;
+}
+
+const u32 *find_frame_type(
+    const u32 *begin, const u32 *end, const FrameTypeSet &types, FrameScanImpl impl)
+{
+    switch (impl)
+    {
+#ifdef MVLC_FRAME_SCAN_HAVE_AVX2
+        case FrameScanImpl::AVX2:
+            if (is_supported(FrameScanImpl::AVX2))
+                return find_frame_type_avx2(begin, end, types);
+            break;
+#endif
+
+#ifdef MVLC_FRAME_SCAN_HAVE_SSE2
+        case FrameScanImpl::SSE2:
+            return find_frame_type_sse2(begin, end, types);
+#endif
+
+        default:
+            break;
+    }
+
+    return find_frame_type_scalar(begin, end, types);
+}
+
+FrameTypeCounts count_frames_by_type(
+    const u32 *begin, const u32 *end, const FrameTypeSet &validTypes)
+{
+    FrameTypeCounts result;
+    const auto impl = best_frame_scan_impl();
+
+    while (begin < end)
+    {
+        const u8 type = get_frame_type(*begin);
+
+        if (!validTypes.contains(type))
+        {
+            const u32 *next = find_frame_type(begin, end, validTypes, impl);
+            result.skippedWords += next - begin;
+            begin = next;
+            continue;
+        }
+
+        const size_t frameWords = 1u + extract_frame_info(*begin).len;
+
+        if (static_cast<size_t>(end - begin) < frameWords)
+        {
+            result.truncatedWords = end - begin;
+            break;
+        }
+
+        ++result.frames[type];
+        begin += frameWords;
+    }
+
+    return result;
+}
+
+} // end namespace mvlc
+} // end namespace mesytec
@@ -0,0 +1,103 @@
+#ifndef __MESYTEC_MVLC_MVLC_FRAME_SCAN_H__
+#define __MESYTEC_MVLC_MVLC_FRAME_SCAN_H__
+
+#include <array>
+#include <initializer_list>
+
+#include "mesytec-mvlc/mesytec-mvlc_export.h"
+#include "mesytec-mvlc/mvlc_constants.h"
+
+namespace mesytec
+{
+namespace mvlc
+{
+
+// Fast scanning of MVLC data for frame headers. Used to resynchronize to the
+// frame structure after framing errors and to gather statistics about buffer
+// contents.
+//
+// The scanner only looks at the frame type (the highest byte of a word). Data
+// words can have the same highest byte as a frame header, so results are
+// candidates which have to be validated by following the frame lengths.
+
+// Set of frame types to search for. Up to MaxTypes types are supported.
+struct FrameTypeSet
+{
+    static const size_t MaxTypes = 8;
+
+    std::array<u8, MaxTypes> types = {};
+    size_t size = 0u;
+
+    FrameTypeSet() {}
+
+    FrameTypeSet(std::initializer_list<u8> types_)
+    {
+        for (u8 type: types_)
+            if (size < MaxTypes)
+                types[size++] = type;
+    }
+
+    bool contains(u8 type) const
+    {
+        for (size_t i=0; i<size; ++i)
+            if (types[i] == type)
+                return true;
+        return false;
+    }
+};
+
+// StackFrame, StackContinuation and SystemEvent: the frame types appearing at
+// the top level of a readout data stream.
+MESYTEC_MVLC_EXPORT FrameTypeSet readout_frame_types();
+
+enum class FrameScanImpl
+{
+    Scalar,
+    SSE2,
+    AVX2,
+};
+
+MESYTEC_MVLC_EXPORT const char *to_string(FrameScanImpl impl);
+
+// True if the implementation is compiled in and supported by the CPU.
+MESYTEC_MVLC_EXPORT bool is_supported(FrameScanImpl impl);
+
+// The fastest supported implementation. Determined once at runtime.
+MESYTEC_MVLC_EXPORT FrameScanImpl best_frame_scan_impl();
+
+// Returns a pointer to the first word in [begin, end) with a frame type
+// contained in 'types' or 'end' if no such word is found. Unsupported
+// implementations fall back to the scalar code.
+MESYTEC_MVLC_EXPORT const u32 *find_frame_type(
+    const u32 *begin, const u32 *end, const FrameTypeSet &types, FrameScanImpl impl);
+
+inline const u32 *find_frame_type(
+    const u32 *begin, const u32 *end, const FrameTypeSet &types)
+{
+    return find_frame_type(begin, end, types, best_frame_scan_impl());
+}
+
+struct FrameTypeCounts
+{
+    // Number of frames found, indexed by the frame type.
+    std::array<size_t, 256> frames = {};
+
+    // Words skipped while searching for the next valid frame header.
+    size_t skippedWords = 0u;
+
+    // Set to the number of words of the last frame if it exceeds the input.
+    size_t truncatedWords = 0u;
+};
+
+// Follows the frame structure of a USB formatted readout stream and counts
+// the top level frames by type. Words not starting a frame of one of the
+// 'validTypes' are skipped using find_frame_type(). Frames nested inside
+// others, e.g. block read frames inside stack frames, are not counted.
+MESYTEC_MVLC_EXPORT FrameTypeCounts count_frames_by_type(
+    const u32 *begin, const u32 *end,
+    const FrameTypeSet &validTypes = readout_frame_types());
+
+} // end namespace mvlc
+} // end namespace mesytec
+
+#endif /* __MESYTEC_MVLC_MVLC_FRAME_SCAN_H__ */
@@ -0,0 +1,107 @@
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "mvlc_frame_scan.h"
+#include "mvlc_readout.h"
+
+using namespace mesytec::mvlc;
+
+TEST(mvlc_frame_scan, FindFrameTypeAllImpls)
+{
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<u32> dataWord(0, 0x00ffffffu);
+    const auto types = readout_frame_types();
+
+    for (auto impl: { FrameScanImpl::Scalar, FrameScanImpl::SSE2, FrameScanImpl::AVX2 })
+    {
+        if (!is_supported(impl))
+            continue;
+
+        SCOPED_TRACE(to_string(impl));
+
+        // Place a header at each position of buffers of different sizes to
+        // cover the vector loop and the scalar tail.
+        for (size_t size=0; size<40; ++size)
+        {
+            std::vector<u32> buffer(size);
+
+            for (auto &w: buffer)
+                w = dataWord(rng);
+
+            const u32 *begin = buffer.data();
+            const u32 *end = begin + buffer.size();
+
+            ASSERT_EQ(find_frame_type(begin, end, types, impl), end);
+
+            for (size_t pos=0; pos<size; ++pos)
+            {
+                for (u32 type: { 0xF3u, 0xF9u, 0xFAu })
+                {
+                    auto copy = buffer;
+                    copy[pos] = (type << 24) | 0x1234;
+
+                    if (pos + 1 < size)
+                        copy[pos + 1] = 0xF3000000u; // only the first match is returned
+
+                    ASSERT_EQ(find_frame_type(copy.data(), copy.data() + size, types, impl),
+                              copy.data() + pos);
+                }
+
+                // Other frame types are not matched.
+                auto copy = buffer;
+                copy[pos] = 0xF5000003u;
+                ASSERT_EQ(find_frame_type(copy.data(), copy.data() + size, types, impl),
+                          copy.data() + size);
+            }
+        }
+    }
+}
+
+TEST(mvlc_frame_scan, CountFramesByType)
+{
+    std::vector<u32> buffer =
+    {
+        0xF3010003, 0xF5000001, 0x1, 0x2,   // stack frame containing a block frame
+        0x0, 0x12345678,                    // garbage
+        0xF9010001, 0x3,                    // stack continuation
+        0xFA000001, 0x4,                    // system event
+        0xF3010002, 0x5,                    // truncated stack frame
+    };
+
+    auto counts = count_frames_by_type(buffer.data(), buffer.data() + buffer.size());
+
+    ASSERT_EQ(counts.frames[0xF3], 1u);
+    ASSERT_EQ(counts.frames[0xF5], 0u);
+    ASSERT_EQ(counts.frames[0xF9], 1u);
+    ASSERT_EQ(counts.frames[0xFA], 1u);
+    ASSERT_EQ(counts.skippedWords, 2u);
+    ASSERT_EQ(counts.truncatedWords, 2u);
+}
+
+TEST(mvlc_frame_scan, FixupUSBBufferResync)
+{
+    std::vector<u32> data =
+    {
+        0xF3010001, 0x1,                    // stack frame
+        0x0, 0x1, 0x2, 0x3, 0x4, 0x5, 0x6,  // garbage
+        0x7, 0x8, 0x9, 0xa,
+        0xF3020001, 0x2,                    // stack frame
+        0xF3010003, 0x3,                    // partial stack frame
+    };
+
+    ReadoutBuffer readBuffer(data.size() * sizeof(u32));
+    ReadoutBuffer tempBuffer(data.size() * sizeof(u32));
+    std::memcpy(readBuffer.data(), data.data(), data.size() * sizeof(u32));
+    readBuffer.setUsed(data.size() * sizeof(u32));
+
+    ReadoutWorker::Counters counters = {};
+    fixup_usb_buffer(readBuffer, tempBuffer, counters);
+
+    ASSERT_EQ(counters.usbFramingErrors, 11u);
+    ASSERT_EQ(counters.stackHits[1], 1u);
+    ASSERT_EQ(counters.stackHits[2], 1u);
+    ASSERT_EQ(readBuffer.used(), (data.size() - 2) * sizeof(u32));
+    ASSERT_EQ(tempBuffer.used(), 2 * sizeof(u32));
+}
@@ -1,6 +1,7 @@
 #include "mvlc_impl_eth.h"
 #include "mvlc_constants.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cerrno>
 #include <chrono>
@@ -24,6 +25,7 @@
         #include <linux/rtnetlink.h>
         #include <linux/inet_diag.h>
         #include <linux/sock_diag.h>
+        #include <poll.h>
     #endif
 
     #include <arpa/inet.h>
@@ -79,6 +81,13 @@ using namespace mesytec::mvlc;
 static const unsigned DefaultWriteTimeout_ms = 500;
 static const unsigned DefaultReadTimeout_ms  = 500;
 
+// Max number of packets received with a single recvmmsg() call.
+static const size_t MaxPacketsPerReceiveCall = 128;
+
+// Payload size of MVLC data packets without jumbo frames: 1500 byte MTU minus
+// the IP and UDP headers. Initial receive slot size of read_packets().
+static const size_t InitialPacketStride = 1500 - 28;
+
 
 // Does IPv4 host lookup for a UDP socket. On success the resulting struct
 // sockaddr_in is copied to dest.
@@ -568,6 +577,8 @@ void mvlc_eth_throttler(
     prctl(PR_SET_NAME,"eth_throttler",0,0,0);
 #endif
 
+    counters.access()->threadPolicy = apply_thread_policy("eth_throttler");
+
     int diagSocket = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_SOCK_DIAG);
 
     if (diagSocket < 0)
@@ -703,9 +714,12 @@ namespace eth
 
 Impl::Impl(const std::string &host)
     : m_host(host)
+    , m_statsResetGeneration(0u)
     , m_throttleCounters({})
     , m_throttleContext({})
 {
+    m_packetStride.fill(InitialPacketStride);
+
 #ifdef __WIN32
     WORD wVersionRequested;
     WSADATA wsaData;
@@ -1181,12 +1195,6 @@ PacketReadResult Impl::read_packet(Pipe pipe_, u8 *buffer, size_t size)
     PacketReadResult res = {};
 
     unsigned pipe = static_cast<unsigned>(pipe_);
-    auto &pipeStats = m_pipeStats[pipe];
-
-    {
-        UniqueLock guard(m_statsMutex);
-        ++pipeStats.receiveAttempts;
-    }
 
     if (pipe >= PipeCount)
     {
@@ -1194,6 +1202,8 @@ PacketReadResult Impl::read_packet(Pipe pipe_, u8 *buffer, size_t size)
         return res;
     }
 
+    ++writeReceiveStats(pipe)->pipeStats.receiveAttempts;
+
     if (!isConnected())
     {
         res.ec = make_error_code(MVLCErrorCode::IsDisconnected);
@@ -1208,22 +1218,72 @@ PacketReadResult Impl::read_packet(Pipe pipe_, u8 *buffer, size_t size)
     if (res.ec && res.bytesTransferred == 0)
         return res;
 
+    process_received_packet(pipe, res);
+
+    return res;
+}
+
+void PacketHistograms::reset()
+{
+    for (auto &bin: packetSizes)
+        bin.store(0u, std::memory_order_relaxed);
+
+    for (auto &bin: headerTypes)
+        bin.store(0u, std::memory_order_relaxed);
+}
+
+void PacketHistograms::copyTo(PacketHistogramCounts &dest) const
+{
+    for (size_t bin=0; bin<packetSizes.size(); ++bin)
+        dest.packetSizes[bin] = packetSizes[bin].load(std::memory_order_relaxed);
+
+    for (size_t type=0; type<headerTypes.size(); ++type)
+        dest.headerTypes[type] = headerTypes[type].load(std::memory_order_relaxed);
+}
+
+PacketSizeMap PacketHistogramCounts::packetSizeMap() const
+{
+    PacketSizeMap result;
+
+    for (size_t bin=0; bin<packetSizes.size(); ++bin)
+    {
+        if (auto count = packetSizes[bin])
+            result[bin * sizeof(u32)] = count;
+    }
+
+    return result;
+}
+
+HeaderTypeMap PacketHistogramCounts::headerTypeMap() const
+{
+    HeaderTypeMap result;
+
+    for (size_t type=0; type<headerTypes.size(); ++type)
     {
-        UniqueLock guard(m_statsMutex);
-        ++pipeStats.receivedPackets;
-        pipeStats.receivedBytes += res.bytesTransferred;
-        ++pipeStats.packetSizes[res.bytesTransferred];
+        if (auto count = headerTypes[type])
+            result[type] = count;
     }
 
+    return result;
+}
+
+void process_received_packet(
+    PipeReceiveStats &stats, PipeHistograms &histograms, unsigned pipe, PacketReadResult &res)
+{
+    auto &pipeStats = stats.pipeStats;
+
+    ++pipeStats.receivedPackets;
+    pipeStats.receivedBytes += res.bytesTransferred;
+    histograms.pipe.countPacketSize(res.bytesTransferred);
+
     LOG_TRACE("  pipe=%u, res.bytesTransferred=%u", pipe, res.bytesTransferred);
 
     if (!res.hasHeaders())
     {
-        UniqueLock guard(m_statsMutex);
         ++pipeStats.shortPackets;
         LOG_WARN("  pipe=%u, received data is smaller than the MVLC UDP header size", pipe);
         res.ec = make_error_code(MVLCErrorCode::ShortRead);
-        return res;
+        return;
     }
 
     LOG_TRACE("  pipe=%u, header0=0x%08x -> packetChannel=%u, packetNumber=%u, wordCount=%u",
@@ -1238,7 +1298,7 @@ PacketReadResult Impl::read_packet(Pipe pipe_, u8 *buffer, size_t size)
     if (res.dataWordCount() > res.availablePayloadWords())
     {
         res.ec = make_error_code(MVLCErrorCode::UDPDataWordCountExceedsPacketSize);
-        return res;
+        return;
     }
 
     // This is a workaround for an issue in Windows 10 Build 2004 where
@@ -1256,28 +1316,23 @@ PacketReadResult Impl::read_packet(Pipe pipe_, u8 *buffer, size_t size)
     {
         LOG_WARN("  pipe=%u, %u leftover bytes in received packet",
                  pipe, res.leftoverBytes());
-        UniqueLock guard(m_statsMutex);
         ++pipeStats.packetsWithResidue;
     }
 
     if (res.packetChannel() >= NumPacketChannels)
     {
         LOG_WARN("  pipe=%u, packet channel number out of range: %u", pipe, res.packetChannel());
-        UniqueLock guard(m_statsMutex);
         ++pipeStats.packetChannelOutOfRange;
         res.ec = make_error_code(MVLCErrorCode::UDPPacketChannelOutOfRange);
-        return res;
+        return;
     }
 
-    auto &channelStats = m_packetChannelStats[res.packetChannel()];
-    {
-        UniqueLock guard(m_statsMutex);
-        ++channelStats.receivedPackets;
-        channelStats.receivedBytes += res.bytesTransferred;
-    }
+    auto &channelStats = stats.channelStats[res.packetChannel()];
+    ++channelStats.receivedPackets;
+    channelStats.receivedBytes += res.bytesTransferred;
 
     {
-        auto &lastPacketNumber = m_lastPacketNumbers[res.packetChannel()];
+        auto &lastPacketNumber = stats.lastPacketNumbers[res.packetChannel()];
 
         LOG_TRACE("  pipe=%u, packetChannel=%u, packetNumber=%u, lastPacketNumber=%d",
                   pipe, res.packetChannel(), res.packetNumber(), lastPacketNumber);
@@ -1295,17 +1350,12 @@ PacketReadResult Impl::read_packet(Pipe pipe_, u8 *buffer, size_t size)
             }
 
             res.lostPackets = loss;
-            UniqueLock guard(m_statsMutex);
             pipeStats.lostPackets += loss;
             channelStats.lostPackets += loss;
         }
 
         lastPacketNumber = res.packetNumber();
-
-        {
-            UniqueLock guard(m_statsMutex);
-            ++channelStats.packetSizes[res.bytesTransferred];
-        }
+        histograms.channels[res.packetChannel()].countPacketSize(res.bytesTransferred);
     }
 
     // Check where nextHeaderPointer is pointing to
@@ -1317,7 +1367,6 @@ PacketReadResult Impl::read_packet(Pipe pipe_, u8 *buffer, size_t size)
 
         if (headerp >= end)
         {
-            UniqueLock guard(m_statsMutex);
             ++pipeStats.headerOutOfRange;
             ++channelStats.headerOutOfRange;
 
@@ -1331,23 +1380,211 @@ PacketReadResult Impl::read_packet(Pipe pipe_, u8 *buffer, size_t size)
             u32 header = *headerp;
             LOG_TRACE("  pipe=%u, nextHeaderPointer=%u -> header=0x%08x",
                       pipe, res.nextHeaderPointer(), header);
-            u32 type = get_frame_type(header);
-            UniqueLock guard(m_statsMutex);
-            ++pipeStats.headerTypes[type];
-            ++channelStats.headerTypes[type];
+            u8 type = get_frame_type(header);
+            histograms.pipe.countHeaderType(type);
+            histograms.channels[res.packetChannel()].countHeaderType(type);
         }
     }
     else
     {
         LOG_TRACE("  pipe=%u, NoHeaderPointerPresent, eth header1=0x%08x",
                   pipe, res.header1());
-        UniqueLock guard(m_statsMutex);
         ++pipeStats.noHeader;
         ++channelStats.noHeader;
     }
+}
 
-    return res;
+SeqLockedWrite<PipeReceiveStats> Impl::writeReceiveStats(unsigned pipe)
+{
+    auto stats = m_receiveStats[pipe].write();
+    const u32 generation = m_statsResetGeneration.load(std::memory_order_acquire);
+
+    // Apply a reset requested via resetPipeAndChannelStats().
+    if (stats->resetGeneration != generation)
+    {
+        stats.ref() = {};
+        m_histograms[pipe].reset();
+        stats->resetGeneration = generation;
+        stats->lastPacketNumbers.fill(-1);
+    }
+
+    return stats;
+}
+
+void Impl::process_received_packet(unsigned pipe, PacketReadResult &res)
+{
+    eth::process_received_packet(writeReceiveStats(pipe).ref(), m_histograms[pipe], pipe, res);
+}
+
+#ifdef __linux__
+std::error_code Impl::read_packets(
+    Pipe pipe_, ReadoutBuffer &dest, std::vector<PacketReadResult> &results,
+    std::chrono::milliseconds maxWait)
+{
+    results.clear();
+
+    unsigned pipe = static_cast<unsigned>(pipe_);
+
+    if (pipe >= PipeCount)
+        return make_error_code(MVLCErrorCode::InvalidPipe);
+
+    if (!isConnected())
+        return make_error_code(MVLCErrorCode::IsDisconnected);
+
+    // Each packet is received directly into the destination buffer. The
+    // slots are spaced by the size of the largest packet of the previous
+    // batch, so that a sequence of full sized packets ends up back-to-back
+    // without moving any data. Packets following a shorter packet have to be
+    // moved. Bytes exceeding the slot size are received into the overflow
+    // area. The free space check makes sure that the packets fit even if all
+    // of them are JumboFrameMaxSize.
+    const unsigned slotCount = std::min(
+        dest.free() / JumboFrameMaxSize, MaxPacketsPerReceiveCall);
+
+    if (slotCount == 0)
+        return {};
+
+    const size_t stride = m_packetStride[pipe];
+
+    if (stride < JumboFrameMaxSize && m_packetOverflow.empty())
+        m_packetOverflow.resize(MaxPacketsPerReceiveCall * JumboFrameMaxSize);
+
+    std::array<struct mmsghdr, MaxPacketsPerReceiveCall> msgs;
+    std::array<struct iovec, 2 * MaxPacketsPerReceiveCall> iovecs;
+    u8 *slotsBegin = dest.data() + dest.used();
+
+    for (unsigned i=0; i<slotCount; ++i)
+    {
+        iovecs[2 * i].iov_base = slotsBegin + i * stride;
+        iovecs[2 * i].iov_len = stride;
+        iovecs[2 * i + 1].iov_base = m_packetOverflow.data() + i * JumboFrameMaxSize;
+        iovecs[2 * i + 1].iov_len = JumboFrameMaxSize - stride;
+        msgs[i] = {};
+        msgs[i].msg_hdr.msg_iov = &iovecs[2 * i];
+        msgs[i].msg_hdr.msg_iovlen = stride < JumboFrameMaxSize ? 2 : 1;
+    }
+
+    // MSG_WAITFORONE: block until the first packet arrives (or the socket
+    // read timeout expires), then return whatever else is already queued.
+    // A maxWait shorter than the socket timeout is implemented by polling
+    // the socket first.
+    int res = 0;
+
+    if (maxWait < std::chrono::milliseconds(DefaultReadTimeout_ms))
+    {
+        struct pollfd pfd = {};
+        pfd.fd = getSocket(pipe_);
+        pfd.events = POLLIN;
+        res = ::poll(&pfd, 1, static_cast<int>(std::max(maxWait, std::chrono::milliseconds(0)).count()));
+    }
+    else
+        res = 1;
+
+    if (res > 0)
+        res = ::recvmmsg(getSocket(pipe_), msgs.data(), slotCount, MSG_WAITFORONE, nullptr);
+    else if (res == 0)
+    {
+        res = -1;
+        errno = EAGAIN;
+    }
+
+    {
+        // Each received packet and a read without packets count as one
+        // attempt, just like calls to read_packet().
+        auto stats = writeReceiveStats(pipe);
+        ++stats->pipeStats.receiveBatches;
+        stats->pipeStats.receiveAttempts += res > 0 ? res : 1;
+    }
+
+    if (res < 0)
+    {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return make_error_code(MVLCErrorCode::SocketReadTimeout);
+
+        return std::error_code(errno, std::system_category());
+    }
+
+    const unsigned packetCount = res;
+    size_t maxPacketSize = 0u;
+
+    for (unsigned i=0; i<packetCount; ++i)
+        maxPacketSize = std::max(maxPacketSize, static_cast<size_t>(msgs[i].msg_len));
+
+    // Rare: a packet was larger than the slot size, e.g. after jumbo frames
+    // have been enabled. Assemble the packets in the gather buffer and copy
+    // them back into their slots, now spaced by JumboFrameMaxSize.
+    size_t packetSpacing = stride;
+    size_t movedBytes = 0u;
+
+    if (maxPacketSize > stride)
+    {
+        m_packetGather.resize(packetCount * JumboFrameMaxSize);
+
+        for (unsigned i=0; i<packetCount; ++i)
+        {
+            const size_t len = msgs[i].msg_len;
+            u8 *gathered = m_packetGather.data() + i * JumboFrameMaxSize;
+            std::memcpy(gathered, iovecs[2 * i].iov_base, std::min(len, stride));
+
+            if (len > stride)
+                std::memcpy(gathered + stride, iovecs[2 * i + 1].iov_base, len - stride);
+
+            movedBytes += len;
+        }
+
+        std::memcpy(slotsBegin, m_packetGather.data(), packetCount * JumboFrameMaxSize);
+        packetSpacing = JumboFrameMaxSize;
+    }
+
+    // Adapt the slot size to the packet sizes. A single packet may be a
+    // short one sent at a low data rate, so only batches with multiple
+    // packets shrink the slots, and never below the non-jumbo packet size.
+    if (maxPacketSize > stride || packetCount > 1)
+        m_packetStride[pipe] = std::max(maxPacketSize, InitialPacketStride);
+
+    u8 *writePtr = slotsBegin;
+
+    for (unsigned i=0; i<packetCount; ++i)
+    {
+        PacketReadResult prr = {};
+        prr.buffer = slotsBegin + i * packetSpacing;
+        prr.bytesTransferred = msgs[i].msg_len;
+
+        if (prr.bytesTransferred == 0)
+            continue;
+
+        process_received_packet(pipe, prr);
+
+        // Drop residual bytes. If a previous packet was shorter than the
+        // slot size, move the packet to the end of the previous one.
+        prr.bytesTransferred -= prr.leftoverBytes();
+
+        if (prr.buffer != writePtr)
+        {
+            std::memmove(writePtr, prr.buffer, prr.bytesTransferred);
+            prr.buffer = writePtr;
+            movedBytes += prr.bytesTransferred;
+        }
+
+        writePtr += prr.bytesTransferred;
+        results.emplace_back(prr);
+    }
+
+    dest.use(writePtr - slotsBegin);
+
+    if (movedBytes)
+        writeReceiveStats(pipe)->pipeStats.movedBytes += movedBytes;
+
+    return {};
 }
+#else
+std::error_code Impl::read_packets(
+    Pipe pipe, ReadoutBuffer &dest, std::vector<PacketReadResult> &results,
+    std::chrono::milliseconds maxWait)
+{
+    return MVLC_ETH_Interface::read_packets(pipe, dest, results, maxWait);
+}
+#endif
 
 /* initial:
  *   next_header_pointer = 0
@@ -1476,22 +1713,73 @@ std::error_code Impl::getReadQueueSize(Pipe pipe_, u32 &dest)
 
 std::array<PipeStats, PipeCount> Impl::getPipeStats() const
 {
-    UniqueLock guard(m_statsMutex);
-    return m_pipeStats;
+    std::array<PipeStats, PipeCount> result = {};
+    const u32 generation = m_statsResetGeneration.load(std::memory_order_acquire);
+    PacketHistogramCounts histoCounts;
+
+    for (unsigned pipe=0; pipe<PipeCount; ++pipe)
+    {
+        // The histograms are copied as part of the snapshot so that they are
+        // consistent with the counters.
+        auto snapshot = m_receiveStats[pipe].copy(
+            [this, pipe, &histoCounts] (const PipeReceiveStats &stats)
+            {
+                m_histograms[pipe].pipe.copyTo(histoCounts);
+                return std::make_pair(stats.resetGeneration, stats.pipeStats);
+            });
+
+        // Stats not matching the current reset generation are outdated.
+        if (snapshot.first == generation)
+        {
+            static_cast<PipeCounters &>(result[pipe]) = snapshot.second;
+            result[pipe].packetSizes = histoCounts.packetSizeMap();
+            result[pipe].headerTypes = histoCounts.headerTypeMap();
+        }
+    }
+
+    return result;
 }
 
 std::array<PacketChannelStats, NumPacketChannels> Impl::getPacketChannelStats() const
 {
-    UniqueLock guard(m_statsMutex);
-    return m_packetChannelStats;
+    std::array<PacketChannelStats, NumPacketChannels> result = {};
+    const u32 generation = m_statsResetGeneration.load(std::memory_order_acquire);
+
+    // Packet channel stats are kept per pipe. Usually each channel is only
+    // received on one of the pipes, so summing them up is cheap.
+    std::vector<PacketHistogramCounts> histoCounts(NumPacketChannels);
+
+    for (unsigned pipe=0; pipe<PipeCount; ++pipe)
+    {
+        auto snapshot = m_receiveStats[pipe].copy(
+            [this, pipe, &histoCounts] (const PipeReceiveStats &stats)
+            {
+                for (unsigned chan=0; chan<NumPacketChannels; ++chan)
+                    m_histograms[pipe].channels[chan].copyTo(histoCounts[chan]);
+                return std::make_pair(stats.resetGeneration, stats.channelStats);
+            });
+
+        if (snapshot.first != generation)
+            continue;
+
+        for (unsigned chan=0; chan<NumPacketChannels; ++chan)
+        {
+            PacketChannelStats channelStats;
+            static_cast<PacketChannelCounters &>(channelStats) = snapshot.second[chan];
+            channelStats.packetSizes = histoCounts[chan].packetSizeMap();
+            channelStats.headerTypes = histoCounts[chan].headerTypeMap();
+            result[chan] += channelStats;
+        }
+    }
+
+    return result;
 }
 
 void Impl::resetPipeAndChannelStats()
 {
-    UniqueLock guard(m_statsMutex);
-    m_pipeStats = {};
-    m_packetChannelStats = {};
-    std::fill(m_lastPacketNumbers.begin(), m_lastPacketNumbers.end(), -1);
+    // The receiving threads apply the reset when processing the next packet.
+    // Until then the readers ignore the outdated stats.
+    ++m_statsResetGeneration;
 }
 
 u32 Impl::getCmdAddress() const
@@ -35,9 +35,11 @@
 #endif
 
 #include <array>
+#include <atomic>
 #include <fstream>
 #include <string>
 #include <thread>
+#include <vector>
 
 #include "mesytec-mvlc/mesytec-mvlc_export.h"
 #include "mesytec-mvlc/mvlc_basic_interface.h"
@@ -45,6 +47,7 @@
 #include "mesytec-mvlc/mvlc_counters.h"
 #include "mesytec-mvlc/mvlc_eth_interface.h"
 #include "mesytec-mvlc/util/protected.h"
+#include "mesytec-mvlc/util/seqlocked.h"
 #include "mesytec-mvlc/util/ticketmutex.h"
 
 namespace mesytec
@@ -79,6 +82,91 @@ struct EthThrottleContext
     std::ofstream debugOut; // Will receive throttling debug output if open.
 };
 
+// Receive statistics and packet loss tracking state of a single pipe. Only
+// the thread reading from the pipe modifies this. The histograms are kept
+// separately in PipeHistograms.
+struct PipeReceiveStats
+{
+    // Used to detect pending stats resets, see Impl::resetPipeAndChannelStats().
+    u32 resetGeneration = 0u;
+    PipeCounters pipeStats;
+    // Stats of the packet channels as received on this pipe.
+    std::array<PacketChannelCounters, NumPacketChannels> channelStats;
+    // Last packet number per channel, -1 if no packet has been seen yet.
+    std::array<s32, NumPacketChannels> lastPacketNumbers = {{ -1, -1, -1 }};
+};
+
+// Packet size histogram bins. The bin index is the packet size in 32-bit
+// words, the last bin also counts all packets larger than JumboFrameMaxSize.
+static const size_t PacketSizeBins = JumboFrameMaxSize / sizeof(u32) + 1;
+
+inline size_t packet_size_bin(size_t packetBytes)
+{
+    size_t bin = packetBytes / sizeof(u32);
+    return bin < PacketSizeBins ? bin : PacketSizeBins - 1;
+}
+
+// Plain copy of the bins of a PacketHistograms object.
+struct MESYTEC_MVLC_EXPORT PacketHistogramCounts
+{
+    std::array<u64, PacketSizeBins> packetSizes;
+    std::array<u64, 256> headerTypes;
+
+    PacketSizeMap packetSizeMap() const;
+    HeaderTypeMap headerTypeMap() const;
+};
+
+// Packet size and frame header type histograms of a pipe or packet channel.
+// These are too large to be part of the trivially copyable PipeReceiveStats.
+// Instead the thread reading from the pipe increments the bins using relaxed
+// atomic stores while holding the SeqLockedWrite of the PipeReceiveStats.
+// Readers copy the bins from within the SeqLocked::copy() of the stats, so
+// the histograms match the PipeReceiveStats snapshot.
+struct MESYTEC_MVLC_EXPORT PacketHistograms
+{
+    std::array<std::atomic<u64>, PacketSizeBins> packetSizes;
+    std::array<std::atomic<u64>, 256> headerTypes;
+
+    PacketHistograms() { reset(); }
+
+    void reset();
+
+    // Single writer only: a load followed by a store instead of a locked
+    // read-modify-write.
+    void countPacketSize(size_t packetBytes)
+    {
+        auto &bin = packetSizes[packet_size_bin(packetBytes)];
+        bin.store(bin.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    void countHeaderType(u8 type)
+    {
+        auto &bin = headerTypes[type];
+        bin.store(bin.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    void copyTo(PacketHistogramCounts &dest) const;
+};
+
+struct PipeHistograms
+{
+    PacketHistograms pipe;
+    std::array<PacketHistograms, NumPacketChannels> channels;
+
+    void reset()
+    {
+        pipe.reset();
+        for (auto &h: channels)
+            h.reset();
+    }
+};
+
+// Validates a packet received on the given pipe and updates the stats. Errors
+// are reported via res.ec. For ETH packets containing padding bytes
+// res.bytesTransferred is truncated to the actual packet size.
+void MESYTEC_MVLC_EXPORT process_received_packet(
+    PipeReceiveStats &stats, PipeHistograms &histograms, unsigned pipe, PacketReadResult &res);
+
 class MESYTEC_MVLC_EXPORT Impl: public MVLCBasicInterface, public MVLC_ETH_Interface
 {
     public:
@@ -96,6 +184,10 @@ class MESYTEC_MVLC_EXPORT Impl: public MVLCBasicInterface, public MVLC_ETH_Inter
                              size_t &bytesTransferred) override;
 
         PacketReadResult read_packet(Pipe pipe, u8 *buffer, size_t size) override;
+        using MVLC_ETH_Interface::read_packets;
+        std::error_code read_packets(
+            Pipe pipe, ReadoutBuffer &dest, std::vector<PacketReadResult> &results,
+            std::chrono::milliseconds maxWait) override;
 
         ConnectionType connectionType() const override { return ConnectionType::ETH; }
         std::string connectionInfo() const override;
@@ -132,6 +224,11 @@ class MESYTEC_MVLC_EXPORT Impl: public MVLCBasicInterface, public MVLC_ETH_Inter
     private:
         int getSocket(Pipe pipe) { return pipe == Pipe::Command ? m_cmdSock : m_dataSock; }
 
+        // Returns write access to the receive stats of the pipe. Only to be
+        // called from the thread reading from the pipe.
+        SeqLockedWrite<PipeReceiveStats> writeReceiveStats(unsigned pipe);
+        void process_received_packet(unsigned pipe, PacketReadResult &res);
+
         std::string m_host;
         int m_cmdSock = -1;
         int m_dataSock = -1;
@@ -156,11 +253,21 @@ class MESYTEC_MVLC_EXPORT Impl: public MVLCBasicInterface, public MVLC_ETH_Inter
         };
 
         std::array<ReceiveBuffer, PipeCount> m_receiveBuffers;
-        std::array<PipeStats, PipeCount> m_pipeStats;
-        std::array<PacketChannelStats, NumPacketChannels> m_packetChannelStats;
-        std::array<s32, NumPacketChannels> m_lastPacketNumbers;
+        // Per pipe receive stats. Written without locking by the thread
+        // reading from the pipe, readers obtain consistent snapshots.
+        std::array<SeqLocked<PipeReceiveStats>, PipeCount> m_receiveStats;
+        // Per pipe histograms, written by the same thread as m_receiveStats.
+        std::array<PipeHistograms, PipeCount> m_histograms;
+        // Incremented by resetPipeAndChannelStats().
+        std::atomic<u32> m_statsResetGeneration;
+        // read_packets(): per pipe size of the receive slots in the
+        // destination buffer, adapted to the sizes of the received packets.
+        // Packet data exceeding the slot size is received into
+        // m_packetOverflow.
+        std::array<size_t, PipeCount> m_packetStride;
+        std::vector<u8> m_packetOverflow;
+        std::vector<u8> m_packetGather;
         bool m_disableTriggersOnConnect = false;
-        mutable TicketMutex m_statsMutex;
         mutable Protected<EthThrottleCounters> m_throttleCounters;
         Protected<EthThrottleContext> m_throttleContext;
         std::thread m_throttleThread;
@@ -562,7 +562,8 @@ std::error_code Impl::connect()
     // post_connect_cleanup() work.
     for (auto pipe: { Pipe::Command, Pipe::Data})
     {
-        if (auto ec = set_endpoint_timeout(m_handle, get_endpoint(pipe, EndpointDirection::In), 100))
+        if (auto ec = set_endpoint_timeout(m_handle, get_endpoint(pipe, EndpointDirection::In),
+                                           usb::DataPipeReadTimeout_ms))
         {
             closeHandle();
             return ec;
@@ -1,8 +1,14 @@
 #include "mvlc_listfile_zip.h"
 
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
 #include <iostream>
 #include <cassert>
 #include <cstring>
+#include <mutex>
+#include <thread>
+#define LZ4F_STATIC_LINKING_ONLY
 #include <lz4frame.h>
 #include <mz.h>
 #include <mz_compat.h>
@@ -14,6 +20,10 @@
 #include <mz_zip_rw.h>
 #include <sys/stat.h>
 
+#ifdef MESYTEC_MVLC_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
 #include "util/filesystem.h"
 #include "util/storage_sizes.h"
 #include "util/string_view.hpp"
@@ -29,6 +39,49 @@ namespace mvlc
 namespace listfile
 {
 
+namespace
+{
+
+// LZ4 block index entry layout. All values are stored in native (little endian) byte order:
+//   char magic[8], u32 version, u32 reserved, u64 frameSize, u64 uncompressedSize,
+//   u64 frameCount, u64 frameOffsets[frameCount]
+static const char LZ4IndexMagic[8] = { 'M', 'V', 'L', 'Z', '4', 'I', 'D', 'X' };
+static const u32 LZ4IndexVersion = 1u;
+static const size_t LZ4IndexHeaderSize = sizeof(LZ4IndexMagic) + 2 * sizeof(u32) + 3 * sizeof(u64);
+
+template<typename T>
+void append_value(std::vector<u8> &dest, const T &value)
+{
+    auto bytes = reinterpret_cast<const u8 *>(&value);
+    dest.insert(dest.end(), bytes, bytes + sizeof(value));
+}
+
+template<typename T>
+T extract_value(const u8 *&src)
+{
+    T result;
+    std::memcpy(&result, src, sizeof(result));
+    src += sizeof(result);
+    return result;
+}
+
+inline bool has_suffix(const std::string &str, const char *suffix)
+{
+    const size_t len = std::strlen(suffix);
+    return str.size() >= len && str.compare(str.size() - len, len, suffix) == 0;
+}
+
+} // end anon namespace
+
+bool zstd_support_enabled()
+{
+#ifdef MESYTEC_MVLC_HAVE_ZSTD
+    return true;
+#else
+    return false;
+#endif
+}
+
 //
 // ZipCreator
 //
@@ -56,11 +109,13 @@ struct ZipCreator::Private
             unsigned long long size_out;
         };
 
-        static constexpr size_t ChunkSize = util::Megabytes(1);
+        static constexpr size_t ChunkSize = LZ4IndexFrameSize;
 
+        // Each frame holds ChunkSize bytes of uncompressed data in a single
+        // block so that frames can be decompressed independently.
         LZ4F_preferences_t lz4Prefs =
         {
-            { LZ4F_max4MB, LZ4F_blockLinked, LZ4F_noContentChecksum, LZ4F_frame,
+            { LZ4F_max1MB, LZ4F_blockIndependent, LZ4F_noContentChecksum, LZ4F_frame,
               0 /* unknown content size */, 0 /* no dictID */ , LZ4F_noBlockChecksum },
             0,   /* compression level; 0 == default */
             0,   /* autoflush */
@@ -70,6 +125,10 @@ struct ZipCreator::Private
 
         LZ4F_compressionContext_t ctx = {};
         std::vector<u8> buffer;
+        bool frameOpen = false;
+        size_t frameBytesIn = 0u;
+        // compressed offset of each frame within the zip entry
+        std::vector<u64> frameOffsets;
 
         void begin(int compressLevel)
         {
@@ -77,16 +136,180 @@ struct ZipCreator::Private
                 throw std::runtime_error("LZ4F_createCompressionContext: " + std::to_string(err));
 
             lz4Prefs.compressionLevel = compressLevel;
-            size_t bufferSize = LZ4F_compressBound(ChunkSize, &lz4Prefs);
+            size_t bufferSize = LZ4F_compressBound(ChunkSize, &lz4Prefs) + LZ4F_HEADER_SIZE_MAX;
             buffer = std::vector<u8>(bufferSize);
+            frameOpen = false;
+            frameBytesIn = 0u;
+            frameOffsets.clear();
         }
 
         void end()
         {
             LZ4F_freeCompressionContext(ctx);   /* supports free on NULL */
+            ctx = {};
+        }
+    };
+
+    // Compresses LZ4 frames of LZ4WriteContext::ChunkSize bytes on a pool of
+    // worker threads. The writer copies incoming data into the next free job,
+    // hands full jobs to the workers and writes the compressed frames to the
+    // archive in submission order.
+    struct LZ4WorkerPool
+    {
+        struct Job
+        {
+            enum State { Free, Queued, Done };
+
+            std::vector<u8> input;
+            std::vector<u8> output;
+            size_t inputUsed = 0u;
+            size_t compressResult = 0u; // compressed size or LZ4F error code
+            unsigned worker = 0u;
+            std::chrono::microseconds busyTime = {};
+            State state = Free; // guarded by mutex
+        };
+
+        LZ4F_preferences_t lz4Prefs = {};
+        std::vector<Job> jobs;
+        std::vector<std::thread> workers;
+        std::deque<size_t> queue;
+        std::mutex mutex;
+        std::condition_variable jobQueued;
+        std::condition_variable jobDone;
+        bool quit = false;
+
+        // Writer side state.
+        size_t fillIndex = 0u;  // job currently being filled
+        size_t writeIndex = 0u; // oldest submitted job
+        size_t submitted = 0u;  // jobs submitted but not yet written
+
+        bool isActive() const { return !workers.empty(); }
+
+        void start(unsigned workerCount, const LZ4F_preferences_t &prefs)
+        {
+            assert(!isActive());
+
+            lz4Prefs = prefs;
+            jobs = std::vector<Job>(workerCount * 2);
+
+            for (auto &job: jobs)
+            {
+                job.input.resize(LZ4WriteContext::ChunkSize);
+                job.output.resize(LZ4F_compressFrameBound(LZ4WriteContext::ChunkSize, &lz4Prefs));
+            }
+
+            queue.clear();
+            quit = false;
+            fillIndex = writeIndex = submitted = 0u;
+
+            for (unsigned i=0; i<workerCount; ++i)
+                workers.emplace_back(std::thread(&LZ4WorkerPool::loop, this, i));
+        }
+
+        void stop()
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                quit = true;
+            }
+
+            jobQueued.notify_all();
+
+            for (auto &t: workers)
+                if (t.joinable()) t.join();
+
+            workers.clear();
+        }
+
+        void loop(unsigned workerIndex)
+        {
+            LZ4F_cctx *cctx = nullptr;
+
+            // Falls back to LZ4F_compressFrame() which creates a context for
+            // each call.
+            if (LZ4F_isError(LZ4F_createCompressionContext(&cctx, LZ4F_VERSION)))
+                cctx = nullptr;
+
+            while (true)
+            {
+                size_t jobIndex = 0u;
+
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    jobQueued.wait(lock, [this] () { return quit || !queue.empty(); });
+
+                    if (queue.empty())
+                        break;
+
+                    jobIndex = queue.front();
+                    queue.pop_front();
+                }
+
+                auto &job = jobs[jobIndex];
+                auto tStart = std::chrono::steady_clock::now();
+
+                size_t result = cctx
+                    ? LZ4F_compressFrame_usingCDict(
+                        cctx,
+                        job.output.data(), job.output.size(),
+                        job.input.data(), job.inputUsed,
+                        nullptr, &lz4Prefs)
+                    : LZ4F_compressFrame(
+                        job.output.data(), job.output.size(),
+                        job.input.data(), job.inputUsed,
+                        &lz4Prefs);
+
+                auto busyTime = std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - tStart);
+
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    job.compressResult = result;
+                    job.worker = workerIndex;
+                    job.busyTime = busyTime;
+                    job.state = Job::Done;
+                }
+
+                jobDone.notify_all();
+            }
+
+            LZ4F_freeCompressionContext(cctx);
         }
     };
 
+#ifdef MESYTEC_MVLC_HAVE_ZSTD
+    struct ZstdWriteContext
+    {
+        ZSTD_CCtx *ctx = nullptr;
+        std::vector<u8> buffer;
+
+        void begin(int compressLevel, unsigned compressThreads)
+        {
+            if (!ctx && !(ctx = ZSTD_createCCtx()))
+                throw std::runtime_error("ZSTD_createCCtx failed");
+
+            ZSTD_CCtx_reset(ctx, ZSTD_reset_session_and_parameters);
+
+            size_t res = ZSTD_CCtx_setParameter(ctx, ZSTD_c_compressionLevel, compressLevel);
+
+            if (ZSTD_isError(res))
+                throw std::runtime_error(std::string("ZSTD_c_compressionLevel: ") + ZSTD_getErrorName(res));
+
+            // Fails if libzstd was built without multithreading support. Compression
+            // then happens on the calling thread.
+            if (compressThreads > 1)
+                ZSTD_CCtx_setParameter(ctx, ZSTD_c_nbWorkers, compressThreads);
+
+            buffer.resize(ZSTD_CStreamOutSize());
+        }
+
+        ~ZstdWriteContext()
+        {
+            ZSTD_freeCCtx(ctx); /* supports free on NULL */
+        }
+    };
+#endif
+
     explicit Private(ZipCreator *q_)
         : entryWriteHandle(q_)
     {
@@ -100,6 +323,8 @@ struct ZipCreator::Private
 
     ~Private()
     {
+        lz4Workers.stop();
+
         mz_zip_writer_delete(&mz_zipWriter);
         mz_stream_delete(&mz_bufStream);
         mz_stream_delete(&mz_osStream);
@@ -121,6 +346,237 @@ struct ZipCreator::Private
         return static_cast<size_t>(bytesWritten);
     }
 
+    void beginLZ4Frame()
+    {
+        assert(!lz4Ctx.frameOpen);
+
+        // write the LZ4 frame header
+        size_t headerSize = LZ4F_compressBegin(
+            lz4Ctx.ctx,
+            lz4Ctx.buffer.data(),
+            lz4Ctx.buffer.size(),
+            &lz4Ctx.lz4Prefs);
+
+        if (LZ4F_isError(headerSize))
+            throw std::runtime_error("LZ4F_compressBegin: " + std::to_string(headerSize));
+
+        lz4Ctx.frameOffsets.push_back(entryInfo.lz4CompressedBytesWritten);
+        writeToCurrentZIPEntry(lz4Ctx.buffer.data(), headerSize);
+
+        entryInfo.lz4CompressedBytesWritten += headerSize;
+        entryInfo.lz4IndexFrameCount = lz4Ctx.frameOffsets.size();
+        lz4Ctx.frameOpen = true;
+        lz4Ctx.frameBytesIn = 0u;
+    }
+
+    void endLZ4Frame()
+    {
+        assert(lz4Ctx.frameOpen);
+
+        // flush whatever remains within internal buffers
+        size_t compressedSize = LZ4F_compressEnd(
+            lz4Ctx.ctx,
+            lz4Ctx.buffer.data(), lz4Ctx.buffer.size(),
+            nullptr);
+
+        if (LZ4F_isError(compressedSize))
+            throw std::runtime_error("LZ4F_compressEnd: " + std::to_string(compressedSize));
+
+        writeToCurrentZIPEntry(lz4Ctx.buffer.data(), compressedSize);
+
+        entryInfo.lz4CompressedBytesWritten += compressedSize;
+        lz4Ctx.frameOpen = false;
+    }
+
+    // Hands the currently filled job to the workers. Also writes out jobs
+    // that have been completed in the meantime.
+    void submitLZ4Job()
+    {
+        auto &pool = lz4Workers;
+
+        {
+            std::unique_lock<std::mutex> lock(pool.mutex);
+            pool.jobs[pool.fillIndex].state = LZ4WorkerPool::Job::Queued;
+            pool.queue.push_back(pool.fillIndex);
+        }
+
+        pool.jobQueued.notify_one();
+        pool.fillIndex = (pool.fillIndex + 1) % pool.jobs.size();
+        ++pool.submitted;
+
+        writeCompletedLZ4Jobs(false);
+    }
+
+    // Writes completed jobs to the archive in submission order. If
+    // waitForOldest is true blocks until the oldest submitted job is done.
+    void writeCompletedLZ4Jobs(bool waitForOldest)
+    {
+        auto &pool = lz4Workers;
+
+        while (pool.submitted > 0)
+        {
+            auto &job = pool.jobs[pool.writeIndex];
+
+            {
+                std::unique_lock<std::mutex> lock(pool.mutex);
+
+                if (job.state != LZ4WorkerPool::Job::Done)
+                {
+                    if (!waitForOldest)
+                        break;
+
+                    ++entryInfo.lz4WriterWaits;
+                    pool.jobDone.wait(lock, [&job] () { return job.state == LZ4WorkerPool::Job::Done; });
+                }
+            }
+
+            waitForOldest = false;
+
+            if (LZ4F_isError(job.compressResult))
+                throw std::runtime_error("LZ4F_compressFrame: " + std::to_string(job.compressResult));
+
+            lz4Ctx.frameOffsets.push_back(entryInfo.lz4CompressedBytesWritten);
+            writeToCurrentZIPEntry(job.output.data(), job.compressResult);
+
+            entryInfo.lz4CompressedBytesWritten += job.compressResult;
+            entryInfo.lz4IndexFrameCount = lz4Ctx.frameOffsets.size();
+
+            auto &stats = entryInfo.lz4WorkerStats[job.worker];
+            ++stats.framesCompressed;
+            stats.bytesIn += job.inputUsed;
+            stats.bytesOut += job.compressResult;
+            stats.busyTime += job.busyTime;
+
+            job.inputUsed = 0u;
+
+            {
+                std::unique_lock<std::mutex> lock(pool.mutex);
+                job.state = LZ4WorkerPool::Job::Free;
+            }
+
+            pool.writeIndex = (pool.writeIndex + 1) % pool.jobs.size();
+            --pool.submitted;
+        }
+    }
+
+    size_t writeToLZ4Workers(const u8 *inputData, size_t inputSize)
+    {
+        auto &pool = lz4Workers;
+        size_t bytesWritten = 0u;
+
+        while (bytesWritten < inputSize)
+        {
+            // Wait for the oldest job to be written if all jobs are in use.
+            while (pool.submitted == pool.jobs.size())
+                writeCompletedLZ4Jobs(true);
+
+            auto &job = pool.jobs[pool.fillIndex];
+            size_t chunkBytes = std::min(inputSize - bytesWritten, job.input.size() - job.inputUsed);
+
+            std::memcpy(job.input.data() + job.inputUsed, inputData + bytesWritten, chunkBytes);
+            job.inputUsed += chunkBytes;
+            bytesWritten += chunkBytes;
+            entryInfo.bytesWritten += chunkBytes;
+
+            if (job.inputUsed == job.input.size())
+                submitLZ4Job();
+        }
+
+        return bytesWritten;
+    }
+
+    // Submits the partially filled job, writes all remaining frames and stops
+    // the workers.
+    void finishLZ4Workers()
+    {
+        auto &pool = lz4Workers;
+
+        // Always produce at least one frame, even for empty entries.
+        if (pool.jobs[pool.fillIndex].inputUsed > 0 || lz4Ctx.frameOffsets.size() + pool.submitted == 0)
+            submitLZ4Job();
+
+        while (pool.submitted > 0)
+            writeCompletedLZ4Jobs(true);
+
+        pool.stop();
+    }
+
+    // Compresses the input and writes the output to the current entry. If
+    // endFrame is set the zstd frame is completed.
+    size_t writeToCurrentZstdEntry(const u8 *inputData, size_t inputSize, bool endFrame)
+    {
+#ifdef MESYTEC_MVLC_HAVE_ZSTD
+        const ZSTD_EndDirective directive = endFrame ? ZSTD_e_end : ZSTD_e_continue;
+        ZSTD_inBuffer input = { inputData, inputSize, 0 };
+        bool finished = false;
+
+        while (!finished)
+        {
+            ZSTD_outBuffer output = { zstdCtx.buffer.data(), zstdCtx.buffer.size(), 0 };
+
+            size_t remaining = ZSTD_compressStream2(zstdCtx.ctx, &output, &input, directive);
+
+            if (ZSTD_isError(remaining))
+                throw std::runtime_error(std::string("ZSTD_compressStream2: ") + ZSTD_getErrorName(remaining));
+
+            if (output.pos)
+                writeToCurrentZIPEntry(zstdCtx.buffer.data(), output.pos);
+
+            entryInfo.zstdCompressedBytesWritten += output.pos;
+
+            finished = (endFrame ? remaining == 0 : input.pos == input.size);
+        }
+
+        entryInfo.bytesWritten += inputSize;
+        return inputSize;
+#else
+        (void) inputData;
+        (void) inputSize;
+        (void) endFrame;
+        throw std::runtime_error("mesytec-mvlc was built without zstd support");
+#endif
+    }
+
+    // Writes the frame offsets collected while writing the LZ4 entry to a
+    // separate, uncompressed entry. The info of the LZ4 entry is left
+    // unmodified.
+    void writeLZ4Index()
+    {
+        std::vector<u8> indexData;
+        indexData.reserve(LZ4IndexHeaderSize + lz4Ctx.frameOffsets.size() * sizeof(u64));
+        indexData.insert(indexData.end(), std::begin(LZ4IndexMagic), std::end(LZ4IndexMagic));
+        append_value(indexData, LZ4IndexVersion);
+        append_value(indexData, static_cast<u32>(0u));
+        append_value(indexData, static_cast<u64>(LZ4WriteContext::ChunkSize));
+        append_value(indexData, static_cast<u64>(entryInfo.bytesWritten));
+        append_value(indexData, static_cast<u64>(lz4Ctx.frameOffsets.size()));
+
+        for (u64 offset: lz4Ctx.frameOffsets)
+            append_value(indexData, offset);
+
+        const std::string indexName = entryInfo.name + LZ4IndexSuffix;
+
+        mz_zip_file file_info = {};
+        file_info.filename = indexName.c_str();
+        file_info.modified_date = time(nullptr);
+        file_info.version_madeby = MZ_VERSION_MADEBY;
+        file_info.compression_method = MZ_COMPRESS_METHOD_STORE;
+        file_info.zip64 = MZ_ZIP64_FORCE;
+        file_info.external_fa = (S_IFREG) | (0644u << 16);
+
+        mz_zip_writer_set_compress_method(mz_zipWriter, MZ_COMPRESS_METHOD_STORE);
+        mz_zip_writer_set_compress_level(mz_zipWriter, 0);
+
+        if (auto err = mz_zip_writer_entry_open(mz_zipWriter, &file_info))
+            throw std::runtime_error("mz_zip_writer_entry_open: " + std::to_string(err));
+
+        if (!indexData.empty())
+            writeToCurrentZIPEntry(indexData.data(), indexData.size());
+
+        if (auto err = mz_zip_writer_entry_close(mz_zipWriter))
+            throw std::runtime_error("mz_zip_writer_entry_close: " + std::to_string(err));
+    }
+
     void *mz_zipWriter = nullptr;
     void *mz_bufStream = nullptr;
     void *mz_osStream = nullptr;
@@ -128,6 +584,10 @@ struct ZipCreator::Private
     ZipEntryInfo entryInfo;
 
     LZ4WriteContext lz4Ctx;
+    LZ4WorkerPool lz4Workers;
+#ifdef MESYTEC_MVLC_HAVE_ZSTD
+    ZstdWriteContext zstdCtx;
+#endif
 
     ZipEntryWriteHandle entryWriteHandle;
 };
@@ -211,7 +671,8 @@ ZipEntryWriteHandle *ZipCreator::createZIPEntry(const std::string &entryName, in
     return &d->entryWriteHandle;
 }
 
-ZipEntryWriteHandle *ZipCreator::createLZ4Entry(const std::string &entryName_, int compressLevel)
+ZipEntryWriteHandle *ZipCreator::createLZ4Entry(
+    const std::string &entryName_, int compressLevel, unsigned compressThreads)
 {
     if (hasOpenEntry())
         throw std::runtime_error("ZipCreator has open archive entry");
@@ -239,23 +700,58 @@ ZipEntryWriteHandle *ZipCreator::createLZ4Entry(const std::string &entryName_, i
 
     d->lz4Ctx.begin(compressLevel);
 
-    // write the LZ4 frame header
-    size_t lz4BufferBytes = LZ4F_compressBegin(
-        d->lz4Ctx.ctx,
-        d->lz4Ctx.buffer.data(),
-        d->lz4Ctx.buffer.size(),
-        &d->lz4Ctx.lz4Prefs);
+    if (compressThreads > 1)
+    {
+        d->entryInfo.lz4WorkerStats.resize(compressThreads);
+        d->lz4Workers.start(compressThreads, d->lz4Ctx.lz4Prefs);
+    }
+    else
+    {
+        d->beginLZ4Frame();
+    }
 
-    if (LZ4F_isError(lz4BufferBytes))
-        throw std::runtime_error("LZ4F_compressBegin: " + std::to_string(lz4BufferBytes));
+    return &d->entryWriteHandle;
+}
 
-    // flush the LZ4 buffer contents to the ZIP
-    d->writeToCurrentZIPEntry(d->lz4Ctx.buffer.data(), lz4BufferBytes);
+ZipEntryWriteHandle *ZipCreator::createZstdEntry(
+    const std::string &entryName_, int compressLevel, unsigned compressThreads)
+{
+    if (hasOpenEntry())
+        throw std::runtime_error("ZipCreator has open archive entry");
+
+#ifdef MESYTEC_MVLC_HAVE_ZSTD
+    const std::string entryName = entryName_ + ".zst";
+
+    // Setup the compression context first so that no entry is left open on
+    // error.
+    d->zstdCtx.begin(compressLevel, compressThreads);
+
+    mz_zip_file file_info = {};
+    file_info.filename = entryName.c_str();
+    file_info.modified_date = time(nullptr);
+    file_info.version_madeby = MZ_VERSION_MADEBY;
+    file_info.compression_method = MZ_COMPRESS_METHOD_STORE;
+    file_info.zip64 = MZ_ZIP64_FORCE;
+    file_info.external_fa = (S_IFREG) | (0644u << 16);
+
+    mz_zip_writer_set_compress_method(d->mz_zipWriter, MZ_COMPRESS_METHOD_STORE);
+    mz_zip_writer_set_compress_level(d->mz_zipWriter, 0);
 
-    d->entryInfo.bytesWritten += lz4BufferBytes;
-    d->entryInfo.lz4CompressedBytesWritten += lz4BufferBytes;
+    if (auto err = mz_zip_writer_entry_open(d->mz_zipWriter, &file_info))
+        throw std::runtime_error("mz_zip_writer_entry_open: " + std::to_string(err));
+
+    d->entryInfo = {};
+    d->entryInfo.type = ZipEntryInfo::ZSTD;
+    d->entryInfo.name = entryName;
+    d->entryInfo.isOpen = true;
 
     return &d->entryWriteHandle;
+#else
+    (void) entryName_;
+    (void) compressLevel;
+    (void) compressThreads;
+    throw std::runtime_error("mesytec-mvlc was built without zstd support");
+#endif
 }
 
 bool ZipCreator::hasOpenEntry() const
@@ -282,13 +778,23 @@ size_t ZipCreator::writeToCurrentEntry(const u8 *inputData, size_t inputSize)
             break;
 
         case ZipEntryInfo::LZ4:
+            if (d->lz4Workers.isActive())
+            {
+                bytesWritten = d->writeToLZ4Workers(inputData, inputSize);
+                break;
+            }
+
             while (bytesWritten < inputSize)
             {
+                if (!d->lz4Ctx.frameOpen)
+                    d->beginLZ4Frame();
+
+                // never cross a frame boundary with a single update
                 size_t bytesLeft = inputSize - bytesWritten;
-                size_t chunkBytes = std::min(bytesLeft, d->lz4Ctx.buffer.size());
+                size_t chunkBytes = std::min(bytesLeft, d->lz4Ctx.ChunkSize - d->lz4Ctx.frameBytesIn);
 
                 assert(inputData + bytesWritten + chunkBytes <= inputData + inputSize);
-                assert(chunkBytes <= LZ4F_compressBound(d->lz4Ctx.ChunkSize, &d->lz4Ctx.lz4Prefs));
+                assert(chunkBytes > 0);
 
                 // compress the chunk into the LZ4WriteContext buffer
                 size_t compressedSize = LZ4F_compressUpdate(
@@ -304,10 +810,18 @@ size_t ZipCreator::writeToCurrentEntry(const u8 *inputData, size_t inputSize)
                 d->writeToCurrentZIPEntry(d->lz4Ctx.buffer.data(), compressedSize);
 
                 bytesWritten += chunkBytes;
+                d->lz4Ctx.frameBytesIn += chunkBytes;
                 d->entryInfo.bytesWritten += chunkBytes;
                 d->entryInfo.lz4CompressedBytesWritten += compressedSize;
+
+                if (d->lz4Ctx.frameBytesIn == d->lz4Ctx.ChunkSize)
+                    d->endLZ4Frame();
             }
             break;
+
+        case ZipEntryInfo::ZSTD:
+            bytesWritten = d->writeToCurrentZstdEntry(inputData, inputSize, false);
+            break;
     };
 
     return bytesWritten;
@@ -318,28 +832,25 @@ void ZipCreator::closeCurrentEntry()
     if (!hasOpenEntry())
         throw std::runtime_error("ZipCreator has no open archive entry");
 
-    if (d->entryInfo.type == ZipEntryInfo::LZ4)
-    {
-        // flush whatever remains within internal buffers
-        size_t const compressedSize = LZ4F_compressEnd(
-            d->lz4Ctx.ctx,
-            d->lz4Ctx.buffer.data(), d->lz4Ctx.buffer.size(),
-            nullptr);
+    if (d->entryInfo.type == ZipEntryInfo::LZ4 && d->lz4Workers.isActive())
+        d->finishLZ4Workers();
 
-        if (LZ4F_isError(compressedSize))
-            throw std::runtime_error("LZ4F_compressEnd: " + std::to_string(compressedSize));
+    if (d->entryInfo.type == ZipEntryInfo::LZ4 && d->lz4Ctx.frameOpen)
+        d->endLZ4Frame();
 
-        // flush the LZ4 buffer contents to the ZIP
-        size_t bytesWritten = d->writeToCurrentZIPEntry(d->lz4Ctx.buffer.data(), compressedSize);
-
-        d->entryInfo.bytesWritten += bytesWritten;
-        d->entryInfo.lz4CompressedBytesWritten += compressedSize;
-    }
+    if (d->entryInfo.type == ZipEntryInfo::ZSTD)
+        d->writeToCurrentZstdEntry(nullptr, 0, true);
 
     if (auto err = mz_zip_writer_entry_close(d->mz_zipWriter))
         throw std::runtime_error("mz_zip_writer_entry_close: " + std::to_string(err));
 
     d->entryInfo.isOpen = false;
+
+    if (d->entryInfo.type == ZipEntryInfo::LZ4)
+    {
+        d->writeLZ4Index();
+        d->lz4Ctx.end();
+    }
 }
 
 //
@@ -353,16 +864,7 @@ size_t ZipReadHandle::read(u8 *dest, size_t maxSize)
 
 void ZipReadHandle::seek(size_t pos)
 {
-    std::string currentName = m_zipReader->currentEntryName();
-    m_zipReader->closeCurrentEntry();
-    m_zipReader->openEntry(currentName);
-
-    std::vector<u8> buffer(util::Megabytes(1));
-
-    while (pos > 0)
-    {
-        pos -= read(buffer.data(), std::min(buffer.size(), pos));
-    }
+    m_zipReader->seekCurrentEntry(pos);
 }
 
 
@@ -401,6 +903,48 @@ struct ZipReader::Private
         }
     };
 
+    struct LZ4Index
+    {
+        std::string entryName;
+        size_t frameSize = 0u;
+        size_t uncompressedSize = 0u;
+        std::vector<u64> frameOffsets;
+
+        bool isValid() const { return frameSize > 0 && !frameOffsets.empty(); }
+    };
+
+#ifdef MESYTEC_MVLC_HAVE_ZSTD
+    struct ZstdReadContext
+    {
+        ZSTD_DCtx *ctx = nullptr;
+        std::vector<u8> compressedBuffer;
+        ZSTD_inBuffer input = {};
+        // Set if the last decompression call filled the output buffer. The
+        // decoder may then hold more output without needing further input.
+        bool flushPending = false;
+
+        ZstdReadContext()
+            : ctx(ZSTD_createDCtx())
+            , compressedBuffer(ZSTD_DStreamInSize())
+        {
+            if (!ctx)
+                throw std::runtime_error("ZSTD_createDCtx failed");
+        }
+
+        ~ZstdReadContext()
+        {
+            ZSTD_freeDCtx(ctx);
+        }
+
+        void clear()
+        {
+            ZSTD_DCtx_reset(ctx, ZSTD_reset_session_only);
+            input = { compressedBuffer.data(), 0, 0 };
+            flushPending = false;
+        }
+    };
+#endif
+
     explicit Private(ZipReader *q_)
         : entryReadHandle(q_)
     {
@@ -423,6 +967,100 @@ struct ZipReader::Private
         return static_cast<size_t>(res);
     }
 
+    // Reads compressed data either through minizip or, after an indexed
+    // seek, directly from the archive file.
+    size_t readCompressedData(u8 *dest, size_t maxSize)
+    {
+        if (!directRead)
+            return readFromCurrentZipEntry(dest, maxSize);
+
+        assert(entryDataOffset >= 0);
+
+        size_t toRead = std::min(maxSize, entryInfo.compressedSize - std::min(entryInfo.compressedSize, directReadPos));
+
+        if (toRead == 0)
+            return 0u;
+
+        if (auto err = mz_stream_seek(osStream, entryDataOffset + directReadPos, MZ_SEEK_SET))
+            throw std::runtime_error("mz_stream_seek: " + std::to_string(err));
+
+        s32 res = mz_stream_read(osStream, dest, toRead);
+
+        if (res < 0)
+            throw std::runtime_error("mz_stream_read: " + std::to_string(res));
+
+        directReadPos += res;
+
+        return static_cast<size_t>(res);
+    }
+
+    bool hasEntry(const std::string &name) const
+    {
+        return std::find(entryNameCache.begin(), entryNameCache.end(), name) != entryNameCache.end();
+    }
+
+    // Loads the block index of the given LZ4 entry. Must be called while no
+    // entry is open. Leaves the index in an invalid state if the entry has
+    // no index or the index is malformed.
+    void loadLZ4Index(const std::string &name)
+    {
+        if (lz4Index.entryName == name)
+            return;
+
+        lz4Index = {};
+        lz4Index.entryName = name;
+
+        const std::string indexName = name + LZ4IndexSuffix;
+
+        if (!hasEntry(indexName))
+            return;
+
+        if (auto err = mz_zip_reader_locate_entry(reader, indexName.c_str(), false))
+            throw std::runtime_error("mz_zip_reader_locate_entry: " + std::to_string(err));
+
+        if (auto err = mz_zip_reader_entry_open(reader))
+            throw std::runtime_error("mz_zip_reader_entry_open: " + std::to_string(err));
+
+        std::vector<u8> indexData;
+        std::vector<u8> buffer(util::Kilobytes(64));
+        size_t bytesRead = 0u;
+
+        while ((bytesRead = readFromCurrentZipEntry(buffer.data(), buffer.size())) > 0)
+            indexData.insert(indexData.end(), buffer.begin(), buffer.begin() + bytesRead);
+
+        auto err = mz_zip_reader_entry_close(reader);
+
+        if (err != MZ_OK && err != MZ_CRC_ERROR)
+            throw std::runtime_error("mz_zip_reader_entry_close: " + std::to_string(err));
+
+        if (indexData.size() < LZ4IndexHeaderSize
+            || std::memcmp(indexData.data(), LZ4IndexMagic, sizeof(LZ4IndexMagic)) != 0)
+        {
+            return;
+        }
+
+        const u8 *src = indexData.data() + sizeof(LZ4IndexMagic);
+        const auto version = extract_value<u32>(src);
+        extract_value<u32>(src); // reserved
+        const auto frameSize = extract_value<u64>(src);
+        const auto uncompressedSize = extract_value<u64>(src);
+        const auto frameCount = extract_value<u64>(src);
+
+        if (version != LZ4IndexVersion
+            || indexData.size() != LZ4IndexHeaderSize + frameCount * sizeof(u64))
+        {
+            return;
+        }
+
+        lz4Index.frameOffsets.resize(frameCount);
+
+        for (auto &offset: lz4Index.frameOffsets)
+            offset = extract_value<u64>(src);
+
+        lz4Index.frameSize = frameSize;
+        lz4Index.uncompressedSize = uncompressedSize;
+    }
+
     void *reader = nullptr;
     void *osStream = nullptr;
     std::vector<std::string> entryNameCache;
@@ -433,6 +1071,16 @@ struct ZipReader::Private
     ZipReadHandle entryReadHandle { nullptr };
     ZipEntryInfo entryInfo;
     LZ4ReadContext lz4Ctx;
+    LZ4Index lz4Index;
+#ifdef MESYTEC_MVLC_HAVE_ZSTD
+    ZstdReadContext zstdCtx;
+#endif
+    // absolute file offset of the current entries data
+    s64 entryDataOffset = -1;
+    // true after an indexed seek: compressed data is read from osStream at
+    // entryDataOffset + directReadPos instead of going through minizip.
+    bool directRead = false;
+    size_t directReadPos = 0u;
 };
 
 ZipReader::ZipReader()
@@ -463,6 +1111,8 @@ void ZipReader::openArchive(const std::string &archiveName)
     }
 
     d->entryNameCache = {};
+    d->entryInfoCache = {};
+    d->lz4Index = {};
     s32 err = MZ_OK;
 
     do
@@ -498,7 +1148,24 @@ void ZipReader::closeArchive()
 
 std::vector<std::string> ZipReader::entryNameList()
 {
-    return d->entryNameCache;
+    std::vector<std::string> result;
+
+    for (const auto &name: d->entryNameCache)
+    {
+        // hide the block indexes of LZ4 entries
+        const size_t suffixLen = std::strlen(LZ4IndexSuffix);
+
+        if (name.size() > suffixLen
+            && name.compare(name.size() - suffixLen, suffixLen, LZ4IndexSuffix) == 0
+            && d->hasEntry(name.substr(0, name.size() - suffixLen)))
+        {
+            continue;
+        }
+
+        result.push_back(name);
+    }
+
+    return result;
 }
 
 namespace
@@ -523,6 +1190,17 @@ inline size_t get_block_size(const LZ4F_frameInfo_t* info)
 
 ZipReadHandle *ZipReader::openEntry(const std::string &name)
 {
+    const bool isLZ4 = has_suffix(name, ".lz4");
+    const bool isZstd = has_suffix(name, ".zst");
+
+#ifndef MESYTEC_MVLC_HAVE_ZSTD
+    if (isZstd)
+        throw std::runtime_error("mesytec-mvlc was built without zstd support");
+#endif
+
+    if (isLZ4)
+        d->loadLZ4Index(name);
+
     if (auto err = mz_zip_reader_locate_entry(d->reader, name.c_str(), false))
         throw std::runtime_error("mz_zip_reader_locate_entry: " + std::to_string(err));
 
@@ -539,16 +1217,29 @@ ZipReadHandle *ZipReader::openEntry(const std::string &name)
     d->entryInfo.name = name;
     d->entryInfo.compressedSize = mzEntryInfo->compressed_size;
     d->entryInfo.uncompressedSize = mzEntryInfo->uncompressed_size;
+    // The stream is positioned at the start of the entry data right after
+    // opening the entry.
+    d->entryDataOffset = mz_stream_tell(d->osStream);
+    d->directRead = false;
+    d->directReadPos = 0u;
 
-    if (name.size() >= 4)
+    if (isLZ4)
     {
-        auto suffix = string_view(name.data() + (name.length() - 4), 4);
+        d->entryInfo.type = ZipEntryInfo::LZ4;
 
-        if (suffix == ".lz4")
+        if (d->lz4Index.isValid())
         {
-            d->entryInfo.type = ZipEntryInfo::LZ4;
+            d->entryInfo.lz4IndexFrameCount = d->lz4Index.frameOffsets.size();
+            d->entryInfo.lz4IndexUncompressedSize = d->lz4Index.uncompressedSize;
         }
     }
+    else if (isZstd)
+    {
+        d->entryInfo.type = ZipEntryInfo::ZSTD;
+#ifdef MESYTEC_MVLC_HAVE_ZSTD
+        d->zstdCtx.clear();
+#endif
+    }
 
     if (d->entryInfo.type == ZipEntryInfo::LZ4)
     {
@@ -619,6 +1310,39 @@ size_t ZipReader::readCurrentEntry(u8 *dest, size_t maxSize)
     if (d->entryInfo.type == ZipEntryInfo::ZIP)
         return d->readFromCurrentZipEntry(dest, maxSize);
 
+#ifdef MESYTEC_MVLC_HAVE_ZSTD
+    if (d->entryInfo.type == ZipEntryInfo::ZSTD)
+    {
+        auto &zctx = d->zstdCtx;
+        ZSTD_outBuffer output = { dest, maxSize, 0 };
+
+        while (output.pos < output.size)
+        {
+            if (zctx.input.pos == zctx.input.size && !zctx.flushPending)
+            {
+                size_t bytesRead = d->readFromCurrentZipEntry(
+                    zctx.compressedBuffer.data(), zctx.compressedBuffer.size());
+
+                if (bytesRead == 0)
+                    break;
+
+                zctx.input = { zctx.compressedBuffer.data(), bytesRead, 0 };
+                d->entryInfo.zstdCompressedBytesRead += bytesRead;
+            }
+
+            size_t res = ZSTD_decompressStream(zctx.ctx, &output, &zctx.input);
+
+            if (ZSTD_isError(res))
+                throw std::runtime_error(std::string("ZSTD_decompressStream: ") + ZSTD_getErrorName(res));
+
+            zctx.flushPending = (output.pos == output.size);
+        }
+
+        d->entryInfo.bytesRead += output.pos;
+        return output.pos;
+    }
+#endif
+
     assert(d->entryInfo.type == ZipEntryInfo::LZ4);
 
     size_t retval = 0u;
@@ -635,7 +1359,7 @@ size_t ZipReader::readCurrentEntry(u8 *dest, size_t maxSize)
             {
                 //cout << __PRETTY_FUNCTION__ << " loop #" << loop << ": compressedView is empty, reading more data from zip" << endl;
 
-                size_t bytesRead = d->readFromCurrentZipEntry(
+                size_t bytesRead = d->readCompressedData(
                     d->lz4Ctx.compressedBuffer.data(), d->lz4Ctx.compressedBuffer.size());
 
                 d->lz4Ctx.compressedView = { d->lz4Ctx.compressedBuffer.data(), bytesRead };
@@ -704,6 +1428,48 @@ size_t ZipReader::readCurrentEntry(u8 *dest, size_t maxSize)
     return retval;
 }
 
+void ZipReader::seekCurrentEntry(size_t pos)
+{
+    if (d->entryInfo.type == ZipEntryInfo::LZ4 && d->lz4Index.isValid())
+    {
+        const auto &index = d->lz4Index;
+        const size_t frameIndex = pos / index.frameSize;
+
+        LZ4F_resetDecompressionContext(d->lz4Ctx.ctx);
+        d->lz4Ctx.compressedView = {};
+        d->lz4Ctx.decompressedView = {};
+        d->directRead = true;
+
+        if (frameIndex >= index.frameOffsets.size())
+        {
+            // seek to the end of the entry
+            d->directReadPos = d->entryInfo.compressedSize;
+            return;
+        }
+
+        d->directReadPos = index.frameOffsets[frameIndex];
+        pos -= frameIndex * index.frameSize;
+    }
+    else
+    {
+        std::string currentName = currentEntryName();
+        closeCurrentEntry();
+        openEntry(currentName);
+    }
+
+    std::vector<u8> buffer(std::min(pos, util::Megabytes(1)));
+
+    while (pos > 0)
+    {
+        size_t bytesRead = readCurrentEntry(buffer.data(), std::min(buffer.size(), pos));
+
+        if (bytesRead == 0)
+            break;
+
+        pos -= bytesRead;
+    }
+}
+
 std::string ZipReader::currentEntryName() const
 {
     return d->entryInfo.name;
@@ -1,7 +1,9 @@
 #ifndef __MESYTEC_MVLC_MVLC_LISTFILE_ZIP_H__
 #define __MESYTEC_MVLC_MVLC_LISTFILE_ZIP_H__
 
+#include <chrono>
 #include <memory>
+#include <vector>
 #include "mesytec-mvlc/mvlc_listfile.h"
 #include "mesytec-mvlc/mesytec-mvlc_export.h"
 
@@ -14,7 +16,7 @@ namespace listfile
 
 struct ZipEntryInfo
 {
-    enum Type { ZIP, LZ4 };
+    enum Type { ZIP, LZ4, ZSTD };
 
     Type type = ZIP;
     std::string name;
@@ -32,10 +34,52 @@ struct ZipEntryInfo
     // bytes of compressed LZ4 data read
     size_t lz4CompressedBytesRead = 0u;
 
+    // bytes written after zstd compression
+    size_t zstdCompressedBytesWritten = 0u;
+
+    // bytes of compressed zstd data read
+    size_t zstdCompressedBytesRead = 0u;
+
     size_t compressedSize = 0u;
     size_t uncompressedSize = 0u;
+
+    // Number of independently decompressible LZ4 frames written to or found
+    // in the block index of an LZ4 entry. 0 if the entry has no index.
+    size_t lz4IndexFrameCount = 0u;
+
+    // Uncompressed size of an LZ4 entry as recorded in its block index. 0 if
+    // the entry has no index.
+    size_t lz4IndexUncompressedSize = 0u;
+
+    // Per worker statistics for LZ4 entries compressed using multiple
+    // threads. Updated each time a compressed frame is written to the archive.
+    struct LZ4WorkerStats
+    {
+        size_t framesCompressed = 0u;
+        size_t bytesIn = 0u;
+        size_t bytesOut = 0u;
+        std::chrono::microseconds busyTime = {};
+    };
+
+    std::vector<LZ4WorkerStats> lz4WorkerStats;
+
+    // Number of times the writing thread had to wait for a worker to finish
+    // compressing a frame.
+    size_t lz4WriterWaits = 0u;
 };
 
+// LZ4 entries are written as a sequence of LZ4 frames each holding
+// LZ4IndexFrameSize bytes of uncompressed data. On closing the entry a second
+// entry with the name of the LZ4 entry plus LZ4IndexSuffix is written. It
+// contains the compressed offset of each frame which allows ZipReader to seek
+// without decompressing the preceding data.
+static constexpr size_t LZ4IndexFrameSize = util::Megabytes(1);
+static const char * const LZ4IndexSuffix = ".idx";
+
+// True if the library was built with zstd support. Otherwise creating or
+// reading zstd entries throws.
+bool MESYTEC_MVLC_EXPORT zstd_support_enabled();
+
 class ZipEntryWriteHandle;
 
 class MESYTEC_MVLC_EXPORT ZipCreator
@@ -55,11 +99,29 @@ class MESYTEC_MVLC_EXPORT ZipCreator
         ZipEntryWriteHandle *createZIPEntry(const std::string &entryName)
         { return createZIPEntry(entryName, 1); } // 1: "super fast compression", 0: store/no compression
 
-        ZipEntryWriteHandle *createLZ4Entry(const std::string &entryName, int compressLevel);
+        // Appends ".lz4" to the entry name. Also creates the block index entry
+        // when the entry is closed.
+        // If compressThreads is greater than 1 the LZ4 frames are compressed
+        // in parallel on that many worker threads and written in order.
+        ZipEntryWriteHandle *createLZ4Entry(const std::string &entryName, int compressLevel,
+                                            unsigned compressThreads);
+
+        ZipEntryWriteHandle *createLZ4Entry(const std::string &entryName, int compressLevel)
+        { return createLZ4Entry(entryName, compressLevel, 1); }
 
         ZipEntryWriteHandle *createLZ4Entry(const std::string &entryName)
         { return createLZ4Entry(entryName, 0); }; // 0: lz4 default compression
 
+        // Appends ".zst" to the entry name. compressLevel is passed to zstd
+        // (0 selects the zstd default level). If compressThreads is greater
+        // than 1 zstd compresses on that many internal worker threads, given
+        // that libzstd has been built with multithreading support.
+        ZipEntryWriteHandle *createZstdEntry(const std::string &entryName, int compressLevel,
+                                             unsigned compressThreads = 1);
+
+        ZipEntryWriteHandle *createZstdEntry(const std::string &entryName)
+        { return createZstdEntry(entryName, 0); } // 0: zstd default compression
+
         bool hasOpenEntry() const;
         const ZipEntryInfo &entryInfo() const;
 
@@ -108,12 +170,21 @@ class MESYTEC_MVLC_EXPORT ZipReader
 
         void openArchive(const std::string &archiveName);
         void closeArchive();
+
+        // Names of the entries in the archive. LZ4 block index entries are
+        // not included.
         std::vector<std::string> entryNameList();
 
         ZipReadHandle *openEntry(const std::string &name);
         ZipReadHandle *currentEntry();
         void closeCurrentEntry();
         size_t readCurrentEntry(u8 *dest, size_t maxSize);
+
+        // Seeks to the given uncompressed position. Uses the block index if
+        // the current entry is an LZ4 entry with an index, otherwise reopens
+        // the entry and reads up to pos.
+        void seekCurrentEntry(size_t pos);
+
         std::string currentEntryName() const;
         const ZipEntryInfo &entryInfo() const;
 
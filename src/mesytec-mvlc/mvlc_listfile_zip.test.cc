@@ -1,6 +1,8 @@
+#include <algorithm>
 #include <chrono>
 #include <random>
 #include <iostream>
+#include <lz4frame.h>
 #include <mz.h>
 #include <mz_os.h>
 #include <mz_strm.h>
@@ -309,6 +311,299 @@ TEST(mvlc_listfile_zip, LZ4Data)
     }
 }
 
+namespace
+{
+
+// Reads size bytes at pos after seeking and compares them to expected.
+void check_seek_read(ZipReadHandle &readHandle, const std::vector<u8> &expected, size_t pos, size_t size)
+{
+    readHandle.seek(pos);
+
+    size = std::min(size, expected.size() - std::min(pos, expected.size()));
+    std::vector<u8> readBuffer(size);
+    size_t bytesRead = readHandle.read(readBuffer.data(), readBuffer.size());
+
+    ASSERT_EQ(bytesRead, size);
+    ASSERT_TRUE(std::equal(readBuffer.begin(), readBuffer.end(), expected.begin() + pos));
+}
+
+}
+
+TEST(mvlc_listfile_zip, LZ4IndexedSeek)
+{
+    std::vector<u8> outData0(util::Megabytes(10) + 12345);
+
+    for (size_t i=0; i<outData0.size(); i++)
+    {
+        outData0[i] = (i * 7) % 251u;
+    }
+
+    std::string archiveName = "mvlc_listfile_zip.test.LZ4IndexedSeek.zip";
+
+    {
+        ZipCreator creator;
+        creator.createArchive(archiveName, ZipCreator::Overwrite);
+
+        auto &writeHandle = *creator.createLZ4Entry("outfile0.data", 0);
+
+        // Write using sizes not aligned to the LZ4 frame size.
+        const size_t WriteSize = util::Kilobytes(300) + 17;
+
+        for (size_t offset=0; offset<outData0.size(); offset += WriteSize)
+        {
+            size_t size = std::min(WriteSize, outData0.size() - offset);
+            ASSERT_EQ(writeHandle.write(outData0.data() + offset, size), size);
+        }
+
+        creator.closeCurrentEntry();
+
+        const size_t expectedFrames = (outData0.size() + LZ4IndexFrameSize - 1) / LZ4IndexFrameSize;
+        ASSERT_EQ(creator.entryInfo().lz4IndexFrameCount, expectedFrames);
+        ASSERT_EQ(creator.entryInfo().bytesWritten, outData0.size());
+    }
+
+    {
+        ZipReader reader;
+        reader.openArchive(archiveName);
+
+        // The index entry is not listed.
+        std::vector<std::string> expectedEntries = { "outfile0.data.lz4" };
+        ASSERT_EQ(reader.entryNameList(), expectedEntries);
+
+        auto readHandle = reader.openEntry("outfile0.data.lz4");
+        ASSERT_GT(reader.entryInfo().lz4IndexFrameCount, 0u);
+        ASSERT_EQ(reader.entryInfo().lz4IndexUncompressedSize, outData0.size());
+
+        const size_t positions[] =
+        {
+            outData0.size() - 100, 0, 1, LZ4IndexFrameSize - 1, LZ4IndexFrameSize,
+            util::Megabytes(5) + 4321, util::Megabytes(10) + 1, 42,
+        };
+
+        for (size_t pos: positions)
+        {
+            check_seek_read(*readHandle, outData0, pos, util::Kilobytes(1500));
+        }
+
+        // Reading continues across frame boundaries after a seek.
+        readHandle->seek(util::Megabytes(3) + 5);
+        std::vector<u8> readBuffer(outData0.size());
+        size_t bytesRead = readHandle->read(readBuffer.data(), readBuffer.size());
+        ASSERT_EQ(bytesRead, outData0.size() - (util::Megabytes(3) + 5));
+        ASSERT_TRUE(std::equal(readBuffer.begin(), readBuffer.begin() + bytesRead,
+                               outData0.begin() + util::Megabytes(3) + 5));
+
+        // Seeking to or past the end yields no more data.
+        readHandle->seek(outData0.size());
+        ASSERT_EQ(readHandle->read(readBuffer.data(), readBuffer.size()), 0u);
+        readHandle->seek(outData0.size() + util::Megabytes(2));
+        ASSERT_EQ(readHandle->read(readBuffer.data(), readBuffer.size()), 0u);
+    }
+}
+
+TEST(mvlc_listfile_zip, LZ4SeekWithoutIndex)
+{
+    // Emulate an LZ4 entry written before the block index was introduced: a
+    // single frame using linked 4MB blocks without an accompanying index
+    // entry.
+    std::vector<u8> outData0(util::Megabytes(6) + 333);
+
+    for (size_t i=0; i<outData0.size(); i++)
+    {
+        outData0[i] = i % 255u;
+    }
+
+    std::string archiveName = "mvlc_listfile_zip.test.LZ4SeekWithoutIndex.zip";
+
+    {
+        LZ4F_preferences_t prefs = {};
+        prefs.frameInfo.blockSizeID = LZ4F_max4MB;
+        prefs.frameInfo.blockMode = LZ4F_blockLinked;
+
+        std::vector<u8> compressed(LZ4F_compressFrameBound(outData0.size(), &prefs));
+        size_t compressedSize = LZ4F_compressFrame(
+            compressed.data(), compressed.size(), outData0.data(), outData0.size(), &prefs);
+        ASSERT_FALSE(LZ4F_isError(compressedSize));
+
+        ZipCreator creator;
+        creator.createArchive(archiveName, ZipCreator::Overwrite);
+        auto &writeHandle = *creator.createZIPEntry("outfile0.data.lz4", 0);
+        writeHandle.write(compressed.data(), compressedSize);
+        creator.closeCurrentEntry();
+    }
+
+    {
+        ZipReader reader;
+        reader.openArchive(archiveName);
+
+        auto readHandle = reader.openEntry("outfile0.data.lz4");
+        ASSERT_EQ(reader.entryInfo().type, ZipEntryInfo::LZ4);
+        ASSERT_EQ(reader.entryInfo().lz4IndexFrameCount, 0u);
+
+        const size_t positions[] = { util::Megabytes(5), 0, 100, util::Megabytes(4) - 3 };
+
+        for (size_t pos: positions)
+        {
+            check_seek_read(*readHandle, outData0, pos, util::Kilobytes(1500));
+        }
+    }
+}
+
+TEST(mvlc_listfile_zip, LZ4ParallelCompression)
+{
+    std::vector<u8> outData0(util::Megabytes(10) + 54321);
+
+    for (size_t i=0; i<outData0.size(); i++)
+    {
+        outData0[i] = (i * 13) % 253u;
+    }
+
+    std::string archiveName = "mvlc_listfile_zip.test.LZ4ParallelCompression.zip";
+    const unsigned CompressThreads = 4;
+
+    {
+        ZipCreator creator;
+        creator.createArchive(archiveName, ZipCreator::Overwrite);
+
+        auto &writeHandle = *creator.createLZ4Entry("outfile0.data", 1, CompressThreads);
+
+        const size_t WriteSize = util::Kilobytes(700) + 3;
+
+        for (size_t offset=0; offset<outData0.size(); offset += WriteSize)
+        {
+            size_t size = std::min(WriteSize, outData0.size() - offset);
+            ASSERT_EQ(writeHandle.write(outData0.data() + offset, size), size);
+        }
+
+        creator.closeCurrentEntry();
+
+        const auto &entryInfo = creator.entryInfo();
+        const size_t expectedFrames = (outData0.size() + LZ4IndexFrameSize - 1) / LZ4IndexFrameSize;
+
+        ASSERT_EQ(entryInfo.bytesWritten, outData0.size());
+        ASSERT_EQ(entryInfo.lz4IndexFrameCount, expectedFrames);
+        ASSERT_EQ(entryInfo.lz4WorkerStats.size(), CompressThreads);
+
+        size_t framesCompressed = 0u, bytesIn = 0u, bytesOut = 0u;
+
+        for (const auto &stats: entryInfo.lz4WorkerStats)
+        {
+            framesCompressed += stats.framesCompressed;
+            bytesIn += stats.bytesIn;
+            bytesOut += stats.bytesOut;
+        }
+
+        ASSERT_EQ(framesCompressed, expectedFrames);
+        ASSERT_EQ(bytesIn, outData0.size());
+        ASSERT_EQ(bytesOut, entryInfo.lz4CompressedBytesWritten);
+
+        creator.createLZ4Entry("outfile1.data", 0, CompressThreads);
+        creator.closeCurrentEntry();
+        ASSERT_EQ(creator.entryInfo().lz4IndexFrameCount, 1u);
+    }
+
+    {
+        ZipReader reader;
+        reader.openArchive(archiveName);
+
+        std::vector<std::string> expectedEntries = { "outfile0.data.lz4", "outfile1.data.lz4" };
+        ASSERT_EQ(reader.entryNameList(), expectedEntries);
+
+        auto readHandle = reader.openEntry("outfile0.data.lz4");
+        std::vector<u8> readBuffer(outData0.size() + 1);
+        size_t bytesRead = readHandle->read(readBuffer.data(), readBuffer.size());
+        readBuffer.resize(bytesRead);
+
+        ASSERT_EQ(readBuffer, outData0);
+
+        check_seek_read(*readHandle, outData0, util::Megabytes(7) + 99, util::Kilobytes(1500));
+
+        readHandle = reader.openEntry("outfile1.data.lz4");
+        ASSERT_EQ(readHandle->read(readBuffer.data(), readBuffer.size()), 0u);
+    }
+}
+
+TEST(mvlc_listfile_zip, ZstdData)
+{
+    std::string archiveName = "mvlc_listfile_zip.test.ZstdData.zip";
+
+    if (!zstd_support_enabled())
+    {
+        ZipCreator creator;
+        creator.createArchive(archiveName, ZipCreator::Overwrite);
+        ASSERT_THROW(creator.createZstdEntry("outfile0.data", 3), std::runtime_error);
+        ASSERT_FALSE(creator.hasOpenEntry());
+        return;
+    }
+
+    std::vector<u8> outData0(util::Megabytes(5) + 777);
+
+    for (size_t i=0; i<outData0.size(); i++)
+    {
+        outData0[i] = (i * 7) % 251u;
+    }
+
+    for (unsigned compressThreads: { 1u, 2u })
+    {
+        {
+            ZipCreator creator;
+            creator.createArchive(archiveName, ZipCreator::Overwrite);
+
+            auto &writeHandle = *creator.createZstdEntry("outfile0.data", 3, compressThreads);
+
+            const size_t WriteSize = util::Kilobytes(300) + 17;
+
+            for (size_t offset=0; offset<outData0.size(); offset += WriteSize)
+            {
+                size_t size = std::min(WriteSize, outData0.size() - offset);
+                ASSERT_EQ(writeHandle.write(outData0.data() + offset, size), size);
+            }
+
+            creator.closeCurrentEntry();
+
+            ASSERT_EQ(creator.entryInfo().type, ZipEntryInfo::ZSTD);
+            ASSERT_EQ(creator.entryInfo().bytesWritten, outData0.size());
+            ASSERT_GT(creator.entryInfo().zstdCompressedBytesWritten, 0u);
+            ASSERT_LT(creator.entryInfo().zstdCompressedBytesWritten, outData0.size());
+
+            // empty entry
+            creator.createZstdEntry("outfile1.data");
+            creator.closeCurrentEntry();
+        }
+
+        {
+            ZipReader reader;
+            reader.openArchive(archiveName);
+
+            std::vector<std::string> expectedEntries = { "outfile0.data.zst", "outfile1.data.zst" };
+            ASSERT_EQ(reader.entryNameList(), expectedEntries);
+
+            // Read in small chunks to exercise the buffering.
+            auto readHandle = reader.openEntry("outfile0.data.zst");
+            ASSERT_EQ(reader.entryInfo().type, ZipEntryInfo::ZSTD);
+
+            std::vector<u8> readBuffer(outData0.size());
+            size_t totalBytesRead = 0u, bytesRead = 0u;
+
+            do
+            {
+                size_t toRead = std::min(util::Kilobytes(100) + 1, readBuffer.size() - totalBytesRead);
+                bytesRead = readHandle->read(readBuffer.data() + totalBytesRead, toRead);
+                totalBytesRead += bytesRead;
+            } while (bytesRead > 0 && totalBytesRead < readBuffer.size());
+
+            ASSERT_EQ(totalBytesRead, outData0.size());
+            ASSERT_EQ(readBuffer, outData0);
+            ASSERT_EQ(readHandle->read(readBuffer.data(), readBuffer.size()), 0u);
+
+            check_seek_read(*readHandle, outData0, util::Megabytes(3) + 5, util::Kilobytes(10));
+
+            readHandle = reader.openEntry("outfile1.data.zst");
+            ASSERT_EQ(readHandle->read(readBuffer.data(), readBuffer.size()), 0u);
+        }
+    }
+}
+
 #if 0
 namespace
 {
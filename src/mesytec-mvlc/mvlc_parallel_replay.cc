@@ -0,0 +1,512 @@
+#include "mvlc_parallel_replay.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <regex>
+#include <thread>
+
+#if __linux__
+#include <sys/prctl.h>
+#endif
+
+#include "mvlc_eth_interface.h"
+#include "mvlc_listfile.h"
+#include "mvlc_listfile_zip.h"
+#include "util/fmt.h"
+
+namespace mesytec
+{
+namespace mvlc
+{
+
+using namespace readout_parser;
+
+namespace
+{
+
+// Amount of data read at a chunk boundary to search for the next resync
+// point. Doubled until a resync point is found or the end of the data is
+// reached.
+static const size_t ResyncSearchWindow = util::Kilobytes(256);
+
+std::string find_listfile_entry(listfile::ZipReader &zr)
+{
+    static const std::regex re(R"foo(.+\.mvlclst(\.lz4|\.zst)?$)foo");
+
+    for (const auto &entryName: zr.entryNameList())
+    {
+        if (std::regex_search(entryName, re))
+            return entryName;
+    }
+
+    return {};
+}
+
+// ReadHandle::read() may return less than the requested number of bytes.
+size_t read_fully(listfile::ReadHandle &rh, u8 *dest, size_t size)
+{
+    size_t result = 0u;
+
+    while (result < size)
+    {
+        size_t bytesRead = rh.read(dest + result, size - result);
+
+        if (bytesRead == 0)
+            break;
+
+        result += bytesRead;
+    }
+
+    return result;
+}
+
+// Returns the number of words of the next parser buffer: as many complete
+// frames (USB) or packets and system events (ETH) as fit into maxWords, but
+// at least one.
+size_t next_buffer_words(ConnectionType type, const u32 *data, size_t words, size_t maxWords)
+{
+    size_t pos = 0u;
+
+    while (pos < words)
+    {
+        size_t elementWords = 0u;
+
+        if (type == ConnectionType::USB
+            || get_frame_type(data[pos]) == frame_headers::SystemEvent)
+        {
+            elementWords = 1u + extract_frame_info(data[pos]).len;
+        }
+        else if (words - pos >= eth::HeaderWords)
+        {
+            elementWords = eth::HeaderWords
+                + eth::PayloadHeaderInfo{ data[pos], data[pos + 1] }.dataWordCount();
+        }
+        else
+            elementWords = words - pos;
+
+        if (pos > 0 && pos + elementWords > maxWords)
+            break;
+
+        pos = std::min(pos + elementWords, words);
+    }
+
+    return pos;
+}
+
+void parse_chunk(
+    ConnectionType type,
+    ReadoutParserState &state,
+    ReadoutParserCallbacks &callbacks,
+    ReadoutParserCounters &counters,
+    const ReadoutParserCheckpoint &checkpoint,
+    const std::vector<u8> &chunkData,
+    size_t maxBufferWords)
+{
+    // Buffers are numbered starting from 1 within each chunk. This way no
+    // buffer loss is detected at the start of the chunk.
+    auto cp = checkpoint;
+    cp.lastBufferNumber = 0;
+    restore_checkpoint(state, cp);
+
+    const u32 *data = reinterpret_cast<const u32 *>(chunkData.data());
+    size_t words = chunkData.size() / sizeof(u32);
+    u32 bufferNumber = 0;
+
+    while (words > 0)
+    {
+        size_t bufferWords = next_buffer_words(type, data, words, maxBufferWords);
+        parse_readout_buffer(type, state, callbacks, counters, ++bufferNumber, data, bufferWords);
+        data += bufferWords;
+        words -= bufferWords;
+    }
+}
+
+struct Chunk
+{
+    ReadoutParserCheckpoint checkpoint;
+    std::vector<u8> data;
+};
+
+// Bounded queue used to pass chunks from the reading thread to the workers.
+class ChunkQueue
+{
+    public:
+        explicit ChunkQueue(size_t capacity)
+            : m_capacity(capacity)
+        {}
+
+        // Returns false if the queue has been closed.
+        bool push(Chunk &&chunk)
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_notFull.wait(lock, [this] { return m_closed || m_chunks.size() < m_capacity; });
+
+            if (m_closed)
+                return false;
+
+            m_chunks.emplace_back(std::move(chunk));
+            m_notEmpty.notify_one();
+            return true;
+        }
+
+        // Returns false once the queue is closed and empty.
+        bool pop(Chunk &dest)
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_notEmpty.wait(lock, [this] { return m_closed || !m_chunks.empty(); });
+
+            if (m_chunks.empty())
+                return false;
+
+            dest = std::move(m_chunks.front());
+            m_chunks.pop_front();
+            m_notFull.notify_one();
+            return true;
+        }
+
+        // Pending chunks are still handed out by pop().
+        void close()
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_closed = true;
+            m_notEmpty.notify_all();
+            m_notFull.notify_all();
+        }
+
+        // Discards pending chunks. Used when aborting.
+        void clear()
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_chunks.clear();
+            m_notFull.notify_all();
+        }
+
+    private:
+        std::mutex m_mutex;
+        std::condition_variable m_notEmpty;
+        std::condition_variable m_notFull;
+        std::deque<Chunk> m_chunks;
+        size_t m_capacity;
+        bool m_closed = false;
+};
+
+// Records the first exception thrown by any of the worker threads.
+struct ErrorState
+{
+    std::mutex mutex;
+    std::exception_ptr eptr;
+    std::atomic<bool> abort;
+
+    ErrorState(): abort(false) {}
+
+    void setError(std::exception_ptr e)
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+
+        if (!eptr)
+            eptr = e;
+
+        abort = true;
+    }
+};
+
+void run_workers(unsigned workerCount, ErrorState &errorState,
+                 const std::function<void (unsigned workerIndex)> &work)
+{
+    std::vector<std::thread> threads;
+
+    for (unsigned wi=0; wi<workerCount; ++wi)
+    {
+        threads.emplace_back([wi, &errorState, &work] ()
+        {
+#if __linux__
+            auto threadName = fmt::format("replay_par{}", wi);
+            prctl(PR_SET_NAME, threadName.c_str(), 0, 0, 0);
+#endif
+
+            try
+            {
+                work(wi);
+            }
+            catch (...)
+            {
+                errorState.setError(std::current_exception());
+            }
+        });
+    }
+
+    for (auto &t: threads)
+        t.join();
+}
+
+// Per worker reader used for parallel decompression.
+struct EntryReader
+{
+    listfile::ZipReader zr;
+    listfile::ReadHandle *rh = nullptr;
+
+    EntryReader(const std::string &archiveName, const std::string &entryName)
+    {
+        zr.openArchive(archiveName);
+        rh = zr.openEntry(entryName);
+    }
+};
+
+// Byte offset relative to the start of the readout data and the parser state
+// to start parsing with.
+struct ChunkStart
+{
+    size_t offset = 0u;
+    ReadoutParserCheckpoint checkpoint;
+};
+
+ChunkStart find_chunk_start(
+    listfile::ReadHandle &rh, ConnectionType type, size_t dataOffset, size_t dataBytes,
+    size_t searchOffset)
+{
+    std::vector<u8> buffer;
+
+    for (size_t window = ResyncSearchWindow; ; window *= 2)
+    {
+        buffer.resize(std::min(window, dataBytes - searchOffset));
+        rh.seek(dataOffset + searchOffset);
+        const size_t bytesRead = read_fully(rh, buffer.data(), buffer.size());
+        const size_t words = bytesRead / sizeof(u32);
+
+        auto rp = find_resync_point(
+            type, reinterpret_cast<const u32 *>(buffer.data()), words, 0);
+
+        if (rp.offset < words)
+            return { searchOffset + rp.offset * sizeof(u32), rp.checkpoint };
+
+        if (searchOffset + bytesRead >= dataBytes || bytesRead < buffer.size())
+            return { dataBytes, {} };
+    }
+}
+
+} // end anon namespace
+
+ParallelReplayResult replay_listfile_parallel(
+    const std::string &archiveName,
+    const ParallelReplayCallbacksFactory &callbacksFactory,
+    const ParallelReplayOptions &options)
+{
+    const auto tStart = std::chrono::steady_clock::now();
+
+    ParallelReplayResult result;
+
+    listfile::ZipReader zr;
+    zr.openArchive(archiveName);
+
+    result.entryName = options.entryName.empty() ? find_listfile_entry(zr) : options.entryName;
+
+    if (result.entryName.empty())
+        throw std::runtime_error("replay_listfile_parallel: no listfile found in " + archiveName);
+
+    auto &rh = *zr.openEntry(result.entryName);
+    auto preamble = listfile::read_preamble(rh);
+
+    if (preamble.magic == listfile::get_filemagic_eth())
+        result.listfileFormat = ConnectionType::ETH;
+    else if (preamble.magic == listfile::get_filemagic_usb())
+        result.listfileFormat = ConnectionType::USB;
+    else
+        throw std::runtime_error("replay_listfile_parallel: unknown listfile format");
+
+    auto configSection = preamble.findCrateConfig();
+
+    if (!configSection)
+        throw std::runtime_error("replay_listfile_parallel: no CrateConfig found in listfile");
+
+    result.crateConfig = crate_config_from_yaml(configSection->contentsToString());
+
+    const auto type = result.listfileFormat;
+    const unsigned workerCount = std::max(
+        1u, options.workerCount ? options.workerCount : std::thread::hardware_concurrency());
+    // Keep the chunk boundaries word aligned.
+    const size_t chunkBytes = std::max(options.chunkSize / sizeof(u32), size_t(1)) * sizeof(u32);
+    const size_t maxBufferWords = std::max(options.bufferSize / sizeof(u32), size_t(1));
+    // The readout data starts right after the file magic.
+    const size_t dataOffset = preamble.magic.size();
+
+    std::vector<ReadoutParserState> states;
+    std::vector<ReadoutParserCallbacks> callbacks;
+    result.workerParserCounters.resize(workerCount);
+
+    for (unsigned wi=0; wi<workerCount; ++wi)
+    {
+        states.emplace_back(make_readout_parser(
+                result.crateConfig.stacks, options.moduleSelection, options.useFixedModuleParsers));
+        callbacks.emplace_back(callbacksFactory(wi, result.crateConfig));
+    }
+
+    ErrorState errorState;
+
+    const auto &entryInfo = zr.entryInfo();
+
+    result.parallelDecompression = (entryInfo.type == listfile::ZipEntryInfo::LZ4
+                                    && entryInfo.lz4IndexFrameCount > 0
+                                    && entryInfo.lz4IndexUncompressedSize >= dataOffset);
+
+    if (result.parallelDecompression)
+    {
+        const size_t dataBytes = entryInfo.lz4IndexUncompressedSize - dataOffset;
+        const size_t boundaryCount = std::max((dataBytes + chunkBytes - 1) / chunkBytes, size_t(1));
+
+        // Find the resync points following the nominal chunk boundaries.
+        std::vector<ChunkStart> starts(boundaryCount + 1);
+        starts.back().offset = dataBytes;
+        std::atomic<size_t> nextBoundary(1);
+
+        run_workers(workerCount, errorState, [&] (unsigned)
+        {
+            std::unique_ptr<EntryReader> reader;
+
+            for (size_t bi = nextBoundary++; bi < boundaryCount && !errorState.abort; bi = nextBoundary++)
+            {
+                if (!reader)
+                    reader = std::make_unique<EntryReader>(archiveName, result.entryName);
+
+                starts[bi] = find_chunk_start(*reader->rh, type, dataOffset, dataBytes, bi * chunkBytes);
+            }
+        });
+
+        // Multiple nominal boundaries can map to the same resync point.
+        std::vector<size_t> chunkIndexes;
+
+        for (size_t ci=0; ci<boundaryCount; ++ci)
+        {
+            if (starts[ci].offset < starts[ci + 1].offset)
+                chunkIndexes.push_back(ci);
+        }
+
+        result.chunkCount = chunkIndexes.size();
+        result.bytesRead = dataBytes;
+        std::atomic<size_t> nextChunk(0);
+
+        if (!errorState.abort)
+        {
+            run_workers(workerCount, errorState, [&] (unsigned wi)
+            {
+                std::unique_ptr<EntryReader> reader;
+                std::vector<u8> chunkData;
+
+                for (size_t i = nextChunk++; i < chunkIndexes.size() && !errorState.abort; i = nextChunk++)
+                {
+                    if (!reader)
+                        reader = std::make_unique<EntryReader>(archiveName, result.entryName);
+
+                    const auto &start = starts[chunkIndexes[i]];
+                    const size_t endOffset = starts[chunkIndexes[i] + 1].offset;
+
+                    chunkData.resize(endOffset - start.offset);
+                    reader->rh->seek(dataOffset + start.offset);
+                    chunkData.resize(read_fully(*reader->rh, chunkData.data(), chunkData.size()));
+
+                    parse_chunk(type, states[wi], callbacks[wi], result.workerParserCounters[wi],
+                                start.checkpoint, chunkData, maxBufferWords);
+                }
+            });
+        }
+    }
+    else
+    {
+        // Sequential decompression. The calling thread reads the data, cuts
+        // it into chunks and hands them to the workers.
+        ChunkQueue queue(2 * workerCount);
+
+        std::thread workersThread([&] ()
+        {
+            run_workers(workerCount, errorState, [&] (unsigned wi)
+            {
+                Chunk chunk;
+
+                while (queue.pop(chunk))
+                {
+                    if (!errorState.abort)
+                        parse_chunk(type, states[wi], callbacks[wi], result.workerParserCounters[wi],
+                                    chunk.checkpoint, chunk.data, maxBufferWords);
+                }
+            });
+
+            if (errorState.abort)
+            {
+                queue.close();
+                queue.clear();
+            }
+        });
+
+        try
+        {
+            Chunk pending;
+            bool eof = false;
+
+            while (!eof && !errorState.abort)
+            {
+                const size_t used = pending.data.size();
+                pending.data.resize(used + chunkBytes);
+                const size_t bytesRead = read_fully(rh, pending.data.data() + used, chunkBytes);
+                pending.data.resize(used + bytesRead);
+                result.bytesRead += bytesRead;
+                eof = bytesRead < chunkBytes;
+
+                // Cut off chunks once enough data following the nominal chunk
+                // size is available to find the next resync point.
+                while (pending.data.size() >= chunkBytes + ResyncSearchWindow || (eof && !pending.data.empty()))
+                {
+                    const size_t words = pending.data.size() / sizeof(u32);
+
+                    auto rp = find_resync_point(
+                        type, reinterpret_cast<const u32 *>(pending.data.data()),
+                        words, chunkBytes / sizeof(u32));
+
+                    if (rp.offset >= words && !eof)
+                        break;
+
+                    Chunk chunk;
+                    chunk.checkpoint = pending.checkpoint;
+
+                    if (rp.offset >= words)
+                    {
+                        chunk.data = std::move(pending.data);
+                        pending.data.clear();
+                    }
+                    else
+                    {
+                        const auto cut = pending.data.begin() + rp.offset * sizeof(u32);
+                        chunk.data.assign(pending.data.begin(), cut);
+                        pending.data.erase(pending.data.begin(), cut);
+                        pending.checkpoint = rp.checkpoint;
+                    }
+
+                    ++result.chunkCount;
+
+                    if (!queue.push(std::move(chunk)))
+                        break;
+                }
+            }
+        }
+        catch (...)
+        {
+            errorState.setError(std::current_exception());
+        }
+
+        queue.close();
+        workersThread.join();
+    }
+
+    if (errorState.eptr)
+        std::rethrow_exception(errorState.eptr);
+
+    for (const auto &counters: result.workerParserCounters)
+        add_counters(result.parserCounters, counters);
+
+    result.elapsed = std::chrono::steady_clock::now() - tStart;
+
+    return result;
+}
+
+} // end namespace mvlc
+} // end namespace mesytec
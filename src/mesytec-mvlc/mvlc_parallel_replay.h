@@ -0,0 +1,95 @@
+#ifndef __MESYTEC_MVLC_MVLC_PARALLEL_REPLAY_H__
+#define __MESYTEC_MVLC_MVLC_PARALLEL_REPLAY_H__
+
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "mesytec-mvlc/mesytec-mvlc_export.h"
+#include "mesytec-mvlc/mvlc_readout_config.h"
+#include "mesytec-mvlc/mvlc_readout_parser.h"
+#include "mesytec-mvlc/util/storage_sizes.h"
+
+namespace mesytec
+{
+namespace mvlc
+{
+
+// Multi-threaded offline analysis of a listfile.
+//
+// The readout data of the listfile is split into chunks of roughly
+// ParallelReplayOptions::chunkSize bytes. The chunk boundaries are placed on
+// resync points (see readout_parser::find_resync_point()) so that the parsed
+// events and the merged parser counters are the same as when replaying the
+// file with a single parser. Each worker thread has its own readout parser
+// and callbacks and parses one chunk at a time.
+//
+// For LZ4 entries with a block index each worker opens the archive itself and
+// seeks to its chunk, so decompression runs in parallel as well. Other entry
+// types are decompressed sequentially by the calling thread which hands the
+// chunks to the workers.
+//
+// Events are passed to the callbacks of the worker parsing the chunk, in
+// order within a chunk but in no particular order across chunks.
+
+struct ParallelReplayOptions
+{
+    // Number of worker threads. 0 uses std::thread::hardware_concurrency().
+    unsigned workerCount = 0u;
+
+    // Approximate number of readout data bytes per chunk.
+    size_t chunkSize = util::Megabytes(16);
+
+    // Maximum size of the buffers passed to the readout parser. Chunks are
+    // split into buffers on frame or packet boundaries like the ReplayWorker
+    // does.
+    size_t bufferSize = util::Megabytes(1);
+
+    // Name of the listfile entry in the archive. If empty the first entry
+    // with a .mvlclst, .mvlclst.lz4 or .mvlclst.zst suffix is used.
+    std::string entryName;
+
+    // Passed to readout_parser::make_readout_parser().
+    readout_parser::ModuleSelection moduleSelection;
+    bool useFixedModuleParsers = true;
+};
+
+struct ParallelReplayResult
+{
+    std::string entryName;
+    ConnectionType listfileFormat = ConnectionType::USB;
+    CrateConfig crateConfig = {};
+
+    // True if the workers decompressed their chunks themselves.
+    bool parallelDecompression = false;
+    size_t chunkCount = 0u;
+    // Number of readout data bytes following the file magic.
+    size_t bytesRead = 0u;
+    std::chrono::steady_clock::duration elapsed = {};
+
+    // Sum of the counters of all workers.
+    readout_parser::ReadoutParserCounters parserCounters = {};
+    std::vector<readout_parser::ReadoutParserCounters> workerParserCounters;
+};
+
+// Creates the parser callbacks for the given worker. Called once per worker
+// from the calling thread before the workers are started. The callbacks of a
+// worker are only ever invoked from that workers thread.
+using ParallelReplayCallbacksFactory = std::function<
+    readout_parser::ReadoutParserCallbacks (unsigned workerIndex, const CrateConfig &crateConfig)>;
+
+// Replays the listfile stored in the given zip archive. Blocks until all data
+// has been parsed. Throws std::runtime_error if the archive cannot be read or
+// does not contain a listfile with a CrateConfig. Errors occuring on the
+// worker threads are rethrown once all workers have stopped. Exceptions thrown
+// by the parser callbacks are handled by the readout parser as usual.
+MESYTEC_MVLC_EXPORT ParallelReplayResult replay_listfile_parallel(
+    const std::string &archiveName,
+    const ParallelReplayCallbacksFactory &callbacksFactory,
+    const ParallelReplayOptions &options = {});
+
+} // end namespace mvlc
+} // end namespace mesytec
+
+#endif /* __MESYTEC_MVLC_MVLC_PARALLEL_REPLAY_H__ */
@@ -0,0 +1,315 @@
+#include <algorithm>
+#include <cstring>
+#include <random>
+#include <sstream>
+
+#include "gtest/gtest.h"
+#include "mvlc_eth_interface.h"
+#include "mvlc_listfile.h"
+#include "mvlc_listfile_util.h"
+#include "mvlc_listfile_zip.h"
+#include "mvlc_parallel_replay.h"
+#include "vme_constants.h"
+
+using namespace mesytec::mvlc;
+using namespace mesytec::mvlc::readout_parser;
+
+namespace
+{
+
+// Two events: the first with a single prefix/dynamic/suffix module, the
+// second with a prefix only module and a dynamic/suffix module.
+CrateConfig make_test_crate_config(ConnectionType type)
+{
+    StackCommandBuilder sb0("event0");
+    sb0.beginGroup("module0");
+    sb0.addWriteMarker(0x1111u);
+    sb0.addVMEBlockRead(0x00000000u, vme_amods::MBLT64, 0xffff);
+    sb0.addWriteMarker(0x2222u);
+
+    StackCommandBuilder sb1("event1");
+    sb1.beginGroup("module0");
+    sb1.addWriteMarker(0x3333u);
+    sb1.addWriteMarker(0x4444u);
+    sb1.beginGroup("module1");
+    sb1.addVMEBlockRead(0x00000000u, vme_amods::MBLT64, 0xffff);
+    sb1.addWriteMarker(0x5555u);
+
+    CrateConfig result = {};
+    result.connectionType = type;
+    result.stacks = { sb0, sb1 };
+    return result;
+}
+
+// Generates well-formed readout data for make_test_crate_config(). Some
+// events are split into continuation frames and system events are inserted
+// between the events.
+std::vector<u32> make_usb_stream(std::mt19937 &rng, size_t eventCount)
+{
+    std::uniform_int_distribution<unsigned> percent(0, 99);
+    std::uniform_int_distribution<u32> blockLen(0, 20);
+    std::vector<u32> result;
+
+    for (size_t ei=0; ei<eventCount; ++ei)
+    {
+        const u8 stackId = 1 + percent(rng) % 2;
+        std::vector<std::vector<u32>> items;
+
+        items.push_back(stackId == 1 ? std::vector<u32>{ 0x1111 } : std::vector<u32>{ 0x3333, 0x4444 });
+
+        std::vector<u32> block = { 0xF5000000u | blockLen(rng) };
+        for (u32 i=0; i<(block[0] & 0xffff); ++i)
+            block.push_back(0xd0000000u | (ei << 8) | i);
+        items.push_back(block);
+
+        items.push_back({ stackId == 1 ? 0x2222u : 0x5555u });
+
+        const bool split = percent(rng) < 15;
+        std::vector<std::vector<u32>> frames(1);
+
+        for (const auto &item: items)
+        {
+            if (split && !frames.back().empty() && percent(rng) < 50)
+                frames.emplace_back();
+            frames.back().insert(frames.back().end(), item.begin(), item.end());
+        }
+
+        for (size_t fi=0; fi<frames.size(); ++fi)
+        {
+            const u32 type = (fi == 0 ? 0xF3u : 0xF9u);
+            const u32 flags = (fi == frames.size() - 1 ? 0u : frame_flags::Continue);
+            result.push_back((type << frame_headers::TypeShift)
+                             | (flags << frame_headers::FrameFlagsShift)
+                             | (stackId << frame_headers::StackNumShift)
+                             | frames[fi].size());
+            result.insert(result.end(), frames[fi].begin(), frames[fi].end());
+        }
+
+        if (percent(rng) < 2)
+            result.insert(result.end(), { 0xFA000001u, 0x1234u });
+    }
+
+    return result;
+}
+
+// Packs the USB stream into ETH packets of random size. Some packets are lost.
+std::vector<u32> make_eth_stream(std::mt19937 &rng, const std::vector<u32> &stream)
+{
+    std::uniform_int_distribution<unsigned> percent(0, 99);
+    std::uniform_int_distribution<size_t> packetWords(1, 64);
+    std::vector<u32> result;
+    size_t nextFrameHeader = 0u;
+    u32 packetNumber = 0u;
+
+    for (size_t pos=0; pos<stream.size();)
+    {
+        const size_t dataWords = std::min(packetWords(rng), stream.size() - pos);
+        u32 nextHeaderPointer = eth::header1::NoHeaderPointerPresent;
+
+        while (nextFrameHeader < pos)
+            nextFrameHeader += 1 + extract_frame_info(stream[nextFrameHeader]).len;
+
+        if (nextFrameHeader < pos + dataWords)
+            nextHeaderPointer = nextFrameHeader - pos;
+
+        if (percent(rng) >= 1)
+        {
+            result.push_back((static_cast<u32>(eth::PacketChannel::Data) << eth::header0::PacketChannelShift)
+                             | ((packetNumber & eth::header0::PacketNumberMask) << eth::header0::PacketNumberShift)
+                             | static_cast<u32>(dataWords));
+            result.push_back(nextHeaderPointer);
+            result.insert(result.end(), stream.begin() + pos, stream.begin() + pos + dataWords);
+        }
+
+        ++packetNumber;
+        pos += dataWords;
+    }
+
+    return result;
+}
+
+ReadoutParserCallbacks make_recording_callbacks(std::vector<std::string> &events, size_t &systemEvents)
+{
+    ReadoutParserCallbacks callbacks;
+
+    callbacks.eventData = [&events] (int eventIndex, const ModuleData *moduleData, unsigned moduleCount)
+    {
+        std::ostringstream out;
+        out << "event " << eventIndex << ":";
+
+        for (unsigned mi=0; mi<moduleCount; ++mi)
+        {
+            for (const auto &block: { moduleData[mi].prefix, moduleData[mi].dynamic, moduleData[mi].suffix })
+            {
+                out << " [";
+                for (u32 i=0; i<block.size; ++i)
+                    out << " " << std::hex << block.data[i] << std::dec;
+                out << " ]";
+            }
+        }
+
+        events.emplace_back(out.str());
+    };
+
+    callbacks.systemEvent = [&systemEvents] (const u32 *, u32)
+    {
+        ++systemEvents;
+    };
+
+    return callbacks;
+}
+
+// Writes the listfile twice: as an indexed LZ4 entry and as a deflate entry.
+void write_listfile_archive(const std::string &archiveName, const CrateConfig &crateConfig,
+                            const std::vector<u32> &data)
+{
+    listfile::ZipCreator creator;
+    creator.createArchive(archiveName, listfile::ZipCreator::Overwrite);
+
+    for (bool lz4: { true, false })
+    {
+        auto &writeHandle = (lz4
+                             ? *creator.createLZ4Entry("run.mvlclst", 0)
+                             : *creator.createZIPEntry("run_deflate.mvlclst", 1));
+        listfile_write_preamble(writeHandle, crateConfig);
+        writeHandle.write(reinterpret_cast<const u8 *>(data.data()), data.size() * sizeof(u32));
+        creator.closeCurrentEntry();
+    }
+}
+
+} // end anon namespace
+
+TEST(mvlc_parallel_replay, MatchesSequentialParse)
+{
+    std::mt19937 rng(2345);
+    const std::string archiveName = "test_mvlc_parallel_replay.zip";
+
+    for (auto type: { ConnectionType::USB, ConnectionType::ETH })
+    {
+        auto crateConfig = make_test_crate_config(type);
+        auto data = make_usb_stream(rng, 30000);
+
+        if (type == ConnectionType::ETH)
+            data = make_eth_stream(rng, data);
+
+        write_listfile_archive(archiveName, crateConfig, data);
+
+        // Sequential reference parse of the readout data including the
+        // system events written by the preamble.
+        std::vector<u32> preambleData;
+        {
+            ReadoutBuffer buffer;
+            listfile::BufferWriteHandle wh(buffer);
+            listfile_write_preamble(wh, crateConfig);
+            preambleData.resize((buffer.used() - listfile::get_filemagic_len()) / sizeof(u32));
+            std::memcpy(preambleData.data(), buffer.data() + listfile::get_filemagic_len(),
+                        preambleData.size() * sizeof(u32));
+        }
+
+        std::vector<std::string> expectedEvents;
+        size_t expectedSystemEvents = 0u;
+        ReadoutParserCounters expectedCounters = {};
+
+        {
+            auto state = make_readout_parser(crateConfig.stacks);
+            auto callbacks = make_recording_callbacks(expectedEvents, expectedSystemEvents);
+            parse_readout_buffer(type, state, callbacks, expectedCounters, 1,
+                                 preambleData.data(), preambleData.size());
+            parse_readout_buffer(type, state, callbacks, expectedCounters, 2,
+                                 data.data(), data.size());
+        }
+
+        std::sort(expectedEvents.begin(), expectedEvents.end());
+
+        ASSERT_GT(expectedCounters.eventHits[1], 0u);
+        if (type == ConnectionType::ETH)
+            ASSERT_GT(expectedCounters.ethPacketLoss, 0u);
+
+        for (auto entryName: { "run.mvlclst.lz4", "run_deflate.mvlclst" })
+        {
+            const unsigned WorkerCount = 4;
+            std::vector<std::vector<std::string>> workerEvents(WorkerCount);
+            std::vector<size_t> workerSystemEvents(WorkerCount);
+
+            ParallelReplayOptions options;
+            options.workerCount = WorkerCount;
+            options.chunkSize = util::Kilobytes(64);
+            options.bufferSize = util::Kilobytes(4);
+            options.entryName = entryName;
+
+            auto result = replay_listfile_parallel(
+                archiveName,
+                [&] (unsigned workerIndex, const CrateConfig &)
+                {
+                    return make_recording_callbacks(workerEvents[workerIndex], workerSystemEvents[workerIndex]);
+                },
+                options);
+
+            ASSERT_EQ(result.entryName, entryName);
+            ASSERT_EQ(result.listfileFormat, type);
+            ASSERT_EQ(result.crateConfig, crateConfig);
+            ASSERT_EQ(result.parallelDecompression, std::string(entryName) == "run.mvlclst.lz4");
+            ASSERT_GT(result.chunkCount, 8u);
+            ASSERT_EQ(result.bytesRead, (preambleData.size() + data.size()) * sizeof(u32));
+            ASSERT_EQ(result.workerParserCounters.size(), WorkerCount);
+
+            std::vector<std::string> events;
+            size_t systemEvents = 0u;
+
+            for (unsigned wi=0; wi<WorkerCount; ++wi)
+            {
+                events.insert(events.end(), workerEvents[wi].begin(), workerEvents[wi].end());
+                systemEvents += workerSystemEvents[wi];
+            }
+
+            std::sort(events.begin(), events.end());
+
+            ASSERT_EQ(events, expectedEvents);
+            ASSERT_EQ(systemEvents, expectedSystemEvents);
+
+            const auto &counters = result.parserCounters;
+            ASSERT_EQ(counters.eventHits, expectedCounters.eventHits);
+            ASSERT_EQ(counters.groupPrefixHits, expectedCounters.groupPrefixHits);
+            ASSERT_EQ(counters.groupDynamicHits, expectedCounters.groupDynamicHits);
+            ASSERT_EQ(counters.groupSuffixHits, expectedCounters.groupSuffixHits);
+            ASSERT_EQ(counters.systemEvents, expectedCounters.systemEvents);
+            ASSERT_EQ(counters.ethPacketLoss, expectedCounters.ethPacketLoss);
+            ASSERT_EQ(counters.ethPacketsProcessed, expectedCounters.ethPacketsProcessed);
+            ASSERT_EQ(counters.unusedBytes, expectedCounters.unusedBytes);
+            ASSERT_EQ(counters.parserExceptions, expectedCounters.parserExceptions);
+        }
+    }
+}
+
+TEST(mvlc_parallel_replay, Errors)
+{
+    auto factory = [] (unsigned, const CrateConfig &) { return ReadoutParserCallbacks{}; };
+
+    ASSERT_THROW(replay_listfile_parallel("no_such_file.zip", factory), std::runtime_error);
+
+    const std::string archiveName = "test_mvlc_parallel_replay_errors.zip";
+    auto crateConfig = make_test_crate_config(ConnectionType::USB);
+    std::mt19937 rng(1234);
+    write_listfile_archive(archiveName, crateConfig, make_usb_stream(rng, 100));
+
+    ParallelReplayOptions options;
+    options.entryName = "missing.mvlclst";
+    ASSERT_THROW(replay_listfile_parallel(archiveName, factory, options), std::runtime_error);
+
+    // Exceptions thrown by the callbacks end up in the parse results like
+    // with a single parser.
+    auto throwingFactory = [] (unsigned, const CrateConfig &)
+    {
+        ReadoutParserCallbacks callbacks;
+        callbacks.eventData = [] (int, const ModuleData *, unsigned)
+        {
+            throw std::runtime_error("callback error");
+        };
+        return callbacks;
+    };
+
+    options.entryName = {};
+    options.workerCount = 2;
+    auto result = replay_listfile_parallel(archiveName, throwingFactory, options);
+    ASSERT_GT(result.parserCounters.parserExceptions, 0u);
+}
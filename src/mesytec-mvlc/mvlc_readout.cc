@@ -58,15 +58,30 @@
 //
 // Note: max amount to copy is the max length of a frame. That's 2^13 words
 // (32k bytes) for readout frames.
+//
+//
+// Threads
+// -------------------------
+// The readout_worker thread runs the DAQ start/stop sequences and reads from
+// the data pipe into a small pool of receive buffers. It does nothing else
+// with the data so that the kernel receive buffers are drained as fast as
+// possible. The readout_proc thread copies the received data into output
+// buffers, does the USB framing fixup and stack hit counting, writes system
+// events and timeticks and flushes the output buffers to the listfile writer
+// and the snoop queues.
 
 #include "mvlc_readout.h"
 #include "mvlc_constants.h"
 #include "mvlc_listfile.h"
 
+#include <algorithm>
 #include <atomic>
 #include <cstring>
 #include <exception>
+#include <fstream>
 #include <iostream>
+#include <new>
+#include <unordered_map>
 #include <fmt/format.h>
 #include <spdlog/spdlog.h>
 
@@ -77,11 +92,14 @@
 #include "mvlc_dialog_util.h"
 #include "mvlc_eth_interface.h"
 #include "mvlc_factory.h"
+#include "mvlc_frame_scan.h"
 #include "mvlc_listfile_util.h"
 #include "mvlc_usb_interface.h"
 #include "util/future_util.h"
 #include "util/io_util.h"
 #include "util/perf.h"
+#include "util/snapshot_publisher.h"
+#include "util/spsc_queue.h"
 #include "util/storage_sizes.h"
 
 using std::cerr;
@@ -212,6 +230,8 @@ void MESYTEC_MVLC_EXPORT listfile_buffer_writer(
     prctl(PR_SET_NAME,"listfile_writer",0,0,0);
 #endif
 
+    auto threadPolicy = apply_thread_policy("listfile_writer");
+
     auto &filled = bufferQueues.filledBufferQueue();
     auto &empty = bufferQueues.emptyBufferQueue();
 
@@ -224,6 +244,7 @@ void MESYTEC_MVLC_EXPORT listfile_buffer_writer(
         auto state = protectedState.access();
         state->tStart = ListfileWriterCounters::Clock::now();
         state->state = ListfileWriterCounters::Running;
+        state->threadPolicy = threadPolicy;
     }
 
     try
@@ -318,6 +339,31 @@ class ReadoutErrorCategory: public std::error_category
 
 const ReadoutErrorCategory theReadoutErrorCateogry {};
 
+// Write handle for the ReadoutWorker spill file. Throws on error.
+class FileWriteHandle: public listfile::WriteHandle
+{
+    public:
+        explicit FileWriteHandle(const std::string &filename)
+            : m_out(filename, std::ios::binary | std::ios::trunc)
+        {
+            if (!m_out)
+                throw std::runtime_error(fmt::format("could not open {}", filename));
+        }
+
+        size_t write(const u8 *data, size_t size) override
+        {
+            m_out.write(reinterpret_cast<const char *>(data), size);
+
+            if (!m_out)
+                throw std::runtime_error("write failed");
+
+            return size;
+        }
+
+    private:
+        std::ofstream m_out;
+};
+
 } // end anon namespace
 
 std::error_code make_error_code(ReadoutWorkerError error)
@@ -330,6 +376,53 @@ struct ReadoutWorker::Private
     static constexpr size_t ListfileWriterBufferSize = util::Megabytes(1);
     static constexpr size_t ListfileWriterBufferCount = 10;
     static constexpr std::chrono::seconds ShutdownReadoutMaxWait = std::chrono::seconds(10);
+    // Number of output buffers lent to the readout thread at a time.
+    static constexpr size_t ReceiveBufferCount = 4;
+    // Minimum free space for appending a timetick section to a buffer of
+    // readout data.
+    static constexpr size_t TimetickMaxBytes = 64;
+    // Largest partial frame the USB readout carries over to the start of
+    // the next buffer.
+    static constexpr size_t UsbFrameMaxBytes = (frame_headers::LengthMask + 1u) * sizeof(u32);
+
+    // An output buffer lent to the readout thread. The readout thread
+    // receives data directly into the buffer. The processing thread then
+    // flushes the buffer to the listfile writer and the snoop queue without
+    // copying the data.
+    struct ReceiveBuffer
+    {
+        ReadoutBuffer *buffer = nullptr;
+        // True if buffer was taken from the snoop queues.
+        bool isSnoopBuffer = false;
+        // Bytes read from the controller into buffer. For USB this excludes
+        // the partial frame carried over from the previous buffer.
+        size_t bytesRead = 0u;
+        // ETH only: the packets contained in buffer.
+        std::vector<eth::PacketReadResult> packets;
+        // Error code returned by the last read.
+        std::error_code ec;
+        // Time the read into this buffer was started.
+        std::chrono::steady_clock::time_point tReadStart;
+        // Set if buffer had to grow beyond its external memory while reading.
+        bool storageDetached = false;
+        // USB only: the totals of the readout thread framing counters after
+        // this buffer was fixed up.
+        size_t usbFramingErrors = 0u;
+        size_t usbTempMovedBytes = 0u;
+        StackHits usbStackHits = {};
+    };
+
+    // Items passed from the readout thread to the processing thread.
+    struct ProcessingItem
+    {
+        enum class Kind { None, ReadoutData, SystemEvent, EndOfRun };
+
+        Kind kind = Kind::None;
+        ReceiveBuffer *buffer = nullptr; // ReadoutData
+        u8 systemEventSubtype = 0u;      // SystemEvent
+    };
+
+    enum class FlushReason { BufferFull, Latency, SystemEvent };
 
     WaitableProtected<ReadoutWorker::State> state;
     std::atomic<ReadoutWorker::State> desiredState;
@@ -342,24 +435,174 @@ struct ReadoutWorker::Private
     StackCommandBuilder mcstDaqStart;
     StackCommandBuilder mcstDaqStop;
     std::chrono::seconds timeToRun;
-    Protected<Counters> counters;
+
+    // Part of the Counters owned by the readout thread: run state, time
+    // points, errors and the readout thread policy.
+    struct RunCounters
+    {
+        State state = State::Idle;
+        std::chrono::steady_clock::time_point tStart;
+        std::chrono::steady_clock::time_point tEnd;
+        std::chrono::steady_clock::time_point tTerminateStart;
+        std::chrono::steady_clock::time_point tTerminateEnd;
+        std::error_code ec;
+        std::exception_ptr eptr;
+        std::vector<ThreadPolicyResult> threadPolicies;
+    };
+
+    // Each group of counters has a single writer which publishes snapshots
+    // without locking. ReadoutWorker::counters() merges the two snapshots.
+    // runCounters is written by the readout thread, and by
+    // ReadoutWorker::start() before that thread exists. counters is written
+    // by the processing thread while it is running, otherwise by the readout
+    // thread.
+    RunCounters runCounters;
+    SnapshotPublisher<RunCounters> runCountersSnapshot;
+    Counters counters;
+    SnapshotPublisher<Counters> countersSnapshot;
+    std::atomic<std::chrono::milliseconds::rep> countersPublishInterval;
+    std::chrono::steady_clock::time_point tCountersPublished;
     std::thread readoutThread;
-    ReadoutBufferQueues listfileQueues;
+    // Recreated by setListfileBufferAllocation() while idle.
+    std::unique_ptr<ReadoutBufferQueues> listfileQueues;
     listfile::WriteHandle *lfh = nullptr;
-    ReadoutBuffer localBuffer;
+    Protected<ListfileWriterCounters> writerCounters;
+
+    // The readout thread only moves data from the controller into the
+    // output buffers lent to it and passes them on. Stack hit counting,
+    // timeticks and flushing the output buffers happen on the processing
+    // thread.
+    // USB data is read in large chunks ignoring frame boundaries. The
+    // readout thread moves a partial frame at the end of a buffer into
+    // previousData and from there to the start of the next buffer. Doing
+    // this on the processing thread would require copying all data.
+    std::vector<std::unique_ptr<ReceiveBuffer>> receiveBuffers;
+    SPSCQueue<ReceiveBuffer *> freeReceiveBuffers;
+    SPSCQueue<ProcessingItem> processingQueue;
+    // Set by the processing thread. processingFailed is set once
+    // processingError has been stored.
+    std::exception_ptr processingError;
+    std::atomic<bool> processingFailed;
+    std::vector<eth::PacketReadResult> ethPacketResults;
+
+    Protected<FlushPolicy> flushPolicy;
+    // Set by the processing thread from the flush policy. The readout thread
+    // hands off a receive buffer once it holds receiveSize bytes or after
+    // receiveTimeout.
+    std::atomic<size_t> receiveSize;
+    std::atomic<std::chrono::milliseconds::rep> receiveTimeout;
+
+    // Readout thread only: USB frame carry-over and the counters updated by
+    // fixup_usb_buffer().
     ReadoutBuffer previousData;
+    Counters usbCounters;
+
+    // The members below are used by the processing thread only.
     ReadoutBuffer *outputBuffer_ = nullptr;
+    // Receive buffers waiting for an output buffer to become available.
+    std::vector<ReceiveBuffer *> idleReceiveBuffers;
+    std::chrono::steady_clock::time_point tTimetick;
+    // Data rate measurement for adaptive flush sizing.
+    size_t rateWindowBytes = 0u;
+    std::chrono::steady_clock::time_point tRateWindow;
+    // True if outputBuffer_ was taken from the snoop queues, false if it is
+    // one of our own listfile buffers.
+    bool outputBufferIsSnoopBuffer = false;
     u32 nextOutputBufferNumber = 1u;
 
+    // Snoop buffers handed to both the listfile writer and the snoop consumer
+    // are reference counted. The writer releases its reference by returning
+    // the buffer via listfileQueues->emptyBufferQueue(), the snoop consumer
+    // by putting it back onto the snoop empty queue. A snoop buffer is only
+    // reused once both references have been released. Buffers without an
+    // entry are not referenced.
+    std::unordered_map<const ReadoutBuffer *, unsigned> snoopBufferRefs;
+    std::vector<ReadoutBuffer *> freeListfileBuffers;
+
+    // Listfile buffers allocated in addition to the ones in listfileQueues
+    // when the writer falls behind. Each one is allocated like the initial
+    // pool using listfileAllocation.
+    std::unordered_map<const ReadoutBuffer *, std::unique_ptr<ReadoutBufferQueues>> extraListfileBuffers;
+    // Memory of the listfile buffers including the extra ones, checked
+    // against ListfileBufferPolicy::memoryLimit.
+    size_t listfileMemory = 0u;
+    // Memory of the last extra buffer allocated. Used to check the limit
+    // before allocating another one.
+    size_t extraListfileBufferMemory = 0u;
+    // Region bytes of the extra buffers, added to the allocation info.
+    std::atomic<size_t> extraListfileRegionBytes;
+
+    BufferAllocation listfileAllocation;
+    ListfileBufferPolicy listfilePolicy; // changed only while idle
+    std::unique_ptr<listfile::WriteHandle> spillFile;
+
+    // Readout thread -> listfile writer is a single producer, single
+    // consumer setup. Snoop buffers shared with the writer also pass through
+    // these queues, so they need room for those and for the maximum number
+    // of listfile buffers the pool may grow to.
+    std::unique_ptr<ReadoutBufferQueues> makeListfileQueues()
+    {
+        return std::make_unique<ReadoutBufferQueues>(
+            listfileBufferCapacity(), ListfileWriterBufferCount,
+            ReadoutBufferQueues::QueueKind::SPSC,
+            maxListfileBuffers() + snoopQueues.bufferCount(),
+            listfileAllocation);
+    }
+
+    // USB reads need room for a full stream pipe read after the partial
+    // frame carried over from the previous buffer. Sizing the listfile
+    // buffers for this keeps them inside their preallocated memory.
+    size_t listfileBufferCapacity() const
+    {
+        return mvlc.connectionType() == ConnectionType::USB
+            ? usb::USBStreamPipeReadSize + UsbFrameMaxBytes
+            : ListfileWriterBufferSize;
+    }
+
+    // Upper limit for the number of listfile buffers. Each buffer uses at
+    // least listfileBufferCapacity() bytes of memory.
+    size_t maxListfileBuffers() const
+    {
+        return std::max(ListfileWriterBufferCount, listfilePolicy.memoryLimit / listfileBufferCapacity());
+    }
+
+    // Memory allocated for the buffers of the given queues. Contiguous
+    // regions are rounded up to the page size.
+    static size_t allocatedMemory(const ReadoutBufferQueues &queues, size_t bufferCapacity)
+    {
+        const auto &info = queues.allocationInfo();
+
+        if (info.mode == BufferAllocation::Mode::Contiguous && info.regionSize)
+            return info.regionSize;
+
+        return queues.bufferCount() * bufferCapacity;
+    }
+
     Private(MVLC &mvlc_, ReadoutBufferQueues &snoopQueues_)
         : state({})
         , mvlc(mvlc_)
         , snoopQueues(snoopQueues_)
+        , runCountersSnapshot(RunCounters{})
         , counters({})
-        , listfileQueues(ListfileWriterBufferSize, ListfileWriterBufferCount)
-        , localBuffer(ListfileWriterBufferSize)
+        , countersSnapshot(Counters{})
+        , countersPublishInterval(100)
+        , writerCounters({})
+        , freeReceiveBuffers(ReceiveBufferCount)
+        // Room for all receive buffers plus some system events.
+        , processingQueue(ReceiveBufferCount + 16)
+        , processingFailed(false)
+        , flushPolicy({})
+        , receiveSize(ListfileWriterBufferSize)
+        , receiveTimeout(0)
         , previousData(ListfileWriterBufferSize)
-    {}
+        , extraListfileRegionBytes(0u)
+    {
+        // Created here as the queue size depends on listfilePolicy.
+        listfileQueues = makeListfileQueues();
+
+        for (size_t i=0; i<ReceiveBufferCount; ++i)
+            receiveBuffers.emplace_back(std::make_unique<ReceiveBuffer>());
+    }
 
     ~Private()
     {
@@ -367,67 +610,408 @@ struct ReadoutWorker::Private
             readoutThread.join();
     }
 
+    // The new state is published before it becomes visible via
+    // waitableState(), so that anyone waiting for a state change also
+    // observes the counters belonging to it. Must be called from the thread
+    // owning runCounters.
     void setState(const ReadoutWorker::State &state_)
     {
+        runCounters.state = state_;
+        publishRunCounters();
         state.access().ref() = state_;
         desiredState = state_;
-        counters.access()->state = state_;
     }
 
-    ReadoutBuffer *getOutputBuffer()
+    void publishRunCounters()
     {
-        if (!outputBuffer_)
+        while (!runCountersSnapshot.publish(runCounters))
+            std::this_thread::yield();
+    }
+
+    // Makes the current counters available to ReadoutWorker::counters().
+    // Unless forced this happens at most once per countersPublishInterval.
+    // Must be called from the thread currently owning the counters.
+    void publishCounters(bool force = false)
+    {
+        auto now = std::chrono::steady_clock::now();
+
+        if (!force && now - tCountersPublished < std::chrono::milliseconds(countersPublishInterval))
+            return;
+
+        // Copy the ethernet pipe stats into the Counters structure. The
+        // getPipeStats() access is thread-safe in the eth implementation.
+        if (mvlcETH)
+            counters.ethStats = mvlcETH->getPipeStats();
+
+        // Publishing fails if readers are busy copying both of the inactive
+        // snapshots. This is rare, so simply try again for forced updates.
+        while (!countersSnapshot.publish(counters))
+        {
+            if (!force)
+                return;
+            std::this_thread::yield();
+        }
+
+        tCountersPublished = now;
+    }
+
+    // Drops one reference to a shared snoop buffer. Returns true if the
+    // buffer is not referenced anymore.
+    bool releaseSnoopBuffer(const ReadoutBuffer *buffer)
+    {
+        auto it = snoopBufferRefs.find(buffer);
+
+        if (it == snoopBufferRefs.end())
+            return true;
+
+        if (--it->second > 0)
+            return false;
+
+        snoopBufferRefs.erase(it);
+        return true;
+    }
+
+    // Handles a buffer returned by the listfile writer: the writer reference
+    // of snoop buffers is released, our own buffers are made available for
+    // reuse.
+    void reclaimWriterBuffer(ReadoutBuffer *buffer)
+    {
+        if (snoopBufferRefs.count(buffer))
+        {
+            // The snoop consumer returned the buffer before the writer did
+            // and getOutputBuffer() took it off the snoop empty queue. Now
+            // that it is not referenced anymore put it back.
+            if (releaseSnoopBuffer(buffer))
+                snoopQueues.emptyBufferQueue().enqueue(buffer);
+        }
+        else
+            freeListfileBuffers.push_back(buffer);
+
+        // Release the extra buffers once the writer has caught up.
+        if (!extraListfileBuffers.empty()
+            && listfileQueues->filledBufferQueue().size() < ListfileWriterBufferCount / 2)
+        {
+            auto it = std::remove_if(freeListfileBuffers.begin(), freeListfileBuffers.end(),
+                                     [this] (const ReadoutBuffer *b) { return releaseExtraListfileBuffer(b); });
+            freeListfileBuffers.erase(it, freeListfileBuffers.end());
+            counters.listfileBuffersAllocated = ListfileWriterBufferCount + extraListfileBuffers.size();
+        }
+    }
+
+    void reclaimReturnedBuffers()
+    {
+        while (auto buffer = listfileQueues->emptyBufferQueue().dequeue())
+            reclaimWriterBuffer(buffer);
+    }
+
+    // Returns true if a listfile buffer is available without waiting for the
+    // writer. Grows the pool if possible.
+    bool haveFreeListfileBuffer()
+    {
+        reclaimReturnedBuffers();
+
+        const size_t bufferCapacity = listfileBufferCapacity();
+        const size_t growthMemory = std::max(extraListfileBufferMemory, bufferCapacity);
+
+        if (freeListfileBuffers.empty()
+            && listfileMemory + growthMemory <= listfilePolicy.memoryLimit)
+        {
+            std::unique_ptr<ReadoutBufferQueues> queues;
+
+            try
+            {
+                queues = std::make_unique<ReadoutBufferQueues>(
+                    bufferCapacity, 1, ReadoutBufferQueues::QueueKind::SPSC, 0, listfileAllocation);
+                extraListfileBufferMemory = allocatedMemory(*queues, bufferCapacity);
+            }
+            catch (const std::bad_alloc &)
+            {
+                spdlog::warn("ReadoutWorker: could not allocate an additional listfile buffer");
+            }
+
+            if (queues && listfileMemory + extraListfileBufferMemory <= listfilePolicy.memoryLimit)
+            {
+                auto buffer = queues->emptyBufferQueue().dequeue();
+                freeListfileBuffers.push_back(buffer);
+                listfileMemory += extraListfileBufferMemory;
+                extraListfileRegionBytes += queues->allocationInfo().regionSize;
+                extraListfileBuffers.emplace(buffer, std::move(queues));
+
+                const size_t allocated = ListfileWriterBufferCount + extraListfileBuffers.size();
+                counters.listfileBuffersAllocated = allocated;
+                counters.listfileBuffersHighWater = std::max(counters.listfileBuffersHighWater, allocated);
+                counters.listfileMemoryHighWater = std::max(counters.listfileMemoryHighWater, listfileMemory);
+            }
+        }
+
+        return !freeListfileBuffers.empty();
+    }
+
+    // Frees the buffer if it is one of the extra listfile buffers.
+    bool releaseExtraListfileBuffer(const ReadoutBuffer *buffer)
+    {
+        auto it = extraListfileBuffers.find(buffer);
+
+        if (it == extraListfileBuffers.end())
+            return false;
+
+        listfileMemory -= allocatedMemory(*it->second, listfileBufferCapacity());
+        extraListfileRegionBytes -= it->second->allocationInfo().regionSize;
+        extraListfileBuffers.erase(it);
+        return true;
+    }
+
+    ReadoutBuffer *acquireListfileBuffer()
+    {
+        if (!haveFreeListfileBuffer())
+        {
+            counters.listfileBufferWaits++;
+
+            while (freeListfileBuffers.empty())
+                reclaimWriterBuffer(listfileQueues->emptyBufferQueue().dequeue_blocking());
+        }
+
+        auto result = freeListfileBuffers.back();
+        freeListfileBuffers.pop_back();
+        return result;
+    }
+
+    // Called instead of handing a listfile buffer to the writer if no other
+    // buffer would be available afterwards. Drops or spills the buffer
+    // contents according to the ListfileBufferPolicy.
+    void handleListfileOverflow(ReadoutBuffer *buffer)
+    {
+        if (listfilePolicy.overflow == ListfileBufferPolicy::Overflow::Spill)
         {
-            outputBuffer_ = snoopQueues.emptyBufferQueue().dequeue();
+            try
+            {
+                if (!spillFile)
+                {
+                    counters.listfileSpillFilename = fmt::format(
+                        "{}/mvlc_spill_{}.mvlclst", listfilePolicy.spillDirectory,
+                        std::chrono::system_clock::to_time_t(std::chrono::system_clock::now()));
+                    spillFile = std::make_unique<FileWriteHandle>(counters.listfileSpillFilename);
+                    listfile_write_magic(*spillFile, buffer->type());
+                }
 
-            if (!outputBuffer_)
-                outputBuffer_ = &localBuffer;
+                auto view = buffer->viewU8();
+                spillFile->write(view.data(), view.size());
+                counters.listfileSpilledBuffers++;
+                counters.listfileSpilledBytes += view.size();
+                return;
+            }
+            catch (const std::exception &e)
+            {
+                if (spillFile)
+                    spdlog::warn("ReadoutWorker: error writing spill file, dropping data: {}", e.what());
+                else
+                    spdlog::warn("ReadoutWorker: could not create spill file, dropping data: {}", e.what());
+                spillFile.reset();
+                listfilePolicy.overflow = ListfileBufferPolicy::Overflow::Drop;
+            }
+        }
 
-            outputBuffer_->clear();
+        counters.listfileDroppedBuffers++;
+        counters.listfileDroppedBytes += buffer->used();
+    }
+
+    // Returns an empty output buffer: a free snoop buffer if available,
+    // otherwise a listfile buffer. Returns nullptr if wait is false and no
+    // buffer is available without waiting for the listfile writer.
+    ReadoutBuffer *takeOutputBuffer(bool &isSnoopBuffer, bool wait = true)
+    {
+        reclaimReturnedBuffers();
+
+        auto result = snoopQueues.emptyBufferQueue().dequeue();
+
+        // Getting the buffer from the snoop empty queue releases the
+        // snoop consumer reference. If the writer still holds the buffer
+        // use a listfile buffer instead of waiting for the writer.
+        // reclaimWriterBuffer() puts the snoop buffer back once the
+        // writer is done with it.
+        if (result && !releaseSnoopBuffer(result))
+        {
+            counters.listfileSharedBufferSkips++;
+            result = nullptr;
+        }
+
+        isSnoopBuffer = result != nullptr;
+
+        if (!result)
+        {
+            if (wait)
+                result = acquireListfileBuffer();
+            else if (haveFreeListfileBuffer())
+            {
+                result = freeListfileBuffers.back();
+                freeListfileBuffers.pop_back();
+            }
+        }
+
+        if (result)
+        {
+            result->clear();
+            result->setType(mvlc.connectionType());
+        }
+
+        return result;
+    }
+
+    // Returns an unused output buffer to where it was taken from.
+    void returnOutputBuffer(ReadoutBuffer *buffer, bool isSnoopBuffer)
+    {
+        if (isSnoopBuffer)
+            snoopQueues.emptyBufferQueue().enqueue(buffer);
+        else
+            freeListfileBuffers.push_back(buffer);
+    }
+
+    // Output buffer for system events and timeticks written while no readout
+    // data is at hand.
+    ReadoutBuffer *getOutputBuffer()
+    {
+        if (!outputBuffer_)
+        {
+            outputBuffer_ = takeOutputBuffer(outputBufferIsSnoopBuffer);
             outputBuffer_->setBufferNumber(nextOutputBufferNumber++);
-            outputBuffer_->setType(mvlc.connectionType());
         }
 
         return outputBuffer_;
     }
 
-    void maybePutBackSnoopBuffer()
+    // Lends output buffers to the readout thread. Waits for the listfile
+    // writer only if the readout thread would otherwise run out of buffers.
+    void refillReceiveBuffers()
     {
-        if (outputBuffer_ && outputBuffer_ != &localBuffer)
-            snoopQueues.emptyBufferQueue().enqueue(outputBuffer_);
+        while (!idleReceiveBuffers.empty())
+        {
+            auto rb = idleReceiveBuffers.back();
+            const bool wait = idleReceiveBuffers.size() == receiveBuffers.size();
 
-        outputBuffer_ = nullptr;
+            if (!(rb->buffer = takeOutputBuffer(rb->isSnoopBuffer, wait)))
+                break;
+
+            idleReceiveBuffers.pop_back();
+            freeReceiveBuffers.enqueue(rb);
+        }
     }
 
-    void flushCurrentOutputBuffer()
+    // Writes a timetick section if one is due. Uses the free space of the
+    // given buffer of readout data if possible.
+    void maybeWriteTimetick(ReadoutBuffer *dataBuffer = nullptr)
+    {
+        static const auto TimetickInterval = std::chrono::seconds(1);
+
+        const auto now = std::chrono::steady_clock::now();
+
+        if (now - tTimetick < TimetickInterval)
+            return;
+
+        if (dataBuffer)
+        {
+            if (dataBuffer->free() < TimetickMaxBytes)
+                return;
+
+            listfile::BufferWriteHandle wh(*dataBuffer);
+            listfile_write_timestamp_section(wh, system_event::subtype::UnixTimetick);
+        }
+        else
+        {
+            listfile::BufferWriteHandle wh(*getOutputBuffer());
+            listfile_write_timestamp_section(wh, system_event::subtype::UnixTimetick);
+            flushCurrentOutputBuffer(FlushReason::SystemEvent);
+        }
+
+        tTimetick = now;
+
+        // Also copy the ListfileWriterCounters into our
+        // ReadoutWorker::Counters structure.
+        counters.listfileWriterCounters = writerCounters.access().ref();
+    }
+
+    // Hands the current output buffer to the listfile writer and, if it was
+    // taken from the snoop queues, to the snoop consumer. The buffer is shared
+    // by both sides, no copy is made.
+    void flushCurrentOutputBuffer(FlushReason reason)
     {
         if (outputBuffer_ && outputBuffer_->used() > 0)
         {
-            auto listfileBuffer = listfileQueues.emptyBufferQueue().dequeue_blocking();
-            // copy the data and queue it up for the writer thread
-            *listfileBuffer = *outputBuffer_;
-            listfileQueues.filledBufferQueue().enqueue(listfileBuffer);
+            switch (reason)
+            {
+                case FlushReason::BufferFull:
+                    counters.flushesBufferFull++;
+                    break;
+                case FlushReason::Latency:
+                    counters.flushesLatency++;
+                    break;
+                case FlushReason::SystemEvent:
+                    counters.flushesSystemEvent++;
+                    break;
+            }
+
+            // Keep the last free listfile buffer for the next output buffer
+            // unless the policy is to wait for the writer. System events are
+            // always written.
+            if (!outputBufferIsSnoopBuffer
+                && reason != FlushReason::SystemEvent
+                && listfilePolicy.overflow != ListfileBufferPolicy::Overflow::Block
+                && !haveFreeListfileBuffer())
+            {
+                handleListfileOverflow(outputBuffer_);
+                freeListfileBuffers.push_back(outputBuffer_);
+                outputBuffer_ = nullptr;
+                return;
+            }
+
+            // One reference for the writer and one for the snoop consumer.
+            if (outputBufferIsSnoopBuffer)
+                snoopBufferRefs[outputBuffer_] = 2;
 
-            if (outputBuffer_ != &localBuffer)
+            listfileQueues->filledBufferQueue().enqueue(outputBuffer_);
+            counters.listfileQueuedHighWater = std::max(counters.listfileQueuedHighWater,
+                                                        listfileQueues->filledBufferQueue().size());
+
+            if (outputBufferIsSnoopBuffer)
+            {
+                // The buffer is not copied into a listfile buffer, both
+                // sides read the same memory.
+                counters.listfileSharedBuffers++;
+                counters.listfileCopyBytesAvoided += outputBuffer_->used();
                 snoopQueues.filledBufferQueue().enqueue(outputBuffer_);
+            }
             else
-                counters.access()->snoopMissedBuffers++;
+                counters.snoopMissedBuffers++;
+
+            counters.buffersFlushed++;
 
-            counters.access()->buffersFlushed++;
             outputBuffer_ = nullptr;
         }
     }
 
+    std::exception_ptr getProcessingError() const
+    {
+        return processingFailed.load(std::memory_order_acquire) ? processingError : nullptr;
+    }
+
     void loop(std::promise<std::error_code> promise);
     std::error_code startReadout();
     std::error_code terminateReadout();
 
     std::error_code readout(size_t &bytesTransferred);
-    std::error_code readout_usb(usb::MVLC_USB_Interface *mvlcUSB, size_t &bytesTransferred);
-    std::error_code readout_eth(eth::MVLC_ETH_Interface *mvlcETH, size_t &bytesTransferred);
+    std::error_code readout_usb(usb::MVLC_USB_Interface *mvlcUSB, ReadoutBuffer &destBuffer);
+    std::error_code readout_eth(eth::MVLC_ETH_Interface *mvlcETH, ReceiveBuffer &destBuffer);
+
+    void processingLoop();
+    void processReceiveBuffer(ReceiveBuffer &rb);
+    void updateFlushSize(const FlushPolicy &policy);
 };
 
 constexpr std::chrono::seconds ReadoutWorker::Private::ShutdownReadoutMaxWait;
+constexpr size_t ReadoutWorker::Private::ReceiveBufferCount;
+constexpr size_t ReadoutWorker::Private::TimetickMaxBytes;
+constexpr size_t ReadoutWorker::Private::UsbFrameMaxBytes;
+constexpr size_t ReadoutWorker::Private::ListfileWriterBufferSize;
+constexpr size_t ReadoutWorker::Private::ListfileWriterBufferCount;
 
 ReadoutWorker::ReadoutWorker(
     MVLC mvlc,
@@ -481,7 +1065,17 @@ void ReadoutWorker::Private::loop(std::promise<std::error_code> promise)
 
     std::cout << "readout_worker thread starting" << std::endl;
 
-    counters.access().ref() = {}; // reset the readout counters
+    // reset the readout counters
+    counters = {};
+    runCounters.tStart = runCounters.tEnd = {};
+    runCounters.tTerminateStart = runCounters.tTerminateEnd = {};
+    runCounters.ec = {};
+    runCounters.eptr = {};
+    runCounters.threadPolicies = { apply_thread_policy("readout_worker") };
+    processingError = {};
+    processingFailed = false;
+    previousData.clear();
+    usbCounters = {};
 
     // ConnectionType specifics
     this->mvlcETH = nullptr;
@@ -509,6 +1103,7 @@ void ReadoutWorker::Private::loop(std::promise<std::error_code> promise)
                         bytesTransferred))
                 {
                     promise.set_value(ec);
+                    publishCounters(true);
                     setState(State::Idle);
                     return;
                 }
@@ -527,26 +1122,36 @@ void ReadoutWorker::Private::loop(std::promise<std::error_code> promise)
     mvlc.resetStackErrorCounters();
 
     // listfile writer thread
-    Protected<ListfileWriterCounters> writerCounters({});
+    writerCounters.access().ref() = {};
 
     auto writerThread = std::thread(
         listfile_buffer_writer,
         lfh,
-        std::ref(listfileQueues),
+        std::ref(*listfileQueues),
         std::ref(writerCounters));
 
-    const auto TimestampInterval = std::chrono::seconds(1);
-
     auto tStart = std::chrono::steady_clock::now();
-    counters.access()->tStart = tStart;
+
+    runCounters.tStart = tStart;
+    counters.listfileBuffersAllocated = ListfileWriterBufferCount;
+    counters.listfileBuffersHighWater = ListfileWriterBufferCount;
+    listfileMemory = allocatedMemory(*listfileQueues, listfileBufferCapacity());
+    extraListfileBufferMemory = 0u;
+    counters.listfileMemoryHighWater = listfileMemory;
+
+    // Initial flush and receive sizes
+    tRateWindow = tStart;
+    rateWindowBytes = 0u;
+    updateFlushSize(flushPolicy.access().copy());
+
+    // Last publication of the counters by this thread until the processing
+    // thread has been joined.
+    publishCounters(true);
     setState(State::Running);
 
-    // Grab an output buffer and write an initial timestamp into it.
-    {
-        listfile::BufferWriteHandle wh(*getOutputBuffer());
-        listfile_write_timestamp_section(wh, system_event::subtype::BeginRun);
-    }
-    auto tTimestamp = tStart;
+    // The processing thread writes the BeginRun section, then handles the
+    // items queued by the readout code below.
+    auto processingThread = std::thread(&Private::processingLoop, this);
 
     std::error_code ec = startReadout();
 
@@ -554,6 +1159,14 @@ void ReadoutWorker::Private::loop(std::promise<std::error_code> promise)
     // complete.
     promise.set_value(ec);
 
+    auto queue_system_event = [this] (u8 subtype)
+    {
+        ProcessingItem item;
+        item.kind = ProcessingItem::Kind::SystemEvent;
+        item.systemEventSubtype = subtype;
+        processingQueue.enqueue(item);
+    };
+
     if (!ec)
     {
         try
@@ -573,22 +1186,6 @@ void ReadoutWorker::Private::loop(std::promise<std::error_code> promise)
                     }
                 }
 
-                // check if we need to write a timestamp
-                {
-                    auto elapsed = now - tTimestamp;
-
-                    if (elapsed >= TimestampInterval)
-                    {
-                        listfile::BufferWriteHandle wh(*getOutputBuffer());
-                        listfile_write_timestamp_section(wh, system_event::subtype::UnixTimetick);
-                        tTimestamp = now;
-
-                        // Also copy the ListfileWriterCounters into our
-                        // ReadoutWorker::Counters structure.
-                        counters.access()->listfileWriterCounters = writerCounters.access().ref();
-                    }
-                }
-
                 auto state_ = state.access().copy();
 
                 // stay in running state
@@ -609,8 +1206,7 @@ void ReadoutWorker::Private::loop(std::promise<std::error_code> promise)
                 else if (state_ == State::Running && desiredState == State::Paused)
                 {
                     terminateReadout();
-                    listfile::BufferWriteHandle wh(*getOutputBuffer());
-                    listfile_write_timestamp_section(wh, system_event::subtype::Pause);
+                    queue_system_event(system_event::subtype::Pause);
                     setState(State::Paused);
                     std::cout << "MVLC readout paused" << std::endl;
                 }
@@ -618,8 +1214,7 @@ void ReadoutWorker::Private::loop(std::promise<std::error_code> promise)
                 else if (state_ == State::Paused && desiredState == State::Running)
                 {
                     startReadout();
-                    listfile::BufferWriteHandle wh(*getOutputBuffer());
-                    listfile_write_timestamp_section(wh, system_event::subtype::Resume);
+                    queue_system_event(system_event::subtype::Resume);
                     setState(State::Running);
                     std::cout << "MVLC readout resumed" << std::endl;
                 }
@@ -641,19 +1236,25 @@ void ReadoutWorker::Private::loop(std::promise<std::error_code> promise)
                     assert(!"invalid code path");
                 }
 
-                // Check if the listfile writer caught an exception. This can
-                // only happen if we actually do write a listfile.
+                // Check if the listfile writer or the processing thread caught
+                // an exception. The writer can only fail if we actually do
+                // write a listfile.
                 // For now just rethrow the exception and let the outer
                 // try/catch handle it.
                 if (auto eptr = writerCounters.access()->eptr)
                 {
                     std::rethrow_exception(eptr);
                 }
+
+                if (auto eptr = getProcessingError())
+                {
+                    std::rethrow_exception(eptr);
+                }
             }
         }
         catch (...)
         {
-            counters.access()->eptr = std::current_exception();
+            runCounters.eptr = std::current_exception();
         }
     }
 
@@ -668,33 +1269,30 @@ void ReadoutWorker::Private::loop(std::promise<std::error_code> promise)
     auto terminateDuration = std::chrono::duration_cast<std::chrono::milliseconds>(
         tTerminateEnd - tTerminateStart);
 
-    {
-        auto c = counters.access();
-        c->tTerminateStart = tTerminateStart;
-        c->tTerminateEnd = tTerminateEnd;
-    }
+    runCounters.tTerminateStart = tTerminateStart;
+    runCounters.tTerminateEnd = tTerminateEnd;
+    publishRunCounters();
 
     std::cout << "terminateReadout() took " << terminateDuration.count()
         << " ms to complete" << std::endl;
 
-    // Write EndRun and EndOfFile system event sections into a ReadoutBuffer
-    // and immediately flush the buffer.
-    if (writerCounters.access()->state == ListfileWriterCounters::Running)
+    // Let the processing thread handle the remaining data and write the
+    // EndRun and EndOfFile sections.
     {
-        listfile::BufferWriteHandle wh(*getOutputBuffer());
-        listfile_write_timestamp_section(wh, system_event::subtype::EndRun);
-        listfile_write_system_event(wh, system_event::subtype::EndOfFile);
-        flushCurrentOutputBuffer();
+        ProcessingItem item;
+        item.kind = ProcessingItem::Kind::EndOfRun;
+        processingQueue.enqueue(item);
     }
 
-    maybePutBackSnoopBuffer();
+    if (processingThread.joinable())
+        processingThread.join();
 
     // stop the listfile writer
     if (writerCounters.access()->state == ListfileWriterCounters::Running)
     {
-        auto sentinel = listfileQueues.emptyBufferQueue().dequeue_blocking();
+        auto sentinel = acquireListfileBuffer();
         sentinel->clear();
-        listfileQueues.filledBufferQueue().enqueue(sentinel);
+        listfileQueues->filledBufferQueue().enqueue(sentinel);
     }
 
     if (writerThread.joinable())
@@ -702,20 +1300,270 @@ void ReadoutWorker::Private::loop(std::promise<std::error_code> promise)
 
     // Final copy of the listfile writer counters to our
     // ReadoutWorker::Counters structure.
-    counters.access()->listfileWriterCounters = writerCounters.access().ref();
+    counters.listfileWriterCounters = writerCounters.access().ref();
 
     // Record the final tEnd
+    runCounters.tEnd = std::chrono::steady_clock::now();
+    runCounters.ec = ec;
+
+    if (!runCounters.eptr)
+        runCounters.eptr = getProcessingError();
+
+    // Collect the buffers returned by the writer, then check that all of our
+    // own listfile buffers are back. The remaining snoop buffer references
+    // are held by the snoop consumer which is done with them once they are
+    // on the snoop empty queue.
+    reclaimReturnedBuffers();
+
+    freeListfileBuffers.erase(
+        std::remove_if(freeListfileBuffers.begin(), freeListfileBuffers.end(),
+                       [this] (const ReadoutBuffer *b) { return releaseExtraListfileBuffer(b); }),
+        freeListfileBuffers.end());
+    extraListfileBuffers.clear();
+    extraListfileRegionBytes = 0u;
+    spillFile.reset();
+
+    counters.listfileBuffersAllocated = ListfileWriterBufferCount;
+    publishCounters(true);
+
+    assert(std::all_of(snoopBufferRefs.begin(), snoopBufferRefs.end(),
+                       [] (const auto &kv) { return kv.second == 1; }));
+    snoopBufferRefs.clear();
+    assert(freeListfileBuffers.size() == ListfileWriterBufferCount);
+
+    for (auto buffer: freeListfileBuffers)
+        listfileQueues->emptyBufferQueue().enqueue(buffer);
+    freeListfileBuffers.clear();
+
+    setState(State::Idle);
+}
+
+// Handles the items queued by the readout thread: flushes the buffers of
+// readout data to the listfile writer and the snoop queue, writes system
+// event sections and periodic timeticks and lends new output buffers to the
+// readout thread.
+void ReadoutWorker::Private::processingLoop()
+{
+#ifdef __linux__
+    prctl(PR_SET_NAME,"readout_proc",0,0,0);
+#endif
+
+    counters.threadPolicies.emplace_back(apply_thread_policy("readout_proc"));
+
+    // Max time to wait for items before checking for timeticks.
+    static const auto PollInterval = std::chrono::milliseconds(100);
+    // Retry interval if the readout thread is waiting for output buffers.
+    static const auto RefillInterval = std::chrono::milliseconds(1);
+
+    tTimetick = std::chrono::steady_clock::now();
+    idleReceiveBuffers.clear();
+
+    for (auto &rb: receiveBuffers)
+        idleReceiveBuffers.push_back(rb.get());
+
+    auto handle_error = [this] ()
     {
-        auto tEnd = std::chrono::steady_clock::now();
-        auto c = counters.access();
-        c->tEnd = tEnd;
-        c->ec = ec;
+        if (!processingFailed)
+        {
+            processingError = std::current_exception();
+            processingFailed.store(true, std::memory_order_release);
+        }
+    };
+
+    // Write the initial timestamp, then hand out the first output buffers.
+    try
+    {
+        {
+            listfile::BufferWriteHandle wh(*getOutputBuffer());
+            listfile_write_timestamp_section(wh, system_event::subtype::BeginRun);
+        }
+        flushCurrentOutputBuffer(FlushReason::SystemEvent);
+        refillReceiveBuffers();
+    }
+    catch (...)
+    {
+        handle_error();
     }
 
-    // Check that all buffers from the listfile writer queue have been returned.
-    assert(listfileQueues.emptyBufferQueue().size() == ListfileWriterBufferCount);
+    while (true)
+    {
+        auto item = processingQueue.dequeue(
+            idleReceiveBuffers.empty() ? PollInterval : RefillInterval);
+        const auto policy = flushPolicy.access().copy();
 
-    setState(State::Idle);
+        try
+        {
+            // After an error the remaining buffers are handed back to the
+            // readout thread without processing them so that it does not
+            // block.
+            if (!processingFailed)
+            {
+                switch (item.kind)
+                {
+                    case ProcessingItem::Kind::None:
+                        break;
+
+                    case ProcessingItem::Kind::ReadoutData:
+                        processReceiveBuffer(*item.buffer);
+                        break;
+
+                    case ProcessingItem::Kind::SystemEvent:
+                        {
+                            listfile::BufferWriteHandle wh(*getOutputBuffer());
+                            listfile_write_timestamp_section(wh, item.systemEventSubtype);
+                        }
+                        flushCurrentOutputBuffer(FlushReason::SystemEvent);
+                        break;
+
+                    case ProcessingItem::Kind::EndOfRun:
+                        // Write EndRun and EndOfFile system event sections
+                        // into a ReadoutBuffer and immediately flush the
+                        // buffer.
+                        if (writerCounters.access()->state == ListfileWriterCounters::Running)
+                        {
+                            listfile::BufferWriteHandle wh(*getOutputBuffer());
+                            listfile_write_timestamp_section(wh, system_event::subtype::EndRun);
+                            listfile_write_system_event(wh, system_event::subtype::EndOfFile);
+                        }
+                        flushCurrentOutputBuffer(FlushReason::SystemEvent);
+                        break;
+                }
+
+                if (item.kind != ProcessingItem::Kind::EndOfRun)
+                    maybeWriteTimetick();
+
+                updateFlushSize(policy);
+            }
+            else if (item.buffer)
+            {
+                item.buffer->buffer->clear();
+                freeReceiveBuffers.enqueue(item.buffer);
+            }
+
+            if (item.kind != ProcessingItem::Kind::EndOfRun)
+                refillReceiveBuffers();
+
+            publishCounters();
+        }
+        catch (...)
+        {
+            handle_error();
+        }
+
+        if (item.kind == ProcessingItem::Kind::EndOfRun)
+            break;
+    }
+
+    // The readout thread does not read anymore once EndOfRun has been
+    // queued. Take back the buffers lent to it.
+    ReceiveBuffer *rb = nullptr;
+
+    while (freeReceiveBuffers.try_dequeue(rb))
+    {
+        returnOutputBuffer(rb->buffer, rb->isSnoopBuffer);
+        rb->buffer = nullptr;
+    }
+
+    if (outputBuffer_)
+        returnOutputBuffer(outputBuffer_, outputBufferIsSnoopBuffer);
+    outputBuffer_ = nullptr;
+}
+
+// Counts the data received into the buffer and flushes it. The buffer is
+// flushed as is, data is not accumulated across receive buffers: the readout
+// thread already hands off buffers once they reach the flush size or the
+// latency target.
+void ReadoutWorker::Private::processReceiveBuffer(ReceiveBuffer &rb)
+{
+    auto buffer = rb.buffer;
+    rb.buffer = nullptr;
+    idleReceiveBuffers.push_back(&rb);
+
+    if (rb.bytesRead)
+    {
+        counters.buffersRead++;
+        counters.bytesRead += rb.bytesRead;
+        rateWindowBytes += rb.bytesRead;
+    }
+
+    if (rb.ec == ErrorType::Timeout)
+        counters.readTimeouts++;
+
+    if (rb.storageDetached && counters.outputBufferDetaches++ == 0)
+    {
+        spdlog::warn("ReadoutWorker: a {} output buffer outgrew its preallocated memory"
+                     " and was moved to the heap", rb.isSnoopBuffer ? "snoop" : "listfile");
+    }
+
+    if (mvlcUSB)
+    {
+        counters.usbFramingErrors = rb.usbFramingErrors;
+        counters.usbTempMovedBytes = rb.usbTempMovedBytes;
+        counters.bytesCopied = rb.usbTempMovedBytes;
+        counters.stackHits = rb.usbStackHits;
+    }
+    else
+    {
+        for (const auto &result: rb.packets)
+        {
+            if (result.ec == MVLCErrorCode::ShortRead)
+            {
+                counters.ethShortReads++;
+                continue;
+            }
+
+            count_stack_hits(result, counters.stackHits);
+        }
+    }
+
+    if (buffer->empty())
+    {
+        returnOutputBuffer(buffer, rb.isSnoopBuffer);
+        return;
+    }
+
+    buffer->setBufferNumber(nextOutputBufferNumber++);
+    maybeWriteTimetick(buffer);
+
+    outputBuffer_ = buffer;
+    outputBufferIsSnoopBuffer = rb.isSnoopBuffer;
+    flushCurrentOutputBuffer(buffer->used() >= counters.flushSize
+                             ? FlushReason::BufferFull : FlushReason::Latency);
+}
+
+// Updates the data rate estimate and the flush size derived from the policy.
+void ReadoutWorker::Private::updateFlushSize(const FlushPolicy &policy)
+{
+    static const auto RateWindow = std::chrono::milliseconds(100);
+
+    const auto now = std::chrono::steady_clock::now();
+    const auto elapsed = now - tRateWindow;
+
+    if (elapsed >= RateWindow)
+    {
+        const double rate = rateWindowBytes / std::chrono::duration<double>(elapsed).count();
+        // Smooth out bursts.
+        counters.dataRate = counters.dataRate > 0.0 ? 0.5 * (counters.dataRate + rate) : rate;
+        rateWindowBytes = 0u;
+        tRateWindow = now;
+    }
+
+    size_t flushSize = policy.maxFill;
+
+    if (policy.adaptiveSizing)
+    {
+        const double latency = std::chrono::duration<double>(policy.latencyTarget).count();
+        const double adaptive = counters.dataRate * latency;
+        flushSize = std::max(policy.minFill, std::min(static_cast<size_t>(adaptive), policy.maxFill));
+    }
+
+    counters.flushSize = flushSize;
+
+    // The readout thread hands off buffers once they reach the flush size
+    // or after half the latency target, leaving the other half for the
+    // processing side and the consumers.
+    receiveSize = flushSize;
+    receiveTimeout = (policy.latencyTarget / 2).count();
 }
 
 // Start readout or resume after pause
@@ -835,22 +1683,15 @@ inline bool is_valid_readout_frame(const FrameInfo &frameInfo)
             || frameInfo.type == frame_headers::SystemEvent);
 }
 
-// Ensure that the readBuffer contains only complete frames. In other words: if
-// a frame starts then it should fully fit into the readBuffer. Trailing data
-// is moved to the tempBuffer.
-//
 // Walk through the readBuffer following the frame structure. If a partial
 // frame is found at the end of the buffer move the trailing bytes to the
 // tempBuffer and shrink the readBuffer accordingly.
-//
-// Note that invalid data words (ones that do not pass
-// is_valid_readout_frame()) are just skipped and left in the buffer without
-// modification. This has to be taken into account on the analysis side.
-inline void fixup_usb_buffer(
+void fixup_usb_buffer(
     ReadoutBuffer &readBuffer,
     ReadoutBuffer &tempBuffer,
-    Protected<ReadoutWorker::Counters> &counters)
+    ReadoutWorker::Counters &counters)
 {
+    static const FrameTypeSet readoutFrameTypes = readout_frame_types();
     auto view = readBuffer.viewU8();
 
     while (!view.empty())
@@ -860,40 +1701,34 @@ inline void fixup_usb_buffer(
             FrameInfo frameInfo = {};
             u32 frameHeader = 0u;
 
-            while (view.size() >= sizeof(u32))
+            // Skip over words not starting a valid readout frame. This
+            // should not happen if the incoming MVLC data and the readout code
+            // are correct. Each skipped word counts as a framing error.
             {
-                frameHeader = *reinterpret_cast<const u32 *>(&view[0]);
-                // Can peek and check the next frame header
-                frameInfo = extract_frame_info(frameHeader);
+                auto words = reinterpret_cast<const u32 *>(view.data());
+                auto wordsEnd = words + view.size() / sizeof(u32);
+                auto next = words;
 
-                if (is_valid_readout_frame(frameInfo))
-                    break;
+                // Only start the scanner if the frame structure was lost.
+                if (!is_valid_readout_frame(extract_frame_info(*words)))
+                    next = find_frame_type(words, wordsEnd, readoutFrameTypes);
+                const size_t skippedWords = next - words;
 
-#if 0
-                auto offset = &view[0] - readBuffer.data();
-                auto wordOffset = offset / sizeof(u32);
-
-                std::cout << fmt::format(
-                    "!is_valid_readout_frame: buffer #{},  byteOffset={}, "
-                    "wordOffset={}, frameHeader=0x{:008x}",
-                    readBuffer.bufferNumber(),
-                    offset, wordOffset, frameHeader) << std::endl;
-#endif
-                counters.access()->usbFramingErrors++;
-
-                // Unexpected or invalid frame type. This should not happen
-                // if the incoming MVLC data and the readout code are
-                // correct.
-                // Consume the invalid frame header word and try again with the
-                // next word.
-                view.remove_prefix(sizeof(u32));
+                counters.usbFramingErrors += skippedWords;
+                view.remove_prefix(skippedWords * sizeof(u32));
+
+                if (next != wordsEnd)
+                {
+                    frameHeader = *next;
+                    frameInfo = extract_frame_info(frameHeader);
+                }
             }
 
             if (!is_valid_readout_frame(frameInfo))
             {
                 cout << fmt::format("non valid readout frame: frameHeader=0x{:08x}", frameHeader) << endl;
 
-                // The above loop was not able to find a valid readout frame.
+                // The scan above was not able to find a valid readout frame.
                 // Go to the top of the outer loop and let that handle any
                 // possible leftover bytes on the next iteration.
                 continue;
@@ -909,14 +1744,14 @@ inline void fixup_usb_buffer(
                     view.size());
                 tempBuffer.setUsed(view.size());
                 readBuffer.setUsed(readBuffer.used() - view.size());
-                counters.access()->usbTempMovedBytes += view.size();
+                counters.usbTempMovedBytes += view.size();
                 return;
             }
 
             if (frameInfo.type == frame_headers::StackFrame
                 || frameInfo.type == frame_headers::StackContinuation)
             {
-                ++counters.access()->stackHits[frameInfo.stack];
+                ++counters.stackHits[frameInfo.stack];
             }
 
             // Skip over the frameHeader and the frame contents.
@@ -925,8 +1760,6 @@ inline void fixup_usb_buffer(
     }
 }
 
-static const std::chrono::milliseconds FlushBufferTimeout(500);
-
 // Code to add delays after reading from the MVLC.
 #define ENABLE_ARTIFICIAL_READ_DELAYS 0
 
@@ -940,12 +1773,46 @@ std::error_code ReadoutWorker::Private::readout(size_t &bytesTransferred)
 {
     assert(this->mvlcETH || this->mvlcUSB);
 
+    // Blocks if the processing thread is not keeping up.
+    auto rb = freeReceiveBuffers.dequeue_blocking();
+    auto &destBuffer = *rb->buffer;
+    rb->packets.clear();
+    rb->tReadStart = std::chrono::steady_clock::now();
+    const bool externalStorage = destBuffer.hasExternalStorage();
+
     std::error_code ec = {};
 
     if (mvlcUSB)
-        ec = readout_usb(mvlcUSB, bytesTransferred);
+    {
+        // Start with the partial frame left over from the previous buffer.
+        if (previousData.used())
+        {
+            destBuffer.ensureFreeSpace(previousData.used());
+            std::memcpy(destBuffer.data() + destBuffer.used(),
+                        previousData.data(), previousData.used());
+            destBuffer.use(previousData.used());
+            previousData.clear();
+        }
+
+        const size_t carriedOver = destBuffer.used();
+        ec = readout_usb(mvlcUSB, destBuffer);
+        rb->bytesRead = destBuffer.used() - carriedOver;
+
+        fixup_usb_buffer(destBuffer, previousData, usbCounters);
+
+        rb->usbFramingErrors = usbCounters.usbFramingErrors;
+        rb->usbTempMovedBytes = usbCounters.usbTempMovedBytes;
+        rb->usbStackHits = usbCounters.stackHits;
+    }
     else
-        ec = readout_eth(mvlcETH, bytesTransferred);
+    {
+        ec = readout_eth(mvlcETH, *rb);
+        rb->bytesRead = destBuffer.used();
+    }
+
+    rb->ec = ec;
+    rb->storageDetached = externalStorage && !destBuffer.hasExternalStorage();
+    bytesTransferred = rb->bytesRead;
 
 #if ENABLE_ARTIFICIAL_READ_DELAYS == 1
     // Static Delay
@@ -961,60 +1828,46 @@ std::error_code ReadoutWorker::Private::readout(size_t &bytesTransferred)
     if (DebugPostReadoutDelay.count() > 0 && nextOutputBufferNumber > StartDelayBufferNumber)
         std::this_thread::sleep_for(DebugPostReadoutDelay);
 #endif
-    {
-        auto c = counters.access();
-
-        if (bytesTransferred)
-        {
-            c->buffersRead++;
-            c->bytesRead += bytesTransferred;
-        }
-
-        if (ec == ErrorType::Timeout)
-            c->readTimeouts++;
-    }
 
-    flushCurrentOutputBuffer();
+    ProcessingItem item;
+    item.kind = ProcessingItem::Kind::ReadoutData;
+    item.buffer = rb;
+    processingQueue.enqueue(item);
 
     return ec;
 }
 
 std::error_code ReadoutWorker::Private::readout_usb(
     usb::MVLC_USB_Interface *mvlcUSB,
-    size_t &totalBytesTransferred)
+    ReadoutBuffer &destBuffer)
 {
-    auto tStart = std::chrono::steady_clock::now();
-    totalBytesTransferred = 0u;
-    auto destBuffer = getOutputBuffer();
+    using Clock = std::chrono::steady_clock;
+
+    const auto tStart = Clock::now();
+    const auto timeout = std::chrono::milliseconds(receiveTimeout);
+    const size_t handOffSize = receiveSize;
+    // The latency budget starts with the first read returning data.
+    Clock::time_point tFirstData;
+    bool haveData = false;
     std::error_code ec;
 
-    if (previousData.used())
-    {
-        // move bytes from previousData into destBuffer
-        destBuffer->ensureFreeSpace(previousData.used());
-        std::memcpy(destBuffer->data() + destBuffer->used(),
-                    previousData.data(), previousData.used());
-        destBuffer->use(previousData.used());
-        previousData.clear();
-    }
-
-    destBuffer->ensureFreeSpace(usb::USBStreamPipeReadSize);
+    destBuffer.ensureFreeSpace(usb::USBStreamPipeReadSize);
 
-    while (destBuffer->free() >= usb::USBStreamPipeReadSize)
+    while (destBuffer.free() >= usb::USBStreamPipeReadSize)
     {
         const size_t bytesToRead = usb::USBStreamPipeReadSize;
         size_t bytesTransferred = 0u;
+        const auto tRead = Clock::now();
 
         auto dataGuard = mvlc.getLocks().lockData();
         ec = mvlcUSB->read_unbuffered(
             Pipe::Data,
-            destBuffer->data() + destBuffer->used(),
+            destBuffer.data() + destBuffer.used(),
             bytesToRead,
             bytesTransferred);
         dataGuard.unlock();
 
-        destBuffer->use(bytesTransferred);
-        totalBytesTransferred += bytesTransferred;
+        destBuffer.use(bytesTransferred);
 
         if (ec == ErrorType::ConnectionError)
         {
@@ -1022,111 +1875,100 @@ std::error_code ReadoutWorker::Private::readout_usb(
             break;
         }
 
-        auto elapsed = std::chrono::steady_clock::now() - tStart;
+        if (destBuffer.used() >= handOffSize)
+            break;
 
-        if (elapsed >= FlushBufferTimeout)
+        if (bytesTransferred && !haveData)
         {
-            //cerr << "flush buffer timeout reached, leaving reaodut_usb()" << endl;
-            break;
+            tFirstData = tRead;
+            haveData = true;
         }
-    }
-
-    //util::log_buffer(std::cout, destBuffer->viewU32(),
-    //                 fmt::format("usb buffer#{} pre fixup", destBuffer->bufferNumber()),
-    //                 3*60, 3*60);
-
-    //auto preSize = destBuffer->used();
 
-    fixup_usb_buffer(*destBuffer, previousData, counters);
+        const auto now = Clock::now();
 
-    //auto postSize = destBuffer->used();
+        if (!haveData && now - tStart >= timeout)
+            break;
 
-    //util::log_buffer(std::cout, destBuffer->viewU32(),
-    //                 fmt::format("usb buffer#{} post fixup", destBuffer->bufferNumber()),
-    //                 3*60, 3*60);
+        // The pipe read timeout can not be lowered during the readout.
+        // Instead do not start another read which could end after the
+        // latency budget is used up.
+        if (haveData && now - tFirstData + std::chrono::milliseconds(usb::DataPipeReadTimeout_ms) >= timeout)
+            break;
+    }
 
     return ec;
 }
 
 std::error_code ReadoutWorker::Private::readout_eth(
     eth::MVLC_ETH_Interface *mvlcETH,
-    size_t &totalBytesTransferred)
+    ReceiveBuffer &destBuffer)
 {
-    auto tStart = std::chrono::steady_clock::now();
-    totalBytesTransferred = 0u;
-    auto destBuffer = getOutputBuffer();
+    using Clock = std::chrono::steady_clock;
+
+    const auto tStart = Clock::now();
+    const auto timeout = std::chrono::milliseconds(receiveTimeout);
+    const size_t handOffSize = receiveSize;
+    // The latency budget starts with the first received packet. Later
+    // receive calls wait at most for the remainder of the budget.
+    Clock::time_point tFirstData;
     std::error_code ec;
-    std::array<size_t, stacks::StackCount> stackHits = {};
 
+    auto &dest = *destBuffer.buffer;
+    dest.ensureFreeSpace(eth::JumboFrameMaxSize);
+
+    auto dataGuard = mvlc.getLocks().lockData();
+
+    while (dest.free() >= eth::JumboFrameMaxSize)
     {
-        auto dataGuard = mvlc.getLocks().lockData();
+        auto maxWait = std::chrono::milliseconds::max();
 
-        while (destBuffer->free() >= eth::JumboFrameMaxSize)
+        if (!destBuffer.packets.empty())
         {
-            auto result = mvlcETH->read_packet(
-                Pipe::Data,
-                destBuffer->data() + destBuffer->used(),
-                destBuffer->free());
-
-            ec = result.ec;
-            destBuffer->use(result.bytesTransferred);
-            totalBytesTransferred += result.bytesTransferred;
+            // Round up to not spin on sub-millisecond remainders.
+            maxWait = std::chrono::duration_cast<std::chrono::milliseconds>(
+                timeout - (Clock::now() - tFirstData)) + std::chrono::milliseconds(1);
+        }
 
-#if 0
-            if (this->firstPacketDebugDump)
-            {
-                cout << "first received readout eth packet:" << endl;
-                cout << fmt::format("header0=0x{:08x}", result.header0()) << endl;
-                cout << fmt::format("header1=0x{:08x}", result.header1()) << endl;
-                cout << "  packetNumber=" << result.packetNumber() << endl;
-                cout << "  dataWordCount=" << result.dataWordCount() << endl;
-                cout << "  lostPackets=" << result.lostPackets << endl;
-                cout << "  nextHeaderPointer=" << result.nextHeaderPointer() << endl;
-                this->firstPacketDebugDump = false;
-            }
-#endif
+        ec = mvlcETH->read_packets(Pipe::Data, dest, ethPacketResults, maxWait);
 
-            if (result.ec == ErrorType::ConnectionError)
-                return result.ec;
+        if (ec == ErrorType::ConnectionError)
+            return ec;
 
-            if (result.ec == MVLCErrorCode::ShortRead)
-            {
-                counters.access()->ethShortReads++;
-                continue;
-            }
+        // The latency budget ran out. This is not counted as a read timeout.
+        if (ec == ErrorType::Timeout && !destBuffer.packets.empty())
+        {
+            ec = {};
+            break;
+        }
 
-            // Record stack hits in the local counters array.
-            count_stack_hits(result, stackHits);
+        if (destBuffer.packets.empty() && !ethPacketResults.empty())
+            tFirstData = Clock::now();
 
-            // A crude way of handling packets with residual bytes at the end. Just
-            // subtract the residue from buffer->used which means the residual
-            // bytes will be overwritten by the next packets data. This will at
-            // least keep the structure somewhat intact assuming that the
-            // dataWordCount in header0 is correct. Note that this case does not
-            // happen, the MVLC never generates packets with residual bytes.
-            if (unlikely(result.leftoverBytes()))
-            {
-                //std::cout << "Oi! There's residue here!" << std::endl; // TODO: log a warning instead of using cout
-                destBuffer->setUsed(destBuffer->used() - result.leftoverBytes());
-            }
+        // The results point into the destination buffer which is not
+        // reallocated while reading. The processing thread uses them to count stack
+        // hits.
+        destBuffer.packets.insert(
+            destBuffer.packets.end(), ethPacketResults.begin(), ethPacketResults.end());
 
-            auto elapsed = std::chrono::steady_clock::now() - tStart;
+        for (const auto &result: ethPacketResults)
+        {
+            ec = result.ec;
 
-            if (elapsed >= FlushBufferTimeout)
-                break;
+            if (result.ec == ErrorType::ConnectionError)
+                return result.ec;
         }
-    } // with dataGuard
 
-    // Copy the ethernet pipe stats and the stack hits into the Counters
-    // structure. The getPipeStats() access is thread-safe in the eth
-    // implementation.
-    {
-        auto c = counters.access();
+        // Note: residual bytes at the end of packets are dropped by
+        // read_packets(). The MVLC never generates packets with residual
+        // bytes.
+
+        if (dest.used() >= handOffSize)
+            break;
 
-        c->ethStats = mvlcETH->getPipeStats();
+        const auto now = Clock::now();
 
-        for (size_t stack=0; stack<stackHits.size(); ++stack)
-            c->stackHits[stack] += stackHits[stack];
+        if (destBuffer.packets.empty() ? now - tStart >= timeout : now - tFirstData >= timeout)
+            break;
     }
 
     return ec;
@@ -1148,8 +1990,67 @@ WaitableProtected<ReadoutWorker::State> &ReadoutWorker::waitableState()
 
 ReadoutWorker::Counters ReadoutWorker::counters()
 {
-    auto counters = d->counters.access();
-    return counters.copy();
+    auto result = d->countersSnapshot.copy();
+    const auto run = d->runCountersSnapshot.copy();
+
+    result.state = run.state;
+    result.tStart = run.tStart;
+    result.tEnd = run.tEnd;
+    result.tTerminateStart = run.tTerminateStart;
+    result.tTerminateEnd = run.tTerminateEnd;
+    result.ec = run.ec;
+    result.eptr = run.eptr;
+    result.threadPolicies.insert(
+        result.threadPolicies.begin(), run.threadPolicies.begin(), run.threadPolicies.end());
+
+    return result;
+}
+
+void ReadoutWorker::setCountersPublishInterval(const std::chrono::milliseconds &interval)
+{
+    d->countersPublishInterval = interval.count();
+}
+
+void ReadoutWorker::setFlushPolicy(const FlushPolicy &policy)
+{
+    d->flushPolicy.access().ref() = policy;
+}
+
+ReadoutWorker::FlushPolicy ReadoutWorker::flushPolicy() const
+{
+    return d->flushPolicy.access().copy();
+}
+
+std::error_code ReadoutWorker::setListfileBufferAllocation(const BufferAllocation &allocation)
+{
+    if (d->state.access().ref() != State::Idle)
+        return make_error_code(ReadoutWorkerError::ReadoutNotIdle);
+
+    d->listfileAllocation = allocation;
+    d->listfileQueues = d->makeListfileQueues();
+    return {};
+}
+
+BufferAllocationInfo ReadoutWorker::listfileBufferAllocation() const
+{
+    auto result = d->listfileQueues->allocationInfo();
+    result.regionSize += d->extraListfileRegionBytes;
+    return result;
+}
+
+std::error_code ReadoutWorker::setListfileBufferPolicy(const ListfileBufferPolicy &policy)
+{
+    if (d->state.access().ref() != State::Idle)
+        return make_error_code(ReadoutWorkerError::ReadoutNotIdle);
+
+    d->listfilePolicy = policy;
+    d->listfileQueues = d->makeListfileQueues();
+    return {};
+}
+
+ReadoutWorker::ListfileBufferPolicy ReadoutWorker::listfileBufferPolicy() const
+{
+    return d->listfilePolicy;
 }
 
 std::future<std::error_code> ReadoutWorker::start(const std::chrono::seconds &timeToRun)
@@ -1163,6 +2064,11 @@ std::future<std::error_code> ReadoutWorker::start(const std::chrono::seconds &ti
         return f;
     }
 
+    // The previous readout thread has set the Idle state and is about to
+    // exit.
+    if (d->readoutThread.joinable())
+        d->readoutThread.join();
+
     d->setState(State::Starting);
     d->timeToRun = timeToRun;
 
@@ -2,6 +2,7 @@
 #define __MESYTEC_MVLC_MVLC_READOUT_H__
 
 #include <future>
+#include <string>
 #include <vector>
 
 #include "mesytec-mvlc/mesytec-mvlc_export.h"
@@ -11,8 +12,10 @@
 #include "mesytec-mvlc/mvlc_listfile.h"
 #include "mesytec-mvlc/mvlc_readout_config.h"
 #include "mesytec-mvlc/mvlc_stack_executor.h"
+#include "mesytec-mvlc/mvlc_thread_policy.h"
 #include "mesytec-mvlc/readout_buffer_queues.h"
 #include "mesytec-mvlc/util/protected.h"
+#include "mesytec-mvlc/util/storage_sizes.h"
 #include "mvlc_constants.h"
 
 namespace mesytec
@@ -49,6 +52,8 @@ struct MESYTEC_MVLC_EXPORT ListfileWriterCounters
     size_t writes;
     size_t bytesWritten;
     std::exception_ptr eptr;
+    // Effective thread policy of the writer thread.
+    ThreadPolicyResult threadPolicy;
 };
 
 // Usage:
@@ -59,6 +64,10 @@ struct MESYTEC_MVLC_EXPORT ListfileWriterCounters
 // Note: the WriteHandle *lfh may be nullptr in. In this case the writer will
 // still dequeue filled buffers from the queue and immediately re-enqueue them
 // on the empty queue.
+// The buffers passed to the writer may be shared with other consumers, e.g.
+// the snoop side of a ReadoutWorker. The writer does not modify buffer
+// contents and signals that it is done with a buffer by enqueueing it on the
+// empty queue.
 
 void MESYTEC_MVLC_EXPORT listfile_buffer_writer(
     listfile::WriteHandle *lfh,
@@ -126,6 +135,38 @@ class MESYTEC_MVLC_EXPORT ReadoutWorker
             // buffers the analysis side did not see.
             size_t snoopMissedBuffers;
 
+            // Buffers shared between the snoop queue and the listfile writer
+            // are not copied into a separate listfile buffer. Number of shared
+            // buffers and the number of bytes that did not have to be copied.
+            size_t listfileSharedBuffers;
+            size_t listfileCopyBytesAvoided;
+
+            // Number of times a free snoop buffer was skipped because the
+            // listfile writer was still holding on to it. A listfile buffer
+            // is used instead, the readout does not wait for the writer.
+            size_t listfileSharedBufferSkips;
+
+            // Listfile buffer pool, see ListfileBufferPolicy. The number of
+            // buffers currently allocated and the high-water marks of the
+            // allocated buffers, their memory and the number of buffers
+            // queued to the writer.
+            size_t listfileBuffersAllocated;
+            size_t listfileBuffersHighWater;
+            size_t listfileMemoryHighWater;
+            size_t listfileQueuedHighWater;
+
+            // Number of times the readout had to wait for the listfile writer
+            // to return a buffer.
+            size_t listfileBufferWaits;
+
+            // Buffers discarded or written to the spill file because the
+            // pool limit was reached.
+            size_t listfileDroppedBuffers;
+            size_t listfileDroppedBytes;
+            size_t listfileSpilledBuffers;
+            size_t listfileSpilledBytes;
+            std::string listfileSpillFilename;
+
             // Number of times we did not land on an expected frame header
             // while following the framing structure. To recover from this case
             // the readotu data is searched for a new frame header.
@@ -135,6 +176,20 @@ class MESYTEC_MVLC_EXPORT ReadoutWorker
             // the current USB readout buffer only contains full frames.
             size_t usbTempMovedBytes;
 
+            // Readout data bytes copied between buffers. Data is received
+            // directly into the buffers handed to the listfile writer and
+            // the snoop queue. Only partial USB frames are copied from the
+            // end of one buffer to the start of the next.
+            size_t bytesCopied;
+
+            // Number of output buffers that had to grow beyond their
+            // preallocated memory, e.g. the region set up by
+            // setListfileBufferAllocation(), and were moved to the heap. The
+            // listfile buffers are sized so that this does not happen.
+            // Externally backed snoop buffers may be too small for USB
+            // reads.
+            size_t outputBufferDetaches;
+
             // Number of packets received that where shorter than
             // eth::HeaderBytes.
             size_t ethShortReads;
@@ -144,13 +199,76 @@ class MESYTEC_MVLC_EXPORT ReadoutWorker
             // while reading buffered datat from the MVLC.
             size_t readTimeouts;
 
+            // Number of output buffer flushes by reason: the buffer reached
+            // the flush size, the data in the buffer reached the latency
+            // target or a pause/resume/end of run system event was written.
+            size_t flushesBufferFull;
+            size_t flushesLatency;
+            size_t flushesSystemEvent;
+
+            // Flush size currently in effect and the data rate in bytes per
+            // second used to calculate it when adaptive sizing is enabled.
+            size_t flushSize;
+            double dataRate;
+
             std::array<size_t, stacks::StackCount> stackHits = {};
             std::array<eth::PipeStats, PipeCount> ethStats;
             std::error_code ec;
             std::exception_ptr eptr;
             ListfileWriterCounters listfileWriterCounters = {};
+
+            // Effective thread policies of the readout_worker and
+            // readout_proc threads.
+            std::vector<ThreadPolicyResult> threadPolicies;
+        };
+
+        // Controls when buffers of readout data are handed to the listfile
+        // writer and the snoop queues. The defaults flush full 1 MB buffers
+        // or after 500 ms. For low latency online analysis use a short
+        // latencyTarget together with adaptiveSizing.
+        struct FlushPolicy
+        {
+            // Maximum time readout data is held back before being flushed.
+            std::chrono::milliseconds latencyTarget = std::chrono::milliseconds(500);
+
+            // If enabled the flush size is derived from the observed data
+            // rate as rate * latencyTarget, limited to [minFill, maxFill].
+            // Otherwise maxFill is used as the flush size.
+            bool adaptiveSizing = false;
+            size_t minFill = util::Kilobytes(64);
+            size_t maxFill = util::Megabytes(1);
+        };
+
+        // Controls the pool of buffers handed to the listfile writer. If the
+        // writer falls behind, e.g. because the disk stalls, additional
+        // buffers are allocated up to memoryLimit and released again once the
+        // writer has caught up. The overflow policy decides what happens
+        // once the limit is reached.
+        struct ListfileBufferPolicy
+        {
+            enum class Overflow
+            {
+                // Wait for the writer to return a buffer. No data is lost
+                // but the readout stalls.
+                Block,
+                // Discard the data of the buffer.
+                Drop,
+                // Write the data to a listfile in spillDirectory. Falls back
+                // to Drop if the spill file cannot be written.
+                Spill,
+            };
+
+            // Total memory of the listfile buffers including the rounding of
+            // contiguous regions to the page size. The default does not
+            // allow the pool to grow.
+            size_t memoryLimit = util::Megabytes(10);
+            Overflow overflow = Overflow::Block;
+            std::string spillDirectory;
         };
 
+        // Note: buffers taken from the snoopQueues are shared with the
+        // listfile writer thread. Snoop consumers must treat the buffers as
+        // read-only until they are put back onto the empty queue.
         ReadoutWorker(
             MVLC mvlc,
             const std::array<u32, stacks::ReadoutStackCount> &stackTriggers,
@@ -172,7 +290,37 @@ class MESYTEC_MVLC_EXPORT ReadoutWorker
 
         State state() const;
         WaitableProtected<State> &waitableState();
+
+        // Returns a copy of the most recently published counters. The readout
+        // thread publishes the state, time points and errors on state
+        // changes. The processing thread accumulates the remaining counters
+        // and publishes them at most once per publish interval and at the
+        // end of the run. This call does not lock and does not interfere
+        // with either thread.
         Counters counters();
+
+        // Sets the minimum time between counter publications, 100 ms by
+        // default. Each publication copies the counters including the
+        // ethernet pipe stats, so an interval of 0, which publishes after
+        // every readout buffer, is only meant for testing.
+        void setCountersPublishInterval(const std::chrono::milliseconds &interval);
+
+        // Can be changed at any time, also while the readout is running.
+        void setFlushPolicy(const FlushPolicy &policy);
+        FlushPolicy flushPolicy() const;
+
+        // Reallocates the buffers handed to the listfile writer, e.g. as a
+        // contiguous huge page backed region on the NUMA node the writer and
+        // compression threads run on. Only possible while idle. Buffers
+        // added when the pool grows use the same allocation, each in a
+        // region of its own. The reported regionSize includes these regions.
+        std::error_code setListfileBufferAllocation(const BufferAllocation &allocation);
+        BufferAllocationInfo listfileBufferAllocation() const;
+
+        // Only possible while idle.
+        std::error_code setListfileBufferPolicy(const ListfileBufferPolicy &policy);
+        ListfileBufferPolicy listfileBufferPolicy() const;
+
         std::future<std::error_code> start(const std::chrono::seconds &timeToRun = {});
         std::error_code stop();
         std::error_code pause();
@@ -193,6 +341,18 @@ using StackHits = std::array<size_t, stacks::StackCount>;
 // parsed to the end.
 MESYTEC_MVLC_EXPORT bool count_stack_hits(const eth::PacketReadResult &prr, StackHits &stackHits);
 
+// Ensure that the readBuffer contains only complete frames. In other words: if
+// a frame starts then it should fully fit into the readBuffer. Trailing data
+// is moved to the tempBuffer. Used by the ReadoutWorker for USB readouts.
+//
+// Note that invalid data words (ones that do not pass
+// is_valid_readout_frame()) are just skipped and left in the buffer without
+// modification. This has to be taken into account on the analysis side.
+MESYTEC_MVLC_EXPORT void fixup_usb_buffer(
+    ReadoutBuffer &readBuffer,
+    ReadoutBuffer &tempBuffer,
+    ReadoutWorker::Counters &counters);
+
 MESYTEC_MVLC_EXPORT const char *readout_worker_state_to_string(const ReadoutWorker::State &state);
 
 } // end namespace mvlc
@@ -32,6 +32,7 @@
 
 #include "mvlc_buffer_validators.h"
 #include "mvlc_constants.h"
+#include "mvlc_frame_scan.h"
 #include "mvlc_impl_eth.h"
 #include "util/io_util.h"
 #include "util/storage_sizes.h"
@@ -248,16 +249,321 @@ inline void copy_to_workbuffer(
     state.curStackFrame.wordsLeft -= wordsToCopy;
 }
 
+// Zero-copy alternative to copy_to_workbuffer(): used if all words of a span
+// are available in the source. Returns a pointer to the first word of the span
+// in the source.
+inline const u32 *consume_direct(
+    ReadoutParserState &state, basic_string_view<u32> &source, size_t words)
+{
+    if (source.size() < words)
+        throw end_of_buffer();
+
+    const u32 *result = source.data();
+    source.remove_prefix(words);
+    state.curStackFrame.wordsLeft -= words;
+    return result;
+}
+
+inline bool is_module_selected(const ReadoutParserState &state, int eventIndex, int moduleIndex)
+{
+    return state.moduleSelection.empty() || state.moduleSelection[eventIndex][moduleIndex];
+}
+
+// Copies the spans of the current event that point into the input buffer to
+// the workBuffer. Has to be called before returning to the caller with an
+// event in progress as the input buffer is not valid anymore after that.
+inline void move_direct_spans_to_workbuffer(ReadoutParserState &state)
+{
+    auto &dest = state.workBuffer;
+
+    auto move_span = [&dest] (Span &span)
+    {
+        if (!span.data)
+            return;
+
+        ensure_free_space(dest, span.size);
+        std::copy(span.data, span.data + span.size, dest.buffer.data() + dest.used);
+        span.offset = dest.used;
+        span.data = nullptr;
+        dest.used += span.size;
+    };
+
+    for (auto &spans: state.readoutDataSpans)
+    {
+        move_span(spans.prefixSpan);
+        move_span(spans.dynamicSpan);
+        move_span(spans.suffixSpan);
+    }
+
+    // The span currently being filled has to stay at the end of the
+    // workBuffer so that the remaining data can be appended to it. Move it
+    // behind the spans copied above.
+    if (state.moduleIndex < 0
+        || static_cast<size_t>(state.moduleIndex) >= state.readoutDataSpans.size())
+        return;
+
+    // The words of unselected modules are skipped, their spans only track the
+    // parsing progress.
+    if (!is_module_selected(state, state.eventIndex, state.moduleIndex))
+        return;
+
+    auto &spans = state.readoutDataSpans[state.moduleIndex];
+    Span *openSpan = nullptr;
+
+    switch (state.groupParseState)
+    {
+        case ReadoutParserState::Prefix:
+            openSpan = &spans.prefixSpan;
+            break;
+        case ReadoutParserState::Dynamic:
+            openSpan = &spans.dynamicSpan;
+            break;
+        case ReadoutParserState::Suffix:
+            openSpan = &spans.suffixSpan;
+            break;
+    }
+
+    if (openSpan->size && openSpan->offset + openSpan->size != dest.used)
+    {
+        ensure_free_space(dest, openSpan->size);
+        auto begin = dest.buffer.data() + openSpan->offset;
+        std::copy(begin, begin + openSpan->size, dest.buffer.data() + dest.used);
+        openSpan->offset = dest.used;
+        dest.used += openSpan->size;
+    }
+}
+
+// Appends the data block to the batches data vector. If the vector has to
+// grow the blocks already pointing into it are rebased.
+inline const u32 *append_to_batch_data(EventBatch &batch, const DataBlock &block)
+{
+    auto &data = batch.data;
+    const u32 *oldBegin = data.data();
+    const u32 *oldEnd = oldBegin + data.size();
+    const size_t offset = data.size();
+
+    data.insert(data.end(), block.data, block.data + block.size);
+
+    if (data.data() != oldBegin)
+    {
+        auto rebase = [&] (DataBlock &part)
+        {
+            std::less_equal<const u32 *> le;
+
+            if (le(oldBegin, part.data) && le(part.data, oldEnd) && part.data != oldEnd)
+                part.data = data.data() + (part.data - oldBegin);
+        };
+
+        for (auto &moduleData: batch.modules)
+        {
+            rebase(moduleData.prefix);
+            rebase(moduleData.dynamic);
+            rebase(moduleData.suffix);
+        }
+    }
+
+    return data.data() + offset;
+}
+
+// Appends the current event to the eventBatch. Parts assembled in the
+// workBuffer are copied to the batch as the workBuffer is reused for the next
+// event.
+inline void add_event_to_batch(ReadoutParserState &state, unsigned moduleCount)
+{
+    auto &batch = state.eventBatch;
+
+    batch.events.push_back({ state.eventIndex, static_cast<u32>(batch.modules.size()), moduleCount });
+
+    for (unsigned mi = 0; mi < moduleCount; ++mi)
+    {
+        const auto &spans = state.readoutDataSpans[mi];
+        batch.modules.push_back(state.moduleDataBuffer[mi]);
+        auto &moduleData = batch.modules.back();
+
+        if (!spans.prefixSpan.data && moduleData.prefix.size)
+            moduleData.prefix.data = append_to_batch_data(batch, moduleData.prefix);
+
+        if (!spans.dynamicSpan.data && moduleData.dynamic.size)
+            moduleData.dynamic.data = append_to_batch_data(batch, moduleData.dynamic);
+
+        if (!spans.suffixSpan.data && moduleData.suffix.size)
+            moduleData.suffix.data = append_to_batch_data(batch, moduleData.suffix);
+    }
+}
+
+inline void deliver_event_batch(ReadoutParserState &state, ReadoutParserCallbacks &callbacks)
+{
+    if (callbacks.eventBatch && !state.eventBatch.events.empty())
+        callbacks.eventBatch(state.eventBatch);
+
+    state.eventBatch.clear();
+}
+
+// Parsers for events which are completely contained in a single stack frame.
+// The module parsers are specialized for the parts a module consists of and
+// are selected once in make_readout_parser(). They return false if the data
+// does not match the expected structure. In this case the event is parsed
+// again by the generic parser which handles all the error cases.
+//
+// For modules not selected in the ReadoutParserState the data is only checked
+// and skipped, the spans are left empty.
+template<bool HasPrefix, bool HasDynamic, bool HasSuffix, bool Selected>
+bool parse_module_fixed(ReadoutParserState &state, unsigned moduleIndex, const u32 *&iter, const u32 *end)
+{
+    const auto &mrs = state.readoutStructure[state.eventIndex][moduleIndex];
+    auto &spans = state.readoutDataSpans[moduleIndex];
+
+    if (HasPrefix)
+    {
+        if (end - iter < mrs.prefixLen)
+            return false;
+
+        if (Selected)
+            spans.prefixSpan = { 0u, mrs.prefixLen, iter };
+        iter += mrs.prefixLen;
+    }
+
+    if (HasDynamic)
+    {
+        bool isContinued = true;
+
+        while (isContinued)
+        {
+            if (iter == end)
+                return false;
+
+            auto frameInfo = extract_frame_info(*iter);
+
+            if (frameInfo.type != frame_headers::BlockRead || end - iter - 1 < frameInfo.len)
+                return false;
+
+            ++iter;
+
+            isContinued = frameInfo.flags & frame_flags::Continue;
+
+            if (!Selected)
+            {
+                iter += frameInfo.len;
+                continue;
+            }
+
+            if (!isContinued && spans.dynamicSpan.size == 0)
+            {
+                spans.dynamicSpan = { 0u, frameInfo.len, iter };
+                iter += frameInfo.len;
+                break;
+            }
+
+            // The block read data is split into multiple frames and has to be
+            // assembled in the workBuffer.
+            auto &workBuffer = state.workBuffer;
+
+            if (spans.dynamicSpan.size == 0)
+                spans.dynamicSpan.offset = workBuffer.used;
+
+            ensure_free_space(workBuffer, frameInfo.len);
+            std::copy(iter, iter + frameInfo.len, workBuffer.buffer.data() + workBuffer.used);
+            workBuffer.used += frameInfo.len;
+            spans.dynamicSpan.size += frameInfo.len;
+            iter += frameInfo.len;
+        }
+    }
+
+    if (HasSuffix)
+    {
+        if (end - iter < mrs.suffixLen)
+            return false;
+
+        if (Selected)
+            spans.suffixSpan = { 0u, mrs.suffixLen, iter };
+        iter += mrs.suffixLen;
+    }
+
+    return true;
+}
+
+template<bool Selected>
+ReadoutParserState::FixedModuleParser select_fixed_module_parser(const ModuleReadoutStructure &mrs)
+{
+    const unsigned parts = (mrs.prefixLen ? 0b100u : 0u) | (mrs.hasDynamic ? 0b010u : 0u) | (mrs.suffixLen ? 0b001u : 0u);
+
+    switch (parts)
+    {
+        case 0b000: return parse_module_fixed<false, false, false, Selected>;
+        case 0b001: return parse_module_fixed<false, false, true, Selected>;
+        case 0b010: return parse_module_fixed<false, true, false, Selected>;
+        case 0b011: return parse_module_fixed<false, true, true, Selected>;
+        case 0b100: return parse_module_fixed<true, false, false, Selected>;
+        case 0b101: return parse_module_fixed<true, false, true, Selected>;
+        case 0b110: return parse_module_fixed<true, true, false, Selected>;
+        case 0b111: return parse_module_fixed<true, true, true, Selected>;
+    }
+
+    return nullptr;
+}
+
 } // end anon namespace
 
 static const size_t InitialWorkerBufferSize = util::Megabytes(1) / sizeof(u32);
 
 MESYTEC_MVLC_EXPORT ReadoutParserState make_readout_parser(
-    const std::vector<StackCommandBuilder> &readoutStacks)
+    const std::vector<StackCommandBuilder> &readoutStacks,
+    bool useFixedModuleParsers)
+{
+    return make_readout_parser(readoutStacks, ModuleSelection{}, useFixedModuleParsers);
+}
+
+MESYTEC_MVLC_EXPORT ReadoutParserState make_readout_parser(
+    const std::vector<StackCommandBuilder> &readoutStacks,
+    const ModuleSelection &moduleSelection,
+    bool useFixedModuleParsers)
 {
     ReadoutParserState result = {};
     result.readoutStructure = build_readout_structure(readoutStacks);
 
+    // Expand the selection to the full readout structure. Left empty if all
+    // modules are selected.
+    bool allSelected = true;
+
+    for (size_t ei=0; ei<result.readoutStructure.size(); ++ei)
+    {
+        const size_t moduleCount = result.readoutStructure[ei].size();
+        std::vector<bool> eventSelection(moduleCount, true);
+
+        if (ei < moduleSelection.size())
+        {
+            for (size_t mi=0; mi<std::min(moduleCount, moduleSelection[ei].size()); ++mi)
+            {
+                eventSelection[mi] = moduleSelection[ei][mi];
+                allSelected = allSelected && eventSelection[mi];
+            }
+        }
+
+        result.moduleSelection.emplace_back(eventSelection);
+    }
+
+    if (allSelected)
+        result.moduleSelection.clear();
+
+    if (useFixedModuleParsers)
+    {
+        for (size_t ei=0; ei<result.readoutStructure.size(); ++ei)
+        {
+            const auto &moduleStructures = result.readoutStructure[ei];
+            std::vector<ReadoutParserState::FixedModuleParser> parsers;
+
+            for (size_t mi=0; mi<moduleStructures.size(); ++mi)
+            {
+                if (is_module_selected(result, ei, mi))
+                    parsers.push_back(select_fixed_module_parser<true>(moduleStructures[mi]));
+                else
+                    parsers.push_back(select_fixed_module_parser<false>(moduleStructures[mi]));
+            }
+
+            result.fixedModuleParsers.emplace_back(parsers);
+        }
+    }
+
     size_t maxGroupCount = 0;
 
     for (const auto &groupReadoutStructure: result.readoutStructure)
@@ -273,6 +579,108 @@ MESYTEC_MVLC_EXPORT ReadoutParserState make_readout_parser(
     return result;
 }
 
+void add_counters(ReadoutParserCounters &dest, const ReadoutParserCounters &src)
+{
+    auto add_vector = [] (auto &dest, const auto &src)
+    {
+        if (dest.size() < src.size())
+            dest.resize(src.size());
+
+        for (size_t i=0; i<src.size(); ++i)
+            dest[i] += src[i];
+    };
+
+    auto add_hits = [&add_vector] (ReadoutParserCounters::GroupPartHits &dest,
+                                   const ReadoutParserCounters::GroupPartHits &src)
+    {
+        if (dest.size() < src.size())
+            dest.resize(src.size());
+
+        for (size_t ei=0; ei<src.size(); ++ei)
+            add_vector(dest[ei], src[ei]);
+    };
+
+    auto add_sizes = [] (ReadoutParserCounters::GroupPartSizes &dest,
+                         const ReadoutParserCounters::GroupPartSizes &src)
+    {
+        if (dest.size() < src.size())
+            dest.resize(src.size());
+
+        for (size_t ei=0; ei<src.size(); ++ei)
+        {
+            if (dest[ei].size() < src[ei].size())
+                dest[ei].resize(src[ei].size());
+
+            for (size_t mi=0; mi<src[ei].size(); ++mi)
+            {
+                dest[ei][mi].min = std::min(dest[ei][mi].min, src[ei][mi].min);
+                dest[ei][mi].max = std::max(dest[ei][mi].max, src[ei][mi].max);
+                dest[ei][mi].sum += src[ei][mi].sum;
+            }
+        }
+    };
+
+    dest.internalBufferLoss += src.internalBufferLoss;
+    dest.buffersProcessed += src.buffersProcessed;
+    dest.unusedBytes += src.unusedBytes;
+    dest.ethPacketsProcessed += src.ethPacketsProcessed;
+    dest.ethPacketLoss += src.ethPacketLoss;
+
+    for (size_t i=0; i<src.systemEvents.size(); ++i)
+        dest.systemEvents[i] += src.systemEvents[i];
+
+    for (size_t i=0; i<src.parseResults.size(); ++i)
+        dest.parseResults[i] += src.parseResults[i];
+
+    dest.parserExceptions += src.parserExceptions;
+    dest.emptyStackFrames += src.emptyStackFrames;
+    dest.zeroCopyParts += src.zeroCopyParts;
+    dest.workBufferParts += src.workBufferParts;
+
+    add_vector(dest.eventHits, src.eventHits);
+    add_hits(dest.groupPrefixHits, src.groupPrefixHits);
+    add_hits(dest.groupDynamicHits, src.groupDynamicHits);
+    add_hits(dest.groupSuffixHits, src.groupSuffixHits);
+    add_sizes(dest.groupPrefixSizes, src.groupPrefixSizes);
+    add_sizes(dest.groupDynamicSizes, src.groupDynamicSizes);
+    add_sizes(dest.groupSuffixSizes, src.groupSuffixSizes);
+}
+
+void reset_counters(ReadoutParserCounters &counters)
+{
+    auto reset_hits = [] (ReadoutParserCounters::GroupPartHits &hits)
+    {
+        for (auto &moduleHits: hits)
+            std::fill(moduleHits.begin(), moduleHits.end(), 0u);
+    };
+
+    auto reset_sizes = [] (ReadoutParserCounters::GroupPartSizes &sizes)
+    {
+        for (auto &moduleSizes: sizes)
+            std::fill(moduleSizes.begin(), moduleSizes.end(), ReadoutParserCounters::PartSizeInfo{});
+    };
+
+    counters.internalBufferLoss = 0;
+    counters.buffersProcessed = 0;
+    counters.unusedBytes = 0;
+    counters.ethPacketsProcessed = 0;
+    counters.ethPacketLoss = 0;
+    counters.systemEvents.fill(0u);
+    counters.parseResults.fill(0u);
+    counters.parserExceptions = 0;
+    counters.emptyStackFrames = 0;
+    counters.zeroCopyParts = 0;
+    counters.workBufferParts = 0;
+
+    std::fill(counters.eventHits.begin(), counters.eventHits.end(), 0u);
+    reset_hits(counters.groupPrefixHits);
+    reset_hits(counters.groupDynamicHits);
+    reset_hits(counters.groupSuffixHits);
+    reset_sizes(counters.groupPrefixSizes);
+    reset_sizes(counters.groupDynamicSizes);
+    reset_sizes(counters.groupSuffixSizes);
+}
+
 inline void clear_readout_data_spans(std::vector<ModuleReadoutSpans> &spans)
 {
     std::fill(spans.begin(), spans.end(), ModuleReadoutSpans{});
@@ -416,6 +824,139 @@ inline const u32 *find_stack_frame_header(
     return find_stack_frame_header(input, wantedFrameType);
 }
 
+// Transforms the offset based ModuleReadoutSpans of the current event into
+// pointer based ModuleData structures, updates the counters and passes the
+// event on to the callbacks. Clears the event state afterwards.
+inline void flush_event(
+    ReadoutParserState &state,
+    ReadoutParserCallbacks &callbacks,
+    ReadoutParserCounters &counters,
+    unsigned moduleCount)
+{
+    auto update_part_size_info = [] (ReadoutParserCounters::PartSizeInfo &sizeInfo, size_t size)
+    {
+        sizeInfo.min = std::min(sizeInfo.min, static_cast<size_t>(size));
+        sizeInfo.max = std::max(sizeInfo.max, static_cast<size_t>(size));
+        sizeInfo.sum += size;
+    };
+
+    auto make_data_block = [&state, &counters] (const Span &span) -> DataBlock
+    {
+        if (span.size)
+            ++(span.data ? counters.zeroCopyParts : counters.workBufferParts);
+
+        if (span.data)
+            return { span.data, span.size };
+
+        return { state.workBuffer.buffer.data() + span.offset, span.size };
+    };
+
+    const auto ei = state.eventIndex;
+
+    for (unsigned mi = 0; mi < moduleCount; ++mi)
+    {
+        const auto &moduleSpans = state.readoutDataSpans[mi];
+        auto &moduleData = state.moduleDataBuffer[mi];
+
+        if (!is_module_selected(state, ei, mi))
+        {
+            moduleData = {};
+            continue;
+        }
+
+        moduleData.prefix = make_data_block(moduleSpans.prefixSpan);
+        moduleData.dynamic = make_data_block(moduleSpans.dynamicSpan);
+        moduleData.suffix = make_data_block(moduleSpans.suffixSpan);
+
+        if (moduleSpans.prefixSpan.size)
+        {
+            ++counters.groupPrefixHits[ei][mi];
+            update_part_size_info(
+                counters.groupPrefixSizes[ei][mi], moduleSpans.prefixSpan.size);
+        }
+
+        if (moduleSpans.dynamicSpan.size)
+        {
+            ++counters.groupDynamicHits[ei][mi];
+            update_part_size_info(
+                counters.groupDynamicSizes[ei][mi], moduleSpans.dynamicSpan.size);
+        }
+
+        if (moduleSpans.suffixSpan.size)
+        {
+            ++counters.groupSuffixHits[ei][mi];
+            update_part_size_info(
+                counters.groupSuffixSizes[ei][mi], moduleSpans.suffixSpan.size);
+        }
+    }
+
+    if (callbacks.eventBatch)
+        add_event_to_batch(state, moduleCount);
+    else
+        callbacks.eventData(state.eventIndex, state.moduleDataBuffer.data(), moduleCount);
+
+    ++counters.eventHits[state.eventIndex];
+
+    LOG_TRACE("parser_clear_event_state because event is done, eventIndex=%d",
+              state.eventIndex);
+
+    parser_clear_event_state(state);
+}
+
+// Called right after parser_begin_event() with the input placed on the first
+// word after the stack frame header. Returns true if the event was parsed and
+// flushed. Otherwise the parser state and the input are left unmodified.
+inline bool try_parse_fixed_event(
+    ReadoutParserState &state,
+    ReadoutParserCallbacks &callbacks,
+    ReadoutParserCounters &counters,
+    basic_string_view<u32> &input)
+{
+    if (state.fixedModuleParsers.empty())
+        return false;
+
+    const auto &frame = state.curStackFrame;
+
+    if ((frame.info().flags & frame_flags::Continue) || frame.wordsLeft > input.size())
+        return false;
+
+    const auto &moduleParsers = state.fixedModuleParsers[state.eventIndex];
+
+    if (moduleParsers.empty())
+        return false;
+
+    const u32 *iter = input.data();
+    const u32 *end = iter + frame.wordsLeft;
+    const unsigned moduleCount = moduleParsers.size();
+    const size_t workBufferUsed = state.workBuffer.used;
+
+    auto restore_state = [&state, workBufferUsed] ()
+    {
+        clear_readout_data_spans(state.readoutDataSpans);
+        state.workBuffer.used = workBufferUsed;
+    };
+
+    for (unsigned mi = 0; mi < moduleCount; ++mi)
+    {
+        if (!moduleParsers[mi](state, mi, iter, end))
+        {
+            restore_state();
+            return false;
+        }
+    }
+
+    // Leftover data in the stack frame is handled by the generic parser.
+    if (iter != end)
+    {
+        restore_state();
+        return false;
+    }
+
+    input.remove_prefix(end - input.data());
+    flush_event(state, callbacks, counters, moduleCount);
+    return true;
+}
+
 // This is called with an iterator over a full USB buffer or with an iterator
 // limited to the payload of a single UDP packet.
 // A precondition is that the iterator is placed on a mvlc frame header word.
@@ -561,6 +1102,9 @@ ParseResult parse_readout_contents(
                     input.remove_prefix(1); // eat the StackFrame marking the beginning of the event
 
                     assert(is_event_in_progress(state));
+
+                    if (try_parse_fixed_event(state, callbacks, counters, input))
+                        continue;
                 }
             }
 
@@ -607,6 +1151,10 @@ ParseResult parse_readout_contents(
             {
                 auto &moduleSpans = state.readoutDataSpans[state.moduleIndex];
 
+                // The words of unselected modules are skipped. Their spans
+                // only keep track of the number of words consumed.
+                const bool isSelected = is_module_selected(state, state.eventIndex, state.moduleIndex);
+
                 switch (state.groupParseState)
                 {
                     case ReadoutParserState::Prefix:
@@ -623,7 +1171,14 @@ ParseResult parse_readout_contents(
                                     static_cast<u32>(state.curStackFrame.wordsLeft),
                                     static_cast<u32>(input.size())});
 
-                            copy_to_workbuffer(state, input, wordsToCopy);
+                            if (!isSelected)
+                                consume_direct(state, input, wordsToCopy);
+                            // Fast path: the whole prefix is contiguous in the input.
+                            else if (wordsToCopy == moduleParts.prefixLen)
+                                moduleSpans.prefixSpan.data = consume_direct(state, input, wordsToCopy);
+                            else
+                                copy_to_workbuffer(state, input, wordsToCopy);
+
                             moduleSpans.prefixSpan.size += wordsToCopy;
                         }
 
@@ -712,7 +1267,19 @@ ParseResult parse_readout_contents(
                                 static_cast<u32>(state.curBlockFrame.wordsLeft),
                                 static_cast<u32>(input.size()));
 
-                            copy_to_workbuffer(state, input, wordsToCopy);
+                            if (!isSelected)
+                                consume_direct(state, input, wordsToCopy);
+                            // Fast path: a single block frame which is fully
+                            // contained in the input.
+                            else if (moduleSpans.dynamicSpan.size == 0
+                                && wordsToCopy == state.curBlockFrame.wordsLeft
+                                && !(state.curBlockFrame.info().flags & frame_flags::Continue))
+                            {
+                                moduleSpans.dynamicSpan.data = consume_direct(state, input, wordsToCopy);
+                            }
+                            else
+                                copy_to_workbuffer(state, input, wordsToCopy);
+
                             moduleSpans.dynamicSpan.size += wordsToCopy;
                             state.curBlockFrame.wordsLeft -= wordsToCopy;
 
@@ -749,7 +1316,13 @@ ParseResult parse_readout_contents(
                                     static_cast<u32>(state.curStackFrame.wordsLeft),
                                     static_cast<u32>(input.size())});
 
-                            copy_to_workbuffer(state, input, wordsToCopy);
+                            if (!isSelected)
+                                consume_direct(state, input, wordsToCopy);
+                            else if (wordsToCopy == moduleParts.suffixLen)
+                                moduleSpans.suffixSpan.data = consume_direct(state, input, wordsToCopy);
+                            else
+                                copy_to_workbuffer(state, input, wordsToCopy);
+
                             moduleSpans.suffixSpan.size += wordsToCopy;
                         }
 
@@ -772,78 +1345,12 @@ ParseResult parse_readout_contents(
                 ++state.moduleIndex;
             }
 
-            auto update_part_size_info = [] (ReadoutParserCounters::PartSizeInfo &sizeInfo, size_t size)
-            {
-                sizeInfo.min = std::min(sizeInfo.min, static_cast<size_t>(size));
-                sizeInfo.max = std::max(sizeInfo.max, static_cast<size_t>(size));
-                sizeInfo.sum += size;
-            };
-
             if (state.moduleIndex >= static_cast<int>(moduleCount))
             {
                 assert(!state.curBlockFrame);
 
                 // All modules have been processed and the event can be flushed.
-
-
-                // Transform the offset based ModuleReadoutSpans into pointer
-                // based ModuleData structures, then invoke the eventData()
-                // callback.
-                for (unsigned mi = 0; mi < moduleCount; ++mi)
-                {
-                    const auto &moduleSpans = state.readoutDataSpans[mi];
-                    auto &moduleData = state.moduleDataBuffer[mi];
-
-                    moduleData.prefix =
-                    {
-                        state.workBuffer.buffer.data() + moduleSpans.prefixSpan.offset,
-                        moduleSpans.prefixSpan.size
-                    };
-
-                    moduleData.dynamic =
-                    {
-                        state.workBuffer.buffer.data() + moduleSpans.dynamicSpan.offset,
-                        moduleSpans.dynamicSpan.size
-                    };
-
-                    moduleData.suffix =
-                    {
-                        state.workBuffer.buffer.data() + moduleSpans.suffixSpan.offset,
-                        moduleSpans.suffixSpan.size
-                    };
-
-                    const auto partIndex = std::make_pair(state.eventIndex, mi);
-
-                    if (moduleSpans.prefixSpan.size)
-                    {
-                        ++counters.groupPrefixHits[partIndex];
-                        update_part_size_info(
-                            counters.groupPrefixSizes[partIndex], moduleSpans.prefixSpan.size);
-                    }
-
-                    if (moduleSpans.dynamicSpan.size)
-                    {
-                        ++counters.groupDynamicHits[partIndex];
-                        update_part_size_info(
-                            counters.groupDynamicSizes[partIndex], moduleSpans.dynamicSpan.size);
-                    }
-
-                    if (moduleSpans.suffixSpan.size)
-                    {
-                        ++counters.groupSuffixHits[partIndex];
-                        update_part_size_info(
-                            counters.groupSuffixSizes[partIndex], moduleSpans.suffixSpan.size);
-                    }
-                }
-
-                callbacks.eventData(state.eventIndex, state.moduleDataBuffer.data(), moduleCount);
-
-                ++counters.eventHits[state.eventIndex];
-
-                LOG_TRACE("parser_clear_event_state because event is done, eventIndex=%d",
-                          state.eventIndex);
-
-                parser_clear_event_state(state);
+                flush_event(state, callbacks, counters, moduleCount);
             }
 
             if (input.data() == lastIterPosition)
@@ -868,6 +1375,51 @@ inline void count_parse_result(ReadoutParserCounters &counters, const ParseResul
     ++counters.parseResults[static_cast<size_t>(pr)];
 }
 
+// Sizes the per event and per module counters to match the readout structure
+// of the parser. Existing counts are kept if the structure matches.
+inline void ensure_counters_layout(const ReadoutParserState &state, ReadoutParserCounters &counters)
+{
+    const auto &structure = state.readoutStructure;
+
+    auto layout_matches = [&structure] (const ReadoutParserCounters::GroupPartHits &hits)
+    {
+        if (hits.size() != structure.size())
+            return false;
+
+        for (size_t ei=0; ei<structure.size(); ++ei)
+        {
+            if (hits[ei].size() != structure[ei].size())
+                return false;
+        }
+
+        return true;
+    };
+
+    if (counters.eventHits.size() == structure.size()
+        && layout_matches(counters.groupPrefixHits))
+    {
+        return;
+    }
+
+    counters.eventHits.resize(structure.size());
+
+    for (auto parts: { &counters.groupPrefixHits, &counters.groupDynamicHits, &counters.groupSuffixHits })
+    {
+        parts->resize(structure.size());
+
+        for (size_t ei=0; ei<structure.size(); ++ei)
+            (*parts)[ei].resize(structure[ei].size());
+    }
+
+    for (auto parts: { &counters.groupPrefixSizes, &counters.groupDynamicSizes, &counters.groupSuffixSizes })
+    {
+        parts->resize(structure.size());
+
+        for (size_t ei=0; ei<structure.size(); ++ei)
+            (*parts)[ei].resize(structure[ei].size());
+    }
+}
+
 // IMPORTANT: This function assumes that packet loss is handled on the outside
 // (parsing state should be reset on loss).
 // The iterator must be bounded by the packets data.
@@ -991,7 +1543,7 @@ ParseResult parse_readout_buffer(
     return result;
 }
 
-ParseResult parse_readout_buffer_eth(
+ParseResult parse_readout_buffer_eth_impl(
     ReadoutParserState &state,
     ReadoutParserCallbacks &callbacks,
     ReadoutParserCounters &counters,
@@ -1001,6 +1553,8 @@ ParseResult parse_readout_buffer_eth(
 
     LOG_TRACE("begin parsing ETH buffer %u, size=%lu bytes", bufferNumber, bufferBytes);
 
+    ensure_counters_layout(state, counters);
+
     s64 bufferLoss = calc_buffer_loss(bufferNumber, state.lastBufferNumber);
     state.lastBufferNumber = bufferNumber;
 
@@ -1177,7 +1731,10 @@ ParseResult parse_readout_buffer_eth(
             input.remove_prefix(packetWords);
 
             if (input.data() == lastInputPosition)
+            {
+                parser_clear_event_state(state);
                 return ParseResult::ParseEthBufferNotAdvancing;
+            }
         }
     }
     catch (const std::exception &e)
@@ -1201,6 +1758,9 @@ ParseResult parse_readout_buffer_eth(
         throw;
     }
 
+    if (is_event_in_progress(state))
+        move_direct_spans_to_workbuffer(state);
+
     ++counters.buffersProcessed;
     auto unusedBytes = input.size() * sizeof(u32);
     counters.unusedBytes += unusedBytes;
@@ -1211,7 +1771,7 @@ ParseResult parse_readout_buffer_eth(
     return {};
 }
 
-ParseResult parse_readout_buffer_usb(
+ParseResult parse_readout_buffer_usb_impl(
     ReadoutParserState &state,
     ReadoutParserCallbacks &callbacks,
     ReadoutParserCounters &counters,
@@ -1221,6 +1781,8 @@ ParseResult parse_readout_buffer_usb(
 
     LOG_TRACE("begin parsing USB buffer %u, size=%lu bytes", bufferNumber, bufferBytes);
 
+    ensure_counters_layout(state, counters);
+
     s64 bufferLoss = calc_buffer_loss(bufferNumber, state.lastBufferNumber);
     state.lastBufferNumber = bufferNumber;
 
@@ -1270,6 +1832,9 @@ ParseResult parse_readout_buffer_usb(
         throw;
     }
 
+    if (is_event_in_progress(state))
+        move_direct_spans_to_workbuffer(state);
+
     ++counters.buffersProcessed;
     counters.unusedBytes += input.size() * sizeof(u32);
     LOG_TRACE("end parsing USB buffer %u, size=%lu bytes", bufferNumber, bufferBytes);
@@ -1277,6 +1842,473 @@ ParseResult parse_readout_buffer_usb(
     return {};
 }
 
+// Wraps the buffer parsing functions to deliver the events collected for the
+// eventBatch callback. Events parsed before an exception occured are
+// delivered as well.
+template<typename ParseFunction>
+ParseResult parse_with_event_batch(
+    ParseFunction parse,
+    ReadoutParserState &state,
+    ReadoutParserCallbacks &callbacks,
+    ReadoutParserCounters &counters,
+    u32 bufferNumber, const u32 *buffer, size_t bufferWords)
+{
+    state.eventBatch.clear();
+    ParseResult result = {};
+
+    try
+    {
+        result = parse(state, callbacks, counters, bufferNumber, buffer, bufferWords);
+    }
+    catch (...)
+    {
+        deliver_event_batch(state, callbacks);
+        throw;
+    }
+
+    deliver_event_batch(state, callbacks);
+    return result;
+}
+
+ParseResult parse_readout_buffer_eth(
+    ReadoutParserState &state,
+    ReadoutParserCallbacks &callbacks,
+    ReadoutParserCounters &counters,
+    u32 bufferNumber, const u32 *buffer, size_t bufferWords)
+{
+    return parse_with_event_batch(
+        parse_readout_buffer_eth_impl,
+        state, callbacks, counters, bufferNumber, buffer, bufferWords);
+}
+
+ParseResult parse_readout_buffer_usb(
+    ReadoutParserState &state,
+    ReadoutParserCallbacks &callbacks,
+    ReadoutParserCounters &counters,
+    u32 bufferNumber, const u32 *buffer, size_t bufferWords)
+{
+    return parse_with_event_batch(
+        parse_readout_buffer_usb_impl,
+        state, callbacks, counters, bufferNumber, buffer, bufferWords);
+}
+
+ReadoutParserCheckpoint make_checkpoint(const ReadoutParserState &state)
+{
+    ReadoutParserCheckpoint result;
+    result.lastBufferNumber = state.lastBufferNumber;
+    result.lastPacketNumber = state.lastPacketNumber;
+
+    if (!is_event_in_progress(state))
+        return result;
+
+    const size_t moduleCount = state.readoutStructure[state.eventIndex].size();
+
+    result.eventIndex = state.eventIndex;
+    result.moduleIndex = state.moduleIndex;
+    result.groupParseState = state.groupParseState;
+    result.curStackFrame = state.curStackFrame;
+    result.curBlockFrame = state.curBlockFrame;
+    result.readoutDataSpans.assign(
+        state.readoutDataSpans.begin(), state.readoutDataSpans.begin() + moduleCount);
+
+    for (const auto &spans: result.readoutDataSpans)
+    {
+        for (const auto &span: { spans.prefixSpan, spans.dynamicSpan, spans.suffixSpan })
+        {
+            if (span.data)
+                throw std::runtime_error("make_checkpoint: parser is in the middle of a buffer");
+        }
+    }
+
+    result.workBuffer.assign(
+        state.workBuffer.buffer.begin(), state.workBuffer.buffer.begin() + state.workBuffer.used);
+
+    return result;
+}
+
+void restore_checkpoint(ReadoutParserState &state, const ReadoutParserCheckpoint &checkpoint)
+{
+    if (checkpoint.eventIndex >= 0)
+    {
+        if (static_cast<size_t>(checkpoint.eventIndex) >= state.readoutStructure.size())
+            throw std::runtime_error("restore_checkpoint: eventIndex out of range");
+
+        const size_t moduleCount = state.readoutStructure[checkpoint.eventIndex].size();
+
+        if (checkpoint.moduleIndex < 0
+            || static_cast<size_t>(checkpoint.moduleIndex) > moduleCount
+            || checkpoint.readoutDataSpans.size() != moduleCount)
+            throw std::runtime_error("restore_checkpoint: module count mismatch");
+
+        for (const auto &spans: checkpoint.readoutDataSpans)
+        {
+            for (const auto &span: { spans.prefixSpan, spans.dynamicSpan, spans.suffixSpan })
+            {
+                if (span.data || span.offset + span.size > checkpoint.workBuffer.size())
+                    throw std::runtime_error("restore_checkpoint: span exceeds the work buffer");
+            }
+        }
+    }
+
+    parser_clear_event_state(state);
+    clear_readout_data_spans(state.readoutDataSpans);
+    state.workBuffer.used = 0;
+    state.lastBufferNumber = checkpoint.lastBufferNumber;
+    state.lastPacketNumber = checkpoint.lastPacketNumber;
+
+    if (checkpoint.eventIndex < 0)
+        return;
+
+    ensure_free_space(state.workBuffer, checkpoint.workBuffer.size());
+    std::copy(checkpoint.workBuffer.begin(), checkpoint.workBuffer.end(),
+              state.workBuffer.buffer.begin());
+    state.workBuffer.used = checkpoint.workBuffer.size();
+    std::copy(checkpoint.readoutDataSpans.begin(), checkpoint.readoutDataSpans.end(),
+              state.readoutDataSpans.begin());
+
+    state.eventIndex = checkpoint.eventIndex;
+    state.moduleIndex = checkpoint.moduleIndex;
+    state.groupParseState = checkpoint.groupParseState;
+    state.curStackFrame = checkpoint.curStackFrame;
+    state.curBlockFrame = checkpoint.curBlockFrame;
+}
+
+namespace
+{
+
+static const u32 CheckpointMagic = 0x4d564350u; // "MVCP"
+static const u32 CheckpointVersion = 1u;
+static const size_t CheckpointHeaderWords = 13u;
+
+} // end anon namespace
+
+std::vector<u32> serialize_checkpoint(const ReadoutParserCheckpoint &cp)
+{
+    std::vector<u32> result =
+    {
+        CheckpointMagic,
+        CheckpointVersion,
+        cp.lastBufferNumber,
+        static_cast<u32>(cp.lastPacketNumber),
+        static_cast<u32>(cp.eventIndex),
+        static_cast<u32>(cp.moduleIndex),
+        static_cast<u32>(cp.groupParseState),
+        cp.curStackFrame.header,
+        cp.curStackFrame.wordsLeft,
+        cp.curBlockFrame.header,
+        cp.curBlockFrame.wordsLeft,
+        static_cast<u32>(cp.readoutDataSpans.size()),
+        static_cast<u32>(cp.workBuffer.size()),
+    };
+
+    assert(result.size() == CheckpointHeaderWords);
+
+    for (const auto &spans: cp.readoutDataSpans)
+    {
+        for (const auto &span: { spans.prefixSpan, spans.dynamicSpan, spans.suffixSpan })
+        {
+            result.push_back(span.offset);
+            result.push_back(span.size);
+        }
+    }
+
+    result.insert(result.end(), cp.workBuffer.begin(), cp.workBuffer.end());
+
+    return result;
+}
+
+ReadoutParserCheckpoint deserialize_checkpoint(const u32 *data, size_t size)
+{
+    if (size < CheckpointHeaderWords || data[0] != CheckpointMagic)
+        throw std::runtime_error("deserialize_checkpoint: not a readout parser checkpoint");
+
+    if (data[1] != CheckpointVersion)
+        throw std::runtime_error("deserialize_checkpoint: unsupported checkpoint version");
+
+    const size_t spanCount = data[11];
+    const size_t workBufferWords = data[12];
+
+    if (data[6] > ReadoutParserState::Suffix
+        || size != CheckpointHeaderWords + spanCount * 6 + workBufferWords)
+        throw std::runtime_error("deserialize_checkpoint: malformed checkpoint data");
+
+    auto make_frame_state = [] (u32 header, u32 wordsLeft)
+    {
+        ReadoutParserState::FrameParseState result(header);
+        result.wordsLeft = wordsLeft;
+        return result;
+    };
+
+    ReadoutParserCheckpoint result;
+    result.lastBufferNumber = data[2];
+    result.lastPacketNumber = static_cast<s32>(data[3]);
+    result.eventIndex = static_cast<int>(data[4]);
+    result.moduleIndex = static_cast<int>(data[5]);
+    result.groupParseState = static_cast<ReadoutParserState::GroupParseState>(data[6]);
+    result.curStackFrame = make_frame_state(data[7], data[8]);
+    result.curBlockFrame = make_frame_state(data[9], data[10]);
+
+    const u32 *iter = data + CheckpointHeaderWords;
+
+    for (size_t i=0; i<spanCount; ++i, iter += 6)
+    {
+        ModuleReadoutSpans spans = {};
+        spans.prefixSpan = { iter[0], iter[1], nullptr };
+        spans.dynamicSpan = { iter[2], iter[3], nullptr };
+        spans.suffixSpan = { iter[4], iter[5], nullptr };
+        result.readoutDataSpans.push_back(spans);
+    }
+
+    result.workBuffer.assign(iter, iter + workBufferWords);
+
+    return result;
+}
+
+namespace
+{
+
+// Number of consecutive frames or packets which have to be valid for a
+// candidate header to be accepted as a frame or packet boundary.
+static const unsigned ResyncValidationDepth = 4;
+
+// Follows the USB frame structure starting at pos. Returns true if the next
+// ResyncValidationDepth frames, or all frames up to the end of the data, have
+// valid top level frame types and fit into the data.
+bool is_usb_frame_boundary(const u32 *data, size_t size, size_t pos)
+{
+    const auto validTypes = readout_frame_types();
+
+    for (unsigned i=0; i<ResyncValidationDepth && pos < size; ++i)
+    {
+        if (!validTypes.contains(get_frame_type(data[pos])))
+            return false;
+
+        pos += 1 + extract_frame_info(data[pos]).len;
+    }
+
+    return pos <= size;
+}
+
+ResyncPoint find_resync_point_usb(const u32 *data, size_t size, size_t pos)
+{
+    const auto validTypes = readout_frame_types();
+    const u32 *end = data + size;
+    ResyncPoint result;
+
+    // True if the last stack frame or continuation did not have the Continue
+    // flag set, false if unknown or the flag was set.
+    bool eventDone = false;
+    bool synced = false;
+
+    while (pos < size)
+    {
+        if (!synced)
+        {
+            pos = find_frame_type(data + pos, end, validTypes) - data;
+
+            if (pos >= size)
+                break;
+
+            if (!is_usb_frame_boundary(data, size, pos))
+            {
+                ++pos;
+                continue;
+            }
+
+            synced = true;
+            eventDone = false;
+        }
+
+        const auto frameInfo = extract_frame_info(data[pos]);
+
+        if (!validTypes.contains(frameInfo.type))
+        {
+            synced = false;
+            continue;
+        }
+
+        if (frameInfo.type == frame_headers::StackFrame && eventDone)
+        {
+            result.offset = pos;
+            return result;
+        }
+
+        if (frameInfo.type != frame_headers::SystemEvent)
+            eventDone = !(frameInfo.flags & frame_flags::Continue);
+
+        pos += 1 + frameInfo.len;
+    }
+
+    result.offset = size;
+    return result;
+}
+
+inline bool is_eth_packet_header(const u32 *data, size_t size, size_t pos)
+{
+    if (size - pos < eth::HeaderWords)
+        return false;
+
+    eth::PayloadHeaderInfo ethHdrs{ data[pos], data[pos + 1] };
+
+    return ((data[pos] >> (eth::header0::PacketChannelShift + 2)) == 0u
+            && ethHdrs.packetChannel() == static_cast<u16>(eth::PacketChannel::Data)
+            && (!ethHdrs.isNextHeaderPointerPresent()
+                || ethHdrs.nextHeaderPointer() < ethHdrs.dataWordCount())
+            && size - pos >= eth::HeaderWords + ethHdrs.dataWordCount());
+}
+
+// ETH readout data consists of system event frames and data packets.
+inline size_t eth_element_words(const u32 *data, size_t pos)
+{
+    if (get_frame_type(data[pos]) == frame_headers::SystemEvent)
+        return 1 + extract_frame_info(data[pos]).len;
+
+    return eth::HeaderWords + eth::PayloadHeaderInfo{ data[pos], data[pos + 1] }.dataWordCount();
+}
+
+bool is_eth_element_boundary(const u32 *data, size_t size, size_t pos)
+{
+    for (unsigned i=0; i<ResyncValidationDepth && pos < size; ++i)
+    {
+        if (get_frame_type(data[pos]) != frame_headers::SystemEvent
+            && !is_eth_packet_header(data, size, pos))
+            return false;
+
+        pos += eth_element_words(data, pos);
+    }
+
+    return pos <= size;
+}
+
+ResyncPoint find_resync_point_eth(const u32 *data, size_t size, size_t pos)
+{
+    ResyncPoint result;
+
+    bool synced = false;
+    // Packet number of the previous packet or -1 if unknown.
+    s32 lastPacketNumber = -1;
+    // True if the frame structure inside the packets is known, i.e.
+    // frameWordsLeft is the number of words of the current frame continuing
+    // in the next packet.
+    bool framesSynced = false;
+    size_t frameWordsLeft = 0u;
+    // True if the last stack frame or continuation did not have the Continue
+    // flag set.
+    bool eventDone = false;
+
+    while (pos < size)
+    {
+        if (!synced)
+        {
+            if (!is_eth_element_boundary(data, size, pos))
+            {
+                ++pos;
+                continue;
+            }
+
+            synced = true;
+            lastPacketNumber = -1;
+            framesSynced = false;
+        }
+
+        if (get_frame_type(data[pos]) == frame_headers::SystemEvent)
+        {
+            pos += eth_element_words(data, pos);
+            continue;
+        }
+
+        if (!is_eth_packet_header(data, size, pos))
+        {
+            synced = false;
+            continue;
+        }
+
+        eth::PayloadHeaderInfo ethHdrs{ data[pos], data[pos + 1] };
+        const u32 *payload = data + pos + eth::HeaderWords;
+        const size_t payloadWords = ethHdrs.dataWordCount();
+
+        if (lastPacketNumber >= 0 && eth::calc_packet_loss(lastPacketNumber, ethHdrs.packetNumber()))
+            framesSynced = false;
+
+        if (framesSynced && lastPacketNumber >= 0 && frameWordsLeft == 0 && eventDone
+            && payloadWords > 0 && ethHdrs.nextHeaderPointer() == 0
+            && get_frame_type(payload[0]) == frame_headers::StackFrame)
+        {
+            result.offset = pos;
+            result.checkpoint.lastPacketNumber = lastPacketNumber;
+            return result;
+        }
+
+        size_t i = 0u;
+
+        if (framesSynced)
+        {
+            i = std::min(frameWordsLeft, payloadWords);
+            frameWordsLeft -= i;
+
+            // The header pointer has to point to the first frame header
+            // following the continuation data.
+            const bool pointerOk = (i < payloadWords
+                                    ? ethHdrs.nextHeaderPointer() == i
+                                    : !ethHdrs.isNextHeaderPointerPresent());
+
+            if (!pointerOk)
+                framesSynced = false;
+        }
+
+        if (!framesSynced && ethHdrs.isNextHeaderPointerPresent())
+        {
+            i = ethHdrs.nextHeaderPointer();
+            frameWordsLeft = 0u;
+            framesSynced = true;
+            eventDone = false;
+        }
+
+        while (framesSynced && i < payloadWords)
+        {
+            const auto frameInfo = extract_frame_info(payload[i]);
+
+            if (frameInfo.type != frame_headers::StackFrame
+                && frameInfo.type != frame_headers::StackContinuation)
+            {
+                framesSynced = false;
+                break;
+            }
+
+            eventDone = !(frameInfo.flags & frame_flags::Continue);
+            ++i;
+
+            const size_t wordsInPacket = std::min(static_cast<size_t>(frameInfo.len), payloadWords - i);
+            i += wordsInPacket;
+            frameWordsLeft = frameInfo.len - wordsInPacket;
+        }
+
+        lastPacketNumber = ethHdrs.packetNumber();
+        pos += eth::HeaderWords + payloadWords;
+    }
+
+    result.offset = size;
+    return result;
+}
+
+} // end anon namespace
+
+ResyncPoint find_resync_point(
+    ConnectionType bufferType, const u32 *data, size_t size, size_t startOffset)
+{
+    if (startOffset >= size)
+    {
+        ResyncPoint result;
+        result.offset = size;
+        return result;
+    }
+
+    if (bufferType == ConnectionType::ETH)
+        return find_resync_point_eth(data, size, startOffset);
+
+    return find_resync_point_usb(data, size, startOffset);
+}
+
 } // end namespace readout_parser
 } // end namespace mesytec
 } // end namespace mvlc
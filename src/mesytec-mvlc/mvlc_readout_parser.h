@@ -32,6 +32,7 @@
 #include <functional>
 #include <limits>
 #include <unordered_map>
+#include <vector>
 
 #include "mesytec-mvlc/mesytec-mvlc_export.h"
 #include "mesytec-mvlc/mvlc_command_builders.h"
@@ -75,6 +76,37 @@ struct ModuleData
     DataBlock suffix;
 };
 
+// The events parsed from a single input buffer. Each event refers to a
+// consecutive range of entries in the modules vector. Module data that was
+// contiguous in the input buffer points directly into it, other data is
+// stored in the batches data vector. All pointers are only valid for the
+// duration of the eventBatch callback.
+struct EventBatch
+{
+    struct Event
+    {
+        int eventIndex;
+        u32 moduleOffset; // index of the first module of the event in 'modules'
+        u32 moduleCount;
+    };
+
+    std::vector<Event> events;
+    std::vector<ModuleData> modules;
+    std::vector<u32> data;
+
+    inline const ModuleData *moduleData(const Event &event) const
+    {
+        return modules.data() + event.moduleOffset;
+    }
+
+    inline void clear()
+    {
+        events.clear();
+        modules.clear();
+        data.clear();
+    }
+};
+
 struct ReadoutParserCallbacks
 {
     // Parameters: index of the VME event the data belongs to, pointer to an
@@ -83,6 +115,12 @@ struct ReadoutParserCallbacks
     std::function<void (int eventIndex, const ModuleData *moduleDataList, unsigned moduleCount)>
         eventData = [] (int, const ModuleData *, size_t) {};
 
+    // Alternative to eventData: if set the events are collected and passed
+    // as a single batch once the input buffer has been parsed. eventData is
+    // not invoked in this case. Note that systemEvent is still invoked
+    // immediately, i.e. before the batch containing the preceding events.
+    std::function<void (const EventBatch &batch)> eventBatch;
+
     // Parameters: pointer to the system event header, number of words in the
     // system event
     std::function<void (const u32 *header, u32 size)>
@@ -105,6 +143,9 @@ struct Span
 {
     u32 offset;
     u32 size;
+    // If non-null the span refers directly to the data in the input buffer
+    // instead of using offset into the workBuffer.
+    const u32 *data;
 };
 
 struct ModuleReadoutSpans
@@ -154,12 +195,16 @@ enum class ParseResult
 MESYTEC_MVLC_EXPORT const char *get_parse_result_name(const ParseResult &pr);
 
 // Helper enabling the use of std::pair as the key in std::unordered_map.
+// The second hash is mixed into the first so that (a, b) and (b, a) do not
+// collide.
 struct PairHash
 {
     template <typename T1, typename T2>
         std::size_t operator() (const std::pair<T1, T2> &pair) const
         {
-            return std::hash<T1>()(pair.first) ^ std::hash<T2>()(pair.second);
+            std::size_t h = std::hash<T1>()(pair.first);
+            h ^= std::hash<T2>()(pair.second) + 0x9e3779b9u + (h << 6) + (h >> 2);
+            return h;
         }
 };
 
@@ -196,6 +241,13 @@ struct MESYTEC_MVLC_EXPORT ReadoutParserCounters
     // MVLC sometimes generates them.
     u32 emptyStackFrames = 0;
 
+    // Number of module data parts (prefix, dynamic, suffix) passed to the
+    // eventData callback as pointers into the input buffer and number of parts
+    // that had to be assembled in the workBuffer because their data was split
+    // across frames, ETH packets or input buffers.
+    u64 zeroCopyParts = 0;
+    u64 workBufferParts = 0;
+
     struct PartSizeInfo
     {
         size_t min = std::numeric_limits<size_t>::max();
@@ -203,23 +255,37 @@ struct MESYTEC_MVLC_EXPORT ReadoutParserCounters
         size_t sum = 0u;
     };
 
-    using GroupPartHits = std::unordered_map<std::pair<int, int>, size_t, PairHash>;
-    using GroupPartSizes = std::unordered_map<std::pair<int, int>, PartSizeInfo, PairHash>;
+    // The per event and per module counters below are dense arrays indexed by
+    // [eventIndex] and [eventIndex][moduleIndex]. They are sized by the parser
+    // to match its readout structure on the first call to one of the
+    // parse_readout_buffer functions.
+    using GroupPartHits = std::vector<std::vector<size_t>>;
+    using GroupPartSizes = std::vector<std::vector<PartSizeInfo>>;
 
     // Event hit counts by eventIndex
-    std::unordered_map<int, size_t> eventHits;
+    std::vector<size_t> eventHits;
 
-    // Part specific hit counts by (eventIndex, moduleIndex)
+    // Part specific hit counts by [eventIndex][moduleIndex]
     GroupPartHits groupPrefixHits;
     GroupPartHits groupDynamicHits;
     GroupPartHits groupSuffixHits;
 
-    // Part specific event size information by (eventIndex, moduleIndex)
+    // Part specific event size information by [eventIndex][moduleIndex]. Only
+    // valid if the corresponding hit count is non-zero.
     GroupPartSizes groupPrefixSizes;
     GroupPartSizes groupDynamicSizes;
     GroupPartSizes groupSuffixSizes;
 };
 
+// Adds the counts from src to dest. Used to aggregate the counters of
+// multiple parser instances. The size infos are merged by taking the min/max
+// values and adding the sums.
+MESYTEC_MVLC_EXPORT void add_counters(ReadoutParserCounters &dest, const ReadoutParserCounters &src);
+
+// Sets all counts to zero and resets the size infos. The per event and per
+// module vectors keep their layout so that no memory is reallocated.
+MESYTEC_MVLC_EXPORT void reset_counters(ReadoutParserCounters &counters);
+
 struct MESYTEC_MVLC_EXPORT ReadoutParserState
 {
     // Helper structure keeping track of the number of words left in a MVLC
@@ -274,7 +340,9 @@ struct MESYTEC_MVLC_EXPORT ReadoutParserState
     WorkBuffer workBuffer;
 
     // Per module offsets and sizes into the workbuffer. This is a map of the
-    // current layout of the workbuffer.
+    // current layout of the workbuffer. Spans whose data is contiguous in the
+    // input buffer point directly into the input instead. These are moved to
+    // the workbuffer if the event is not complete at the end of the input.
     std::vector<ModuleReadoutSpans> readoutDataSpans;
 
     // Same information as in readoutDataSpans but this time using pointers
@@ -300,15 +368,51 @@ struct MESYTEC_MVLC_EXPORT ReadoutParserState
     // ETH parsing only. The transmitted packet number type is u16. Using an
     // s32 here to represent the "no previous packet" case by storing a -1.
     s32 lastPacketNumber = -1;
+
+    // Events collected for the eventBatch callback.
+    EventBatch eventBatch;
+
+    // Module parsers specialized for the readout structure of each module,
+    // indexed by [eventIndex][moduleIndex]. Used for events that are
+    // contained in a single, complete stack frame. Empty if disabled in
+    // make_readout_parser().
+    using FixedModuleParser = bool (*)(ReadoutParserState &state, unsigned moduleIndex,
+                                       const u32 *&iter, const u32 *end);
+
+    std::vector<std::vector<FixedModuleParser>> fixedModuleParsers;
+
+    // Modules selected for output, indexed by [eventIndex][moduleIndex].
+    // Empty if all modules are selected.
+    std::vector<std::vector<bool>> moduleSelection;
 };
 
+// Per event module selection. The inner vectors are indexed by module and
+// contain true for modules that should be passed to the eventData callback.
+// Missing entries count as selected.
+using ModuleSelection = std::vector<std::vector<bool>>;
+
 // Create a readout parser from a list of readout stack defintions.
 //
 // This function assumes that the first element in the vector contains the
 // definition for the readout stack with id 1, the second the one for stack id
 // 2 and so on. Stack 0 (the direct exec stack) must not be included.
+//
+// If useFixedModuleParsers is true events contained in a single stack frame
+// are parsed by module parsers specialized for the readout structure. The
+// results are identical to the generic parser, this is a pure optimization.
+MESYTEC_MVLC_EXPORT ReadoutParserState make_readout_parser(
+    const std::vector<StackCommandBuilder> &readoutStacks,
+    bool useFixedModuleParsers = true);
+
+// Creates a parser which only outputs the modules selected in
+// moduleSelection. The data of unselected modules is skipped: it is neither
+// copied nor included in the part counters. The eventData callback is still
+// invoked with all modules of the event, unselected ones having empty data
+// blocks.
 MESYTEC_MVLC_EXPORT ReadoutParserState make_readout_parser(
-    const std::vector<StackCommandBuilder> &readoutStacks);
+    const std::vector<StackCommandBuilder> &readoutStacks,
+    const ModuleSelection &moduleSelection,
+    bool useFixedModuleParsers = true);
 
 // Functions for steering the parser. These should be called repeatedly with
 // complete MVLC readout buffers. The input buffer sequence may be lossfull
@@ -333,6 +437,86 @@ MESYTEC_MVLC_EXPORT ParseResult parse_readout_buffer_usb(
     ReadoutParserCounters &counters,
     u32 bufferNumber, const u32 *buffer, size_t bufferWords);
 
+// Checkpoints and resynchronization
+//
+// A checkpoint contains the parser state carried over from one input buffer
+// to the next: the buffer and packet numbers used for loss detection and the
+// data of a partially parsed event. The readout structure, module selection
+// and counters are not part of the checkpoint.
+//
+// Restoring a checkpoint into a parser created from the same readout stacks
+// continues parsing exactly where the checkpointed parser left off.
+
+struct MESYTEC_MVLC_EXPORT ReadoutParserCheckpoint
+{
+    u32 lastBufferNumber = 0;
+    s32 lastPacketNumber = -1;
+
+    // State of the event in progress. eventIndex is -1 if no event is in
+    // progress in which case the remaining members are empty.
+    int eventIndex = -1;
+    int moduleIndex = -1;
+    ReadoutParserState::GroupParseState groupParseState = ReadoutParserState::Prefix;
+    ReadoutParserState::FrameParseState curStackFrame{};
+    ReadoutParserState::FrameParseState curBlockFrame{};
+    std::vector<ModuleReadoutSpans> readoutDataSpans;
+    std::vector<u32> workBuffer;
+};
+
+// Must not be called while a buffer is being parsed, e.g. from within one of
+// the parser callbacks.
+MESYTEC_MVLC_EXPORT ReadoutParserCheckpoint make_checkpoint(const ReadoutParserState &state);
+
+// Throws std::runtime_error if the checkpoint does not match the readout
+// structure of the parser.
+MESYTEC_MVLC_EXPORT void restore_checkpoint(
+    ReadoutParserState &state, const ReadoutParserCheckpoint &checkpoint);
+
+// Conversion to and from a flat sequence of words. deserialize_checkpoint()
+// throws std::runtime_error if the data is not a valid checkpoint.
+MESYTEC_MVLC_EXPORT std::vector<u32> serialize_checkpoint(const ReadoutParserCheckpoint &checkpoint);
+MESYTEC_MVLC_EXPORT ReadoutParserCheckpoint deserialize_checkpoint(const u32 *data, size_t size);
+
+struct ResyncPoint
+{
+    // Word offset of the resync point in the input data. Equal to the size of
+    // the input if no resync point was found.
+    size_t offset = 0u;
+
+    // State of a sequential parser at the resync point. For ETH data this
+    // contains the number of the preceding packet so that packet loss across
+    // the resync point is detected. The caller has to set lastBufferNumber
+    // to the number of the buffer preceding the first buffer it parses.
+    ReadoutParserCheckpoint checkpoint;
+};
+
+// Searches forward from startOffset for a position in a readout data stream,
+// e.g. the contents of a listfile, where a sequential parser has no event in
+// progress. Parsing the data up to and starting from a resync point with
+// separate parsers yields the same events and counters as parsing the whole
+// stream with a single parser. This allows to split the stream into ranges
+// which are parsed concurrently. The total counters are obtained by merging
+// the counters of the parsers using add_counters(). Counters depending on
+// the buffer sizes, e.g. buffersProcessed, are only equal if the buffers
+// used by the sequential parser end on the resync points as well.
+//
+// The search does not require startOffset to be on a frame or packet
+// boundary. Candidate headers are validated by following the structure of
+// the data. Resync points are placed on:
+// - USB: a StackFrame header following a stack frame or continuation without
+//   the Continue flag set.
+// - ETH: the first header word of a packet whose payload starts with a
+//   StackFrame header following a frame without the Continue flag set which
+//   ended in the previous packet. Packet loss (a gap in the packet numbers)
+//   restarts the search.
+//
+// The guarantee only holds for data where the frames of each event match the
+// readout structure. Framing errors make the parsers skip data up to the end
+// of the current buffer or packet so the results depend on where the buffers
+// are split.
+MESYTEC_MVLC_EXPORT ResyncPoint find_resync_point(
+    ConnectionType bufferType, const u32 *data, size_t size, size_t startOffset);
+
 } // end namespace readout_parser
 } // end namespace mvlc
 } // end namespace mesytec
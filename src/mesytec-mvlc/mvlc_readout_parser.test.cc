@@ -0,0 +1,866 @@
+#include <atomic>
+#include <cstring>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "mvlc_readout_parser.h"
+#include "mvlc_eth_interface.h"
+#include "mvlc_readout_parser_util.h"
+#include "vme_constants.h"
+
+using namespace mesytec::mvlc;
+using namespace mesytec::mvlc::readout_parser;
+
+namespace
+{
+
+// One event with one module consisting of a marker prefix, a block read and a
+// marker suffix.
+std::vector<StackCommandBuilder> make_test_stacks()
+{
+    StackCommandBuilder sb("event0");
+    sb.beginGroup("module0");
+    sb.addWriteMarker(0x1111u);
+    sb.addVMEBlockRead(0x00000000u, vme_amods::MBLT64, 0xffff);
+    sb.addWriteMarker(0x2222u);
+    return { sb };
+}
+
+struct EventRecorder
+{
+    std::vector<std::vector<u32>> prefix, dynamic, suffix;
+    std::vector<const u32 *> dataPointers;
+
+    ReadoutParserCallbacks callbacks()
+    {
+        ReadoutParserCallbacks result;
+
+        result.eventData = [this] (int, const ModuleData *moduleData, unsigned moduleCount)
+        {
+            ASSERT_EQ(moduleCount, 1u);
+            const auto &md = moduleData[0];
+            prefix.emplace_back(md.prefix.data, md.prefix.data + md.prefix.size);
+            dynamic.emplace_back(md.dynamic.data, md.dynamic.data + md.dynamic.size);
+            suffix.emplace_back(md.suffix.data, md.suffix.data + md.suffix.size);
+            dataPointers = { md.prefix.data, md.dynamic.data, md.suffix.data };
+        };
+
+        return result;
+    }
+};
+
+} // end anon namespace
+
+TEST(mvlc_readout_parser, ZeroCopyContiguousUSB)
+{
+    std::vector<u32> buffer =
+    {
+        0xF3010006, // stack frame, stack 1, len 6
+        0x1111,
+        0xF5000003, // block frame, len 3
+        0xd1, 0xd2, 0xd3,
+        0x2222,
+    };
+
+    auto state = make_readout_parser(make_test_stacks());
+    ReadoutParserCounters counters = {};
+    EventRecorder recorder;
+    auto callbacks = recorder.callbacks();
+
+    auto pr = parse_readout_buffer_usb(state, callbacks, counters, 1, buffer.data(), buffer.size());
+
+    ASSERT_EQ(pr, ParseResult::Ok);
+    ASSERT_EQ(recorder.prefix.size(), 1u);
+    ASSERT_EQ(recorder.prefix[0], std::vector<u32>({ 0x1111 }));
+    ASSERT_EQ(recorder.dynamic[0], std::vector<u32>({ 0xd1, 0xd2, 0xd3 }));
+    ASSERT_EQ(recorder.suffix[0], std::vector<u32>({ 0x2222 }));
+
+    // All parts point straight into the input buffer.
+    ASSERT_EQ(recorder.dataPointers[0], buffer.data() + 1);
+    ASSERT_EQ(recorder.dataPointers[1], buffer.data() + 3);
+    ASSERT_EQ(recorder.dataPointers[2], buffer.data() + 6);
+    ASSERT_EQ(counters.zeroCopyParts, 3u);
+    ASSERT_EQ(counters.workBufferParts, 0u);
+}
+
+TEST(mvlc_readout_parser, SplitEventAcrossUSBBuffers)
+{
+    std::vector<u32> buffer0 =
+    {
+        0xF3810004, // stack frame with continue flag, len 4
+        0x1111,
+        0xF5800002, // block frame with continue flag, len 2
+        0xd1, 0xd2,
+    };
+
+    std::vector<u32> buffer1 =
+    {
+        0xF9010003, // stack continuation, len 3
+        0xF5000001, // block frame, len 1
+        0xd3,
+        0x2222,
+    };
+
+    auto state = make_readout_parser(make_test_stacks());
+    ReadoutParserCounters counters = {};
+    EventRecorder recorder;
+    auto callbacks = recorder.callbacks();
+
+    ASSERT_EQ(parse_readout_buffer_usb(state, callbacks, counters, 1, buffer0.data(), buffer0.size()),
+              ParseResult::Ok);
+    ASSERT_TRUE(recorder.prefix.empty());
+
+    // The first buffer is reused by the producer. The parser must not refer
+    // to its contents anymore.
+    std::fill(buffer0.begin(), buffer0.end(), 0u);
+
+    ASSERT_EQ(parse_readout_buffer_usb(state, callbacks, counters, 2, buffer1.data(), buffer1.size()),
+              ParseResult::Ok);
+
+    ASSERT_EQ(recorder.prefix.size(), 1u);
+    ASSERT_EQ(recorder.prefix[0], std::vector<u32>({ 0x1111 }));
+    ASSERT_EQ(recorder.dynamic[0], std::vector<u32>({ 0xd1, 0xd2, 0xd3 }));
+    ASSERT_EQ(recorder.suffix[0], std::vector<u32>({ 0x2222 }));
+
+    // The suffix is contiguous in the second buffer.
+    ASSERT_EQ(recorder.dataPointers[2], buffer1.data() + 3);
+    ASSERT_EQ(counters.zeroCopyParts, 1u);
+    ASSERT_EQ(counters.workBufferParts, 2u);
+}
+
+TEST(mvlc_readout_parser, SplitEventAcrossETHPackets)
+{
+    std::vector<u32> buffer =
+    {
+        // packet 0: channel 2 (data), packetNumber 0, 5 data words, next header at 0
+        0x20000005, 0x00000000,
+        0xF3810004,
+        0x1111,
+        0xF5800002,
+        0xd1, 0xd2,
+
+        // packet 1
+        0x20010004, 0x00000000,
+        0xF9010003,
+        0xF5000001,
+        0xd3,
+        0x2222,
+    };
+
+    auto state = make_readout_parser(make_test_stacks());
+    ReadoutParserCounters counters = {};
+    EventRecorder recorder;
+    auto callbacks = recorder.callbacks();
+
+    auto pr = parse_readout_buffer_eth(state, callbacks, counters, 1, buffer.data(), buffer.size());
+
+    ASSERT_EQ(pr, ParseResult::Ok);
+    ASSERT_EQ(counters.ethPacketLoss, 0u);
+    ASSERT_EQ(recorder.prefix.size(), 1u);
+    ASSERT_EQ(recorder.prefix[0], std::vector<u32>({ 0x1111 }));
+    ASSERT_EQ(recorder.dynamic[0], std::vector<u32>({ 0xd1, 0xd2, 0xd3 }));
+    ASSERT_EQ(recorder.suffix[0], std::vector<u32>({ 0x2222 }));
+
+    // Prefix and suffix are contiguous within their packets, the dynamic part
+    // spans both packets.
+    ASSERT_EQ(recorder.dataPointers[0], buffer.data() + 3);
+    ASSERT_EQ(recorder.dataPointers[2], buffer.data() + 12);
+    ASSERT_EQ(counters.zeroCopyParts, 2u);
+    ASSERT_EQ(counters.workBufferParts, 1u);
+}
+
+TEST(mvlc_readout_parser, CountersLayout)
+{
+    auto stacks = make_test_stacks();
+    StackCommandBuilder sb("event1");
+    sb.beginGroup("module0");
+    sb.addWriteMarker(0x3333u);
+    sb.beginGroup("module1");
+    sb.addWriteMarker(0x4444u);
+    stacks.push_back(sb);
+
+    std::vector<u32> buffer =
+    {
+        0xF3010006, 0x1111, 0xF5000003, 0xd1, 0xd2, 0xd3, 0x2222, // stack 1
+        0xF3020002, 0x3333, 0x4444,                               // stack 2
+        0xF3010005, 0x1111, 0xF5000002, 0xd1, 0xd2, 0x2222,       // stack 1
+    };
+
+    auto state = make_readout_parser(stacks);
+    ReadoutParserCounters counters = {};
+    ReadoutParserCallbacks callbacks;
+
+    auto pr = parse_readout_buffer_usb(state, callbacks, counters, 1, buffer.data(), buffer.size());
+
+    ASSERT_EQ(pr, ParseResult::Ok);
+    ASSERT_EQ(counters.eventHits, std::vector<size_t>({ 2, 1 }));
+
+    ASSERT_EQ(counters.groupPrefixHits.size(), 2u);
+    ASSERT_EQ(counters.groupPrefixHits[0], std::vector<size_t>({ 2 }));
+    ASSERT_EQ(counters.groupPrefixHits[1], std::vector<size_t>({ 1, 1 }));
+    ASSERT_EQ(counters.groupDynamicHits[0], std::vector<size_t>({ 2 }));
+    ASSERT_EQ(counters.groupDynamicHits[1], std::vector<size_t>({ 0, 0 }));
+    ASSERT_EQ(counters.groupSuffixHits[0], std::vector<size_t>({ 2 }));
+
+    ASSERT_EQ(counters.groupDynamicSizes[0][0].min, 2u);
+    ASSERT_EQ(counters.groupDynamicSizes[0][0].max, 3u);
+    ASSERT_EQ(counters.groupDynamicSizes[0][0].sum, 5u);
+
+    // Resetting zeroes the counts in place. Parsing the next buffer reuses
+    // the existing vectors.
+    const auto eventHitsData = counters.eventHits.data();
+    const auto prefixHitsData = counters.groupPrefixHits[1].data();
+    const auto dynamicSizesData = counters.groupDynamicSizes[0].data();
+
+    reset_counters(counters);
+
+    ASSERT_EQ(counters.buffersProcessed, 0u);
+    ASSERT_EQ(counters.eventHits, std::vector<size_t>({ 0, 0 }));
+    ASSERT_EQ(counters.groupPrefixHits[1], std::vector<size_t>({ 0, 0 }));
+    ASSERT_EQ(counters.groupDynamicSizes[0][0].max, 0u);
+    ASSERT_EQ(counters.groupDynamicSizes[0][0].sum, 0u);
+
+    pr = parse_readout_buffer_usb(state, callbacks, counters, 2, buffer.data(), buffer.size());
+
+    ASSERT_EQ(pr, ParseResult::Ok);
+    ASSERT_EQ(counters.buffersProcessed, 1u);
+    ASSERT_EQ(counters.eventHits, std::vector<size_t>({ 2, 1 }));
+    ASSERT_EQ(counters.groupDynamicSizes[0][0].min, 2u);
+    ASSERT_EQ(counters.eventHits.data(), eventHitsData);
+    ASSERT_EQ(counters.groupPrefixHits[1].data(), prefixHitsData);
+    ASSERT_EQ(counters.groupDynamicSizes[0].data(), dynamicSizesData);
+}
+
+TEST(mvlc_readout_parser, MultipleParsers)
+{
+    static const size_t BufferCount = 100;
+    static const size_t EventsPerBuffer = 10;
+    static const size_t ParserCount = 4;
+
+    const std::vector<u32> event =
+    {
+        0xF3010006, 0x1111, 0xF5000003, 0xd1, 0xd2, 0xd3, 0x2222,
+    };
+
+    auto stacks = make_test_stacks();
+    std::vector<ReadoutParserState> states;
+
+    for (size_t i=0; i<ParserCount; ++i)
+        states.emplace_back(make_readout_parser(stacks));
+
+    Protected<ReadoutParserCounters> counters({});
+    ReadoutBufferQueues snoopQueues(util::Kilobytes(4), 8);
+    std::atomic<size_t> eventCount(0u);
+    ReadoutParserCallbacks callbacks;
+
+    callbacks.eventData = [&eventCount] (int, const ModuleData *moduleData, unsigned)
+    {
+        if (moduleData[0].dynamic.size == 3 && moduleData[0].suffix.data[0] == 0x2222)
+            ++eventCount;
+    };
+
+    std::thread parserThread(run_readout_parsers, std::ref(states), std::ref(counters),
+                             std::ref(snoopQueues), std::ref(callbacks));
+
+    for (size_t bi=0; bi<BufferCount; ++bi)
+    {
+        auto buffer = snoopQueues.emptyBufferQueue().dequeue_blocking();
+        buffer->clear();
+        buffer->setType(ConnectionType::USB);
+        // Skip buffer number 51 to simulate snoop buffer loss.
+        buffer->setBufferNumber(bi < 50 ? bi + 1 : bi + 2);
+
+        for (size_t ei=0; ei<EventsPerBuffer; ++ei)
+        {
+            std::memcpy(buffer->data() + buffer->used(), event.data(), event.size() * sizeof(u32));
+            buffer->use(event.size() * sizeof(u32));
+        }
+
+        snoopQueues.filledBufferQueue().enqueue(buffer);
+    }
+
+    auto sentinel = snoopQueues.emptyBufferQueue().dequeue_blocking();
+    sentinel->clear();
+    snoopQueues.filledBufferQueue().enqueue(sentinel);
+
+    parserThread.join();
+
+    auto result = counters.copy();
+
+    ASSERT_EQ(eventCount, BufferCount * EventsPerBuffer);
+    ASSERT_EQ(result.buffersProcessed, BufferCount);
+    ASSERT_EQ(result.eventHits, std::vector<size_t>({ BufferCount * EventsPerBuffer }));
+    ASSERT_EQ(result.groupDynamicHits[0][0], BufferCount * EventsPerBuffer);
+    ASSERT_EQ(result.internalBufferLoss, 1u);
+    ASSERT_TRUE(snoopQueues.filledBufferQueue().empty());
+}
+
+TEST(mvlc_readout_parser, EventBatch)
+{
+    static const size_t EventCount = 100;
+
+    // The block read data is split into two block frames so that the
+    // dynamic part has to be assembled by the parser.
+    const std::vector<u32> event =
+    {
+        0xF3010007, 0x1111, 0xF5800002, 0xd1, 0xd2, 0xF5000001, 0xd3, 0x2222,
+    };
+
+    std::vector<u32> buffer;
+
+    for (size_t i=0; i<EventCount; ++i)
+    {
+        buffer.insert(buffer.end(), event.begin(), event.end());
+        buffer[buffer.size() - 2] = i; // last dynamic word
+    }
+
+    auto state = make_readout_parser(make_test_stacks());
+    ReadoutParserCounters counters = {};
+    ReadoutParserCallbacks callbacks;
+    size_t batchCount = 0u;
+    size_t singleEventCount = 0u;
+
+    callbacks.eventData = [&] (int, const ModuleData *, unsigned) { ++singleEventCount; };
+
+    callbacks.eventBatch = [&] (const EventBatch &batch)
+    {
+        ++batchCount;
+        ASSERT_EQ(batch.events.size(), EventCount);
+
+        for (size_t i=0; i<batch.events.size(); ++i)
+        {
+            const auto &ev = batch.events[i];
+            ASSERT_EQ(ev.eventIndex, 0);
+            ASSERT_EQ(ev.moduleCount, 1u);
+
+            const auto &md = batch.moduleData(ev)[0];
+            ASSERT_EQ(std::vector<u32>(md.prefix.data, md.prefix.data + md.prefix.size),
+                      std::vector<u32>({ 0x1111 }));
+            ASSERT_EQ(std::vector<u32>(md.dynamic.data, md.dynamic.data + md.dynamic.size),
+                      std::vector<u32>({ 0xd1, 0xd2, static_cast<u32>(i) }));
+            ASSERT_EQ(std::vector<u32>(md.suffix.data, md.suffix.data + md.suffix.size),
+                      std::vector<u32>({ 0x2222 }));
+
+            // Contiguous parts refer to the input buffer.
+            ASSERT_EQ(md.prefix.data, buffer.data() + i * event.size() + 1);
+        }
+    };
+
+    auto pr = parse_readout_buffer_usb(state, callbacks, counters, 1, buffer.data(), buffer.size());
+
+    ASSERT_EQ(pr, ParseResult::Ok);
+    ASSERT_EQ(batchCount, 1u);
+    ASSERT_EQ(singleEventCount, 0u);
+    ASSERT_EQ(counters.eventHits[0], EventCount);
+}
+
+namespace
+{
+
+// Generates a random readout stream for make_fixed_structure_stacks(). Most
+// events are contained in a single stack frame, some are split into multiple
+// frames and some are corrupted unless corrupt is false.
+std::vector<u32> make_random_stream(std::mt19937 &rng, size_t eventCount, bool corrupt = true)
+{
+    std::uniform_int_distribution<unsigned> percent(0, 99);
+    std::uniform_int_distribution<u32> blockLen(0, 20);
+    std::uniform_int_distribution<unsigned> blockFrames(1, 3);
+
+    std::vector<u32> result;
+
+    for (size_t ei=0; ei<eventCount; ++ei)
+    {
+        const u8 stackId = 1 + percent(rng) % 2;
+
+        // Each item is a prefix/suffix word or a block read frame. Stack
+        // frames are only split between items.
+        std::vector<std::vector<u32>> items;
+
+        auto add_block_read = [&] ()
+        {
+            const u32 len = blockLen(rng);
+            const unsigned frames = std::min(blockFrames(rng), std::max(len, 1u));
+
+            for (unsigned fi=0, pos=0; fi<frames; ++fi)
+            {
+                const u32 frameLen = (fi == frames - 1 ? len - pos : len / frames);
+                const u32 flags = (fi == frames - 1 ? 0u : frame_flags::Continue);
+                std::vector<u32> item = { 0xF5000000u | (flags << frame_headers::FrameFlagsShift) | frameLen };
+
+                for (u32 i=0; i<frameLen; ++i, ++pos)
+                    item.push_back(0xd0000000u | (ei << 8) | pos);
+
+                items.emplace_back(item);
+            }
+        };
+
+        if (stackId == 1)
+        {
+            items.push_back({ 0x1111 });
+            add_block_read();
+            items.push_back({ 0x2222 });
+        }
+        else
+        {
+            items.push_back({ 0x3333 });
+            items.push_back({ 0x4444 });
+            add_block_read();
+            items.push_back({ 0x5555 });
+        }
+
+        const unsigned corruption = corrupt ? percent(rng) : 100u;
+
+        if (corruption < 3)
+            items.push_back({ 0xdead }); // excess data in the frame
+        else if (corruption < 6)
+            items.pop_back(); // missing suffix
+        else if (corruption < 8)
+            items.front() = { 0xF5000001u, 0xbeef }; // unexpected block frame
+
+        // Split the event into a stack frame and continuation frames.
+        const bool split = percent(rng) < 15;
+        std::vector<std::vector<u32>> frames(1);
+
+        for (const auto &item: items)
+        {
+            if (split && !frames.back().empty() && percent(rng) < 50)
+                frames.emplace_back();
+            frames.back().insert(frames.back().end(), item.begin(), item.end());
+        }
+
+        for (size_t fi=0; fi<frames.size(); ++fi)
+        {
+            const u32 type = (fi == 0 ? 0xF3u : 0xF9u);
+            const u32 flags = (fi == frames.size() - 1 ? 0u : frame_flags::Continue);
+            result.push_back((type << frame_headers::TypeShift)
+                             | (flags << frame_headers::FrameFlagsShift)
+                             | (stackId << frame_headers::StackNumShift)
+                             | frames[fi].size());
+            result.insert(result.end(), frames[fi].begin(), frames[fi].end());
+        }
+    }
+
+    return result;
+}
+
+// Two events: the first with a single prefix/dynamic/suffix module, the
+// second with a prefix only module and a dynamic/suffix module.
+std::vector<StackCommandBuilder> make_fixed_structure_stacks()
+{
+    auto stacks = make_test_stacks();
+    StackCommandBuilder sb("event1");
+    sb.beginGroup("module0");
+    sb.addWriteMarker(0x3333u);
+    sb.addWriteMarker(0x4444u);
+    sb.beginGroup("module1");
+    sb.addVMEBlockRead(0x00000000u, vme_amods::MBLT64, 0xffff);
+    sb.addWriteMarker(0x5555u);
+    stacks.push_back(sb);
+    return stacks;
+}
+
+// USB buffers always end on a frame boundary.
+std::vector<std::vector<u32>> make_usb_buffers(std::mt19937 &rng, const std::vector<u32> &stream)
+{
+    std::uniform_int_distribution<unsigned> percent(0, 99);
+    std::vector<std::vector<u32>> result(1);
+
+    for (size_t pos=0; pos<stream.size();)
+    {
+        const size_t frameEnd = pos + 1 + extract_frame_info(stream[pos]).len;
+
+        if (!result.back().empty() && percent(rng) < 10)
+            result.emplace_back();
+
+        result.back().insert(result.back().end(), stream.begin() + pos, stream.begin() + frameEnd);
+        pos = frameEnd;
+    }
+
+    return result;
+}
+
+// Splits the stream into ETH packets of random size, one packet per buffer.
+std::vector<std::vector<u32>> make_eth_buffers(std::mt19937 &rng, const std::vector<u32> &stream)
+{
+    std::uniform_int_distribution<size_t> packetWords(1, 64);
+    std::vector<std::vector<u32>> result;
+    size_t nextFrameHeader = 0u;
+    u32 packetNumber = 0u;
+
+    for (size_t pos=0; pos<stream.size();)
+    {
+        const size_t dataWords = std::min(packetWords(rng), stream.size() - pos);
+        u32 nextHeaderPointer = eth::header1::NoHeaderPointerPresent;
+
+        while (nextFrameHeader < pos)
+            nextFrameHeader += 1 + extract_frame_info(stream[nextFrameHeader]).len;
+
+        if (nextFrameHeader < pos + dataWords)
+            nextHeaderPointer = nextFrameHeader - pos;
+
+        std::vector<u32> buffer =
+        {
+            (static_cast<u32>(eth::PacketChannel::Data) << eth::header0::PacketChannelShift)
+                | ((packetNumber++ & eth::header0::PacketNumberMask) << eth::header0::PacketNumberShift)
+                | static_cast<u32>(dataWords),
+            nextHeaderPointer,
+        };
+
+        buffer.insert(buffer.end(), stream.begin() + pos, stream.begin() + pos + dataWords);
+        result.emplace_back(buffer);
+        pos += dataWords;
+    }
+
+    return result;
+}
+
+struct ParseOutput
+{
+    // Serialized callback invocations and parse results.
+    std::string events;
+    ReadoutParserCounters counters = {};
+
+    std::string str() const
+    {
+        std::ostringstream out;
+        out << events;
+        print_counters(out, counters);
+        return out.str();
+    }
+};
+
+// Serializes everything passed to the callbacks. Modules set to false in
+// outputMask are serialized as if they were empty.
+ReadoutParserCallbacks make_serializing_callbacks(std::ostream &out, const ModuleSelection &outputMask = {})
+{
+    ReadoutParserCallbacks callbacks;
+
+    callbacks.eventData = [&out, outputMask] (int eventIndex, const ModuleData *moduleData, unsigned moduleCount)
+    {
+        out << "event " << eventIndex << ":";
+
+        for (unsigned mi=0; mi<moduleCount; ++mi)
+        {
+            const bool masked = (static_cast<size_t>(eventIndex) < outputMask.size()
+                                 && mi < outputMask[eventIndex].size()
+                                 && !outputMask[eventIndex][mi]);
+
+            for (const auto &block: { moduleData[mi].prefix, moduleData[mi].dynamic, moduleData[mi].suffix })
+            {
+                out << " [";
+                for (u32 i=0; !masked && i<block.size; ++i)
+                    out << " " << std::hex << block.data[i] << std::dec;
+                out << " ]";
+            }
+        }
+
+        out << "\n";
+    };
+
+    callbacks.systemEvent = [&out] (const u32 *, u32 size)
+    {
+        out << "system event: " << size << "\n";
+    };
+
+    return callbacks;
+}
+
+ParseOutput parse_buffers(
+    ConnectionType type, const std::vector<std::vector<u32>> &buffers, bool useFixedModuleParsers,
+    const ModuleSelection &moduleSelection = {}, const ModuleSelection &outputMask = {})
+{
+    auto state = make_readout_parser(make_fixed_structure_stacks(), moduleSelection, useFixedModuleParsers);
+    ParseOutput result;
+    std::ostringstream out;
+    auto callbacks = make_serializing_callbacks(out, outputMask);
+    auto parse = (type == ConnectionType::ETH ? parse_readout_buffer_eth : parse_readout_buffer_usb);
+    u32 bufferNumber = 0;
+
+    for (const auto &buffer: buffers)
+    {
+        auto pr = parse(state, callbacks, result.counters, ++bufferNumber, buffer.data(), buffer.size());
+        out << "result: " << get_parse_result_name(pr) << "\n";
+    }
+
+    result.events = out.str();
+
+    return result;
+}
+
+} // end anon namespace
+
+TEST(mvlc_readout_parser, FixedModuleParsersMatchGenericParser)
+{
+    std::mt19937 rng(1234);
+
+    for (auto type: { ConnectionType::USB, ConnectionType::ETH })
+    {
+        auto stream = make_random_stream(rng, 2000);
+        auto buffers = (type == ConnectionType::ETH
+                        ? make_eth_buffers(rng, stream)
+                        : make_usb_buffers(rng, stream));
+
+        auto fixed = parse_buffers(type, buffers, true).str();
+        auto generic = parse_buffers(type, buffers, false).str();
+
+        ASSERT_EQ(fixed, generic);
+        ASSERT_NE(fixed.find("event 1:"), std::string::npos);
+    }
+}
+
+TEST(mvlc_readout_parser, ModuleSelection)
+{
+    std::mt19937 rng(5678);
+    // Skip the first module of the second event.
+    const ModuleSelection selection = { {}, { false, true } };
+
+    for (auto type: { ConnectionType::USB, ConnectionType::ETH })
+    {
+        auto stream = make_random_stream(rng, 2000);
+        auto buffers = (type == ConnectionType::ETH
+                        ? make_eth_buffers(rng, stream)
+                        : make_usb_buffers(rng, stream));
+
+        auto expected = parse_buffers(type, buffers, true, {}, selection);
+
+        for (bool useFixedModuleParsers: { true, false })
+        {
+            auto result = parse_buffers(type, buffers, useFixedModuleParsers, selection);
+
+            ASSERT_EQ(result.events, expected.events);
+            ASSERT_EQ(result.counters.eventHits, expected.counters.eventHits);
+
+            // No part counters for the unselected module.
+            ASSERT_GT(expected.counters.groupPrefixHits[1][0], 0u);
+            ASSERT_EQ(result.counters.groupPrefixHits[1][0], 0u);
+            ASSERT_EQ(result.counters.groupPrefixSizes[1][0].sum, 0u);
+
+            ASSERT_EQ(result.counters.groupPrefixHits[0], expected.counters.groupPrefixHits[0]);
+            ASSERT_EQ(result.counters.groupDynamicHits[1], expected.counters.groupDynamicHits[1]);
+            ASSERT_EQ(result.counters.groupDynamicSizes[1][1].sum,
+                      expected.counters.groupDynamicSizes[1][1].sum);
+        }
+    }
+}
+
+TEST(mvlc_readout_parser, CheckpointRestore)
+{
+    std::mt19937 rng(4321);
+
+    for (auto type: { ConnectionType::USB, ConnectionType::ETH })
+    {
+        auto stream = make_random_stream(rng, 500);
+        auto buffers = (type == ConnectionType::ETH
+                        ? make_eth_buffers(rng, stream)
+                        : make_usb_buffers(rng, stream));
+
+        auto expected = parse_buffers(type, buffers, true);
+        auto parse = (type == ConnectionType::ETH ? parse_readout_buffer_eth : parse_readout_buffer_usb);
+        size_t checkpointsWithEvent = 0u;
+
+        // Checkpoint the parser after each buffer and continue parsing with
+        // a new parser restored from the serialized checkpoint.
+        ParseOutput result;
+        std::ostringstream out;
+        auto callbacks = make_serializing_callbacks(out);
+        u32 bufferNumber = 0;
+
+        auto state = make_readout_parser(make_fixed_structure_stacks());
+
+        for (const auto &buffer: buffers)
+        {
+            auto pr = parse(state, callbacks, result.counters, ++bufferNumber, buffer.data(), buffer.size());
+            out << "result: " << get_parse_result_name(pr) << "\n";
+
+            auto checkpoint = make_checkpoint(state);
+            checkpointsWithEvent += checkpoint.eventIndex >= 0;
+            auto serialized = serialize_checkpoint(checkpoint);
+
+            state = make_readout_parser(make_fixed_structure_stacks());
+            restore_checkpoint(state, deserialize_checkpoint(serialized.data(), serialized.size()));
+        }
+
+        result.events = out.str();
+
+        ASSERT_EQ(result.str(), expected.str());
+        ASSERT_GT(checkpointsWithEvent, 0u);
+    }
+}
+
+TEST(mvlc_readout_parser, CheckpointErrors)
+{
+    auto state = make_readout_parser(make_fixed_structure_stacks());
+    std::vector<u32> buffer = { 0xF3010004u, 0x1111u, 0xF5000002u, 0xd0000000u, 0xd0000001u };
+    ReadoutParserCallbacks callbacks;
+    ReadoutParserCounters counters = {};
+
+    parse_readout_buffer_usb(state, callbacks, counters, 1, buffer.data(), buffer.size());
+    auto serialized = serialize_checkpoint(make_checkpoint(state));
+
+    ASSERT_THROW(deserialize_checkpoint(serialized.data(), serialized.size() - 1), std::runtime_error);
+    serialized[0] = 0;
+    ASSERT_THROW(deserialize_checkpoint(serialized.data(), serialized.size()), std::runtime_error);
+
+    // The event in progress does not exist in a parser for a single event.
+    auto checkpoint = make_checkpoint(state);
+    checkpoint.eventIndex = 1;
+    ASSERT_THROW(restore_checkpoint(state, checkpoint), std::runtime_error);
+}
+
+namespace
+{
+
+// Inserts system event frames between the frames of a USB stream.
+std::vector<u32> add_system_events(std::mt19937 &rng, const std::vector<u32> &stream)
+{
+    std::uniform_int_distribution<unsigned> percent(0, 99);
+    std::vector<u32> result;
+
+    for (size_t pos=0; pos<stream.size();)
+    {
+        if (percent(rng) < 5)
+            result.insert(result.end(), { 0xFA000001u, 0x1234u });
+
+        const size_t frameEnd = pos + 1 + extract_frame_info(stream[pos]).len;
+        result.insert(result.end(), stream.begin() + pos, stream.begin() + frameEnd);
+        pos = frameEnd;
+    }
+
+    return result;
+}
+
+// Concatenates ETH packets into a single stream like the one stored in
+// listfiles. Some packets are lost and system events are inserted between
+// packets.
+std::vector<u32> make_eth_stream(std::mt19937 &rng, const std::vector<std::vector<u32>> &packets)
+{
+    std::uniform_int_distribution<unsigned> percent(0, 99);
+    std::vector<u32> result;
+
+    for (const auto &packet: packets)
+    {
+        if (percent(rng) < 1)
+            continue;
+
+        if (percent(rng) < 5)
+            result.insert(result.end(), { 0xFA000001u, 0x1234u });
+
+        result.insert(result.end(), packet.begin(), packet.end());
+    }
+
+    return result;
+}
+
+// Splits an ETH stream into buffers containing up to 4 packets or system
+// events.
+std::vector<std::vector<u32>> split_eth_stream(std::mt19937 &rng, const std::vector<u32> &stream)
+{
+    std::uniform_int_distribution<unsigned> elementsPerBuffer(1, 4);
+    std::vector<std::vector<u32>> result;
+
+    for (size_t pos=0; pos<stream.size();)
+    {
+        result.emplace_back();
+
+        for (unsigned i=elementsPerBuffer(rng); i>0 && pos<stream.size(); --i)
+        {
+            size_t words = (get_frame_type(stream[pos]) == frame_headers::SystemEvent
+                            ? 1 + extract_frame_info(stream[pos]).len
+                            : eth::HeaderWords + (stream[pos] & eth::header0::NumDataWordsMask));
+
+            result.back().insert(result.back().end(), stream.begin() + pos, stream.begin() + pos + words);
+            pos += words;
+        }
+    }
+
+    return result;
+}
+
+} // end anon namespace
+
+TEST(mvlc_readout_parser, ParseRangesBetweenResyncPoints)
+{
+    std::mt19937 rng(8765);
+    const size_t RangeCount = 8;
+
+    for (auto type: { ConnectionType::USB, ConnectionType::ETH })
+    {
+        auto events = make_random_stream(rng, 4000, false);
+        auto stream = (type == ConnectionType::ETH
+                       ? make_eth_stream(rng, make_eth_buffers(rng, events))
+                       : add_system_events(rng, events));
+
+        // Split the stream into ranges starting at resync points.
+        std::vector<ResyncPoint> rangeStarts = { ResyncPoint{} };
+
+        for (size_t i=1; i<RangeCount; ++i)
+        {
+            auto rp = find_resync_point(type, stream.data(), stream.size(), i * stream.size() / RangeCount);
+
+            ASSERT_LT(rp.offset, stream.size());
+
+            if (rp.offset > rangeStarts.back().offset)
+                rangeStarts.push_back(rp);
+        }
+
+        ASSERT_GT(rangeStarts.size(), RangeCount / 2);
+
+        std::vector<std::vector<std::vector<u32>>> rangeBuffers;
+
+        for (size_t ri=0; ri<rangeStarts.size(); ++ri)
+        {
+            size_t end = (ri + 1 < rangeStarts.size() ? rangeStarts[ri + 1].offset : stream.size());
+            std::vector<u32> range(stream.begin() + rangeStarts[ri].offset, stream.begin() + end);
+            rangeBuffers.emplace_back(type == ConnectionType::ETH
+                                      ? split_eth_stream(rng, range)
+                                      : make_usb_buffers(rng, range));
+        }
+
+        // Sequential pass over all buffers.
+        std::vector<std::vector<u32>> allBuffers;
+
+        for (const auto &buffers: rangeBuffers)
+            allBuffers.insert(allBuffers.end(), buffers.begin(), buffers.end());
+
+        auto expected = parse_buffers(type, allBuffers, true);
+
+        // Separate parser per range.
+        auto parse = (type == ConnectionType::ETH ? parse_readout_buffer_eth : parse_readout_buffer_usb);
+        ParseOutput merged;
+        u32 bufferNumber = 0;
+
+        for (size_t ri=0; ri<rangeStarts.size(); ++ri)
+        {
+            auto state = make_readout_parser(make_fixed_structure_stacks());
+            auto checkpoint = rangeStarts[ri].checkpoint;
+            checkpoint.lastBufferNumber = bufferNumber;
+            restore_checkpoint(state, checkpoint);
+
+            ReadoutParserCounters counters = {};
+            std::ostringstream out;
+            auto callbacks = make_serializing_callbacks(out);
+
+            for (const auto &buffer: rangeBuffers[ri])
+            {
+                auto pr = parse(state, callbacks, counters, ++bufferNumber, buffer.data(), buffer.size());
+                out << "result: " << get_parse_result_name(pr) << "\n";
+            }
+
+            // The next range starts where the sequential parser has no event
+            // in progress.
+            ASSERT_EQ(make_checkpoint(state).eventIndex, -1);
+
+            merged.events += out.str();
+            add_counters(merged.counters, counters);
+        }
+
+        ASSERT_EQ(merged.str(), expected.str());
+        ASSERT_GT(expected.counters.eventHits[1], 0u);
+
+        if (type == ConnectionType::ETH)
+            ASSERT_GT(expected.counters.ethPacketLoss, 0u);
+    }
+}
@@ -4,7 +4,10 @@
 #include <sys/prctl.h>
 #endif
 
+#include <atomic>
 #include <iostream>
+#include <mutex>
+#include <thread>
 #include <fmt/format.h>
 
 using std::cerr;
@@ -89,6 +92,140 @@ void run_readout_parser(
     cerr << "run_readout_parser left loop" << endl;
 }
 
+void run_readout_parsers(
+    std::vector<readout_parser::ReadoutParserState> &states,
+    Protected<readout_parser::ReadoutParserCounters> &counters,
+    ReadoutBufferQueues &snoopQueues,
+    readout_parser::ReadoutParserCallbacks &parserCallbacks)
+{
+    auto &filled = snoopQueues.filledBufferQueue();
+    auto &empty = snoopQueues.emptyBufferQueue();
+
+    // SPSC queues support a single consumer only.
+    std::mutex dequeueMutex;
+    const bool serializeDequeue = (filled.kind() == ReadoutBufferQueue::Kind::SPSC);
+
+    // Tracks the range of buffer numbers seen by the workers to calculate
+    // the actual snoop buffer loss. Protected by the counters lock.
+    struct BufferNumbers
+    {
+        bool valid = false;
+        u32 first = 0;
+        u32 last = 0;
+        u64 count = 0;
+    } bufferNumbers;
+
+    const u32 initialBufferLoss = counters.access()->internalBufferLoss;
+    std::atomic<size_t> workersRunning(states.size());
+
+    auto worker = [&] (size_t workerIndex)
+    {
+#ifdef __linux__
+        auto threadName = fmt::format("rdo_parser{}", workerIndex);
+        prctl(PR_SET_NAME, threadName.c_str(), 0, 0, 0);
+#endif
+
+        auto &state = states[workerIndex];
+        ReadoutParserCounters localCounters = {};
+
+        try
+        {
+            while (true)
+            {
+                ReadoutBuffer *buffer = nullptr;
+
+                if (serializeDequeue)
+                {
+                    std::lock_guard<std::mutex> guard(dequeueMutex);
+                    buffer = filled.dequeue(std::chrono::milliseconds(100));
+                }
+                else
+                    buffer = filled.dequeue(std::chrono::milliseconds(100));
+
+                if (buffer && buffer->empty()) // sentinel
+                {
+                    // Pass the sentinel on to the other workers. The last one
+                    // consumes it.
+                    if (--workersRunning > 0)
+                        filled.enqueue(buffer);
+                    break;
+                }
+                else if (!buffer)
+                    continue;
+
+                const u32 bufferNumber = buffer->bufferNumber();
+
+                try
+                {
+                    auto bufferView = buffer->viewU32();
+
+                    readout_parser::parse_readout_buffer(
+                        buffer->type(),
+                        state,
+                        parserCallbacks,
+                        localCounters,
+                        bufferNumber,
+                        bufferView.data(),
+                        bufferView.size());
+
+                    empty.enqueue(buffer);
+                }
+                catch (...)
+                {
+                    empty.enqueue(buffer);
+                    throw;
+                }
+
+                // The local buffer loss only reflects the buffers taken by the
+                // other workers.
+                localCounters.internalBufferLoss = 0;
+
+                auto ca = counters.access();
+                add_counters(ca.ref(), localCounters);
+                // Keeps the dense per event and per module vectors allocated.
+                reset_counters(localCounters);
+
+                if (!bufferNumbers.valid)
+                {
+                    bufferNumbers.first = bufferNumbers.last = bufferNumber;
+                    bufferNumbers.valid = true;
+                }
+
+                if (static_cast<s32>(bufferNumber - bufferNumbers.last) > 0)
+                    bufferNumbers.last = bufferNumber;
+
+                ++bufferNumbers.count;
+
+                const u64 expected = bufferNumbers.last - bufferNumbers.first + 1u;
+                ca->internalBufferLoss = initialBufferLoss
+                    + (expected > bufferNumbers.count ? expected - bufferNumbers.count : 0u);
+            }
+        }
+        catch (const std::runtime_error &e)
+        {
+            --workersRunning;
+            cerr << "readout_parser " << workerIndex << " caught a std::runtime_error: " << e.what() << endl;
+        }
+        catch (...)
+        {
+            --workersRunning;
+            cerr << "readout_parser " << workerIndex << " caught an unknown exception." << endl;
+        }
+    };
+
+    cerr << "run_readout_parsers: starting " << states.size() << " parser threads" << endl;
+
+    std::vector<std::thread> threads;
+
+    for (size_t i=0; i<states.size(); ++i)
+        threads.emplace_back(std::thread(worker, i));
+
+    for (auto &t: threads)
+        t.join();
+
+    cerr << "run_readout_parsers: parser threads finished" << endl;
+}
+
 std::ostream &print_counters(std::ostream &out, const ReadoutParserCounters &counters)
 {
     auto print_hits_and_sizes = [&out] (
@@ -96,35 +233,35 @@ std::ostream &print_counters(std::ostream &out, const ReadoutParserCounters &cou
         const ReadoutParserCounters::GroupPartHits &hits,
         const ReadoutParserCounters::GroupPartSizes &sizes)
     {
-        if (!hits.empty())
-        {
-            out << "group " + partTitle + " hits: ";
+        std::string hitsLine;
+        std::string sizesLine;
 
-            for (const auto &kv: hits)
+        for (size_t ei=0; ei<hits.size(); ++ei)
+        {
+            for (size_t mi=0; mi<hits[ei].size(); ++mi)
             {
-                out << fmt::format(
-                    "eventIndex={}, groupIndex={}, hits={}; ",
-                    kv.first.first, kv.first.second, kv.second);
-            }
+                if (!hits[ei][mi])
+                    continue;
 
-            out << endl;
-        }
+                hitsLine += fmt::format(
+                    "eventIndex={}, groupIndex={}, hits={}; ",
+                    ei, mi, hits[ei][mi]);
 
-        if (!sizes.empty())
-        {
-            out << "group " + partTitle + " sizes: ";
+                const auto &sizeInfo = sizes.at(ei).at(mi);
 
-            for (const auto &kv: sizes)
-            {
-                out << fmt::format(
+                sizesLine += fmt::format(
                     "eventIndex={}, groupIndex={}, min={}, max={}, avg={}; ",
-                    kv.first.first, kv.first.second,
-                    kv.second.min,
-                    kv.second.max,
-                    kv.second.sum / static_cast<double>(hits.at(kv.first)));
+                    ei, mi,
+                    sizeInfo.min,
+                    sizeInfo.max,
+                    sizeInfo.sum / static_cast<double>(hits[ei][mi]));
             }
+        }
 
-            out << endl;
+        if (!hitsLine.empty())
+        {
+            out << "group " + partTitle + " hits: " << hitsLine << endl;
+            out << "group " + partTitle + " sizes: " << sizesLine << endl;
         }
     };
 
@@ -160,10 +297,15 @@ std::ostream &print_counters(std::ostream &out, const ReadoutParserCounters &cou
 
     out << "parserExceptions=" << counters.parserExceptions << endl;
     out << "emptyStackFrames=" << counters.emptyStackFrames << endl;
+    out << "zeroCopyParts=" << counters.zeroCopyParts << endl;
+    out << "workBufferParts=" << counters.workBufferParts << endl;
 
     out << "eventHits: ";
-    for (const auto &kv: counters.eventHits)
-        out << fmt::format("ei={}, hits={}, ", kv.first, kv.second);
+    for (size_t ei=0; ei<counters.eventHits.size(); ++ei)
+    {
+        if (counters.eventHits[ei])
+            out << fmt::format("ei={}, hits={}, ", ei, counters.eventHits[ei]);
+    }
     out << endl;
 
     print_hits_and_sizes("prefix", counters.groupPrefixHits, counters.groupPrefixSizes);
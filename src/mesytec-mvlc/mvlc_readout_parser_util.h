@@ -2,6 +2,7 @@
 #define __MESYTEC_MVLC_MVLC_READOUT_PARSER_UTIL_H__
 
 #include <ostream>
+#include <vector>
 
 #include "mesytec-mvlc/mesytec-mvlc_export.h"
 #include "mesytec-mvlc/mvlc_readout_parser.h"
@@ -35,6 +36,26 @@ void MESYTEC_MVLC_EXPORT run_readout_parser(
     ReadoutBufferQueues &snoopQueues,
     readout_parser::ReadoutParserCallbacks &parserCallbacks);
 
+// Multi-threaded variant of run_readout_parser() for lossy snoop data. One
+// worker thread is started per parser state. The workers take buffers from the
+// snoopQueues concurrently, so events spanning more than one buffer are only
+// parsed if the parts happen to end up on the same worker. The remaining data
+// is treated like internal buffer loss.
+//
+// The parserCallbacks are invoked concurrently from the worker threads and
+// must be thread-safe. The counters of the individual parsers are added to
+// the aggregate counters after each buffer. internalBufferLoss is the number
+// of buffers missing from the snoop stream as seen by all workers together.
+//
+// To terminate enqueue a single empty buffer onto
+// snoopQueues.filledBufferQueue(). The function returns once all workers have
+// finished.
+void MESYTEC_MVLC_EXPORT run_readout_parsers(
+    std::vector<readout_parser::ReadoutParserState> &states,
+    Protected<readout_parser::ReadoutParserCounters> &counters,
+    ReadoutBufferQueues &snoopQueues,
+    readout_parser::ReadoutParserCallbacks &parserCallbacks);
+
 MESYTEC_MVLC_EXPORT std::ostream &print_counters(
     std::ostream &out, const ReadoutParserCounters &counters);
 
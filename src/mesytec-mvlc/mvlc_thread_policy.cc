@@ -0,0 +1,275 @@
+#include "mvlc_thread_policy.h"
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <spdlog/spdlog.h>
+
+#ifdef __linux__
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace mesytec
+{
+namespace mvlc
+{
+
+namespace
+{
+
+struct Registry
+{
+    std::mutex mutex;
+    std::map<std::string, ThreadPolicy> policies;
+    std::map<std::string, ThreadPolicyResult> results;
+};
+
+Registry &get_registry()
+{
+    static Registry registry;
+    return registry;
+}
+
+// Parses the sysfs cpulist format, e.g. "0-3,8,10-11".
+std::vector<unsigned> parse_cpu_list(const std::string &str)
+{
+    std::vector<unsigned> result;
+    std::istringstream ss(str);
+    std::string range;
+
+    while (std::getline(ss, range, ','))
+    {
+        unsigned first = 0, last = 0;
+        char dash = 0;
+        std::istringstream rs(range);
+
+        if (!(rs >> first))
+            continue;
+
+        if (rs >> dash >> last && dash == '-')
+        {
+            for (unsigned cpu=first; cpu<=last; ++cpu)
+                result.push_back(cpu);
+        }
+        else
+            result.push_back(first);
+    }
+
+    return result;
+}
+
+#ifdef __linux__
+std::error_code errno_error_code(int err)
+{
+    return std::error_code(err, std::system_category());
+}
+
+void read_back_settings(ThreadPolicyResult &result)
+{
+    cpu_set_t cpuSet;
+    CPU_ZERO(&cpuSet);
+
+    if (pthread_getaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet) == 0)
+    {
+        for (unsigned cpu=0; cpu<CPU_SETSIZE; ++cpu)
+        {
+            if (CPU_ISSET(cpu, &cpuSet))
+                result.cpus.push_back(cpu);
+        }
+    }
+
+    sched_param param = {};
+
+    if (pthread_getschedparam(pthread_self(), &result.schedPolicy, &param) == 0)
+        result.schedPriority = param.sched_priority;
+
+    int mode = 0;
+    unsigned long nodeMask = 0u;
+
+    if (syscall(SYS_get_mempolicy, &mode, &nodeMask, sizeof(nodeMask) * 8, nullptr, 0) == 0
+        && (mode == MPOL_PREFERRED || mode == MPOL_BIND)
+        && nodeMask != 0u)
+    {
+        // The first node set in the mask.
+        for (int node=0; node<static_cast<int>(sizeof(nodeMask) * 8); ++node)
+        {
+            if (nodeMask & (1ul << node))
+            {
+                result.numaNode = node;
+                break;
+            }
+        }
+    }
+}
+#endif
+
+} // end anon namespace
+
+void set_thread_policy(const std::string &threadName, const ThreadPolicy &policy)
+{
+    auto &registry = get_registry();
+    std::lock_guard<std::mutex> guard(registry.mutex);
+    registry.policies[threadName] = policy;
+}
+
+void clear_thread_policy(const std::string &threadName)
+{
+    auto &registry = get_registry();
+    std::lock_guard<std::mutex> guard(registry.mutex);
+    registry.policies.erase(threadName);
+}
+
+void clear_thread_policies()
+{
+    auto &registry = get_registry();
+    std::lock_guard<std::mutex> guard(registry.mutex);
+    registry.policies.clear();
+}
+
+ThreadPolicy get_thread_policy(const std::string &threadName)
+{
+    auto &registry = get_registry();
+    std::lock_guard<std::mutex> guard(registry.mutex);
+    auto it = registry.policies.find(threadName);
+    return it != registry.policies.end() ? it->second : ThreadPolicy{};
+}
+
+std::vector<unsigned> numa_node_cpus(int node)
+{
+    if (node < 0)
+        return {};
+
+    std::ifstream in("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+    std::string line;
+
+    if (!std::getline(in, line))
+        return {};
+
+    return parse_cpu_list(line);
+}
+
+ThreadPolicyResult apply_thread_policy(const std::string &threadName)
+{
+    auto &registry = get_registry();
+    ThreadPolicy policy;
+    ThreadPolicyResult result;
+    result.threadName = threadName;
+
+    {
+        std::lock_guard<std::mutex> guard(registry.mutex);
+        auto it = registry.policies.find(threadName);
+
+        if (it != registry.policies.end())
+        {
+            policy = it->second;
+            result.policyApplied = true;
+        }
+    }
+
+    auto set_error = [&result] (const std::error_code &ec)
+    {
+        if (!result.ec)
+            result.ec = ec;
+    };
+
+#ifdef __linux__
+    if (result.policyApplied)
+    {
+        // CPU affinity
+        auto cpus = policy.cpus;
+
+        if (policy.numaNode >= 0)
+        {
+            auto nodeCpus = numa_node_cpus(policy.numaNode);
+
+            if (nodeCpus.empty())
+                set_error(std::make_error_code(std::errc::invalid_argument));
+            else if (cpus.empty())
+                cpus = nodeCpus;
+            else
+            {
+                cpus.erase(std::remove_if(cpus.begin(), cpus.end(), [&nodeCpus] (unsigned cpu)
+                {
+                    return std::find(nodeCpus.begin(), nodeCpus.end(), cpu) == nodeCpus.end();
+                }), cpus.end());
+
+                if (cpus.empty())
+                    set_error(std::make_error_code(std::errc::invalid_argument));
+            }
+        }
+
+        if (!cpus.empty())
+        {
+            cpu_set_t cpuSet;
+            CPU_ZERO(&cpuSet);
+
+            for (unsigned cpu: cpus)
+            {
+                if (cpu < CPU_SETSIZE)
+                    CPU_SET(cpu, &cpuSet);
+            }
+
+            if (int err = pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet))
+                set_error(errno_error_code(err));
+        }
+
+        // NUMA memory policy
+        if (policy.numaNode >= 0 && policy.numaNode < static_cast<int>(sizeof(unsigned long) * 8))
+        {
+            unsigned long nodeMask = 1ul << policy.numaNode;
+
+            if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, &nodeMask, sizeof(nodeMask) * 8) != 0)
+                set_error(errno_error_code(errno));
+        }
+
+        // Scheduling
+        if (policy.fifoPriority > 0)
+        {
+            sched_param param = {};
+            param.sched_priority = policy.fifoPriority;
+
+            if (int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param))
+                set_error(errno_error_code(err));
+        }
+    }
+
+    read_back_settings(result);
+#else
+    if (result.policyApplied)
+        set_error(std::make_error_code(std::errc::not_supported));
+#endif
+
+    if (result.ec)
+    {
+        spdlog::warn("Could not fully apply the thread policy of {}: {}",
+                     threadName, result.ec.message());
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(registry.mutex);
+        registry.results[threadName] = result;
+    }
+
+    return result;
+}
+
+std::vector<ThreadPolicyResult> get_thread_policy_results()
+{
+    auto &registry = get_registry();
+    std::lock_guard<std::mutex> guard(registry.mutex);
+    std::vector<ThreadPolicyResult> result;
+
+    for (const auto &kv: registry.results)
+        result.push_back(kv.second);
+
+    return result;
+}
+
+} // end namespace mvlc
+} // end namespace mesytec
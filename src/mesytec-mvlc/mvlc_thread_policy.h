@@ -0,0 +1,92 @@
+#ifndef __MESYTEC_MVLC_MVLC_THREAD_POLICY_H__
+#define __MESYTEC_MVLC_MVLC_THREAD_POLICY_H__
+
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "mesytec-mvlc/mesytec-mvlc_export.h"
+
+namespace mesytec
+{
+namespace mvlc
+{
+
+// CPU placement and scheduling of the threads spawned by the library.
+//
+// Policies are configured per thread name and applied by the threads
+// themselves when they start, so they have to be set before starting a
+// readout or connecting to a controller. The named threads are:
+//
+//   readout_worker   ReadoutWorker, reads from the data pipe
+//   readout_proc     ReadoutWorker, processes and flushes readout buffers
+//   listfile_writer  listfile_buffer_writer()
+//   eth_throttler    ETH implementation, receive buffer monitoring
+//   cmd_pipe_reader  MVLC command pipe reader
+//
+// Only implemented on linux. Elsewhere applying a policy reports
+// std::errc::not_supported.
+
+struct ThreadPolicy
+{
+    // CPUs the thread is allowed to run on. Empty leaves the affinity as is
+    // unless numaNode is set.
+    std::vector<unsigned> cpus;
+
+    // If non-negative the thread is restricted to the CPUs of this NUMA node
+    // (intersected with cpus if both are given) and memory is preferably
+    // allocated from the node.
+    int numaNode = -1;
+
+    // If greater than 0 the thread is switched to SCHED_FIFO with this
+    // priority (1-99). Requires CAP_SYS_NICE or a suitable RLIMIT_RTPRIO.
+    int fifoPriority = 0;
+};
+
+// The settings in effect for a thread after applying its policy. Settings are
+// read back from the system, not copied from the policy.
+struct ThreadPolicyResult
+{
+    std::string threadName;
+
+    // True if a policy was configured for the thread.
+    bool policyApplied = false;
+
+    // CPU affinity of the thread.
+    std::vector<unsigned> cpus;
+
+    // NUMA node memory is preferably allocated from, -1 if none.
+    int numaNode = -1;
+
+    // Scheduling policy (SCHED_OTHER, SCHED_FIFO, ...) and priority.
+    int schedPolicy = 0;
+    int schedPriority = 0;
+
+    // First error that occured while applying the policy. The remaining
+    // parts of the policy are still applied.
+    std::error_code ec;
+};
+
+MESYTEC_MVLC_EXPORT void set_thread_policy(const std::string &threadName, const ThreadPolicy &policy);
+MESYTEC_MVLC_EXPORT void clear_thread_policy(const std::string &threadName);
+MESYTEC_MVLC_EXPORT void clear_thread_policies();
+
+// Returns a default constructed policy if none is set for the thread name.
+MESYTEC_MVLC_EXPORT ThreadPolicy get_thread_policy(const std::string &threadName);
+
+// Applies the policy configured for threadName to the calling thread and
+// returns the effective settings. Also records the result for
+// get_thread_policy_results(). Called by the library threads on startup.
+MESYTEC_MVLC_EXPORT ThreadPolicyResult apply_thread_policy(const std::string &threadName);
+
+// Most recent results of apply_thread_policy(), one entry per thread name.
+MESYTEC_MVLC_EXPORT std::vector<ThreadPolicyResult> get_thread_policy_results();
+
+// Returns the CPUs of the given NUMA node or an empty vector if the node does
+// not exist or the information is not available.
+MESYTEC_MVLC_EXPORT std::vector<unsigned> numa_node_cpus(int node);
+
+} // end namespace mvlc
+} // end namespace mesytec
+
+#endif /* __MESYTEC_MVLC_MVLC_THREAD_POLICY_H__ */
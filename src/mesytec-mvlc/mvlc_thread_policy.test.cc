@@ -0,0 +1,165 @@
+#include <algorithm>
+#include <thread>
+
+#include "gtest/gtest.h"
+#include "mvlc_thread_policy.h"
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+using namespace mesytec::mvlc;
+
+#ifdef __linux__
+
+namespace
+{
+
+std::vector<unsigned> current_affinity()
+{
+    std::vector<unsigned> result;
+    cpu_set_t cpuSet;
+    CPU_ZERO(&cpuSet);
+
+    if (sched_getaffinity(0, sizeof(cpuSet), &cpuSet) == 0)
+    {
+        for (unsigned cpu=0; cpu<CPU_SETSIZE; ++cpu)
+        {
+            if (CPU_ISSET(cpu, &cpuSet))
+                result.push_back(cpu);
+        }
+    }
+
+    return result;
+}
+
+// Applies the policy of threadName on a new thread. Returns the result of
+// apply_thread_policy() and the affinity observed by the thread afterwards.
+std::pair<ThreadPolicyResult, std::vector<unsigned>> apply_on_thread(const std::string &threadName)
+{
+    ThreadPolicyResult result;
+    std::vector<unsigned> affinity;
+
+    std::thread t([&] ()
+    {
+        result = apply_thread_policy(threadName);
+        affinity = current_affinity();
+    });
+
+    t.join();
+
+    return std::make_pair(result, affinity);
+}
+
+} // end anon namespace
+
+TEST(mvlc_thread_policy, NoPolicy)
+{
+    clear_thread_policies();
+
+    auto r = apply_on_thread("test_thread");
+
+    ASSERT_FALSE(r.first.policyApplied);
+    ASSERT_FALSE(r.first.ec);
+    ASSERT_EQ(r.first.cpus, current_affinity());
+}
+
+TEST(mvlc_thread_policy, AffinityTakesEffect)
+{
+    auto allowed = current_affinity();
+    ASSERT_FALSE(allowed.empty());
+
+    // Pin to the last CPU the process may run on.
+    ThreadPolicy policy;
+    policy.cpus = { allowed.back() };
+    set_thread_policy("test_thread", policy);
+
+    auto r = apply_on_thread("test_thread");
+
+    ASSERT_TRUE(r.first.policyApplied);
+    ASSERT_FALSE(r.first.ec) << r.first.ec.message();
+    ASSERT_EQ(r.second, policy.cpus);
+    ASSERT_EQ(r.first.cpus, policy.cpus);
+
+    // The calling thread is unaffected.
+    ASSERT_EQ(current_affinity(), allowed);
+
+    auto results = get_thread_policy_results();
+    auto it = std::find_if(results.begin(), results.end(),
+                           [] (const ThreadPolicyResult &r) { return r.threadName == "test_thread"; });
+    ASSERT_NE(it, results.end());
+    ASSERT_EQ(it->cpus, policy.cpus);
+
+    clear_thread_policies();
+}
+
+TEST(mvlc_thread_policy, InvalidCpu)
+{
+    auto allowed = current_affinity();
+
+    ThreadPolicy policy;
+    policy.cpus = { CPU_SETSIZE - 1 };
+    set_thread_policy("test_thread", policy);
+
+    auto r = apply_on_thread("test_thread");
+
+    ASSERT_TRUE(r.first.policyApplied);
+    ASSERT_TRUE(r.first.ec);
+    // The affinity is left as is.
+    ASSERT_EQ(r.second, allowed);
+
+    clear_thread_policies();
+}
+
+TEST(mvlc_thread_policy, FifoScheduling)
+{
+    ThreadPolicy policy;
+    policy.fifoPriority = 10;
+    set_thread_policy("test_thread", policy);
+
+    auto r = apply_on_thread("test_thread");
+
+    ASSERT_TRUE(r.first.policyApplied);
+
+    // Without the required privileges the thread keeps its scheduling policy.
+    if (r.first.ec)
+    {
+        ASSERT_EQ(r.first.ec, std::error_code(EPERM, std::system_category()));
+        ASSERT_NE(r.first.schedPolicy, SCHED_FIFO);
+    }
+    else
+    {
+        ASSERT_EQ(r.first.schedPolicy, SCHED_FIFO);
+        ASSERT_EQ(r.first.schedPriority, 10);
+    }
+
+    clear_thread_policies();
+}
+
+TEST(mvlc_thread_policy, NumaNode)
+{
+    auto nodeCpus = numa_node_cpus(0);
+
+    if (nodeCpus.empty())
+        GTEST_SKIP();
+
+    ASSERT_TRUE(numa_node_cpus(-1).empty());
+
+    ThreadPolicy policy;
+    policy.numaNode = 0;
+    set_thread_policy("test_thread", policy);
+
+    auto r = apply_on_thread("test_thread");
+
+    ASSERT_TRUE(r.first.policyApplied);
+    ASSERT_FALSE(r.first.ec) << r.first.ec.message();
+    ASSERT_EQ(r.first.numaNode, 0);
+    ASSERT_FALSE(r.second.empty());
+
+    for (unsigned cpu: r.second)
+        ASSERT_NE(std::find(nodeCpus.begin(), nodeCpus.end(), cpu), nodeCpus.end());
+
+    clear_thread_policies();
+}
+
+#endif // __linux__
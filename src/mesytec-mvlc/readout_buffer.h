@@ -2,6 +2,8 @@
 #define __MESYTEC_MVLC_UTIL_READOUT_BUFFER_H__
 
 #include <cassert>
+#include <cstring>
+#include <stdexcept>
 #include <vector>
 
 #include "mesytec-mvlc/mesytec-mvlc_export.h"
@@ -13,6 +15,17 @@ namespace mesytec
 namespace mvlc
 {
 
+// Buffer for readout data. The memory is either owned by the buffer in form
+// of a std::vector or provided externally, e.g. carved from a larger region by
+// ReadoutBufferQueues. Externally backed buffers switch to an owned vector if
+// they have to grow or if the non-const buffer() is called. Copies always own
+// their memory. Use hasExternalStorage() to check if a buffer is still backed
+// by the external memory.
+//
+// Buffers may be shared read-only between threads, e.g. by the listfile writer
+// and the snoop consumer. Only the owner of a buffer may switch it to an owned
+// vector, so the const accessors never modify the buffer. Use data() or
+// viewU8() to read externally backed buffers.
 class MESYTEC_MVLC_EXPORT ReadoutBuffer
 {
     public:
@@ -20,13 +33,76 @@ class MESYTEC_MVLC_EXPORT ReadoutBuffer
             : m_buffer(capacity)
         { }
 
+        // Uses the given memory which must outlive the buffer. The memory is
+        // not initialized.
+        ReadoutBuffer(u8 *storage, size_t capacity)
+            : m_storage(storage)
+            , m_storageCapacity(capacity)
+        { }
+
+        ReadoutBuffer(const ReadoutBuffer &o)
+            : m_type(o.m_type)
+            , m_number(o.m_number)
+            , m_buffer(o.data(), o.data() + o.capacity())
+            , m_used(o.m_used)
+        { }
+
+        ReadoutBuffer(ReadoutBuffer &&o)
+            : m_type(o.m_type)
+            , m_number(o.m_number)
+            , m_buffer(std::move(o.m_buffer))
+            , m_storage(o.m_storage)
+            , m_storageCapacity(o.m_storageCapacity)
+            , m_used(o.m_used)
+        {
+            o.m_storage = nullptr;
+            o.m_storageCapacity = 0u;
+            o.m_buffer.clear();
+            o.m_used = 0u;
+        }
+
+        ReadoutBuffer &operator=(const ReadoutBuffer &o)
+        {
+            if (this != &o)
+            {
+                m_type = o.m_type;
+                m_number = o.m_number;
+                m_buffer.assign(o.data(), o.data() + o.capacity());
+                m_storage = nullptr;
+                m_storageCapacity = 0u;
+                m_used = o.m_used;
+            }
+            return *this;
+        }
+
+        ReadoutBuffer &operator=(ReadoutBuffer &&o)
+        {
+            if (this != &o)
+            {
+                m_type = o.m_type;
+                m_number = o.m_number;
+                m_buffer = std::move(o.m_buffer);
+                m_storage = o.m_storage;
+                m_storageCapacity = o.m_storageCapacity;
+                m_used = o.m_used;
+                o.m_storage = nullptr;
+                o.m_storageCapacity = 0u;
+                o.m_buffer.clear();
+                o.m_used = 0u;
+            }
+            return *this;
+        }
+
+        // True if the buffer uses externally provided memory.
+        bool hasExternalStorage() const { return m_storage != nullptr; }
+
         ConnectionType type() const { return m_type; }
         void setType(ConnectionType t) { m_type = t; }
 
         size_t bufferNumber() const { return m_number; }
         void setBufferNumber(size_t number) { m_number = number; }
 
-        size_t capacity() const { return m_buffer.size(); }
+        size_t capacity() const { return m_storage ? m_storageCapacity : m_buffer.size(); }
         size_t used() const { return m_used; }
         size_t free() const { return capacity() - m_used; }
 
@@ -35,7 +111,10 @@ class MESYTEC_MVLC_EXPORT ReadoutBuffer
         void ensureFreeSpace(size_t freeSpace)
         {
             if (free() < freeSpace)
+            {
+                detachStorage();
                 m_buffer.resize(m_used + freeSpace);
+            }
             assert(free() >= freeSpace);
         }
 
@@ -53,28 +132,50 @@ class MESYTEC_MVLC_EXPORT ReadoutBuffer
             m_used = bytes;
         }
 
-        const std::vector<u8> &buffer() const { return m_buffer; }
-        std::vector<u8> &buffer() { return m_buffer; }
+        // Throws std::logic_error for externally backed buffers as there is
+        // no vector to return.
+        const std::vector<u8> &buffer() const
+        {
+            if (hasExternalStorage())
+                throw std::logic_error("ReadoutBuffer::buffer() const: buffer uses external storage");
+            return m_buffer;
+        }
+
+        // Note: switches externally backed buffers to an owned vector.
+        std::vector<u8> &buffer() { detachStorage(); return m_buffer; }
 
-        const u8 *data() const { return buffer().data(); }
-        u8 *data() { return buffer().data(); }
+        const u8 *data() const { return m_storage ? m_storage : m_buffer.data(); }
+        u8 *data() { return m_storage ? m_storage : m_buffer.data(); }
 
         nonstd::basic_string_view<const u8> viewU8() const
         {
-            return nonstd::basic_string_view<const u8>(m_buffer.data(), m_used);
+            return nonstd::basic_string_view<const u8>(data(), m_used);
         }
 
         nonstd::basic_string_view<const u32> viewU32() const
         {
             return nonstd::basic_string_view<const u32>(
-                reinterpret_cast<const u32 *>(m_buffer.data()),
+                reinterpret_cast<const u32 *>(data()),
                 m_used / sizeof(u32));
         }
 
     private:
+        void detachStorage()
+        {
+            if (m_storage)
+            {
+                m_buffer.resize(m_storageCapacity);
+                std::memcpy(m_buffer.data(), m_storage, m_used);
+                m_storage = nullptr;
+                m_storageCapacity = 0u;
+            }
+        }
+
         ConnectionType m_type = ConnectionType::ETH;
         size_t m_number = 0;
         std::vector<u8> m_buffer;
+        u8 *m_storage = nullptr;
+        size_t m_storageCapacity = 0u;
         size_t m_used = 0;
 };
 
@@ -1,16 +1,206 @@
 #include "readout_buffer_queues.h"
 
+#include <fstream>
+#include <limits>
+#include <new>
+#include <spdlog/spdlog.h>
+
+#ifdef __linux__
+#include <linux/mempolicy.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
 namespace mesytec
 {
 namespace mvlc
 {
 
-ReadoutBufferQueues::ReadoutBufferQueues(size_t bufferCapacity, size_t bufferCount)
-    : m_bufferStorage(bufferCount, ReadoutBuffer(bufferCapacity))
+namespace
+{
+
+// Buffers carved from a contiguous region start on cache line boundaries.
+static const size_t BufferAlignment = 64;
+
+size_t round_up(size_t size, size_t alignment)
+{
+    return ((size + alignment - 1) / alignment) * alignment;
+}
+
+#ifdef __linux__
+// Default huge page size as reported by /proc/meminfo.
+size_t huge_page_size()
+{
+    std::ifstream in("/proc/meminfo");
+    std::string key;
+
+    while (in >> key)
+    {
+        if (key == "Hugepagesize:")
+        {
+            size_t kb = 0u;
+            if (in >> kb)
+                return util::Kilobytes(kb);
+            break;
+        }
+
+        in.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+    }
+
+    return util::Megabytes(2);
+}
+#endif
+
+} // end anon namespace
+
+struct ReadoutBufferQueues::MemoryRegion
+{
+    u8 *data = nullptr;
+    size_t size = 0u;
+
+#ifdef __linux__
+    MemoryRegion(size_t minSize, const BufferAllocation &allocation, BufferAllocationInfo &info)
+    {
+        auto set_error = [&info] (int err)
+        {
+            if (!info.ec)
+                info.ec = std::error_code(err, std::system_category());
+        };
+
+        const size_t pageSize = sysconf(_SC_PAGESIZE);
+        void *mem = MAP_FAILED;
+
+        if (allocation.hugePages == BufferAllocation::HugePages::Explicit)
+        {
+            size = round_up(minSize, huge_page_size());
+            mem = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+
+            if (mem != MAP_FAILED)
+                info.hugeTLB = true;
+            else
+                set_error(errno);
+        }
+
+        if (mem == MAP_FAILED)
+        {
+            size = round_up(minSize, allocation.hugePages != BufferAllocation::HugePages::None
+                            ? huge_page_size() : pageSize);
+            mem = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+            if (mem == MAP_FAILED)
+                throw std::bad_alloc();
+
+            if (allocation.hugePages != BufferAllocation::HugePages::None)
+            {
+                if (madvise(mem, size, MADV_HUGEPAGE) == 0)
+                    info.transparentHugePages = true;
+                else
+                    set_error(errno);
+            }
+        }
+
+        data = reinterpret_cast<u8 *>(mem);
+
+        // Bind before the pages are touched so that they are allocated on the
+        // requested node.
+        if (allocation.numaNode >= 0)
+        {
+            unsigned long nodeMask = 0u;
+
+            if (allocation.numaNode < static_cast<int>(sizeof(nodeMask) * 8))
+            {
+                nodeMask = 1ul << allocation.numaNode;
+
+                if (syscall(SYS_mbind, data, size, MPOL_BIND, &nodeMask, sizeof(nodeMask) * 8, 0) == 0)
+                    info.numaNode = allocation.numaNode;
+                else
+                    set_error(errno);
+            }
+            else
+                set_error(EINVAL);
+        }
+
+        if (allocation.prefault)
+        {
+            const size_t step = info.hugeTLB ? huge_page_size() : pageSize;
+            volatile u8 *p = data;
+
+            for (size_t offset=0; offset<size; offset+=step)
+                p[offset] = 0;
+        }
+    }
+
+    ~MemoryRegion()
+    {
+        if (data)
+            munmap(data, size);
+    }
+#else
+    std::unique_ptr<u8[]> storage;
+
+    // Plain heap memory. Huge pages and NUMA binding are not supported.
+    MemoryRegion(size_t minSize, const BufferAllocation &allocation, BufferAllocationInfo &info)
+        : size(minSize)
+        , storage(new u8[minSize])
+    {
+        data = storage.get();
+
+        if (allocation.hugePages != BufferAllocation::HugePages::None || allocation.numaNode >= 0)
+            info.ec = std::make_error_code(std::errc::not_supported);
+    }
+#endif
+};
+
+ReadoutBufferQueues::ReadoutBufferQueues(
+    size_t bufferCapacity, size_t bufferCount,
+    QueueKind queueKind, size_t maxQueuedBuffers)
+    : m_filledBuffers(queueKind, maxQueuedBuffers ? maxQueuedBuffers : bufferCount)
+    , m_emptyBuffers(queueKind, maxQueuedBuffers ? maxQueuedBuffers : bufferCount)
+    , m_bufferStorage(bufferCount, ReadoutBuffer(bufferCapacity))
+{
+    for (auto &buffer: m_bufferStorage)
+        m_emptyBuffers.enqueue(&buffer);
+}
+
+ReadoutBufferQueues::ReadoutBufferQueues(
+    size_t bufferCapacity, size_t bufferCount,
+    QueueKind queueKind, size_t maxQueuedBuffers,
+    const BufferAllocation &allocation)
+    : m_filledBuffers(queueKind, maxQueuedBuffers ? maxQueuedBuffers : bufferCount)
+    , m_emptyBuffers(queueKind, maxQueuedBuffers ? maxQueuedBuffers : bufferCount)
 {
+    m_allocationInfo.mode = allocation.mode;
+
+    if (allocation.mode == BufferAllocation::Mode::Contiguous && bufferCount && bufferCapacity)
+    {
+        const size_t stride = round_up(bufferCapacity, BufferAlignment);
+        m_region = std::make_unique<MemoryRegion>(stride * bufferCount, allocation, m_allocationInfo);
+        m_allocationInfo.regionSize = m_region->size;
+
+        if (m_allocationInfo.ec)
+        {
+            spdlog::warn("ReadoutBufferQueues: huge page or NUMA setup incomplete: {}",
+                         m_allocationInfo.ec.message());
+        }
+
+        m_bufferStorage.reserve(bufferCount);
+
+        for (size_t i=0; i<bufferCount; ++i)
+            m_bufferStorage.emplace_back(m_region->data + i * stride, bufferCapacity);
+    }
+    else
+        m_bufferStorage.resize(bufferCount, ReadoutBuffer(bufferCapacity));
+
     for (auto &buffer: m_bufferStorage)
         m_emptyBuffers.enqueue(&buffer);
 }
 
+ReadoutBufferQueues::~ReadoutBufferQueues()
+{
+}
+
 } // end namespace mvlc
 } // end namespace mesytec
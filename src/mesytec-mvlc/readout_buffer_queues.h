@@ -1,8 +1,13 @@
 #ifndef __MESYTEC_MVLC_UTIL_READOUT_BUFFER_QUEUES_H__
 #define __MESYTEC_MVLC_UTIL_READOUT_BUFFER_QUEUES_H__
 
+#include <atomic>
+#include <memory>
+#include <system_error>
+
 #include "mesytec-mvlc/mesytec-mvlc_export.h"
 #include "mesytec-mvlc/readout_buffer.h"
+#include "mesytec-mvlc/util/spsc_queue.h"
 #include "mesytec-mvlc/util/storage_sizes.h"
 #include "mesytec-mvlc/util/threadsafequeue.h"
 
@@ -11,19 +16,177 @@ namespace mesytec
 namespace mvlc
 {
 
+// Queue of ReadoutBuffer pointers. Depending on the QueueKind this is either
+// a ThreadSafeQueue (mutex + condition variable, any number of producers and
+// consumers) or a lock-free SPSCQueue.
+//
+// SPSC queues must only have a single consumer thread. Producers are
+// serialized using a spin flag which is never contended if there really is
+// only a single producer. This keeps occasional additional producers, e.g. a
+// ReadoutWorker returning an unused snoop buffer at the end of a run, safe.
+class MESYTEC_MVLC_EXPORT ReadoutBufferQueue
+{
+    public:
+        enum class Kind
+        {
+            ThreadSafe,
+            SPSC,
+        };
+
+        using value_type = ReadoutBuffer *;
+
+        explicit ReadoutBufferQueue(Kind kind = Kind::ThreadSafe, size_t capacity = 0)
+            : m_kind(kind)
+        {
+            if (m_kind == Kind::SPSC)
+                m_spsc = std::make_unique<SPSCQueue<ReadoutBuffer *>>(capacity);
+        }
+
+        Kind kind() const { return m_kind; }
+
+        void enqueue(ReadoutBuffer *buffer)
+        {
+            if (m_kind == Kind::SPSC)
+            {
+                while (m_producerFlag.test_and_set(std::memory_order_acquire))
+                    std::this_thread::yield();
+                m_spsc->enqueue(buffer);
+                m_producerFlag.clear(std::memory_order_release);
+            }
+            else
+                m_queue.enqueue(buffer);
+        }
+
+        // Returns defaultValue if the queue is empty.
+        ReadoutBuffer *dequeue(ReadoutBuffer *defaultValue = nullptr)
+        {
+            if (m_kind == Kind::SPSC)
+                return m_spsc->dequeue(defaultValue);
+            return m_queue.dequeue(defaultValue);
+        }
+
+        // Waits up to timeout for a buffer to become available.
+        ReadoutBuffer *dequeue(const std::chrono::milliseconds &timeout,
+                               ReadoutBuffer *defaultValue = nullptr)
+        {
+            if (m_kind == Kind::SPSC)
+                return m_spsc->dequeue(timeout, defaultValue);
+            return m_queue.dequeue(timeout, defaultValue);
+        }
+
+        ReadoutBuffer *dequeue_blocking()
+        {
+            if (m_kind == Kind::SPSC)
+                return m_spsc->dequeue_blocking();
+            return m_queue.dequeue_blocking();
+        }
+
+        bool empty() const
+        {
+            return m_kind == Kind::SPSC ? m_spsc->empty() : m_queue.empty();
+        }
+
+        size_t size() const
+        {
+            return m_kind == Kind::SPSC ? m_spsc->size() : m_queue.size();
+        }
+
+    private:
+        Kind m_kind;
+        ThreadSafeQueue<ReadoutBuffer *> m_queue;
+        std::unique_ptr<SPSCQueue<ReadoutBuffer *>> m_spsc;
+        std::atomic_flag m_producerFlag = ATOMIC_FLAG_INIT;
+};
+
+// Controls how ReadoutBufferQueues allocates its buffers.
+struct BufferAllocation
+{
+    enum class Mode
+    {
+        // Each buffer owns a separately allocated, zero-filled vector.
+        PerBuffer,
+        // All buffers are carved from a single memory region which is not
+        // zero-filled. Required for the options below.
+        Contiguous,
+    };
+
+    enum class HugePages
+    {
+        None,
+        // madvise(MADV_HUGEPAGE) for transparent huge pages.
+        Transparent,
+        // MAP_HUGETLB using the reserved huge page pool. Falls back to
+        // Transparent if no huge pages are available.
+        Explicit,
+    };
+
+    Mode mode = Mode::PerBuffer;
+    HugePages hugePages = HugePages::None;
+
+    // If non-negative the memory of the region is bound to this NUMA node.
+    int numaNode = -1;
+
+    // Touch every page of the region after it has been set up so that page
+    // faults do not happen during the readout.
+    bool prefault = true;
+};
+
+// Allocation in effect after constructing a ReadoutBufferQueues instance.
+struct BufferAllocationInfo
+{
+    BufferAllocation::Mode mode = BufferAllocation::Mode::PerBuffer;
+    // Size of the contiguous region in bytes.
+    size_t regionSize = 0u;
+    // True if the region is backed by MAP_HUGETLB pages.
+    bool hugeTLB = false;
+    // True if transparent huge pages were requested for the region.
+    bool transparentHugePages = false;
+    // NUMA node the region is bound to or -1.
+    int numaNode = -1;
+    // First error that occured setting up huge pages or the NUMA binding.
+    // The region is still usable in this case.
+    std::error_code ec;
+};
+
 class MESYTEC_MVLC_EXPORT ReadoutBufferQueues
 {
     public:
-        using QueueType = ThreadSafeQueue<ReadoutBuffer *>;
+        using QueueType = ReadoutBufferQueue;
+        using QueueKind = ReadoutBufferQueue::Kind;
+
+        // With QueueKind::SPSC the queues can hold up to maxQueuedBuffers
+        // buffers. The default of 0 uses bufferCount. Set this higher if
+        // buffers from elsewhere are put into the queues.
+        explicit ReadoutBufferQueues(
+            size_t bufferCapacity = util::Megabytes(1),
+            size_t bufferCount = 10,
+            QueueKind queueKind = QueueKind::ThreadSafe,
+            size_t maxQueuedBuffers = 0);
 
-        explicit ReadoutBufferQueues(size_t bufferCapacity = util::Megabytes(1), size_t bufferCount = 10);
+        // Throws std::bad_alloc if the contiguous region cannot be allocated.
+        ReadoutBufferQueues(
+            size_t bufferCapacity,
+            size_t bufferCount,
+            QueueKind queueKind,
+            size_t maxQueuedBuffers,
+            const BufferAllocation &allocation);
+
+        ~ReadoutBufferQueues();
 
         QueueType &filledBufferQueue() { return m_filledBuffers; }
         QueueType &emptyBufferQueue() { return m_emptyBuffers; }
 
+        size_t bufferCount() const { return m_bufferStorage.size(); }
+        QueueKind queueKind() const { return m_filledBuffers.kind(); }
+        const BufferAllocationInfo &allocationInfo() const { return m_allocationInfo; }
+
     private:
+        struct MemoryRegion;
+
         QueueType m_filledBuffers;
         QueueType m_emptyBuffers;
+        std::unique_ptr<MemoryRegion> m_region;
+        BufferAllocationInfo m_allocationInfo;
         std::vector<ReadoutBuffer> m_bufferStorage;
 };
 
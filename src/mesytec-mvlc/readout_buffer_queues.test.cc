@@ -0,0 +1,184 @@
+#include <algorithm>
+#include <cstring>
+
+#include "gtest/gtest.h"
+#include "readout_buffer_queues.h"
+
+using namespace mesytec::mvlc;
+
+namespace
+{
+
+std::vector<ReadoutBuffer *> take_all(ReadoutBufferQueues &queues)
+{
+    std::vector<ReadoutBuffer *> result;
+
+    while (auto buffer = queues.emptyBufferQueue().dequeue())
+        result.push_back(buffer);
+
+    return result;
+}
+
+} // end anon namespace
+
+TEST(readout_buffer, ExternalStorage)
+{
+    std::vector<u8> storage(64);
+    ReadoutBuffer buffer(storage.data(), storage.size());
+
+    ASSERT_TRUE(buffer.hasExternalStorage());
+    ASSERT_EQ(buffer.capacity(), 64u);
+    ASSERT_EQ(buffer.data(), storage.data());
+
+    std::memset(buffer.data(), 0xab, 16);
+    buffer.use(16);
+    ASSERT_EQ(buffer.viewU8().size(), 16u);
+    ASSERT_EQ(buffer.viewU8()[15], 0xab);
+
+    // Copies own their memory.
+    ReadoutBuffer copy(buffer);
+    ASSERT_FALSE(copy.hasExternalStorage());
+    ASSERT_EQ(copy.capacity(), 64u);
+    ASSERT_EQ(copy.viewU8(), buffer.viewU8());
+
+    // Moves take over the external memory.
+    ReadoutBuffer moved(std::move(buffer));
+    ASSERT_TRUE(moved.hasExternalStorage());
+    ASSERT_EQ(moved.data(), storage.data());
+    ASSERT_EQ(moved.used(), 16u);
+    ASSERT_FALSE(buffer.hasExternalStorage());
+    ASSERT_EQ(buffer.capacity(), 0u);
+
+    // Growing switches to an owned vector keeping the contents.
+    moved.ensureFreeSpace(128);
+    ASSERT_FALSE(moved.hasExternalStorage());
+    ASSERT_NE(moved.data(), storage.data());
+    ASSERT_GE(moved.free(), 128u);
+    ASSERT_EQ(moved.viewU8(), copy.viewU8());
+
+    // The const accessor does not modify the buffer and refuses to return a
+    // vector for external memory.
+    ReadoutBuffer external(storage.data(), storage.size());
+    external.use(16);
+    const auto &constRef = external;
+    ASSERT_THROW(constRef.buffer(), std::logic_error);
+    ASSERT_TRUE(external.hasExternalStorage());
+
+    // Accessing the vector through a non-const reference switches to an owned
+    // vector.
+    ASSERT_EQ(external.buffer().size(), 64u);
+    ASSERT_FALSE(external.hasExternalStorage());
+    ASSERT_EQ(constRef.buffer().size(), 64u);
+    ASSERT_EQ(external.viewU8(), copy.viewU8());
+}
+
+TEST(readout_buffer_queues, PerBuffer)
+{
+    ReadoutBufferQueues queues(1024, 4);
+
+    ASSERT_EQ(queues.bufferCount(), 4u);
+    ASSERT_EQ(queues.allocationInfo().mode, BufferAllocation::Mode::PerBuffer);
+    ASSERT_EQ(queues.allocationInfo().regionSize, 0u);
+
+    for (auto buffer: take_all(queues))
+    {
+        ASSERT_FALSE(buffer->hasExternalStorage());
+        ASSERT_EQ(buffer->capacity(), 1024u);
+    }
+}
+
+TEST(readout_buffer_queues, Contiguous)
+{
+    const size_t BufferCapacity = 1000;
+    const size_t BufferCount = 8;
+
+    BufferAllocation allocation;
+    allocation.mode = BufferAllocation::Mode::Contiguous;
+
+    ReadoutBufferQueues queues(BufferCapacity, BufferCount,
+                               ReadoutBufferQueues::QueueKind::SPSC, 0, allocation);
+
+    const auto &info = queues.allocationInfo();
+    ASSERT_EQ(info.mode, BufferAllocation::Mode::Contiguous);
+    ASSERT_GE(info.regionSize, BufferCapacity * BufferCount);
+    ASSERT_FALSE(info.ec);
+
+    auto buffers = take_all(queues);
+    ASSERT_EQ(buffers.size(), BufferCount);
+
+    std::sort(buffers.begin(), buffers.end(),
+              [] (const ReadoutBuffer *a, const ReadoutBuffer *b) { return a->data() < b->data(); });
+
+    // The buffers are cache line aligned, do not overlap and all lie within a
+    // single region.
+    for (size_t i=0; i<buffers.size(); ++i)
+    {
+        ASSERT_TRUE(buffers[i]->hasExternalStorage());
+        ASSERT_EQ(buffers[i]->capacity(), BufferCapacity);
+        ASSERT_EQ(reinterpret_cast<uintptr_t>(buffers[i]->data()) % 64, 0u);
+
+        if (i > 0)
+            ASSERT_GE(buffers[i]->data(), buffers[i - 1]->data() + BufferCapacity);
+    }
+
+    ASSERT_LE(buffers.back()->data() + BufferCapacity, buffers.front()->data() + info.regionSize);
+
+    for (auto buffer: buffers)
+    {
+        std::memset(buffer->data(), 0xff, buffer->capacity());
+        buffer->use(buffer->capacity());
+        queues.filledBufferQueue().enqueue(buffer);
+    }
+
+    ASSERT_EQ(queues.filledBufferQueue().size(), BufferCount);
+}
+
+#ifdef __linux__
+TEST(readout_buffer_queues, HugePages)
+{
+    BufferAllocation allocation;
+    allocation.mode = BufferAllocation::Mode::Contiguous;
+    allocation.hugePages = BufferAllocation::HugePages::Explicit;
+
+    ReadoutBufferQueues queues(util::Megabytes(1), 3,
+                               ReadoutBufferQueues::QueueKind::ThreadSafe, 0, allocation);
+
+    // Without reserved huge pages MAP_HUGETLB fails and the region falls back
+    // to transparent huge pages. Either way the region is usable.
+    const auto &info = queues.allocationInfo();
+    ASSERT_TRUE(info.hugeTLB || info.transparentHugePages || info.ec);
+    ASSERT_GE(info.regionSize, util::Megabytes(3));
+
+    for (auto buffer: take_all(queues))
+    {
+        std::memset(buffer->data(), 0x42, buffer->capacity());
+        buffer->use(buffer->capacity());
+        ASSERT_EQ(buffer->viewU8().back(), 0x42);
+    }
+}
+
+TEST(readout_buffer_queues, NumaNode)
+{
+    BufferAllocation allocation;
+    allocation.mode = BufferAllocation::Mode::Contiguous;
+    allocation.numaNode = 0;
+
+    ReadoutBufferQueues queues(util::Kilobytes(64), 4,
+                               ReadoutBufferQueues::QueueKind::ThreadSafe, 0, allocation);
+
+    const auto &info = queues.allocationInfo();
+
+    // mbind() fails with ENOSYS if the kernel has no NUMA support.
+    if (info.ec)
+        ASSERT_EQ(info.ec, std::error_code(ENOSYS, std::system_category()));
+    else
+        ASSERT_EQ(info.numaNode, 0);
+
+    allocation.numaNode = 1000;
+    ReadoutBufferQueues invalidNode(util::Kilobytes(64), 4,
+                                    ReadoutBufferQueues::QueueKind::ThreadSafe, 0, allocation);
+    ASSERT_TRUE(invalidNode.allocationInfo().ec);
+    ASSERT_EQ(invalidNode.allocationInfo().numaNode, -1);
+    ASSERT_EQ(take_all(invalidNode).size(), 4u);
+}
+#endif
@@ -0,0 +1,144 @@
+#ifndef __MESYTEC_MVLC_UTIL_SEQLOCKED_H__
+#define __MESYTEC_MVLC_UTIL_SEQLOCKED_H__
+
+#include <atomic>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+namespace mesytec
+{
+namespace mvlc
+{
+
+// SeqLocked combines an object with a sequence counter allowing a single
+// writer thread to modify the object without ever blocking while any number
+// of reader threads can obtain consistent copies of the object.
+//
+// The writer increments the sequence counter before and after modifying the
+// object, so the counter is odd while a modification is in progress. Readers
+// copy the object and retry if the counter was odd or changed during the copy.
+//
+// Only one thread may use write() at a time. The writer thread may read the
+// object directly via writerRef() without any synchronization.
+//
+// The object type must be trivially copyable as readers may copy it while it
+// is being modified. Such a torn copy is always detected and discarded.
+
+template<typename T> class SeqLocked;
+
+template<typename T>
+class [[nodiscard]] SeqLockedWrite
+{
+    public:
+        T &ref() { return m_obj; }
+        T *operator->() { return &m_obj; }
+
+        SeqLockedWrite(SeqLockedWrite &&other)
+            : m_seq(other.m_seq)
+            , m_obj(other.m_obj)
+            , m_active(other.m_active)
+        {
+            other.m_active = false;
+        }
+
+        SeqLockedWrite(const SeqLockedWrite &) = delete;
+        SeqLockedWrite &operator=(const SeqLockedWrite &) = delete;
+
+        ~SeqLockedWrite()
+        {
+            if (m_active)
+                m_seq.store(m_seq.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+
+    private:
+        friend class SeqLocked<T>;
+
+        SeqLockedWrite(std::atomic<unsigned> &seq, T &obj)
+            : m_seq(seq)
+            , m_obj(obj)
+            , m_active(true)
+        {
+            m_seq.store(m_seq.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+        }
+
+        std::atomic<unsigned> &m_seq;
+        T &m_obj;
+        bool m_active;
+};
+
+template<typename T>
+class SeqLocked
+{
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "SeqLocked requires a trivially copyable type");
+
+    public:
+        explicit SeqLocked(const T &obj = {})
+            : m_seq(0u)
+            , m_obj(obj)
+        {
+        }
+
+        // Writer side. The returned object keeps the sequence counter odd
+        // until it is destroyed.
+        SeqLockedWrite<T> write()
+        {
+            return SeqLockedWrite<T>(m_seq, m_obj);
+        }
+
+        void store(const T &obj)
+        {
+            write().ref() = obj;
+        }
+
+        // Unsynchronized access. Only valid from within the writer thread.
+        const T &writerRef() const { return m_obj; }
+
+        // Reader side. Returns a consistent copy of the object.
+        T copy() const
+        {
+            return copy([] (const T &obj) { return obj; });
+        }
+
+        // Reader side. Returns the result of invoking extract() on a
+        // consistent state of the object. Use this to copy only parts of
+        // large objects.
+        template<typename F>
+        auto copy(F extract) const -> decltype(extract(std::declval<const T &>()))
+        {
+            while (true)
+            {
+                unsigned seq0 = m_seq.load(std::memory_order_acquire);
+
+                if (seq0 & 1u)
+                {
+                    std::this_thread::yield();
+                    continue;
+                }
+
+                auto result = extract(m_obj);
+
+                std::atomic_thread_fence(std::memory_order_acquire);
+
+                if (m_seq.load(std::memory_order_relaxed) == seq0)
+                    return result;
+            }
+        }
+
+        // Number of completed writes.
+        unsigned writeCount() const
+        {
+            return m_seq.load(std::memory_order_acquire) / 2u;
+        }
+
+    private:
+        std::atomic<unsigned> m_seq;
+        T m_obj;
+};
+
+}
+}
+
+#endif /* __MESYTEC_MVLC_UTIL_SEQLOCKED_H__ */
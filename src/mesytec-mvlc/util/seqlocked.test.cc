@@ -0,0 +1,63 @@
+#include <gtest/gtest.h>
+#include <array>
+#include <thread>
+#include "mesytec-mvlc/util/seqlocked.h"
+
+using namespace mesytec::mvlc;
+
+TEST(seqlocked, Basic)
+{
+    SeqLocked<int> sl(42);
+
+    ASSERT_EQ(sl.copy(), 42);
+    ASSERT_EQ(sl.writeCount(), 0u);
+
+    sl.store(21);
+
+    ASSERT_EQ(sl.copy(), 21);
+    ASSERT_EQ(sl.writeCount(), 1u);
+
+    {
+        auto w = sl.write();
+        w.ref() += 1;
+    }
+
+    ASSERT_EQ(sl.copy(), 22);
+    ASSERT_EQ(sl.writerRef(), 22);
+    ASSERT_EQ(sl.writeCount(), 2u);
+    ASSERT_EQ(sl.copy([] (const int &i) { return i * 2; }), 44);
+}
+
+TEST(seqlocked, ConsistentCopies)
+{
+    // The writer keeps all elements of the array equal. Readers must never
+    // observe a partially updated array.
+    using Data = std::array<unsigned, 64>;
+
+    SeqLocked<Data> sl;
+    const unsigned WriteCount = 100000u;
+
+    std::thread writer([&sl, WriteCount] ()
+    {
+        for (unsigned i=1; i<=WriteCount; ++i)
+        {
+            auto w = sl.write();
+            w.ref().fill(i);
+        }
+    });
+
+    unsigned lastSeen = 0u;
+
+    while (lastSeen < WriteCount)
+    {
+        auto data = sl.copy();
+
+        for (auto value: data)
+            ASSERT_EQ(value, data[0]);
+
+        ASSERT_GE(data[0], lastSeen);
+        lastSeen = data[0];
+    }
+
+    writer.join();
+}
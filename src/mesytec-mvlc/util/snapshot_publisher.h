@@ -0,0 +1,107 @@
+#ifndef __MESYTEC_MVLC_UTIL_SNAPSHOT_PUBLISHER_H__
+#define __MESYTEC_MVLC_UTIL_SNAPSHOT_PUBLISHER_H__
+
+#include <array>
+#include <atomic>
+
+namespace mesytec
+{
+namespace mvlc
+{
+
+// Makes copies of an object owned by a single writer thread available to any
+// number of reader threads without using locks.
+//
+// The writer publishes snapshots into one of three slots. Readers pin the
+// currently published slot using a per slot reader count and copy it. The
+// writer only ever overwrites slots that are neither published nor pinned
+// by a reader, so it never blocks and readers never observe partial updates.
+// If readers are holding on to both unpublished slots the publication is
+// skipped and publish() returns false.
+//
+// Unlike SeqLocked the object type does not need to be trivially copyable.
+
+template<typename T>
+class SnapshotPublisher
+{
+    public:
+        explicit SnapshotPublisher(const T &initial = {})
+            : m_published(0u)
+            , m_publishCount(0u)
+        {
+            for (auto &slot: m_slots)
+            {
+                slot.obj = initial;
+                slot.readers = 0u;
+            }
+        }
+
+        // Writer side. Only one thread may call this.
+        bool publish(const T &obj)
+        {
+            const unsigned cur = m_published.load();
+
+            for (unsigned i=1; i<SlotCount; ++i)
+            {
+                const unsigned next = (cur + i) % SlotCount;
+                auto &slot = m_slots[next];
+
+                if (slot.readers.load() == 0u)
+                {
+                    slot.obj = obj;
+                    m_published.store(next);
+                    ++m_publishCount;
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        // Reader side. Returns a copy of the most recently published object.
+        T copy() const
+        {
+            while (true)
+            {
+                const unsigned cur = m_published.load();
+                auto &slot = m_slots[cur];
+
+                ++slot.readers;
+
+                // Make sure the slot is still the published one after
+                // pinning it. Otherwise the writer may already be reusing it.
+                if (m_published.load() == cur)
+                {
+                    T result = slot.obj;
+                    --slot.readers;
+                    return result;
+                }
+
+                --slot.readers;
+            }
+        }
+
+        // Number of successful publish() calls.
+        size_t publishCount() const { return m_publishCount.load(); }
+
+    private:
+        static constexpr unsigned SlotCount = 3;
+
+        struct Slot
+        {
+            T obj;
+            mutable std::atomic<unsigned> readers;
+        };
+
+        std::array<Slot, SlotCount> m_slots;
+        std::atomic<unsigned> m_published;
+        std::atomic<size_t> m_publishCount;
+};
+
+template<typename T>
+constexpr unsigned SnapshotPublisher<T>::SlotCount;
+
+}
+}
+
+#endif /* __MESYTEC_MVLC_UTIL_SNAPSHOT_PUBLISHER_H__ */
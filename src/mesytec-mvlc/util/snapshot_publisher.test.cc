@@ -0,0 +1,71 @@
+#include <gtest/gtest.h>
+#include <thread>
+#include <vector>
+#include "mesytec-mvlc/util/snapshot_publisher.h"
+
+using namespace mesytec::mvlc;
+
+TEST(snapshot_publisher, Basic)
+{
+    SnapshotPublisher<int> sp(42);
+
+    ASSERT_EQ(sp.copy(), 42);
+    ASSERT_EQ(sp.publishCount(), 0u);
+
+    ASSERT_TRUE(sp.publish(21));
+    ASSERT_EQ(sp.copy(), 21);
+    ASSERT_EQ(sp.publishCount(), 1u);
+
+    ASSERT_TRUE(sp.publish(1));
+    ASSERT_TRUE(sp.publish(2));
+    ASSERT_TRUE(sp.publish(3));
+    ASSERT_EQ(sp.copy(), 3);
+    ASSERT_EQ(sp.publishCount(), 4u);
+}
+
+TEST(snapshot_publisher, ConsistentCopies)
+{
+    // Uses a non trivially copyable type. All elements of a published vector
+    // are equal, readers must never observe a mix of different values.
+    using Data = std::vector<unsigned>;
+
+    SnapshotPublisher<Data> sp(Data(64, 0u));
+    const unsigned PublishCount = 20000u;
+
+    std::thread writer([&sp, PublishCount] ()
+    {
+        for (unsigned i=1; i<=PublishCount; ++i)
+        {
+            while (!sp.publish(Data(64, i)))
+                std::this_thread::yield();
+        }
+    });
+
+    std::vector<std::thread> readers;
+
+    for (int r=0; r<3; ++r)
+    {
+        readers.emplace_back([&sp, PublishCount] ()
+        {
+            unsigned lastSeen = 0u;
+
+            while (lastSeen < PublishCount)
+            {
+                auto data = sp.copy();
+
+                ASSERT_EQ(data.size(), 64u);
+
+                for (auto value: data)
+                    ASSERT_EQ(value, data[0]);
+
+                ASSERT_GE(data[0], lastSeen);
+                lastSeen = data[0];
+            }
+        });
+    }
+
+    writer.join();
+
+    for (auto &t: readers)
+        t.join();
+}
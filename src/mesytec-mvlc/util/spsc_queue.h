@@ -0,0 +1,209 @@
+#ifndef __MESYTEC_MVLC_UTIL_SPSC_QUEUE_H__
+#define __MESYTEC_MVLC_UTIL_SPSC_QUEUE_H__
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace mesytec
+{
+namespace mvlc
+{
+
+// Bounded lock-free FIFO for exactly one producer and one consumer thread.
+//
+// Enqueueing and dequeueing are wait-free as long as the queue is neither
+// full nor empty. A consumer finding the queue empty first spins for a short
+// while, then yields a few times and finally falls back to waiting on a
+// condition variable. The producer only touches the mutex if the consumer is
+// actually waiting. A producer finding the queue full yields until space
+// becomes available.
+//
+// The capacity is rounded up to the next power of two.
+
+template<typename T>
+class SPSCQueue
+{
+    public:
+        using value_type = T;
+        using size_type = size_t;
+
+        explicit SPSCQueue(size_t capacity)
+            : m_head(0u)
+            , m_tail(0u)
+            , m_consumerWaiting(false)
+        {
+            size_t cap = 1u;
+            while (cap < capacity)
+                cap <<= 1;
+            m_buffer.resize(cap);
+            m_mask = cap - 1;
+        }
+
+        SPSCQueue(const SPSCQueue &) = delete;
+        SPSCQueue &operator=(const SPSCQueue &) = delete;
+
+        size_t capacity() const { return m_buffer.size(); }
+
+        // Producer side.
+        bool try_enqueue(const T &value)
+        {
+            const size_t tail = m_tail.load(std::memory_order_relaxed);
+
+            if (tail - m_head.load(std::memory_order_acquire) >= m_buffer.size())
+                return false;
+
+            m_buffer[tail & m_mask] = value;
+            m_tail.store(tail + 1, std::memory_order_release);
+
+            // Pairs with the fence in waitForData(): either the consumer sees
+            // the new element or we see that the consumer is waiting.
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+
+            if (m_consumerWaiting.load(std::memory_order_relaxed))
+            {
+                {
+                    std::unique_lock<std::mutex> lock(m_waitMutex);
+                }
+                m_waitCond.notify_one();
+            }
+
+            return true;
+        }
+
+        void enqueue(const T &value)
+        {
+            while (!try_enqueue(value))
+                std::this_thread::yield();
+        }
+
+        // Consumer side.
+        bool try_dequeue(T &dest)
+        {
+            const size_t head = m_head.load(std::memory_order_relaxed);
+
+            if (head == m_tail.load(std::memory_order_acquire))
+                return false;
+
+            dest = m_buffer[head & m_mask];
+            m_head.store(head + 1, std::memory_order_release);
+            return true;
+        }
+
+        // Returns defaultValue if the queue is empty.
+        T dequeue(const T &defaultValue = {})
+        {
+            T result = {};
+            return try_dequeue(result) ? result : defaultValue;
+        }
+
+        // Waits up to timeout for an element to become available. Returns
+        // defaultValue if the wait times out.
+        T dequeue(const std::chrono::milliseconds &timeout, const T &defaultValue = {})
+        {
+            T result = {};
+
+            if (try_dequeue(result))
+                return result;
+
+            if (waitForData(&timeout) && try_dequeue(result))
+                return result;
+
+            return defaultValue;
+        }
+
+        T dequeue_blocking()
+        {
+            T result = {};
+
+            while (!try_dequeue(result))
+                waitForData(nullptr);
+
+            return result;
+        }
+
+        bool empty() const
+        {
+            return size() == 0u;
+        }
+
+        size_type size() const
+        {
+            const size_t tail = m_tail.load(std::memory_order_acquire);
+            const size_t head = m_head.load(std::memory_order_acquire);
+            return tail - head;
+        }
+
+    private:
+        static constexpr size_t CacheLineSize = 64;
+        static constexpr unsigned SpinCount = 256;
+        static constexpr unsigned YieldCount = 16;
+
+        bool hasData() const
+        {
+            return m_head.load(std::memory_order_relaxed)
+                != m_tail.load(std::memory_order_acquire);
+        }
+
+        // Spins and yields for a while, then blocks on the condition variable. Waits
+        // forever if timeout is null. Returns true if data is available.
+        bool waitForData(const std::chrono::milliseconds *timeout)
+        {
+            for (unsigned i=0; i<SpinCount; ++i)
+            {
+                if (hasData())
+                    return true;
+            }
+
+            for (unsigned i=0; i<YieldCount; ++i)
+            {
+                std::this_thread::yield();
+
+                if (hasData())
+                    return true;
+            }
+
+            std::unique_lock<std::mutex> lock(m_waitMutex);
+            m_consumerWaiting.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+
+            auto pred = [this] () { return hasData(); };
+            bool result = true;
+
+            if (timeout)
+                result = m_waitCond.wait_for(lock, *timeout, pred);
+            else
+                m_waitCond.wait(lock, pred);
+
+            m_consumerWaiting.store(false, std::memory_order_relaxed);
+            return result;
+        }
+
+        // Consumer and producer positions are kept in separate cache lines.
+        std::atomic<size_t> m_head;
+        char m_pad0[CacheLineSize - sizeof(std::atomic<size_t>)];
+        std::atomic<size_t> m_tail;
+        char m_pad1[CacheLineSize - sizeof(std::atomic<size_t>)];
+        std::atomic<bool> m_consumerWaiting;
+        std::vector<T> m_buffer;
+        size_t m_mask;
+        std::mutex m_waitMutex;
+        std::condition_variable m_waitCond;
+};
+
+template<typename T>
+constexpr size_t SPSCQueue<T>::CacheLineSize;
+
+template<typename T>
+constexpr unsigned SPSCQueue<T>::SpinCount;
+
+template<typename T>
+constexpr unsigned SPSCQueue<T>::YieldCount;
+
+} // end namespace mvlc
+} // end namespace mesytec
+
+#endif /* __MESYTEC_MVLC_UTIL_SPSC_QUEUE_H__ */
@@ -0,0 +1,60 @@
+#include <gtest/gtest.h>
+#include <thread>
+#include "mesytec-mvlc/util/spsc_queue.h"
+
+using namespace mesytec::mvlc;
+
+TEST(spsc_queue, Basic)
+{
+    SPSCQueue<int> queue(3);
+
+    ASSERT_EQ(queue.capacity(), 4u);
+    ASSERT_TRUE(queue.empty());
+    ASSERT_EQ(queue.dequeue(), int{});
+    ASSERT_EQ(queue.dequeue(std::chrono::milliseconds(1), -1), -1);
+
+    for (int i=0; i<4; ++i)
+        ASSERT_TRUE(queue.try_enqueue(i));
+
+    ASSERT_FALSE(queue.try_enqueue(42));
+    ASSERT_EQ(queue.size(), 4u);
+
+    for (int i=0; i<4; ++i)
+        ASSERT_EQ(queue.dequeue(), i);
+
+    ASSERT_TRUE(queue.empty());
+}
+
+TEST(spsc_queue, ProducerConsumer)
+{
+    SPSCQueue<unsigned> queue(16);
+    const unsigned ItemCount = 200000u;
+
+    std::thread producer([&queue, ItemCount] ()
+    {
+        for (unsigned i=1; i<=ItemCount; ++i)
+            queue.enqueue(i);
+    });
+
+    // Alternate between the different dequeue variants.
+    for (unsigned expected=1; expected<=ItemCount; ++expected)
+    {
+        unsigned value = 0u;
+
+        if (expected % 3 == 0)
+            value = queue.dequeue_blocking();
+        else if (expected % 3 == 1)
+        {
+            while ((value = queue.dequeue(std::chrono::milliseconds(10))) == 0u);
+        }
+        else
+        {
+            while ((value = queue.dequeue()) == 0u);
+        }
+
+        ASSERT_EQ(value, expected);
+    }
+
+    producer.join();
+    ASSERT_TRUE(queue.empty());
+}